@@ -0,0 +1,95 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          arena.h
+ * @brief         Block-allocated pools of reusable objects
+ *
+ */
+
+/*a Wrapper
+ */
+#ifdef __INC_ARENA
+#else
+#define __INC_ARENA
+
+/*a Includes
+ */
+#include <stddef.h>
+#include <vector>
+
+/*a Defines
+ */
+#define ARENA_DEFAULT_BLOCK_SIZE (256)
+
+/*a Types
+ */
+/*c c_arena
+ * Objects of type T, default-constructed in blocks of block_size,
+ * which are only freed when the arena is deleted; an object never
+ * moves.
+ *
+ * reset makes every object available to alloc again without
+ * destroying it, so an object returned by alloc may hold the state
+ * (and allocations, such as vector capacity) of an earlier use, and
+ * must be initialised by the caller.
+ */
+template <typename T>
+class c_arena
+{
+private:
+    std::vector<T *> blocks;
+    size_t block_size;
+    size_t used;
+
+public:
+    c_arena(size_t block_size=ARENA_DEFAULT_BLOCK_SIZE) {
+        this->block_size = (block_size<1) ? 1 : block_size;
+        used = 0;
+    }
+    ~c_arena() {
+        for (auto block : blocks) {
+            delete [] block;
+        }
+    }
+    c_arena(const c_arena &) = delete;
+    c_arena &operator=(const c_arena &) = delete;
+
+    /*f alloc
+     * Next unused object, adding a block if all are in use
+     */
+    inline T *alloc(void) {
+        size_t b = used/block_size;
+        if (b==blocks.size()) {
+            blocks.push_back(new T[block_size]);
+        }
+        return &(blocks[b][(used++)%block_size]);
+    }
+
+    /*f reset
+     */
+    inline void reset(void) { used = 0; }
+    inline size_t size(void) const { return used; }
+    inline size_t capacity(void) const { return blocks.size()*block_size; }
+};
+
+/*a Wrapper
+ */
+#endif
+
+/*a Editor preferences and notes
+mode: c ***
+c-basic-offset: 4 ***
+c-default-style: (quote ((c-mode . "k&r") (c++-mode . "k&r"))) ***
+outline-regexp: "/\\\*a\\\|[\t ]*\/\\\*[b-z][\t ]" ***
+*/
@@ -3,16 +3,19 @@ Example
  */
 /*a Includes
  */
-#include <SDL.h> 
-#include <SDL_opengl.h>
-#include <SDL_image.h>
+#include <OpenGL/gl3.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <getopt.h>
 #include "key_value.h"
 #include "texture.h"
 #include "shader.h"
 #include "filter.h"
+#include "gl_context.h"
+#include "filter_pipeline.h"
+#include "filter_cpu.h"
 
 /*a Defines
  */
@@ -544,24 +547,6 @@ static float find_best_mapping(c_mapping_point *mappings[], int num_mappings, t_
 
 }
 
-/*a Types
- */
-/*t c_main
- */
-class c_main
-{
-public:
-    c_main(void);
-    ~c_main();
-    void check_sdl_error(void);
-    int init(void);
-    void exit(void);
-    int create_window(void);
-
-    SDL_Window    *window;
-    SDL_GLContext glContext;
-};
-
 /*a Helper functions
  */
 /*f gl_get_errors
@@ -578,96 +563,6 @@ int gl_get_errors(const char *msg)
     return num_errors;
 }
 
-/*a Main methods
- */
-/*f c_main constructor
- */
-c_main::c_main(void)
-{
-    window = NULL;
-}
-
-/*f c_main::check_sdl_error
- */
-void
-c_main::check_sdl_error(void)
-{
-	const char *error;
-    error = SDL_GetError();
-	if (*error != '\0') {
-		fprintf(stderr,"SDL Error: %s\n", error);
-		SDL_ClearError();
-	}
-}
-
-/*f c_main::init
-*/
-int c_main::init(void)
-{
-    if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
-        return 0;
-    }
-
-    SDL_GL_SetAttribute( SDL_GL_RED_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_GREEN_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_BLUE_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_ALPHA_SIZE, 8 );
-
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-    check_sdl_error();
-
-    fprintf(stderr,"Main Init() completed\n");
-    return 1;
-}
-
-/*f c_main::exit
-*/
-void
-c_main::exit(void)
-{
-    if (window) {
-        SDL_DestroyWindow(window);
-        window = NULL;
-    }
-    SDL_Quit();
-}
-
-/*f c_main::create_window
- */
-int
-c_main::create_window()
-{
-    int flags;
-    int width;
-    int height;
-    width = 64;
-    height = 64;
-
-    flags = SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE;
-    window = SDL_CreateWindow("OpenGL Test",SDL_WINDOWPOS_UNDEFINED,SDL_WINDOWPOS_UNDEFINED,width, height, flags);
-    check_sdl_error();
-
-    if (!window) {
-        return 0;
-    }
-
-    glContext = SDL_GL_CreateContext(window);
-    if (!glContext) {
-        return 0;
-    }
-
-    if (1) {
-        int major, minor;
-        SDL_GL_GetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, &major );
-        SDL_GL_GetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, &minor );
-        check_sdl_error();
-        fprintf(stderr, "Using OpenGL version %d.%d\n",major,minor);
-    }
-    return 1;
-}
-
 /*a Options
  */
 /*v long_options
@@ -676,6 +571,8 @@ static struct option long_options[] =
 {
     {"infile", required_argument, 0, 'i'},
     {"orient", required_argument, 0, 'o'},
+    {"cpu", no_argument, 0, 'c'},
+    {"context", required_argument, 0, 'g'},
     {0, 0, 0, 0}
 };
 
@@ -693,6 +590,8 @@ typedef struct
 {
     t_option_list images;
     int orientation;
+    int cpu;
+    t_gl_context_type context_type;
 } t_options;
 
 /*f option_add_to_list
@@ -708,6 +607,9 @@ static int get_options(int argc, char **argv, t_options *options)
 {
     int c;
     options->images.num=0;
+    options->orientation=0;
+    options->cpu=0;
+    options->context_type = gl_context_default_type();
     while (1)
     {
         int option_index = 0;
@@ -724,6 +626,15 @@ static int get_options(int argc, char **argv, t_options *options)
         case 'o':
             options->orientation = atoi(optarg);
             break;
+        case 'c':
+            options->cpu = 1;
+            break;
+        case 'g':
+            if (gl_context_type_from_string(optarg, &options->context_type)!=0) {
+                fprintf(stderr,"Unsupported OpenGL context type '%s'\n", optarg);
+                return 0;
+            }
+            break;
         default:
             break;
         }
@@ -738,113 +649,96 @@ static int get_options(int argc, char **argv, t_options *options)
 int main(int argc,char *argv[])
 {
     int i;
-    c_main *m;
-    int num_filters;
-    c_filter *filters[256];
+    t_gl_context_ptr gl_context;
+    c_filter_pipeline *pipeline;
     t_options options;
     t_exec_context ec;
     ec.use_ids = 1;
 
-    m = new c_main();
-    if (m->init()==0) {
-        fprintf(stderr,"Initializtion failed\n");
-        return 4;
-    }
-    if (!m->create_window()) {
-        fprintf(stderr,"Create window failed\n");
+    if (get_options(argc, argv, &options)==0) {
         return 4;
     }
 
-    shader_init();
-
-    if (get_options(argc, argv, &options)==0) {
-        return 4;
+    gl_context = NULL;
+    if (options.cpu) {
+        // Run the glsl filters on host textures with no GL context
+        filter_set_backend(filter_backend_cpu);
+    } else {
+        gl_context = gl_context_create(options.context_type);
+        if (!gl_context) {
+            fprintf(stderr,"Failed to create OpenGL context\n");
+            return 4;
+        }
+        shader_init();
     }
 
     int init_filter_end;
-    int match_filter_start;
-    num_filters = 0;
+    pipeline = new c_filter_pipeline(1024, 1024, options.cpu);
     if ((options.orientation&1)==0) {
-        filters[num_filters++] = filter_from_string("glsl:yuv_from_rgb(0,2)&-DINTENSITY_XSCALE=(3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_YSCALE=1.0&-DINTENSITY_YOFS=0.0");
-        //filters[num_filters++] = filter_from_string("glsl:yuv_from_rgb(0,2)&-DINTENSITY_XSCALE=(0.5*3456.0/5184.0)&-DINTENSITY_XOFS=0.1&-DINTENSITY_YSCALE=0.5&-DINTENSITY_YOFS=-0.1");
+        pipeline->add_filter("glsl:yuv_from_rgb(0,2)&-DINTENSITY_XSCALE=(3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_YSCALE=1.0&-DINTENSITY_YOFS=0.0");
+        //pipeline->add_filter("glsl:yuv_from_rgb(0,2)&-DINTENSITY_XSCALE=(0.5*3456.0/5184.0)&-DINTENSITY_XOFS=0.1&-DINTENSITY_YSCALE=0.5&-DINTENSITY_YOFS=-0.1");
     } else {
-        filters[num_filters++] = filter_from_string("glsl:yuv_from_rgb(0,2)&-DINTENSITY_YSCALE=(3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_XSCALE=1.0&-DINTENSITY_YOFS=0.0");
-        //filters[num_filters++] = filter_from_string("glsl:yuv_from_rgb(0,2)&-DINTENSITY_YSCALE=(0.5*3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_XSCALE=0.5&-DINTENSITY_YOFS=0.0");
+        pipeline->add_filter("glsl:yuv_from_rgb(0,2)&-DINTENSITY_YSCALE=(3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_XSCALE=1.0&-DINTENSITY_YOFS=0.0");
+        //pipeline->add_filter("glsl:yuv_from_rgb(0,2)&-DINTENSITY_YSCALE=(0.5*3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_XSCALE=0.5&-DINTENSITY_YOFS=0.0");
     }
     if ((options.orientation&2)==0) {
-        filters[num_filters++] = filter_from_string("glsl:yuv_from_rgb(1,3)&-DINTENSITY_XSCALE=(3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_YSCALE=1.0&-DINTENSITY_YOFS=0.0");
-        //filters[num_filters++] = filter_from_string("glsl:yuv_from_rgb(1,3)&-DINTENSITY_XSCALE=(0.5*3456.0/5184.0)&-DINTENSITY_XOFS=0.05&-DINTENSITY_YSCALE=0.5&-DINTENSITY_YOFS=0.0");
+        pipeline->add_filter("glsl:yuv_from_rgb(1,3)&-DINTENSITY_XSCALE=(3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_YSCALE=1.0&-DINTENSITY_YOFS=0.0");
+        //pipeline->add_filter("glsl:yuv_from_rgb(1,3)&-DINTENSITY_XSCALE=(0.5*3456.0/5184.0)&-DINTENSITY_XOFS=0.05&-DINTENSITY_YSCALE=0.5&-DINTENSITY_YOFS=0.0");
     } else {
-        filters[num_filters++] = filter_from_string("glsl:yuv_from_rgb(1,3)&-DINTENSITY_YSCALE=(3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_XSCALE=1.0&-DINTENSITY_YOFS=0.0");
-        //filters[num_filters++] = filter_from_string("glsl:yuv_from_rgb(1,3)&-DINTENSITY_YSCALE=(0.5*3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_XSCALE=0.5&-DINTENSITY_YOFS=0.0");
+        pipeline->add_filter("glsl:yuv_from_rgb(1,3)&-DINTENSITY_YSCALE=(3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_XSCALE=1.0&-DINTENSITY_YOFS=0.0");
+        //pipeline->add_filter("glsl:yuv_from_rgb(1,3)&-DINTENSITY_YSCALE=(0.5*3456.0/5184.0)&-DINTENSITY_XOFS=0.0&-DINTENSITY_XSCALE=0.5&-DINTENSITY_YOFS=0.0");
+    }
+    pipeline->add_filter("glsl:harris(2,4)&-DNUM_OFFSETS=25&-DOFFSETS=offsets_2d_25");
+    pipeline->add_filter("find:a(4)");
+    pipeline->add_filter("glsl:circle_dft(2,5)&-DDFT_CIRCLE_RADIUS=8&-DCIRCLE_COMPONENT=g");
+    pipeline->add_filter("glsl:circle_dft(3,6)&-DDFT_CIRCLE_RADIUS=8&-DCIRCLE_COMPONENT=g");
+    pipeline->add_filter("save:test_a.png(2)");
+    pipeline->add_filter("save:test_b.png(3)");
+    pipeline->add_filter("save:test_h.png(4)");
+    init_filter_end = pipeline->num_filters;
+    // Every corner is matched against the circle_dft descriptors by filter_cpu_match_corners
+    pipeline->set_output(5);
+    pipeline->set_output(6);
+
+    if (!options.cpu) {
+        texture_draw_init();
     }
-    filters[num_filters++] = filter_from_string("glsl:harris(2,4)&-DNUM_OFFSETS=25&-DOFFSETS=offsets_2d_25");
-    filters[num_filters++] = filter_from_string("find:a(4)");
-    filters[num_filters++] = filter_from_string("glsl:circle_dft(2,5)&-DDFT_CIRCLE_RADIUS=8&-DCIRCLE_COMPONENT=g");
-    filters[num_filters++] = filter_from_string("glsl:circle_dft(3,6)&-DDFT_CIRCLE_RADIUS=8&-DCIRCLE_COMPONENT=g");
-    filters[num_filters++] = filter_from_string("save:test_a.png(2)");
-    filters[num_filters++] = filter_from_string("save:test_b.png(3)");
-    filters[num_filters++] = filter_from_string("save:test_h.png(4)");
-    init_filter_end = num_filters;
-    match_filter_start = num_filters;
-    filters[num_filters++] = filter_from_string("glsl:circle_dft_diff(5,6,7)");
-    filters[num_filters++] = filter_from_string("glsl:circle_dft_diff(5,6,8)");
-    filters[num_filters++] = filter_from_string("glsl:circle_dft_diff(5,6,9)");
-    filters[num_filters++] = filter_from_string("glsl:circle_dft_diff(5,6,10)");
-    filters[num_filters++] = filter_from_string("glsl:circle_dft_diff_combine(7,8,9,10,11)&-DDISCRETE_CIRCLE_OFS=discrete_circle_offsets_4_32&-DNUM_OFFSETS=32");
-    //filters[num_filters++] = filter_from_string("save:test_e.png(10)");
-    //filters[num_filters++] = filter_from_string("fndf:a(7,8,9,10)");
-    //filters[num_filters++] = filter_from_string("save:test_d7.png(7)");
-    //filters[num_filters++] = filter_from_string("save:test_d8.png(8)");
-    //filters[num_filters++] = filter_from_string("save:test_d9.png(9)");
-    //filters[num_filters++] = filter_from_string("save:test_d10.png(10)");
-    //filters[num_filters++] = filter_from_string("save:test_d11.png(11)");
-    filters[num_filters++] = filter_from_string("find:a(11)&min_distance=2.5&max_elements=100&minimum=0.1");
-
-    int failures=0;
-    for (int i=0; i<num_filters; i++) {
-        if (!filters[i]) {
-            failures++;
-            continue;
-        }
-        if (filters[i]->parse_error) {
-            fprintf(stderr, "Filter '%d' parse error: %s\n", i, filters[i]->parse_error);
-            failures++;
-            continue;
+    for (i=0; i<options.images.num; i++) {
+        if (options.cpu) {
+            pipeline->set_input(i, texture_load_host(options.images.strings[i]));
+        } else {
+            pipeline->set_input(i, texture_load(options.images.strings[i], GL_RGB));
         }
-        if (filters[i]->compile()!=0) failures++;
-    }
-    if (failures>0) {
-        exit(4);
     }
+    fprintf(stderr,"Read %d images\n", i);
 
-    texture_draw_init();
-    for (i=0; i<options.images.num; i++) {
-        ec.textures[i] = texture_load(options.images.strings[i], GL_RGB);
+    if (pipeline->compile()!=0) {
+        exit(4);
     }
-    fprintf(stderr,"Read %d images\n", i);
-    for (i=options.images.num; i<16; i++) {
-        ec.textures[i] = texture_create(1024, 1024);
+    pipeline->report(stderr);
+    if (pipeline->allocate(&ec)!=0) {
+        fprintf(stderr,"%s\n", pipeline->parse_error);
+        exit(4);
     }
-    fprintf(stderr,"Made %d textures\n", i);
     ec.points = NULL;
 
-    for (int i=0; i<init_filter_end; i++) {
-        filters[i]->execute(&ec);
-    }
+    pipeline->execute(&ec, 0, init_filter_end);
 
-    t_point_value pts[NUM_MAPPINGS*4];
-    for (int i=0, j=0; (i<ec.num_points) && (i<NUM_MAPPINGS); i++) {
-        pts[j++] = ec.points[i];
-        pts[j++] = ec.points[i];
-        pts[j++] = ec.points[i];
-        pts[j++] = ec.points[i];
+    t_point_value corners[NUM_MAPPINGS];
+    for (int i=0; i<NUM_MAPPINGS; i++) {
+        memset(&corners[i], 0, sizeof(corners[i]));
+        if (i<ec.num_points) corners[i] = ec.points[i];
     }
-    for (int i=0; i<NUM_MAPPINGS*4; i+=4) {
-        pts[i+0].x += 4; // 4 is magic to match c_filter_find4
-        pts[i+1].y += 4;
-        pts[i+2].x -= 4;
-        pts[i+3].y -= 4;
+
+    t_corner_match_parameters match_parameters;
+    t_point_value *matches;
+    int num_matches[NUM_MAPPINGS];
+    filter_cpu_corner_match_defaults(&match_parameters);
+    match_parameters.max_matches = MAX_POINTS_PER_MAPPING;
+    matches = (t_point_value *)malloc(sizeof(t_point_value)*NUM_MAPPINGS*MAX_POINTS_PER_MAPPING);
+    if (filter_cpu_match_corners(ec.textures[5], ec.textures[6], corners, NUM_MAPPINGS,
+                                 &match_parameters, matches, num_matches)!=0) {
+        exit(4);
     }
 
     c_mapping_point *mappings[NUM_MAPPINGS];
@@ -855,25 +749,13 @@ int main(int argc,char *argv[])
 
     for (int p=0; p<NUM_MAPPINGS; p++)
     {
-        int f;
-        mappings[p] = new c_mapping_point(pts[p*4].x-4,pts[p*4].y);
-
-        fprintf(stderr,"Point %d (%d,%d)\n",p,pts[p*4].x-4,pts[p*4].y);
-        f = match_filter_start;
-        for (int i=0; i<4; i++) {
-            filters[f]->uniform_set("uv_base_x",pts[p*4+i].x);
-            filters[f]->uniform_set("uv_base_y",pts[p*4+i].y);
-            filters[f]->execute(&ec);
-            f++;
-        }
-        for (int i=match_filter_start+4; i<num_filters; i++) {
-            filters[i]->execute(&ec);
-        }
+        mappings[p] = new c_mapping_point(corners[p].x,corners[p].y);
 
-        for (int i=0; (i<ec.num_points) && (i<MAX_POINTS_PER_MAPPING); i++) {
+        fprintf(stderr,"Point %d (%d,%d)\n",p,corners[p].x,corners[p].y);
+        for (int i=0; i<num_matches[p]; i++) {
             t_point_value *pv;
             float fft_rotation;
-            pv = &(ec.points[i]);
+            pv = &(matches[p*MAX_POINTS_PER_MAPPING+i]);
             fft_rotation = FFT_ROTATION(pv->vec_y,pv->vec_x);
             mappings[p]->add_match(pv);
 
@@ -1046,7 +928,7 @@ int main(int argc,char *argv[])
         diminish_mappings_by_proposition(mappings, NUM_MAPPINGS, &best_proposition);
     }
 
-    m->exit();
+    gl_context_destroy(gl_context);
     return 0;
 }
 
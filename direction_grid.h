@@ -0,0 +1,243 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          direction_grid.h
+ * @brief         Bucket grids of unit directions and quaternions for nearby lookups
+ *
+ */
+
+/*a Wrapper
+ */
+#ifdef __INC_DIRECTION_GRID
+#else
+#define __INC_DIRECTION_GRID
+
+/*a Includes
+ */
+#include <math.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+#include "quaternion_value.h"
+
+/*a Defines
+ */
+// Cells per axis are offset by this so that keys are non-negative
+#define DIRECTION_GRID_OFFSET (1<<20)
+// As DIRECTION_GRID_OFFSET for the four axes of a quaternion grid
+#define QUATERNION_GRID_OFFSET (1<<15)
+// Smallest radius; a grid for (near) coincident directions still has few cells
+#define DIRECTION_GRID_MIN_RADIUS (1E-4)
+
+/*a Types
+ */
+/*t t_direction_grid_key
+ * Cell coordinates (offset, 21 bits each) and the group of the directions in it
+ */
+typedef struct t_direction_grid_key
+{
+    uint64_t cell;
+    int group;
+    inline bool operator==(const struct t_direction_grid_key &o) const { return (cell==o.cell) && (group==o.group); }
+} t_direction_grid_key;
+
+/*t t_direction_grid_key_hash
+ */
+struct t_direction_grid_key_hash
+{
+    inline size_t operator()(const t_direction_grid_key &k) const {
+        return std::hash<uint64_t>()(k.cell ^ (((uint64_t)k.group)*0x9e3779b97f4a7c15ULL));
+    }
+};
+
+/*c c_direction_grid
+ * Unit vectors, each with an integer id, bucketed in a uniform 3D
+ * grid of cubes with edge 2*radius; only cells that hold directions
+ * exist.
+ *
+ * Every direction within a chord distance of radius of another (i.e.
+ * with dot product at least 1-radius^2/2) is in one of the 2x2x2
+ * cells nearest that other, which for_each_near visits: along each
+ * axis the other's cell and the neighbour on the side of the cell it
+ * is nearer to.
+ *
+ * Directions may be added in separate groups (e.g. the tgt directions
+ * of each src), and a lookup then only visits those of one group.
+ */
+class c_direction_grid
+{
+private:
+    double radius;
+    double inv_cell_size;
+    std::unordered_map<t_direction_grid_key, std::vector<int>, t_direction_grid_key_hash> cells;
+
+    inline int64_t cell_of(double x) const { return (int64_t)floor(x*inv_cell_size) + DIRECTION_GRID_OFFSET; }
+    // First of the two cells along an axis within radius of x
+    inline int64_t near_cell_of(double x) const { return (int64_t)floor(x*inv_cell_size-0.5) + DIRECTION_GRID_OFFSET; }
+    static inline t_direction_grid_key key(int64_t ix, int64_t iy, int64_t iz, int group) {
+        t_direction_grid_key k;
+        k.cell = (((uint64_t)ix)<<42) | (((uint64_t)iy)<<21) | ((uint64_t)iz);
+        k.group = group;
+        return k;
+    }
+
+public:
+    c_direction_grid(void) { reset(2.0); }
+
+    /*f chord_of_cos_half_angle
+     * Chord between two unit vectors whose angle_axis r() is min_cos_half_angle,
+     * i.e. sqrt(2-2d) with d=2*m*m-1, limited to the sphere's diameter
+     */
+    static inline double chord_of_cos_half_angle(double min_cos_half_angle) {
+        if (min_cos_half_angle<=0) return 2.0;
+        if (min_cos_half_angle>=1) return 0.0;
+        return 2*sqrt(1-min_cos_half_angle*min_cos_half_angle);
+    }
+
+    /*f reset
+     * Empty the grid, with a new radius (limited to DIRECTION_GRID_MIN_RADIUS..2)
+     */
+    inline void reset(double radius) {
+        if (radius<DIRECTION_GRID_MIN_RADIUS) radius=DIRECTION_GRID_MIN_RADIUS;
+        if (radius>2.0) radius=2.0;
+        this->radius = radius;
+        inv_cell_size = 0.5/radius;
+        cells.clear();
+    }
+    inline double get_radius(void) const { return radius; }
+
+    /*f covers
+     * True if a dot product d between unit vectors guarantees that they are
+     * within radius (with a margin for rounding), so for_each_near finds them
+     */
+    inline int covers(double d) const { return d > 1-radius*radius/2+1E-12; }
+
+    /*f add
+     */
+    inline void add(const t_vec3d &dir, int id, int group=0) {
+        cells[key(cell_of(dir.x), cell_of(dir.y), cell_of(dir.z), group)].push_back(id);
+    }
+
+    /*f for_each_near
+     * Invoke fn(id) for every direction of the group in the 2x2x2 cells
+     * nearest dir, which include all those within radius of it
+     */
+    template <typename F>
+    inline void for_each_near(const t_vec3d &dir, F fn, int group=0) const {
+        int64_t cx=near_cell_of(dir.x), cy=near_cell_of(dir.y), cz=near_cell_of(dir.z);
+        if (cells.empty()) return;
+        for (int64_t ix=cx; ix<=cx+1; ix++) {
+            for (int64_t iy=cy; iy<=cy+1; iy++) {
+                for (int64_t iz=cz; iz<=cz+1; iz++) {
+                    auto cell = cells.find(key(ix, iy, iz, group));
+                    if (cell==cells.end()) continue;
+                    for (auto id : cell->second) fn(id);
+                }
+            }
+        }
+    }
+};
+
+/*c c_quaternion_grid
+ * Unit quaternions, each with an integer id, bucketed as for
+ * c_direction_grid but in a 4D grid of cubes with edge 2*radius, so
+ * for_each_near visits the 2x2x2x2 cells nearest a quaternion.
+ *
+ * A quaternion and its negation are the same rotation, so quaternions
+ * are added with r>=0 and for_each_near looks around both q and -q; it
+ * finds every quaternion whose chord distance to q or -q is within
+ * radius.
+ */
+class c_quaternion_grid
+{
+private:
+    double radius;
+    double inv_cell_size;
+    std::unordered_map<t_direction_grid_key, std::vector<int>, t_direction_grid_key_hash> cells;
+
+    inline int64_t cell_of(double x) const { return (int64_t)floor(x*inv_cell_size) + QUATERNION_GRID_OFFSET; }
+    inline int64_t near_cell_of(double x) const { return (int64_t)floor(x*inv_cell_size-0.5) + QUATERNION_GRID_OFFSET; }
+    static inline t_direction_grid_key key(int64_t ir, int64_t ii, int64_t ij, int64_t ik) {
+        t_direction_grid_key k;
+        k.cell = (((uint64_t)ir)<<48) | (((uint64_t)ii)<<32) | (((uint64_t)ij)<<16) | ((uint64_t)ik);
+        k.group = 0;
+        return k;
+    }
+    static inline t_quatd canonical(const t_quatd &q) { return (q.r<0) ? (q*-1.0) : q; }
+    template <typename F>
+    inline void for_each_near_one(const t_quatd &q, F fn) const {
+        int64_t cr=near_cell_of(q.r), ci=near_cell_of(q.i), cj=near_cell_of(q.j), ck=near_cell_of(q.k);
+        for (int n=0; n<16; n++) {
+            auto cell = cells.find(key(cr+(n&1), ci+((n>>1)&1), cj+((n>>2)&1), ck+((n>>3)&1)));
+            if (cell==cells.end()) continue;
+            for (auto id : cell->second) fn(id);
+        }
+    }
+
+public:
+    c_quaternion_grid(void) { reset(2.0); }
+
+    /*f chord_of_distance
+     * Chord between unit quaternions (the nearer of q and -q) whose
+     * c_quaternion::distance_to is max_distance, i.e. 2-2d^2 with d their
+     * dot product
+     */
+    static inline double chord_of_distance(double max_distance) {
+        double d;
+        if (max_distance<=0) return 0.0;
+        if (max_distance>=2) return sqrt(2.0);
+        d = sqrt(1-max_distance/2);
+        return sqrt(2-2*d);
+    }
+
+    /*f reset
+     */
+    inline void reset(double radius) {
+        if (radius<DIRECTION_GRID_MIN_RADIUS) radius=DIRECTION_GRID_MIN_RADIUS;
+        if (radius>2.0) radius=2.0;
+        this->radius = radius;
+        inv_cell_size = 0.5/radius;
+        cells.clear();
+    }
+
+    /*f add
+     */
+    inline void add(const t_quatd &q, int id) {
+        t_quatd c = canonical(q.normalized());
+        cells[key(cell_of(c.r), cell_of(c.i), cell_of(c.j), cell_of(c.k))].push_back(id);
+    }
+
+    /*f for_each_near
+     * Invoke fn(id) for every quaternion in the cells nearest q and -q;
+     * an id may be visited twice if q is close to r=0
+     */
+    template <typename F>
+    inline void for_each_near(const t_quatd &q, F fn) const {
+        t_quatd c = canonical(q.normalized());
+        if (cells.empty()) return;
+        for_each_near_one(c, fn);
+        if (c.r<=radius) for_each_near_one(c*-1.0, fn);
+    }
+};
+
+/*a Wrapper
+ */
+#endif
+
+/*a Editor preferences and notes
+mode: c ***
+c-basic-offset: 4 ***
+c-default-style: (quote ((c-mode . "k&r") (c++-mode . "k&r"))) ***
+outline-regexp: "/\\\*a\\\|[\t ]*\/\\\*[b-z][\t ]" ***
+*/
@@ -1,18 +1,51 @@
 /*a Documentation
+  Filter parameters are given in the filter string ('&name=value') or
+  set by name later, and are held in a map by name. A GLSL filter's
+  uniforms are bound through a plan built when its program is linked:
+  one slot per active (non-sampler) uniform of the program, with its
+  type and location, whose value is taken from the parameter of that
+  name. Setting a parameter updates its slot too (the parameter caches
+  its slot for the plan), so a parameter set after compile is still
+  bound; a caller setting a uniform many times
+  (e.g. uv_base_x and uv_base_y for every point matched) can look the
+  slot up once with uniform_slot and then use set_uniform, which only
+  stores the values and marks the slot dirty. At execute time only
+  dirty slots are uploaded - unless another filter sharing the cached
+  program has used it since, when every slot with a value is.
  */
 /*a Includes
  */
 #include <OpenGL/gl3.h> 
 #include <ctype.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
+#include <vector>
 #include "filter.h"
+#include "filter_cpu.h"
+#include "thread_pool.h"
+
+/*a Defines
+ */
+#define FIND_BATCH_SIZE 1024
 
 /*a Types
  */
 
+/*a Static variables
+ */
+/*v filter_backend
+ */
+static t_filter_backend filter_backend = filter_backend_gl;
+
+/*v program_uniform_owner
+ * Filter whose uniform values were last uploaded to each program
+ */
+static std::map<GLuint, const c_filter *> program_uniform_owner;
+
 /*a c_filter class and subclasses
  */
 /*t t_parameter_def
@@ -42,7 +75,10 @@ public:
     ~c_filter_save();
     char *save_filename;
     t_filter_save_parameters parameters;
+    t_texture_ptr readback_texture;
     virtual int do_execute(t_exec_context *ec);
+    virtual int do_execute_start(t_exec_context *ec);
+    virtual int do_execute_complete(t_exec_context *ec);
 };
 
 /*v c_filter_save::parameter_defns
@@ -73,7 +109,8 @@ public:
     char *shader_defines;
     t_filter_glsl_parameters parameters;
 
-    virtual int do_compile(void);
+    virtual int do_compile_start(void);
+    virtual int do_compile_complete(void);
     virtual int do_execute(t_exec_context *ec);
 };
 
@@ -95,7 +132,8 @@ public:
     char *filter_filename;
     char *shader_defines;
 
-    virtual int do_compile(void);
+    virtual int do_compile_start(void);
+    virtual int do_compile_complete(void);
     virtual int do_execute(t_exec_context *ec);
 };
 
@@ -106,6 +144,7 @@ typedef struct
     int perimeter;
     double minimum;
     double min_distance;
+    double grid_cell_size;
     int max_elements;
 } t_filter_find_parameters;
 
@@ -120,9 +159,12 @@ public:
     t_filter_find_parameters parameters;
     int num_elements;
     t_point_value *points;
+    t_texture_ptr readback_texture;
 
     virtual int do_compile(void);
     virtual int do_execute(t_exec_context *ec);
+    virtual int do_execute_start(t_exec_context *ec);
+    virtual int do_execute_complete(t_exec_context *ec);
 };
 
 /*v c_filter_find::parameter_defns
@@ -131,6 +173,7 @@ t_parameter_def c_filter_find::parameter_defns[] = {
         {"perimeter", 'i', offsetof(t_filter_find_parameters,perimeter)},
         {"max_elements", 'i', offsetof(t_filter_find_parameters,max_elements)},
         {"min_distance", 'f', offsetof(t_filter_find_parameters,min_distance)},
+        {"grid_cell_size", 'f', offsetof(t_filter_find_parameters,grid_cell_size)},
         {"minimum", 'f', offsetof(t_filter_find_parameters,minimum)},
         {NULL, 0, 0}
     };
@@ -144,6 +187,7 @@ c_filter::c_filter(t_len_string *textures, t_len_string *parameter_string)
     int texture_ec_ids[MAX_FILTER_TEXTURES];
 
     parse_error = NULL;
+    num_dest_textures = 0;
 
     for (int i=0; i<MAX_FILTER_TIMERS; i++) {
         SL_TIMER_INIT(timers[i]);
@@ -165,6 +209,9 @@ c_filter::c_filter(t_len_string *textures, t_len_string *parameter_string)
     }
 
     parameter_map = new std::map <std::string, t_filter_parameter>();
+    uniforms = NULL;
+    num_uniforms = 0;
+    uniform_plan = 0;
 
     const char *end = parameter_string->ptr+parameter_string->len;
     for (const char *ptr=parameter_string->ptr; ptr<end;) {
@@ -187,9 +234,7 @@ c_filter::c_filter(t_len_string *textures, t_len_string *parameter_string)
             value_string=std::string("");
         }
         t_filter_parameter &fp = (*parameter_map)[key_string];
-        fp.valid_values = fp_valid_string;
-        fp.string = (const char *)malloc(strlen(value_string.c_str()+1));
-        strcpy((char *)fp.string, value_string.c_str());
+        set_parameter(&fp, value_string.c_str());
         ptr = value_end;
     }
 
@@ -200,9 +245,15 @@ c_filter::c_filter(t_len_string *textures, t_len_string *parameter_string)
  */
 c_filter::~c_filter(void)
 {
-    // delete strings in parameter_map
+    for (auto fpi = parameter_map->begin(); fpi != parameter_map->end(); ++fpi) {
+        if (fpi->second.string) free((void *)fpi->second.string);
+    }
     delete parameter_map;
+    if (uniforms) free(uniforms);
     if (filter_pid!=0) {
+        auto owner = program_uniform_owner.find(filter_pid);
+        if ((owner!=program_uniform_owner.end()) && (owner->second==this))
+            program_uniform_owner.erase(owner);
         shader_delete(filter_pid);
         filter_pid = 0;
     }
@@ -217,6 +268,10 @@ int c_filter::set_parameter(const char *name, int value)
 {
     auto &fp=(*parameter_map)[name];
     set_parameter(&fp, value );
+    if (num_uniforms>0) {
+        GLint i = value;
+        set_uniform(parameter_uniform_slot(name, &fp), &i, 1);
+    }
     return 0;
 }
 
@@ -236,6 +291,10 @@ int c_filter::set_parameter(const char *name, double value)
 {
     auto &fp=(*parameter_map)[name];
     set_parameter(&fp, value );
+    if (num_uniforms>0) {
+        float f = value;
+        set_uniform(parameter_uniform_slot(name, &fp), &f, 1);
+    }
     return 0;
 }
 
@@ -254,33 +313,105 @@ int c_filter::set_parameter(const char *name, const char *value)
 {
     auto &fp=(*parameter_map)[name];
     set_parameter(&fp, value );
+    if (num_uniforms>0) {
+        uniform_from_parameter(parameter_uniform_slot(name, &fp), &fp);
+    }
     return 0;
 }
 
 /*f c_filter::set_parameter(filter parameter, string value)
+ * The value is copied, into the parameter's string if it fits
  */
 void c_filter::set_parameter(t_filter_parameter *fp, const char *value)
 {
+    int size = strlen(value)+1;
+    if (size>fp->string_size) {
+        if (fp->string) free((void *)fp->string);
+        fp->string = (const char *)malloc(size);
+        fp->string_size = size;
+    }
+    strcpy((char *)fp->string, value);
     fp->valid_values &= ~(fp_valid_real | fp_valid_integer);
     fp->valid_values |= fp_valid_string;
-    fp->string = value;
+}
+
+/*f c_filter::set_parameter(name, float values)
+ * Set a vector (or matrix) parameter; held in the parameter map as a
+ * comma-separated string, so that it is bound if the filter is compiled later
+ */
+int c_filter::set_parameter(const char *name, const float *values, int num_values)
+{
+    char string[MAX_FILTER_UNIFORM_VALUES*20+1];
+    if ((num_values<1) || (num_values>MAX_FILTER_UNIFORM_VALUES))
+        return 1;
+    int length = 0;
+    for (int i=0; i<num_values; i++) {
+        length += sprintf(string+length, "%s%.9g", i?",":"", values[i]);
+    }
+    auto &fp=(*parameter_map)[name];
+    set_parameter(&fp, (const char *)string);
+    if (num_uniforms>0) {
+        set_uniform(parameter_uniform_slot(name, &fp), values, num_values);
+    }
+    return 0;
 }
 
 /*f c_filter::unset_parameter
+ * The uniform of that name (if any) is no longer uploaded, and keeps its last value
  */
 int c_filter::unset_parameter(const char *name)
 {
-    parameter_map->erase(name);
+    auto fpi = parameter_map->find(name);
+    if (fpi!=parameter_map->end()) {
+        if (fpi->second.string) free((void *)fpi->second.string);
+        parameter_map->erase(fpi);
+    }
+    if (num_uniforms>0) {
+        int slot = uniform_slot(name);
+        if (slot>=0) uniforms[slot].valid = 0;
+    }
     return 0;
 }
 
+/*f c_filter::get_parameter_real
+ * Return 0 and set *value if the named parameter has a numeric value
+ */
+int c_filter::get_parameter_real(const char *name, double *value)
+{
+    auto fpi = parameter_map->find(name);
+    if (fpi==parameter_map->end())
+        return 1;
+    if (fpi->second.valid_values & fp_valid_real) {
+        *value = fpi->second.real;
+        return 0;
+    }
+    if (fpi->second.valid_values & fp_valid_string) {
+        if (sscanf(fpi->second.string, "%lf", value)==1)
+            return 0;
+    }
+    return 1;
+}
+
+/*f c_filter::get_define
+ * Return the string value of a '-D<name>' parameter, or NULL
+ */
+const char *c_filter::get_define(const char *name)
+{
+    auto fpi = parameter_map->find(std::string("-D")+name);
+    if (fpi==parameter_map->end())
+        return NULL;
+    if (!(fpi->second.valid_values & fp_valid_string))
+        return NULL;
+    return fpi->second.string;
+}
+
 /*c c_filter::get_parameter_value
  */
 void c_filter::get_parameter_value(t_filter_parameter *fp)
 {
     if (fp->valid_values & fp_valid_string) {
         double f;
-        if (sscanf(fp->string, "%lf", &f)!=1) {
+        if (sscanf(fp->string, "%lf", &f)==1) {
             if (f==(int)f) {
                 set_parameter(fp, (int)f);
             } else {
@@ -295,18 +426,16 @@ void c_filter::get_parameter_value(t_filter_parameter *fp)
 void c_filter::set_parameters_from_map(t_parameter_def *parameter_defns, void *parameters)
 {
     for (int i=0; parameter_defns[i].name; i++) {
-        // change to find the parameter by name - then use default
-        for (auto fpi = parameter_map->begin(); fpi != parameter_map->end(); ++fpi) {
-            if (!fpi->first.compare(parameter_defns[i].name)) {
-                get_parameter_value(&(fpi->second));
-                char *p = ((char *)parameters) + parameter_defns[i].this_offset;
-                if (parameter_defns[i].type=='i') {
-                    ((int *)p)[0] = fpi->second.integer;
-                }
-                if (parameter_defns[i].type=='f') {
-                    ((double *)p)[0] = fpi->second.real;
-                }
-            }
+        auto fpi = parameter_map->find(parameter_defns[i].name);
+        if (fpi==parameter_map->end())
+            continue; // leave the default
+        get_parameter_value(&(fpi->second));
+        char *p = ((char *)parameters) + parameter_defns[i].this_offset;
+        if (parameter_defns[i].type=='i') {
+            ((int *)p)[0] = fpi->second.integer;
+        }
+        if (parameter_defns[i].type=='f') {
+            ((double *)p)[0] = fpi->second.real;
         }
     }
 }
@@ -459,65 +588,260 @@ int c_filter::set_texture_uniforms(t_exec_context *ec, int num_dest)
     return failures;
 }
 
-/*f c_filter::get_shader_uniform_ids
- * Do this at compile time
+/*f uniform_type_values
+ * Number of values of a GL uniform type, 0 for types not bound by the plan (samplers)
  */
-int c_filter::get_shader_uniform_ids(void)
+static int uniform_type_values(GLenum type, int *is_float)
 {
-    int failures;
-    gl_get_errors("before get shader uniforms");
-    failures = 0;
-    for (auto fpi = parameter_map->begin(); fpi != parameter_map->end(); ++fpi) {
-        fpi->second.gl_id = glGetUniformLocation(filter_pid, fpi->first.c_str());
-        if (fpi->second.gl_id>=0) {
-            fpi->second.valid_values |= fp_valid_gl_id;
+    *is_float = 1;
+    switch (type) {
+    case GL_FLOAT:             return 1;
+    case GL_FLOAT_VEC2:        return 2;
+    case GL_FLOAT_VEC3:        return 3;
+    case GL_FLOAT_VEC4:        return 4;
+    case GL_FLOAT_MAT2:        return 4;
+    case GL_FLOAT_MAT3:        return 9;
+    case GL_FLOAT_MAT4:        return 16;
+    case GL_FLOAT_MAT2x3:      return 6;
+    case GL_FLOAT_MAT2x4:      return 8;
+    case GL_FLOAT_MAT3x2:      return 6;
+    case GL_FLOAT_MAT3x4:      return 12;
+    case GL_FLOAT_MAT4x2:      return 8;
+    case GL_FLOAT_MAT4x3:      return 12;
+    default: break;
+    }
+    *is_float = 0;
+    switch (type) {
+    case GL_INT:               return 1;
+    case GL_INT_VEC2:          return 2;
+    case GL_INT_VEC3:          return 3;
+    case GL_INT_VEC4:          return 4;
+    case GL_UNSIGNED_INT:      return 1;
+    case GL_UNSIGNED_INT_VEC2: return 2;
+    case GL_UNSIGNED_INT_VEC3: return 3;
+    case GL_UNSIGNED_INT_VEC4: return 4;
+    case GL_BOOL:              return 1;
+    case GL_BOOL_VEC2:         return 2;
+    case GL_BOOL_VEC3:         return 3;
+    case GL_BOOL_VEC4:         return 4;
+    default: break;
+    }
+    return 0;
+}
+
+/*f uniform_upload
+ * Upload a slot's values to the current program
+ */
+static void uniform_upload(const t_filter_uniform *fu)
+{
+    const GLfloat *f = fu->value.f;
+    const GLint *i = fu->value.i;
+    switch (fu->type) {
+    case GL_FLOAT:             glUniform1fv(fu->location, 1, f); break;
+    case GL_FLOAT_VEC2:        glUniform2fv(fu->location, 1, f); break;
+    case GL_FLOAT_VEC3:        glUniform3fv(fu->location, 1, f); break;
+    case GL_FLOAT_VEC4:        glUniform4fv(fu->location, 1, f); break;
+    case GL_FLOAT_MAT2:        glUniformMatrix2fv(fu->location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT3:        glUniformMatrix3fv(fu->location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT4:        glUniformMatrix4fv(fu->location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT2x3:      glUniformMatrix2x3fv(fu->location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT2x4:      glUniformMatrix2x4fv(fu->location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT3x2:      glUniformMatrix3x2fv(fu->location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT3x4:      glUniformMatrix3x4fv(fu->location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT4x2:      glUniformMatrix4x2fv(fu->location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT4x3:      glUniformMatrix4x3fv(fu->location, 1, GL_FALSE, f); break;
+    case GL_INT:
+    case GL_BOOL:              glUniform1iv(fu->location, 1, i); break;
+    case GL_INT_VEC2:
+    case GL_BOOL_VEC2:         glUniform2iv(fu->location, 1, i); break;
+    case GL_INT_VEC3:
+    case GL_BOOL_VEC3:         glUniform3iv(fu->location, 1, i); break;
+    case GL_INT_VEC4:
+    case GL_BOOL_VEC4:         glUniform4iv(fu->location, 1, i); break;
+    case GL_UNSIGNED_INT:      glUniform1uiv(fu->location, 1, (const GLuint *)i); break;
+    case GL_UNSIGNED_INT_VEC2: glUniform2uiv(fu->location, 1, (const GLuint *)i); break;
+    case GL_UNSIGNED_INT_VEC3: glUniform3uiv(fu->location, 1, (const GLuint *)i); break;
+    case GL_UNSIGNED_INT_VEC4: glUniform4uiv(fu->location, 1, (const GLuint *)i); break;
+    default: break;
+    }
+}
+
+/*f c_filter::build_uniform_plan
+ * Do this at compile time, once the program is linked
+ *
+ * Arrays and uniform block members are not bound; nor are samplers,
+ * which set_texture_uniforms binds
+ */
+int c_filter::build_uniform_plan(void)
+{
+    GLint num_active;
+    gl_get_errors("before build uniform plan");
+    if (uniforms) free(uniforms);
+    uniforms = NULL;
+    num_uniforms = 0;
+    uniform_plan++;
+    num_active = 0;
+    glGetProgramiv(filter_pid, GL_ACTIVE_UNIFORMS, &num_active);
+    if (num_active>0) {
+        uniforms = (t_filter_uniform *)calloc(num_active, sizeof(t_filter_uniform));
+    }
+    for (GLint u=0; u<num_active; u++) {
+        t_filter_uniform *fu = &uniforms[num_uniforms];
+        GLint size;
+        GLsizei length;
+        glGetActiveUniform(filter_pid, u, sizeof(fu->name), &length, &size, &fu->type, fu->name);
+        fu->num_values = uniform_type_values(fu->type, &fu->is_float);
+        if ((fu->num_values==0) || (size!=1))
+            continue;
+        fu->location = glGetUniformLocation(filter_pid, fu->name);
+        if (fu->location<0)
+            continue;
+        fu->valid = 0;
+        fu->dirty = 0;
+        num_uniforms++;
+        auto fpi = parameter_map->find(fu->name);
+        if (fpi!=parameter_map->end()) {
+            uniform_from_parameter(num_uniforms-1, &(fpi->second));
         }
     }
-    gl_get_errors("after get shader uniforms");
-    return failures;
+    gl_get_errors("after build uniform plan");
+    return 0;
+}
+
+/*f c_filter::uniform_from_parameter
+ * Set a slot from a parameter: a number, or a string of numbers
+ * separated by commas or spaces (parsed once, here)
+ */
+void c_filter::uniform_from_parameter(int slot, t_filter_parameter *fp)
+{
+    if ((slot<0) || (slot>=num_uniforms))
+        return;
+    if (fp->valid_values & fp_valid_integer) {
+        GLint i = fp->integer;
+        set_uniform(slot, &i, 1);
+    } else if (fp->valid_values & fp_valid_real) {
+        float f = fp->real;
+        set_uniform(slot, &f, 1);
+    } else if (fp->valid_values & fp_valid_string) {
+        float values[MAX_FILTER_UNIFORM_VALUES];
+        const char *ptr = fp->string;
+        int n = 0;
+        while (n<MAX_FILTER_UNIFORM_VALUES) {
+            char *next_ptr;
+            while ((ptr[0]==',') || isspace(ptr[0])) ptr++;
+            values[n] = strtod(ptr, &next_ptr);
+            if (next_ptr==ptr) break;
+            ptr = next_ptr;
+            n++;
+        }
+        if (n>0) set_uniform(slot, values, n);
+    }
+}
+
+/*f c_filter::uniform_slot
+ * Slot of the named uniform in the binding plan, or -1 if the program
+ * does not use it (or is not compiled)
+ */
+int c_filter::uniform_slot(const char *name)
+{
+    for (int i=0; i<num_uniforms; i++) {
+        if (!strcmp(uniforms[i].name, name))
+            return i;
+    }
+    return -1;
+}
+
+/*f c_filter::parameter_uniform_slot
+ * Slot of the uniform for a parameter, looked up by name only once per
+ * uniform plan
+ */
+int c_filter::parameter_uniform_slot(const char *name, t_filter_parameter *fp)
+{
+    if (fp->uniform_plan!=uniform_plan) {
+        fp->uniform_slot = uniform_slot(name);
+        fp->uniform_plan = uniform_plan;
+    }
+    return fp->uniform_slot;
+}
+
+/*f c_filter::set_uniform(slot, float values)
+ * Store values in a slot (converted for an integer uniform); it is
+ * uploaded at the next execute if they differ from those it holds
+ */
+int c_filter::set_uniform(int slot, const float *values, int num_values)
+{
+    t_filter_uniform *fu;
+    if ((slot<0) || (slot>=num_uniforms))
+        return 1;
+    fu = &uniforms[slot];
+    if (num_values>fu->num_values) num_values=fu->num_values;
+    for (int i=0; i<num_values; i++) {
+        if (fu->is_float) {
+            if (fu->value.f[i]!=values[i]) fu->dirty = 1;
+            fu->value.f[i] = values[i];
+        } else {
+            GLint v = (GLint)values[i];
+            if (fu->value.i[i]!=v) fu->dirty = 1;
+            fu->value.i[i] = v;
+        }
+    }
+    if (!fu->valid) fu->dirty = 1;
+    fu->valid = 1;
+    return 0;
+}
+
+/*f c_filter::set_uniform(slot, integer values)
+ */
+int c_filter::set_uniform(int slot, const GLint *values, int num_values)
+{
+    t_filter_uniform *fu;
+    if ((slot<0) || (slot>=num_uniforms))
+        return 1;
+    fu = &uniforms[slot];
+    if (num_values>fu->num_values) num_values=fu->num_values;
+    for (int i=0; i<num_values; i++) {
+        if (fu->is_float) {
+            float f = (float)values[i];
+            if (fu->value.f[i]!=f) fu->dirty = 1;
+            fu->value.f[i] = f;
+        } else {
+            if (fu->value.i[i]!=values[i]) fu->dirty = 1;
+            fu->value.i[i] = values[i];
+        }
+    }
+    if (!fu->valid) fu->dirty = 1;
+    fu->valid = 1;
+    return 0;
 }
 
 /*f c_filter::set_shader_uniforms
- * Do this at execute time
+ * Do this at execute time, with the filter's program in use
  */
 int c_filter::set_shader_uniforms(void)
 {
-    int failures;
+    int upload_all=0;
     gl_get_errors("before set shader uniforms");
-    failures = 0;
-    for (auto fpi = parameter_map->begin(); fpi != parameter_map->end(); ++fpi) {
-        if (fpi->second.valid_values & fp_valid_gl_id) {
-            if (!(fpi->second.valid_values & fp_valid_real)) {
-                get_parameter_value(&(fpi->second));
-            }
-            if (fpi->second.valid_values & fp_valid_real) {
-                glUniform1f(fpi->second.gl_id, fpi->second.real);
-            }
+    const c_filter *&owner = program_uniform_owner[filter_pid];
+    if (owner!=this) {
+        owner = this;
+        upload_all = 1;
+    }
+    for (int i=0; i<num_uniforms; i++) {
+        t_filter_uniform *fu = &uniforms[i];
+        if (fu->valid && (fu->dirty || upload_all)) {
+            uniform_upload(fu);
+            fu->dirty = 0;
         }
     }
     gl_get_errors("after set shader uniforms");
-    return failures;
+    return 0;
 }
 
 /*f c_filter::uniform_set
  */
 int c_filter::uniform_set(const char *uniform, float value)
 {
-    set_parameter(uniform, (double)value);
-    return 1;
-    GLint gl_id;
-    if (filter_pid==0)
-        return 0;
-    glUseProgram(filter_pid);
-    gl_id = glGetUniformLocation(filter_pid, uniform);
-    GL_GET_ERRORS;
-    if (gl_id>=0) {
-        glUniform1f(gl_id, value);
-        GL_GET_ERRORS;
-        return 0;
-    }
-    GL_GET_ERRORS;
-    return 1;
+    return set_parameter(uniform, (double)value);
 }
 
 /*a c_filter_glsl methods
@@ -527,6 +851,7 @@ int c_filter::uniform_set(const char *uniform, float value)
 c_filter_glsl::c_filter_glsl(t_len_string *filename, t_len_string *textures, t_len_string *parameter_string)
     : c_filter(textures, parameter_string)
 {
+    num_dest_textures = 1;
     parameters.num_x_divisions = 2;
     parameters.num_y_divisions = 2;
     set_filename("shaders/", ".glsl", filename, &filter_filename);
@@ -542,20 +867,36 @@ c_filter_glsl::~c_filter_glsl()
     return;
 }
 
-/*f c_filter_glsl::do_compile
+/*f c_filter_glsl::do_compile_start
  */
-int c_filter_glsl::do_compile(void)
+int c_filter_glsl::do_compile_start(void)
 {
     int rc=0;
     SL_TIMER_ENTRY(timers[filter_timer_compile]);
 
     get_shader_defines(&shader_defines);
-    filter_pid = shader_load_and_link(0, "shaders/vertex_shader.glsl", filter_filename, shader_defines);
+    filter_pid = shader_load_and_link_start("shaders/vertex_shader.glsl", filter_filename, shader_defines);
+    if (filter_pid==0) {
+        parse_error = "Failed to load shader";
+        rc = 1;
+    }
+    SL_TIMER_EXIT(timers[filter_timer_compile]);
+    return rc;
+}
+
+/*f c_filter_glsl::do_compile_complete
+ */
+int c_filter_glsl::do_compile_complete(void)
+{
+    int rc=0;
+    SL_TIMER_ENTRY(timers[filter_timer_compile]);
+
+    filter_pid = shader_load_and_link_complete(filter_pid);
     if (filter_pid==0) {
         parse_error = "Failed to load and link shader";
         rc = 1;
     }
-    if ((rc==0) && get_shader_uniform_ids()) {
+    if ((rc==0) && build_uniform_plan()) {
         parse_error = "Failed to get shader uniform ids";
         rc = 1;
     }
@@ -604,6 +945,7 @@ int c_filter_glsl::do_execute(t_exec_context *ec)
 c_filter_correlate::c_filter_correlate(t_len_string *filename, t_len_string *textures, t_len_string *parameter_string)
     : c_filter(textures, parameter_string)
 {
+    num_dest_textures = 1;
     set_filename("shaders/", ".glsl", filename, &filter_filename);
     if (num_textures<2) {
         parse_error = "Failed to parse GLSL texture options - need at least '(<src>+,<dst>)' texture numbers";
@@ -617,20 +959,38 @@ c_filter_correlate::~c_filter_correlate()
     return;
 }
 
-/*f c_filter_correlate::do_compile
+/*f c_filter_correlate::do_compile_start
  */
-int c_filter_correlate::do_compile(void)
+int c_filter_correlate::do_compile_start(void)
 {
     int rc=0;
 
     SL_TIMER_ENTRY(timers[filter_timer_compile]);
 
     get_shader_defines(&shader_defines);
-    filter_pid = shader_load_and_link(0, "shaders/vertex_correlation_shader.glsl", filter_filename, shader_defines);
+    filter_pid = shader_load_and_link_start("shaders/vertex_correlation_shader.glsl", filter_filename, shader_defines);
+    if (filter_pid==0) {
+        rc=1;
+    }
+
+    SL_TIMER_EXIT(timers[filter_timer_compile]);
+
+    return rc;
+}
+
+/*f c_filter_correlate::do_compile_complete
+ */
+int c_filter_correlate::do_compile_complete(void)
+{
+    int rc=0;
+
+    SL_TIMER_ENTRY(timers[filter_timer_compile]);
+
+    filter_pid = shader_load_and_link_complete(filter_pid);
     if (filter_pid==0) {
         rc=1;
     }
-    if ((rc==0) && (get_shader_uniform_ids())){
+    if ((rc==0) && (build_uniform_plan())){
         rc=1;
     }
     if ((rc==0) && (get_texture_uniform_ids(1))) {
@@ -685,6 +1045,7 @@ c_filter_save::c_filter_save(t_len_string *filename, t_len_string *textures, t_l
     set_filename(NULL, NULL, filename, &save_filename);
     parameters.conversion = 0;
     parameters.components = 0;
+    readback_texture = NULL;
 
     if (num_textures!=1) {
         parse_error = "Failed to parse save texture - need '(<src>)' texture number";
@@ -702,10 +1063,34 @@ c_filter_save::~c_filter_save()
  */
 int c_filter_save::do_execute(t_exec_context *ec)
 {
-    t_texture_ptr texture;
+    do_execute_start(ec);
+    return do_execute_complete(ec);
+}
 
+/*f c_filter_save::do_execute_start
+ * Start reading back the texture; a host texture is saved immediately,
+ * as a later filter may overwrite it before completion
+ */
+int c_filter_save::do_execute_start(t_exec_context *ec)
+{
     set_parameters_from_map(parameter_defns, (void *)&parameters);
-    texture = bound_texture(ec, 0);
+    readback_texture = bound_texture(ec, 0);
+    if (texture_is_host(readback_texture))
+        return do_execute_complete(ec);
+    texture_readback_start(readback_texture, GL_RGBA, GL_FLOAT);
+    return 0;
+}
+
+/*f c_filter_save::do_execute_complete
+ */
+int c_filter_save::do_execute_complete(t_exec_context *ec)
+{
+    t_texture_ptr texture;
+
+    texture = readback_texture;
+    if (!texture)
+        return 0;
+    readback_texture = NULL;
 
     if (0) {
         fprintf(stderr, "Saving to '%s'\n",save_filename);
@@ -724,6 +1109,8 @@ c_filter_find::c_filter_find(t_len_string *filename, t_len_string *textures, t_l
     parameters.minimum = 0.0;
     parameters.max_elements = 320;
     parameters.min_distance = 10.0;
+    parameters.grid_cell_size = 0.0;
+    readback_texture = NULL;
 
     if (num_textures!=1) {
         parse_error = "Failed to parse find texture options - need '(<src>)' texture number";
@@ -746,22 +1133,387 @@ int c_filter_find::do_compile(void)
 
 /*f c_filter_find::do_execute
  */
+int c_filter_find::do_execute(t_exec_context *ec)
+{
+    do_execute_start(ec);
+    return do_execute_complete(ec);
+}
+
+/*f c_filter_find::do_execute_start
+ * Start reading back the texture; a host texture is scanned immediately,
+ * as a later filter may overwrite it before completion
+ */
+int c_filter_find::do_execute_start(t_exec_context *ec)
+{
+    readback_texture = bound_texture(ec, 0);
+    if (texture_is_host(readback_texture))
+        return do_execute_complete(ec);
+    texture_readback_start(readback_texture, GL_RGBA, GL_FLOAT);
+    return 0;
+}
+
+/*f c_filter_find::do_execute_complete
+ */
 typedef struct
 {
     float value;
     int x;
     int y;
     int place;
+    float vec_x;
+    float vec_y;
 } t_xy_value_place;
 
-int cmp_xy_value_place(const void *a, const void *b)
+/*t t_find_scan
+ * Rows y0 to y0+rows-1 are fetched from rows_fn in num_bands bands. A
+ * candidate must exceed minimum; and, once the first batch of
+ * candidates is known, either exceed threshold or be at most
+ * threshold_place in scan order
+ */
+typedef struct
 {
-    const t_xy_value_place *pa, *pb;
-    pa = (const t_xy_value_place *)a;
-    pb = (const t_xy_value_place *)b;
-    float diff = pb->value - pa->value;
-    if (diff<0) return -1;
-    return 1;
+    const t_find_rows_fn *rows_fn;
+    int w;
+    int x0, x1;
+    int y0, rows;
+    int num_bands;
+    float minimum;
+    float threshold;
+    int threshold_place;
+    int max_elements;
+} t_find_scan;
+
+/*t t_find_band
+ * The best max_elements candidates of a band of rows (best first), with
+ * the number of candidates and the first FIND_BATCH_SIZE of them in
+ * scan order
+ */
+typedef struct
+{
+    std::vector<t_xy_value_place> best;
+    std::vector<t_xy_value_place> first;
+    int num_candidates;
+} t_find_band;
+
+/*f find_candidate_better
+ * Candidates are ordered by value, highest first; equal values are
+ * ordered with the later scan position ('place') first
+ */
+static inline bool find_candidate_better(const t_xy_value_place &a, const t_xy_value_place &b)
+{
+    if (a.value!=b.value) return a.value>b.value;
+    return a.place>b.place;
+}
+
+/*f find_scan_accepts
+ */
+static inline bool find_scan_accepts(const t_find_scan *scan, const t_xy_value_place &c)
+{
+    if (!(c.value>scan->minimum)) return false;
+    return (c.value>scan->threshold) || (c.place<=scan->threshold_place);
+}
+
+/*f find_band_y
+ * First row of band b (or the end of the scan for b of num_bands)
+ */
+static inline int find_band_y(const t_find_scan *scan, int b)
+{
+    return scan->y0+(scan->rows*b)/scan->num_bands;
+}
+
+/*f find_candidate
+ */
+static inline void find_candidate(const t_find_scan *scan, const float *row, int x, int y, t_xy_value_place *c)
+{
+    c->x = x;
+    c->y = y;
+    c->place = y*scan->w+x;
+    c->vec_x = row[x*4+1];
+    c->vec_y = row[x*4+2];
+}
+
+/*f find_band_top_k
+ * Keep the best max_elements candidates of band b in a bounded heap
+ * whose front is the worst kept, and return them best first; if first
+ * is not NULL then record the first FIND_BATCH_SIZE candidates and the
+ * number of candidates too
+ */
+static void find_band_top_k(const t_find_scan *scan, int b, std::vector<t_xy_value_place> *heap, t_find_band *first)
+{
+    std::vector<float> buffer;
+    const float *rows;
+    int y0, y1;
+
+    y0 = find_band_y(scan, b);
+    y1 = find_band_y(scan, b+1);
+    rows = (*scan->rows_fn)(y0, y1, &buffer);
+    heap->clear();
+    heap->reserve(scan->max_elements);
+    for (int y=y0; y<y1; y++) {
+        const float *row = rows + (y-y0)*scan->w*4;
+        for (int x=scan->x0; x<scan->x1; x++) {
+            t_xy_value_place c;
+            c.value = row[x*4+0];
+            if (!(c.value>scan->minimum))
+                continue;
+            find_candidate(scan, row, x, y, &c);
+            if (!find_scan_accepts(scan, c))
+                continue;
+            if (first) {
+                if (first->num_candidates<FIND_BATCH_SIZE)
+                    first->first.push_back(c);
+                first->num_candidates++;
+            }
+            if ((int)heap->size()<scan->max_elements) {
+                heap->push_back(c);
+                std::push_heap(heap->begin(), heap->end(), find_candidate_better);
+                continue;
+            }
+            if (!find_candidate_better(c, heap->front()))
+                continue;
+            std::pop_heap(heap->begin(), heap->end(), find_candidate_better);
+            heap->back() = c;
+            std::push_heap(heap->begin(), heap->end(), find_candidate_better);
+        }
+    }
+    std::sort_heap(heap->begin(), heap->end(), find_candidate_better);
+}
+
+/*f find_merge_batch
+ * Merge a batch of candidates into the best max_elements found so far
+ */
+static void find_merge_batch(int max_elements, std::vector<t_xy_value_place> *batch, std::vector<t_xy_value_place> *found)
+{
+    std::vector<t_xy_value_place> merged(found->size()+batch->size());
+    std::sort(batch->begin(), batch->end(), find_candidate_better);
+    std::merge(found->begin(), found->end(), batch->begin(), batch->end(), merged.begin(), find_candidate_better);
+    if ((int)merged.size()>max_elements) merged.resize(max_elements);
+    found->swap(merged);
+    batch->clear();
+}
+
+/*f find_batch_merge
+ * Select candidates of all the bands in scan order, in batches of
+ * FIND_BATCH_SIZE merged into the best found so far; a candidate is
+ * taken only if it exceeds the worst kept after the previous batch.
+ *
+ * This is the selection the find filter has always made; the banded
+ * scan matches it except when the values tie at the cut-off
+ */
+static void find_batch_merge(const t_find_scan *scan, std::vector<t_xy_value_place> *found)
+{
+    std::vector<t_xy_value_place> batch;
+    std::vector<float> buffer;
+    float threshold;
+
+    found->clear();
+    batch.reserve(FIND_BATCH_SIZE);
+    threshold = scan->minimum;
+    for (int b=0; b<scan->num_bands; b++) {
+        int y0 = find_band_y(scan, b);
+        int y1 = find_band_y(scan, b+1);
+        const float *rows = (*scan->rows_fn)(y0, y1, &buffer);
+        for (int y=y0; y<y1; y++) {
+            const float *row = rows + (y-y0)*scan->w*4;
+            for (int x=scan->x0; x<scan->x1; x++) {
+                t_xy_value_place c;
+                c.value = row[x*4+0];
+                if (!(c.value>threshold))
+                    continue;
+                find_candidate(scan, row, x, y, &c);
+                batch.push_back(c);
+                if ((int)batch.size()<FIND_BATCH_SIZE)
+                    continue;
+                find_merge_batch(scan->max_elements, &batch, found);
+                threshold = found->back().value;
+            }
+        }
+    }
+    if (batch.size()>0)
+        find_merge_batch(scan->max_elements, &batch, found);
+}
+
+/*f find_select_points
+ * Scan bands of rows on the thread pool, and merge their best; see the
+ * timings below
+ */
+int find_select_points(const t_find_rows_fn &rows_fn, int w, int x0, int x1, int y0, int y1,
+                       double minimum, int max_elements, t_point_value *points)
+{
+    t_find_scan scan;
+    int n;
+
+    if (max_elements<0) max_elements=0;
+    scan.rows_fn = &rows_fn;
+    scan.w = w;
+    scan.x0 = x0;
+    scan.x1 = x1;
+    scan.y0 = y0;
+    scan.rows = y1-y0;
+    scan.minimum = -1.0;
+    if (scan.minimum<minimum) scan.minimum=minimum;
+    scan.threshold = scan.minimum;
+    scan.threshold_place = -1;
+    scan.max_elements = max_elements;
+
+    int num_bands = thread_pool_default()->num_threads*4;
+    if (num_bands>scan.rows) num_bands=scan.rows;
+    if ((x1<=x0) || (scan.rows<=0) || (max_elements==0)) num_bands=0;
+    scan.num_bands = num_bands;
+
+    std::vector<t_find_band> bands(num_bands);
+    thread_pool_default()->parallel_for(num_bands, 1, [&](int b0, int b1) {
+            for (int b=b0; b<b1; b++) {
+                bands[b].num_candidates = 0;
+                find_band_top_k(&scan, b, &bands[b].best, &bands[b]);
+            }
+        });
+
+    // With more than a batch of candidates, later candidates are only
+    // taken if better than the worst kept from the first batch
+    int num_candidates = 0;
+    for (int b=0; b<num_bands; b++) {
+        num_candidates += bands[b].num_candidates;
+    }
+    if (num_candidates>FIND_BATCH_SIZE) {
+        std::vector<t_xy_value_place> first_batch;
+        for (int b=0; (b<num_bands) && ((int)first_batch.size()<FIND_BATCH_SIZE); b++) {
+            for (auto c : bands[b].first) {
+                if ((int)first_batch.size()>=FIND_BATCH_SIZE) break;
+                first_batch.push_back(c);
+            }
+        }
+        int k = (max_elements<FIND_BATCH_SIZE) ? max_elements : FIND_BATCH_SIZE;
+        scan.threshold_place = first_batch.back().place;
+        std::nth_element(first_batch.begin(), first_batch.begin()+k-1, first_batch.end(), find_candidate_better);
+        scan.threshold = first_batch[k-1].value;
+
+        // A band that dropped candidates may have dropped ones still
+        // wanted, so it is rescanned if any it kept is now not wanted
+        std::vector<int> rescan;
+        for (int b=0; b<num_bands; b++) {
+            std::vector<t_xy_value_place> &best = bands[b].best;
+            bool full = ((int)best.size()==max_elements);
+            auto end = std::remove_if(best.begin(), best.end(), [&](const t_xy_value_place &c) { return !find_scan_accepts(&scan, c); });
+            if (end==best.end())
+                continue;
+            best.erase(end, best.end());
+            if (full) rescan.push_back(b);
+        }
+        thread_pool_default()->parallel_for((int)rescan.size(), 1, [&](int i0, int i1) {
+                for (int i=i0; i<i1; i++) {
+                    find_band_top_k(&scan, rescan[i], &bands[rescan[i]].best, NULL);
+                }
+            });
+    }
+
+    // k-way merge of the bands, each of which is already in order
+    std::vector<t_xy_value_place> found;
+    std::vector<int> heads(num_bands, 0);
+    while ((int)found.size()<max_elements) {
+        int best = -1;
+        for (int b=0; b<num_bands; b++) {
+            if (heads[b]>=(int)bands[b].best.size())
+                continue;
+            if ((best<0) || find_candidate_better(bands[b].best[heads[b]], bands[best].best[heads[best]]))
+                best = b;
+        }
+        if (best<0)
+            break;
+        found.push_back(bands[best].best[heads[best]++]);
+    }
+
+    // Which of the candidates tied at the cut-off are kept depends on
+    // the batches, so if there are such ties then select in batches
+    if ((num_candidates>FIND_BATCH_SIZE) && ((int)found.size()==max_elements)) {
+        float cut_off = found.back().value;
+        bool tied = (max_elements>1) && (found[max_elements-2].value==cut_off);
+        for (int b=0; (b<num_bands) && !tied; b++) {
+            const std::vector<t_xy_value_place> &best = bands[b].best;
+            if ((heads[b]<(int)best.size()) && (best[heads[b]].value==cut_off)) tied = true;
+            if (((int)best.size()==max_elements) && (best.back().value==cut_off)) tied = true;
+        }
+        if (tied) {
+            scan.threshold = scan.minimum;
+            scan.threshold_place = -1;
+            find_batch_merge(&scan, &found);
+        }
+    }
+
+    for (n=0; n<(int)found.size(); n++) {
+        const t_xy_value_place &c = found[n];
+        memset(&points[n], 0, sizeof(t_point_value));
+        points[n].x     = c.x;
+        points[n].y     = c.y;
+        points[n].value = c.value;
+        points[n].vec_x = c.vec_x;
+        points[n].vec_y = c.vec_y;
+    }
+    return n;
+}
+
+/*f find_suppress_near_points
+ * Keep each point, strongest first, only if no point already kept is
+ * within min_distance of it; return the number kept, which are moved
+ * to the start of the array in order.
+ *
+ * Kept points are chained in a grid of cells of grid_cell_size (the
+ * min_distance if 0), so only the cells within min_distance of a
+ * point need checking.
+ */
+int find_suppress_near_points(t_point_value *points, int n, int w, int h, double min_distance, double grid_cell_size)
+{
+    float min_distance_sq;
+    double cell_size;
+    int grid_w, grid_h, reach;
+    int num_kept;
+
+    min_distance_sq = min_distance * min_distance;
+    if ((n<2) || (min_distance_sq<=0))
+        return n;
+
+    cell_size = (grid_cell_size>0) ? grid_cell_size : fabs(min_distance);
+    if (cell_size<1.0) cell_size=1.0;
+    grid_w = (int)(w/cell_size)+1;
+    grid_h = (int)(h/cell_size)+1;
+    reach  = (int)ceil(fabs(min_distance)/cell_size);
+
+    std::vector<int> cell_head(grid_w*grid_h, -1);
+    std::vector<int> next_in_cell(n, -1);
+    num_kept = 0;
+    for (int i=0; i<n; i++) {
+        int cx, cy, keep;
+        cx = (int)(points[i].x/cell_size);
+        cy = (int)(points[i].y/cell_size);
+        if (cx<0) cx=0;
+        if (cy<0) cy=0;
+        if (cx>=grid_w) cx=grid_w-1;
+        if (cy>=grid_h) cy=grid_h-1;
+        keep = 1;
+        for (int gy=cy-reach; keep && (gy<=cy+reach); gy++) {
+            if ((gy<0) || (gy>=grid_h)) continue;
+            for (int gx=cx-reach; keep && (gx<=cx+reach); gx++) {
+                if ((gx<0) || (gx>=grid_w)) continue;
+                for (int k=cell_head[gy*grid_w+gx]; k>=0; k=next_in_cell[k]) {
+                    float dx, dy, d_sq;
+                    dx = points[i].x-points[k].x;
+                    dy = points[i].y-points[k].y;
+                    d_sq = dx*dx+dy*dy;
+                    if (d_sq<=min_distance_sq) {
+                        keep = 0;
+                        break;
+                    }
+                }
+            }
+        }
+        if (!keep)
+            continue;
+        points[num_kept] = points[i];
+        next_in_cell[num_kept] = cell_head[cy*grid_w+cx];
+        cell_head[cy*grid_w+cx] = num_kept;
+        num_kept++;
+    }
+    return num_kept;
 }
 
 /* timings
@@ -794,166 +1546,63 @@ Intel HD graphics).
 
 That is about 3.5 seconds, half of which is in the GPU fetch, out of a full run-time of python_test of 12.3 seconds
 
-
+The batch qsort and merge has since been replaced by a bounded heap
+per band of rows, with the bands scanned on the thread pool and then
+merged; the order is the same (value, then later scan position, first).
+Once there is more than a batch of candidates the batches only take
+candidates better than the worst kept from the first batch, so the
+bands are filtered (and rescanned if need be) the same way. Only if
+values tie at the cut-off does the selection depend on the later
+batches; then the batch qsort and merge is run instead.
+
+The GPU fetch is now a pixel buffer readback started by
+do_execute_start; a pipeline issues the next filter before completing
+this one, so the fetch overlaps that filter's drawing.
  */
-int c_filter_find::do_execute(t_exec_context *ec)
+int c_filter_find::do_execute_complete(t_exec_context *ec)
 {
     t_texture *texture;
     const t_texture_header *texture_hdr;
     float *raw_img;
-    float elements_minimum;
     int   n;
     int w, h;
-    
-    int num_new_points = 0;
-    int x, y;
-    int done;
 
-    static const int max_new_points = 1024;
-    static t_xy_value_place *new_points=NULL;
-    if (new_points==NULL) {
-        new_points = (t_xy_value_place *)malloc(sizeof(t_xy_value_place)*max_new_points);
-    }
+    texture = readback_texture;
+    if (!texture)
+        return 0;
+    readback_texture = NULL;
 
     SL_TIMER_ENTRY(timers[filter_timer_execute]);
 
     SL_TIMER_ENTRY(timers[filter_timer_compile]);
     set_parameters_from_map(parameter_defns, (void *)&parameters);
 
-
-    texture = bound_texture(ec, 0);
-
     texture_hdr = texture_header(texture);
     raw_img = (float *)texture_get_buffer(texture, GL_RGBA);
     w = texture_hdr->width;
     h = texture_hdr->height;
 
     SL_TIMER_EXIT(timers[filter_timer_compile]);
-
-    elements_minimum = -1.0;
+    if (!raw_img) {
+        SL_TIMER_EXIT(timers[filter_timer_execute]);
+        return 1;
+    }
 
     SL_TIMER_ENTRY(timers[filter_timer_internal_1]);
 
-    if (elements_minimum<parameters.minimum) elements_minimum=parameters.minimum;
-    n=0;
-    points   = (t_point_value *)malloc(sizeof(t_point_value)*parameters.max_elements);
-
-    y=parameters.perimeter;
-    x=parameters.perimeter;
-    done = 0;
-    while (!done) {
-        float value_xy;
-        value_xy = raw_img[(y*w+x)*4+0];
-        if (value_xy>elements_minimum) {
-            new_points[num_new_points].x     = x;
-            new_points[num_new_points].y     = y;
-            new_points[num_new_points].value = value_xy;
-            num_new_points++;
-        }
-        x++;
-        if (x>=w-parameters.perimeter) {
-            x = parameters.perimeter;
-            y++;
-            if (y>=h-parameters.perimeter) {
-                done = 1;
-            }
-        }
-        if ((!done) && (num_new_points<max_new_points))
-            continue;
-
-        if (num_new_points==0)
-            continue;
-        if (num_new_points>1) {
-            qsort(new_points, num_new_points, sizeof(t_xy_value_place), cmp_xy_value_place);
-        }
-
-        int i, j;
-        j=0;
-        for (i=0; (i<n) && (j<num_new_points);) {
-            if (points[i].value > new_points[j].value) {
-                i++;
-                continue;
-            }
-            if (i+j>=parameters.max_elements) break;
-            new_points[j].place = i+j;
-            j++;
-        }
+    int max_elements = parameters.max_elements;
+    if (max_elements<0) max_elements=0;
+    points   = (t_point_value *)malloc(sizeof(t_point_value)*(max_elements+1));
 
-        while ((j<num_new_points) && (n+j<parameters.max_elements)) {
-            new_points[j].place = n+j;
-            j++;
-        }
-        // At this point, h_points[0 .. j-1].place is the index that h_points must end up at
-        // So look at h_points[j-1]  = k1. Move elements k1-j .. n-1 down by j, and set element k from h_points[j-1]
-        // Now look at h_points[j-2] = k2. Move elements k2 .. k1-1 down by j-1, and set element k2 from h_points[j-2]
-        // Hence track 'bottom of range'=l, starting at l=n-j, and start with j=j-1
-        // while j>=0:
-        //   k = h_points[j].place
-        //   move elements k-j..l-1 inclusive down by j+1
-        //   set element[k] from h_points[j]
-        //   j--, l=k
-        // In visual: h_points = 2, 6 (CG); n=12 (ABDEFHIJKLMN); j=2; l=12-2=10; j=j-1=11
-        // j=1, k=6, ABDEFHIJKLMN -> ABDEF__HIJKL -> ABDEF_GHIJKL, l=k, j=j-1=0
-        //    move 5=k-j to 10=l (inc to exc) down by 2=j+1, set [6=k] = G, l=k-j=5, j=j-1=0
-        // j=0, k=2, ABDEF_GHIJKLMN -> AB_DEFGHIJKL -> ABCDEFGHIJKL
-        //    move 2=k-j to 5=l (inc to exc) down by 1=j+1, set [2=k] = C
-        // if we don't start full (i.e. n<parameters.max_elements) then start
-        // with l = min(n, parameters.max_elements-j)
-        // in the above if we had started with n=8 and max of 12, then l=8
-        // in the above if we had started with n=9 and max of 12, then l=9
-        // in the above if we had started with n=10 and max of 12, then l=10
-        // in the above if we had started with n=11 and max of 12, then l=10
-        int l = parameters.max_elements-j;
-        if (l>n) l=n;
-        n = l+j;
-        j--;
-        while (j>=0) {
-            int k = new_points[j].place;
-            if (k-j < l) {
-                memmove(&points[k+1], &points[k-j], sizeof(t_point_value)*(l-(k-j)));
-            }
-            int px = new_points[j].x;
-            int py = new_points[j].y;
-            points[k].x     = px;
-            points[k].y     = py;
-            points[k].value = new_points[j].value;
-            points[k].vec_x = raw_img[(py*w+px)*4+1];
-            points[k].vec_y = raw_img[(py*w+px)*4+2];
-            l=k-j;
-            j--;
-         }
-
-         elements_minimum = points[n-1].value;
-         if (0) {
-             fprintf(stderr,"%d:Merging %d points, total %d so far %f %f\n",y,num_new_points,n,
-                     new_points[0].value, new_points[1].value);
-         }
-         num_new_points = 0;
-    }
+    n = find_select_points([raw_img, w](int y0, int y1, std::vector<float> *buffer) { return raw_img+y0*w*4; },
+                           w, parameters.perimeter, w-parameters.perimeter,
+                           parameters.perimeter, h-parameters.perimeter,
+                           parameters.minimum, max_elements, points);
 
     SL_TIMER_EXIT(timers[filter_timer_internal_1]);
     SL_TIMER_ENTRY(timers[filter_timer_internal_2]);
 
-    float min_distance_sq;
-    min_distance_sq = parameters.min_distance * parameters.min_distance;
-    for (int i=0; i<n; i++) {
-        int j;
-        j = i+1;
-        while (j<n) {
-            float dx, dy, d_sq;
-            dx = points[i].x-points[j].x;
-            dy = points[i].y-points[j].y;
-            d_sq = dx*dx+dy*dy;
-            if (d_sq>min_distance_sq) {
-                j++;
-                continue;
-            }
-            n--;
-            if (j<n) {
-                memmove(&points[j], &points[j+1], sizeof(t_point_value)*(n-j));
-            }
-        }
-    }
+    n = find_suppress_near_points(points, n, w, h, parameters.min_distance, parameters.grid_cell_size);
     SL_TIMER_EXIT(timers[filter_timer_internal_2]);
 
     if (0) {
@@ -1005,10 +1654,23 @@ filter_from_string(const char *optarg)
     textures.len         = parameter_string.ptr-textures.ptr-1;
     parameter_string.len = strlen(parameter_string.ptr);
     if (!strncmp(filter_type.ptr, "glsl", 4)) {
+        if (filter_backend==filter_backend_cpu) {
+            if (!filter_cpu_has_kernel(&filename)) {
+                fprintf(stderr, "Failed to create filter '%s' - no CPU kernel for it\n", optarg);
+                return NULL;
+            }
+            return filter_cpu_create(&filename, &textures, &parameter_string);
+        }
         return new c_filter_glsl(&filename, &textures, &parameter_string);
+    } else if (!strncmp(filter_type.ptr, "cpu", 3)) {
+        return filter_cpu_create(&filename, &textures, &parameter_string);
     } else if (!strncmp(filter_type.ptr, "find", 4)) {
         return new c_filter_find(&filename, &textures, &parameter_string);
     } else if (!strncmp(filter_type.ptr, "corr", 4)) {
+        if (filter_backend==filter_backend_cpu) {
+            fprintf(stderr, "Failed to create filter '%s' - no CPU kernel for it\n", optarg);
+            return NULL;
+        }
         return new c_filter_correlate(&filename, &textures, &parameter_string);
     } else if (!strncmp(filter_type.ptr, "save", 4)) {
         return new c_filter_save(&filename, &textures, &parameter_string);
@@ -1017,3 +1679,11 @@ filter_from_string(const char *optarg)
     return NULL;
 }
 
+/*f filter_set_backend
+ */
+void
+filter_set_backend(t_filter_backend backend)
+{
+    filter_backend = backend;
+}
+
@@ -28,14 +28,17 @@
 #include "timer.h"
 #include "texture.h"
 #include "shader.h"
+#include <functional>
 #include <map>
 #include <string>
+#include <vector>
 
 /*a Defines
  */
 #define MAX_FILTER_TEXTURES 8
 #define MAX_FILTER_PROJECTIONS 2
 #define MAX_FILTER_TIMERS 8
+#define MAX_EC_TEXTURES 16
 typedef enum
 {
     filter_timer_compile,
@@ -46,6 +49,14 @@ typedef enum
 
 /*a Types
  */
+/*t t_filter_backend
+ */
+typedef enum
+{
+    filter_backend_gl,
+    filter_backend_cpu,
+} t_filter_backend;
+
 /*t t_len_string
  */
 typedef struct
@@ -66,11 +77,18 @@ typedef struct
     int extra[4];
 } t_point_value;
 
+/*t t_find_rows_fn
+  Return rows y0 to y1-1 of an RGBA float image of the width given to
+  find_select_points (value in r, vector in g and b); the rows may be
+  computed into buffer. Called from the default thread pool
+ */
+typedef std::function<const float *(int y0, int y1, std::vector<float> *buffer)> t_find_rows_fn;
+
 /*t t_exec_context
  */
 typedef struct
 {
-    t_texture_ptr textures[16];
+    t_texture_ptr textures[MAX_EC_TEXTURES];
     t_point_value *points;
     int num_points;
     int use_ids;
@@ -94,30 +112,66 @@ enum {
 };
 
 /*t t_filter_parameter
+ * The string is owned by the parameter (string_size bytes are
+ * allocated), and is reused while a new value fits. The uniform slot
+ * of the parameter is cached, and is valid if uniform_plan matches the
+ * filter's current plan
  */
 typedef struct
 {
     int valid_values;
     const char *string;
+    int string_size;
     double real;
     int integer;
     GLint gl_id;
+    int uniform_plan;
+    int uniform_slot;
 } t_filter_parameter;
 
+/*t t_filter_uniform
+ * One slot of a filter's uniform binding plan, built from the linked
+ * program's active uniforms at compile time
+ */
+#define MAX_FILTER_UNIFORM_VALUES 16
+typedef struct
+{
+    char name[64];
+    GLenum type;     // GL_FLOAT, GL_FLOAT_VEC2, GL_INT, GL_UNSIGNED_INT, GL_FLOAT_MAT4, ...
+    GLint location;
+    int num_values;  // Components of the type (e.g. 2 for vec2, 16 for mat4)
+    int is_float;    // Values are held as floats, else as ints (uints reinterpreted)
+    int valid;       // A value has been set, so the uniform is uploaded
+    int dirty;       // The value has changed since it was last uploaded
+    union {
+        float f[MAX_FILTER_UNIFORM_VALUES];
+        GLint i[MAX_FILTER_UNIFORM_VALUES];
+    } value;
+} t_filter_uniform;
+
 /*t c_filter
  */
 class c_filter
 {
 private:
     virtual int do_compile(void) {return 0;};
+    virtual int do_compile_start(void) {return do_compile();};
+    virtual int do_compile_complete(void) {return 0;};
     virtual int do_execute(t_exec_context *ec) {return 0;};
+    virtual int do_execute_start(t_exec_context *ec) {return do_execute(ec);};
+    virtual int do_execute_complete(t_exec_context *ec) {return 0;};
 
     std::map <std::string, t_filter_parameter> *parameter_map;
+    t_filter_uniform *uniforms;
+    int num_uniforms;
+    int uniform_plan; // Incremented when the plan is built; 0 if it never has been
 
     void get_parameter_value(t_filter_parameter *fp);
     void set_parameter(t_filter_parameter *fp, double value);
     void set_parameter(t_filter_parameter *fp, int value);
     void set_parameter(t_filter_parameter *fp, const char *value);
+    void uniform_from_parameter(int slot, t_filter_parameter *fp);
+    int parameter_uniform_slot(const char *name, t_filter_parameter *fp);
 
     int read_int_list(t_len_string *string, int *ints, int max_ints);
 
@@ -125,24 +179,43 @@ protected:
     void set_parameters_from_map(struct t_parameter_def *parameter_defns, void *parameters);
     void set_filename(const char *dirname, const char *suffix, t_len_string *filename, char **filter_filename);
     void get_shader_defines(char **shader_defines);
-    int  get_shader_uniform_ids(void);
+    int  build_uniform_plan(void);
     int  get_texture_uniform_ids(int num_dest);
     int set_texture_uniforms(t_exec_context *ec, int num_dest);
     int  set_shader_uniforms(void);
+    const char *get_define(const char *name);
+    int get_parameter_real(const char *name, double *value);
 
 public:
     c_filter(t_len_string *textures, t_len_string *parameters);
     virtual ~c_filter();
-    int compile(void) {return this->do_compile();};
+    int compile(void) {return this->do_compile_start() || this->do_compile_complete();};
+    // compile_start issues any shader compiles; compile_complete must follow. Starting
+    // every filter before completing any lets the driver compile shaders in parallel.
+    int compile_start(void) {return this->do_compile_start();};
+    int compile_complete(void) {return this->do_compile_complete();};
     int execute(t_exec_context *ec) {return this->do_execute(ec);};
+    // execute_start issues the filter's work; execute_complete must follow, after which
+    // its results are available. Other filters may be started in between, so that a
+    // texture readback can overlap the next filter's drawing.
+    int execute_start(t_exec_context *ec) {return this->do_execute_start(ec);};
+    int execute_complete(t_exec_context *ec) {return this->do_execute_complete(ec);};
 
-    int uniform_set(const char *uniform, float value); // used in batch, needs to be replaced with set_parameter
+    int uniform_set(const char *uniform, float value); // as set_parameter
 
     int set_parameter(const char *name, double value);
     int set_parameter(const char *name, int value);
     int set_parameter(const char *name, const char *value);
+    int set_parameter(const char *name, const float *values, int num_values);
     int unset_parameter(const char *name);
 
+    // After compile: a uniform's slot in the binding plan (or -1), and setting
+    // it by slot, which stores the values and marks them for upload on execute
+    int uniform_slot(const char *name);
+    int set_uniform(int slot, const float *values, int num_values);
+    int set_uniform(int slot, const GLint *values, int num_values);
+    int set_uniform(int slot, float value) {return set_uniform(slot, &value, 1);};
+
     const char *parse_error;
     GLuint filter_pid;
 
@@ -151,6 +224,7 @@ public:
     t_texture_ptr bound_texture(t_exec_context *ec, int n);
 
     int num_textures;
+    int num_dest_textures; // the last num_dest_textures of textures[] are written, the rest are read
     t_filter_texture textures[MAX_FILTER_TEXTURES];
     int num_projections;
     class c_lens_projection *projections[MAX_FILTER_PROJECTIONS];
@@ -167,6 +241,31 @@ public:
 c_filter *
 filter_from_string(const char *optarg);
 
+/*f find_select_points
+  Select points from columns x0 to x1-1 of rows y0 to y1-1 exactly as
+  the find filter does before removing near points: up to max_elements
+  that exceed minimum, best first. Return the number selected; it must
+  not be called from within a thread pool chunk
+ */
+extern int
+find_select_points(const t_find_rows_fn &rows_fn, int w, int x0, int x1, int y0, int y1,
+                   double minimum, int max_elements, t_point_value *points);
+
+/*f find_suppress_near_points
+  Keep points (in order, strongest first) that are not within
+  min_distance of a stronger point kept, as the find filter does;
+  return the number kept, moved to the start of the array
+ */
+extern int
+find_suppress_near_points(t_point_value *points, int n, int w, int h, double min_distance, double grid_cell_size);
+
+/*f filter_set_backend
+  With filter_backend_cpu, 'glsl' filter strings create CPU filters
+  (as for the 'cpu' filter type), so no OpenGL context is required
+ */
+extern void
+filter_set_backend(t_filter_backend backend);
+
 /*a Wrapper
  */
 #endif
@@ -0,0 +1,1550 @@
+/*a Documentation
+  CPU versions of the GLSL filters used for matching, so that a filter
+  pipeline can run on host textures without an OpenGL context.
+
+  Each kernel computes what the fragment shader in shaders/ computes,
+  for every pixel of the destination texture, with the same '-D'
+  defines and uniforms. Texture sampling is as for the GL textures:
+  bilinear, clamped to a zero border, and texelFetch outside the
+  texture returns zero. STEP is a 1024th as in base_functions.glsl.
+
+  Rows of the destination are split across the default thread pool.
+
+  filter_cpu_match_corners does what a loop of circle_dft_diff (four
+  times per corner), circle_dft_diff_combine and find does, for a list
+  of corners: each band of rows find_select_points scans computes just
+  the four descriptor differences that band needs, so no full-texture
+  pass or readback is made per corner, and the points selected are
+  those find selects from circle_dft_diff_combine's output.
+ */
+/*a Includes
+ */
+#include <OpenGL/gl3.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "filter_cpu.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <vector>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/*a Defines
+ */
+#define STEP (1.0f/1024)
+#define MAX_CPU_SOURCES 4
+#define MAX_CPU_OFFSETS 81
+#define CPU_ROWS_PER_CHUNK 8
+#define CPU_GAUSS_BLOCK 64
+#define CPU_HARRIS_TILE 64
+#define CPU_DFT_ROWS 32
+#define CPU_DFT_GROUP 8
+#define CPU_MATCH_REACH 4 // Largest component of a discrete circle offset
+#define CPU_MATCH_OFFSETS_MAX 32
+
+/*a Types
+ */
+/*t t_cpu_image
+ */
+typedef struct
+{
+    int width;
+    int height;
+    const float *data;
+} t_cpu_image;
+
+/*t t_cpu_kernel_defines
+ * Values of the shader defines the kernels use, set at compile time
+ */
+typedef struct
+{
+    float intensity_xscale;
+    float intensity_xofs;
+    float intensity_yscale;
+    float intensity_yofs;
+    int   num_offsets;
+    float offsets[MAX_CPU_OFFSETS][2]; // in texels
+    int   offset_extent;               // largest texel offset used
+    float circle_radius;               // in texels
+    int   circle_component;
+    int   x_not_y;
+    int   num_weights;
+    const float (*weights)[2];         // texel offset, weight
+    int   num_discrete_offsets;
+    const int (*discrete_offsets)[2];
+} t_cpu_kernel_defines;
+
+/*t t_cpu_kernel_args
+ */
+typedef struct
+{
+    const t_cpu_kernel_defines *defines;
+    t_cpu_image src[MAX_CPU_SOURCES];
+    int   width;
+    int   height;
+    float *dst;
+    float uv_base_x;
+    float uv_base_y;
+} t_cpu_kernel_args;
+
+/*t t_cpu_kernel_fn
+ * Fill rows y0 to y1-1 of the destination
+ */
+typedef void (*t_cpu_kernel_fn)(const t_cpu_kernel_args *args, int y0, int y1);
+
+/*t t_cpu_kernel
+ */
+typedef enum
+{
+    cpu_kernel_yuv_from_rgb,
+    cpu_kernel_gauss,
+    cpu_kernel_harris,
+    cpu_kernel_circle_dft,
+    cpu_kernel_circle_dft_diff,
+    cpu_kernel_circle_dft_diff_combine,
+} t_cpu_kernel;
+
+/*t t_cpu_kernel_def
+ */
+typedef struct
+{
+    const char *name;
+    t_cpu_kernel kernel;
+    int num_src;
+    int rows_per_chunk;
+    t_cpu_kernel_fn fn;
+} t_cpu_kernel_def;
+
+/*t c_filter_cpu
+ */
+class c_filter_cpu : public c_filter
+{
+    int define_real(const char *name, float *value, int required);
+    int define_int(const char *name, int *value, int required);
+    int compile_offsets(void);
+    int compile_weights(void);
+    int compile_circle(void);
+    int compile_discrete_offsets(void);
+public:
+    c_filter_cpu(const t_cpu_kernel_def *kernel_def, t_len_string *textures, t_len_string *parameter_string);
+    ~c_filter_cpu();
+    const t_cpu_kernel_def *kernel_def;
+    t_cpu_kernel_defines defines;
+
+    virtual int do_compile(void);
+    virtual int do_execute(t_exec_context *ec);
+};
+
+/*a Shader constants
+ */
+/*v circle_offsets_8 - as base_functions.glsl, without STEP*CIRCLE_RADIUS
+ */
+static const float circle_offsets_8[8][2] = {
+    {1.0f, 0.0f},
+    {0.980785280447f, 0.195090321796f},
+    {0.923879532683f, 0.382683431951f},
+    {0.831469612676f, 0.55557023246f},
+    {0.707106781821f, 0.707106780552f},
+    {0.555570233952f, 0.831469611679f},
+    {0.382683433609f, 0.923879531996f},
+    {0.195090323556f, 0.980785280097f},
+};
+
+/*v gauss_offset_weights9 - as base_functions.glsl, offsets in texels
+ */
+static const float gauss_offset_weights9[9][2] = {
+    {-4, 0.000229f},
+    {-3, 0.005977f},
+    {-2, 0.060598f},
+    {-1, 0.241732f},
+    { 0, 0.382928f},
+    { 1, 0.241732f},
+    { 2, 0.060598f},
+    { 3, 0.005977f},
+    { 4, 0.000229f},
+};
+
+/*v discrete_circle_offsets_4_32 - as circle_dft_diff_combine.glsl
+ */
+static const int discrete_circle_offsets_4_32[32][2] = {
+    {4,0},   {4,1},   {4,2},   {3,2},   {3,3},   {2,3},   {2,4},   {1,4},
+    {0,4},   {-1,4},  {-2,4},  {-2,3},  {-3,3},  {-3,2},  {-4,2},  {-4,1},
+    {-4,0},  {-4,-1}, {-4,-2}, {-3,-2}, {-3,-3}, {-2,-3}, {-2,-4}, {-1,-4},
+    {0,-4},  {1,-4},  {2,-4},  {2,-3},  {3,-3},  {3,-2},  {4,-2},  {4,-1},
+};
+
+/*v discrete_circle_offsets_4_16 - as circle_dft_diff_combine.glsl
+ */
+static const int discrete_circle_offsets_4_16[16][2] = {
+    {4,0},  {4,2},   {3,3},   {2,4},
+    {0,4},  {-2,4},  {-3,3},  {-4,2},
+    {-4,0}, {-4,-2}, {-3,-3}, {-2,-4},
+    {0,-4}, {2,-4},  {3,-3},  {4,-2},
+};
+
+/*a SIMD
+ * A t_cpu_vec4 holds one RGBA texel
+ */
+#if defined(__SSE__)
+/*t t_cpu_vec4
+ */
+typedef __m128 t_cpu_vec4;
+
+/*f cpu_vec4_zero
+ */
+static inline t_cpu_vec4 cpu_vec4_zero(void) { return _mm_setzero_ps(); }
+
+/*f cpu_vec4_set1
+ */
+static inline t_cpu_vec4 cpu_vec4_set1(float f) { return _mm_set1_ps(f); }
+
+/*f cpu_vec4_load
+ */
+static inline t_cpu_vec4 cpu_vec4_load(const float *f) { return _mm_loadu_ps(f); }
+
+/*f cpu_vec4_store
+ */
+static inline void cpu_vec4_store(float *f, t_cpu_vec4 v) { _mm_storeu_ps(f, v); }
+
+/*f cpu_vec4_madd - acc + v*w
+ */
+static inline t_cpu_vec4 cpu_vec4_madd(t_cpu_vec4 acc, t_cpu_vec4 v, float w)
+{
+    return _mm_add_ps(acc, _mm_mul_ps(v, _mm_set1_ps(w)));
+}
+
+/*f cpu_vec4_add
+ */
+static inline t_cpu_vec4 cpu_vec4_add(t_cpu_vec4 a, t_cpu_vec4 b) { return _mm_add_ps(a, b); }
+
+/*f cpu_vec4_sub
+ */
+static inline t_cpu_vec4 cpu_vec4_sub(t_cpu_vec4 a, t_cpu_vec4 b) { return _mm_sub_ps(a, b); }
+
+/*f cpu_vec4_mul
+ */
+static inline t_cpu_vec4 cpu_vec4_mul(t_cpu_vec4 a, t_cpu_vec4 b) { return _mm_mul_ps(a, b); }
+#else
+/*t t_cpu_vec4
+ */
+typedef struct { float f[4]; } t_cpu_vec4;
+
+/*f cpu_vec4_zero
+ */
+static inline t_cpu_vec4 cpu_vec4_zero(void) { t_cpu_vec4 r = {{0,0,0,0}}; return r; }
+
+/*f cpu_vec4_set1
+ */
+static inline t_cpu_vec4 cpu_vec4_set1(float f) { t_cpu_vec4 r = {{f,f,f,f}}; return r; }
+
+/*f cpu_vec4_load
+ */
+static inline t_cpu_vec4 cpu_vec4_load(const float *f) { t_cpu_vec4 r; memcpy(r.f, f, sizeof(r.f)); return r; }
+
+/*f cpu_vec4_store
+ */
+static inline void cpu_vec4_store(float *f, t_cpu_vec4 v) { memcpy(f, v.f, sizeof(v.f)); }
+
+/*f cpu_vec4_madd - acc + v*w
+ */
+static inline t_cpu_vec4 cpu_vec4_madd(t_cpu_vec4 acc, t_cpu_vec4 v, float w)
+{
+    for (int i=0; i<4; i++) acc.f[i] += v.f[i]*w;
+    return acc;
+}
+
+/*f cpu_vec4_add
+ */
+static inline t_cpu_vec4 cpu_vec4_add(t_cpu_vec4 a, t_cpu_vec4 b)
+{
+    for (int i=0; i<4; i++) a.f[i] += b.f[i];
+    return a;
+}
+
+/*f cpu_vec4_sub
+ */
+static inline t_cpu_vec4 cpu_vec4_sub(t_cpu_vec4 a, t_cpu_vec4 b)
+{
+    for (int i=0; i<4; i++) a.f[i] -= b.f[i];
+    return a;
+}
+
+/*f cpu_vec4_mul
+ */
+static inline t_cpu_vec4 cpu_vec4_mul(t_cpu_vec4 a, t_cpu_vec4 b)
+{
+    for (int i=0; i<4; i++) a.f[i] *= b.f[i];
+    return a;
+}
+#endif
+
+/*a Sampling and shader function equivalents
+ */
+/*f cpu_texel - texelFetch, zero outside the texture
+ */
+static inline float
+cpu_texel(const t_cpu_image *img, int x, int y, int c)
+{
+    if ((x<0) || (y<0) || (x>=img->width) || (y>=img->height))
+        return 0.0f;
+    return img->data[(y*img->width+x)*4+c];
+}
+
+/*f cpu_texel_bits - texelFetch of a usampler2D, zero outside the texture
+ */
+static inline void
+cpu_texel_bits(const t_cpu_image *img, int x, int y, unsigned int bits[4])
+{
+    if ((x<0) || (y<0) || (x>=img->width) || (y>=img->height)) {
+        bits[0] = bits[1] = bits[2] = bits[3] = 0;
+        return;
+    }
+    memcpy(bits, &img->data[(y*img->width+x)*4], 4*sizeof(unsigned int));
+}
+
+/*f cpu_texture - bilinear texture() of one component, zero border
+ */
+static inline float
+cpu_texture(const t_cpu_image *img, float u, float v, int c)
+{
+    float tx, ty, fx, fy;
+    int x, y;
+    tx = u*img->width-0.5f;
+    ty = v*img->height-0.5f;
+    x = (int)floorf(tx);
+    y = (int)floorf(ty);
+    fx = tx-x;
+    fy = ty-y;
+    return ( (cpu_texel(img,x,y,  c)*(1-fx) + cpu_texel(img,x+1,y,  c)*fx)*(1-fy) +
+             (cpu_texel(img,x,y+1,c)*(1-fx) + cpu_texel(img,x+1,y+1,c)*fx)*fy );
+}
+
+/*f flt_angle
+ */
+static inline float
+flt_angle(float c, float s)
+{
+    float ac, as, angle;
+    ac = fabsf(c);
+    as = fabsf(s);
+    angle = (ac>as)?(as/ac):(2.0f-ac/as);
+    angle = (c<0)?4-angle:angle;
+    angle = (s<0)?8-angle:angle;
+    return angle;
+}
+
+/*f flt_angle_cs
+ */
+static inline void
+flt_angle_cs(float a, float cs[2])
+{
+    float a_i, a_f, ac2, ac, as, t;
+    int octant;
+    a_i = floorf(a);
+    octant = (int)a_i;
+    a_f = a - a_i;
+    a_f = ((octant&1)!=0) ? (1-a_f) : a_f;
+    ac2 = 1/(1+a_f*a_f);
+    as = sqrtf(1-ac2);
+    ac = sqrtf(ac2);
+    if ((octant&4)!=0) { as=-as; ac=-ac; }
+    cs[0] = ac; cs[1] = as;
+    if ((octant&1)!=0) { t=cs[0]; cs[0]=cs[1]; cs[1]=t; }
+    if ((octant&2)!=0) { t=cs[0]; cs[0]=-cs[1]; cs[1]=t; }
+}
+
+/*f flt_angle_diff
+ */
+static inline float
+flt_angle_diff(float a, float b)
+{
+    a = a-b;
+    return (a<0)?(a+8):a;
+}
+
+/*f flt_angle_diff_scale_abs
+ */
+static inline float
+flt_angle_diff_scale_abs(float a, float scale, float b)
+{
+    float r;
+    r = fabsf(a*scale-b);
+    r = (r>=32)?(r-32):r;
+    r = (r>=16)?(r-16):r;
+    r = (r>=8)?(r-8):r;
+    r = (r>=4)?(8-r):r;
+    return r;
+}
+
+/*f pack_power_angle
+ * A NaN angle (from a zero DFT term) packs as 0
+ */
+static inline unsigned int
+pack_power_angle(float power, float angle)
+{
+    unsigned int p, a;
+    if (power>=1.0f) {
+        p = (1<<24)-1;
+    } else {
+        p = (unsigned int)(power*4096*4096);
+    }
+    a = 0;
+    if (angle==angle) a = (unsigned int)(angle*(256/8));
+    return (p<<8)|(a&0xff);
+}
+
+/*f unpack_power_angle
+ */
+static inline void
+unpack_power_angle(unsigned int pa, float *power, float *angle)
+{
+    *angle = ((float)(pa&0xff))/32.0f;
+    *power = ((float)(pa>>8))/(4096.0f*4096.0f);
+}
+
+/*f power_diff
+ */
+static inline float
+power_diff(float p0, float p1)
+{
+    float pl, pu;
+    pl = p0; pu = p1;
+    if (p1<p0) { pl=p1; pu=p0; }
+    pu = (pu==0)?1:pu;
+    return (1+pu)/2*pl/pu;
+}
+
+/*f float_of_bits
+ */
+static inline float
+float_of_bits(unsigned int bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/*a Kernels
+ */
+/*f cpu_yuv_from_rgb - yuv_from_rgb.glsl
+ */
+static void
+cpu_yuv_from_rgb(const t_cpu_kernel_args *args, int y0, int y1)
+{
+    const t_cpu_kernel_defines *d = args->defines;
+    const t_cpu_image *src = &args->src[0];
+    for (int y=y0; y<y1; y++) {
+        float v = (y+0.5f)/args->height;
+        float tv = v*d->intensity_yscale+d->intensity_yofs;
+        float *out = args->dst + y*args->width*4;
+        for (int x=0; x<args->width; x++) {
+            float u = (x+0.5f)/args->width;
+            float tu = u*d->intensity_xscale+d->intensity_xofs;
+            float r = cpu_texture(src, tu, tv, 0);
+            float g = cpu_texture(src, tu, tv, 1);
+            float b = cpu_texture(src, tu, tv, 2);
+            out[x*4+0] = 0.299f*r + 0.587f*g + 0.114f*b;
+            out[x*4+1] = (-0.169f*r -0.331f*g + 0.499f*b)+0.5f;
+            out[x*4+2] = ( 0.499f*r -0.418f*g - 0.0813f*b)+0.5f;
+            out[x*4+3] = 0.0f; // shader output is a vec3
+        }
+    }
+}
+
+/*f cpu_gauss_bilinear
+ * Any size of texture - sample as the shader does
+ */
+static void
+cpu_gauss_bilinear(const t_cpu_kernel_args *args, int y0, int y1)
+{
+    const t_cpu_kernel_defines *d = args->defines;
+    const t_cpu_image *src = &args->src[0];
+    float mx = d->x_not_y ? STEP : 0.0f;
+    float my = d->x_not_y ? 0.0f : STEP;
+    for (int y=y0; y<y1; y++) {
+        float v = (y+0.5f)/args->height;
+        float *out = args->dst + y*args->width*4;
+        for (int x=0; x<args->width; x++) {
+            float u = (x+0.5f)/args->width;
+            for (int c=0; c<4; c++) {
+                float sum = 0.0f;
+                for (int i=0; i<d->num_weights; i++) {
+                    sum += d->weights[i][1] * cpu_texture(src,
+                                                          u+d->weights[i][0]*mx,
+                                                          v+d->weights[i][0]*my, c);
+                }
+                out[x*4+c] = sum;
+            }
+        }
+    }
+}
+
+/*f cpu_gauss - gauss.glsl
+ * When source and destination are 1024 texels in the blur direction,
+ * and the same size, every tap is a whole texel; each RGBA texel is
+ * then one vector. The column pass accumulates blocks of a row from
+ * each source row in turn, so it reads rows sequentially.
+ */
+static void
+cpu_gauss(const t_cpu_kernel_args *args, int y0, int y1)
+{
+    const t_cpu_kernel_defines *d = args->defines;
+    const t_cpu_image *src = &args->src[0];
+    int width = args->width;
+    int height = args->height;
+    if ((src->width!=width) || (src->height!=height) ||
+        ((d->x_not_y?width:height)!=1024)) {
+        cpu_gauss_bilinear(args, y0, y1);
+        return;
+    }
+    if (d->x_not_y) {
+        for (int y=y0; y<y1; y++) {
+            const float *in = src->data + y*width*4;
+            float *out = args->dst + y*width*4;
+            for (int x=0; x<width; x++) {
+                t_cpu_vec4 acc = cpu_vec4_zero();
+                for (int i=0; i<d->num_weights; i++) {
+                    int sx = x+(int)d->weights[i][0];
+                    if ((sx<0) || (sx>=width)) continue;
+                    acc = cpu_vec4_madd(acc, cpu_vec4_load(in+sx*4), d->weights[i][1]);
+                }
+                cpu_vec4_store(out+x*4, acc);
+            }
+        }
+        return;
+    }
+    for (int y=y0; y<y1; y++) {
+        float *out = args->dst + y*width*4;
+        for (int bx=0; bx<width; bx+=CPU_GAUSS_BLOCK) {
+            t_cpu_vec4 acc[CPU_GAUSS_BLOCK];
+            int n = width-bx;
+            if (n>CPU_GAUSS_BLOCK) n=CPU_GAUSS_BLOCK;
+            for (int x=0; x<n; x++) {
+                acc[x] = cpu_vec4_zero();
+            }
+            for (int i=0; i<d->num_weights; i++) {
+                int sy = y+(int)d->weights[i][0];
+                float w = d->weights[i][1];
+                if ((sy<0) || (sy>=height)) continue;
+                const float *in = src->data + (sy*width+bx)*4;
+                for (int x=0; x<n; x++) {
+                    acc[x] = cpu_vec4_madd(acc[x], cpu_vec4_load(in+x*4), w);
+                }
+            }
+            for (int x=0; x<n; x++) {
+                cpu_vec4_store(out+(bx+x)*4, acc[x]);
+            }
+        }
+    }
+}
+
+/*f cpu_harris_bilinear
+ * Any size of texture - gradients are sampled half a STEP either side
+ * of each offset, as the shader does
+ */
+static void
+cpu_harris_bilinear(const t_cpu_kernel_args *args, int y0, int y1)
+{
+    const t_cpu_kernel_defines *d = args->defines;
+    const t_cpu_image *src = &args->src[0];
+    for (int y=y0; y<y1; y++) {
+        float v = (y+0.5f)/args->height;
+        float *out = args->dst + y*args->width*4;
+        for (int x=0; x<args->width; x++) {
+            float u = (x+0.5f)/args->width;
+            float Ix2, Iy2, Ixy;
+            Ix2 = Iy2 = Ixy = 0.0f;
+            for (int i=0; i<d->num_offsets; i++) {
+                float su = u + d->offsets[i][0]*STEP;
+                float sv = v + d->offsets[i][1]*STEP;
+                float Ix = ( cpu_texture(src, su+STEP/2.0f, sv, 0) -
+                             cpu_texture(src, su-STEP/2.0f, sv, 0) );
+                float Iy = ( cpu_texture(src, su, sv+STEP/2.0f, 0) -
+                             cpu_texture(src, su, sv-STEP/2.0f, 0) );
+                Ix2 += Ix*Ix;
+                Iy2 += Iy*Iy;
+                Ixy += Ix*Iy;
+            }
+            float det = Ix2*Iy2-Ixy*Ixy;
+            out[x*4+0] = (det>0) ? sqrtf(sqrtf(det)) : 0.0f;
+            out[x*4+1] = 0.0f;
+            out[x*4+2] = 0.0f;
+            out[x*4+3] = 0.0f;
+        }
+    }
+}
+
+/*f cpu_harris - harris.glsl
+ * For a 1024x1024 source the same size as the destination the half
+ * STEP samples fall midway between texels, so the gradient at an
+ * offset is half the central difference of the texels either side.
+ *
+ * Rows y0 to y1 are done in tiles CPU_HARRIS_TILE wide. For each tile
+ * the intensity is copied with a halo of offset_extent+1 texels (zero
+ * outside the image), the gradient products are formed over the tile
+ * plus offset_extent, and then each offset adds a shifted row of the
+ * products in to the window sums.
+ */
+static void
+cpu_harris(const t_cpu_kernel_args *args, int y0, int y1)
+{
+    const t_cpu_kernel_defines *d = args->defines;
+    const t_cpu_image *src = &args->src[0];
+    int width = args->width;
+    if ((src->width!=width) || (src->height!=args->height) ||
+        (width!=1024) || (args->height!=1024)) {
+        cpu_harris_bilinear(args, y0, y1);
+        return;
+    }
+
+    int r  = d->offset_extent;
+    int pw = CPU_HARRIS_TILE+2*r;
+    int ph = (y1-y0)+2*r;
+    int iw = pw+2;
+    int ih = ph+2;
+    float *buffer = (float *)malloc(sizeof(float)*(iw*ih + 3*pw*ph + 3*CPU_HARRIS_TILE));
+    float *in  = buffer;      // texel (tx0-r-1+i, y0-r-1+j) at in[j*iw+i]
+    float *pxx = in+iw*ih;    // product at (tx0-r+i, y0-r+j) at p[j*pw+i]
+    float *pyy = pxx+pw*ph;
+    float *pxy = pyy+pw*ph;
+    float *sxx = pxy+pw*ph;
+    float *syy = sxx+CPU_HARRIS_TILE;
+    float *sxy = syy+CPU_HARRIS_TILE;
+    t_cpu_vec4 half = cpu_vec4_set1(0.5f);
+
+    for (int tx0=0; tx0<width; tx0+=CPU_HARRIS_TILE) {
+        int tw = width-tx0;
+        if (tw>CPU_HARRIS_TILE) tw=CPU_HARRIS_TILE;
+
+        for (int j=0; j<ih; j++) {
+            for (int i=0; i<iw; i++) {
+                in[j*iw+i] = cpu_texel(src, tx0-r-1+i, y0-r-1+j, 0);
+            }
+        }
+
+        for (int j=0; j<ph; j++) {
+            const float *c = in+(j+1)*iw+1;
+            float *xx = pxx+j*pw;
+            float *yy = pyy+j*pw;
+            float *xy = pxy+j*pw;
+            int i=0;
+            for (; i+4<=pw; i+=4) {
+                t_cpu_vec4 gx, gy;
+                gx = cpu_vec4_mul(cpu_vec4_sub(cpu_vec4_load(c+i+1),  cpu_vec4_load(c+i-1)),  half);
+                gy = cpu_vec4_mul(cpu_vec4_sub(cpu_vec4_load(c+i+iw), cpu_vec4_load(c+i-iw)), half);
+                cpu_vec4_store(xx+i, cpu_vec4_mul(gx,gx));
+                cpu_vec4_store(yy+i, cpu_vec4_mul(gy,gy));
+                cpu_vec4_store(xy+i, cpu_vec4_mul(gx,gy));
+            }
+            for (; i<pw; i++) {
+                float gx = (c[i+1]-c[i-1])*0.5f;
+                float gy = (c[i+iw]-c[i-iw])*0.5f;
+                xx[i] = gx*gx;
+                yy[i] = gy*gy;
+                xy[i] = gx*gy;
+            }
+        }
+
+        for (int y=y0; y<y1; y++) {
+            float *out = args->dst + (y*width+tx0)*4;
+            for (int i=0; i<tw; i++) {
+                sxx[i] = syy[i] = sxy[i] = 0.0f;
+            }
+            for (int k=0; k<d->num_offsets; k++) {
+                int ofs = (y-y0+r+(int)d->offsets[k][1])*pw + r+(int)d->offsets[k][0];
+                int i=0;
+                for (; i+4<=tw; i+=4) {
+                    cpu_vec4_store(sxx+i, cpu_vec4_add(cpu_vec4_load(sxx+i), cpu_vec4_load(pxx+ofs+i)));
+                    cpu_vec4_store(syy+i, cpu_vec4_add(cpu_vec4_load(syy+i), cpu_vec4_load(pyy+ofs+i)));
+                    cpu_vec4_store(sxy+i, cpu_vec4_add(cpu_vec4_load(sxy+i), cpu_vec4_load(pxy+ofs+i)));
+                }
+                for (; i<tw; i++) {
+                    sxx[i] += pxx[ofs+i];
+                    syy[i] += pyy[ofs+i];
+                    sxy[i] += pxy[ofs+i];
+                }
+            }
+            for (int i=0; i<tw; i++) {
+                float det = sxx[i]*syy[i]-sxy[i]*sxy[i];
+                out[i*4+0] = (det>0) ? sqrtf(sqrtf(det)) : 0.0f;
+                out[i*4+1] = 0.0f;
+                out[i*4+2] = 0.0f;
+                out[i*4+3] = 0.0f;
+            }
+        }
+    }
+    free(buffer);
+}
+
+/*f cpu_circle_dft_setup
+ * Circle sample offsets in texels, in the order of texture_circle, and
+ * the twiddles for a 32-point DFT
+ */
+static void
+cpu_circle_dft_setup(const t_cpu_kernel_defines *d, float circle_ofs[32][2], float twiddle[32][2])
+{
+    float r = d->circle_radius;
+    for (int i=0; i<8; i++) {
+        float c = r*circle_offsets_8[i][0];
+        float s = r*circle_offsets_8[i][1];
+        circle_ofs[i   ][0] =  c; circle_ofs[i   ][1] =  s;
+        circle_ofs[i+8 ][0] = -s; circle_ofs[i+8 ][1] =  c;
+        circle_ofs[i+16][0] = -c; circle_ofs[i+16][1] = -s;
+        circle_ofs[i+24][0] =  s; circle_ofs[i+24][1] = -c;
+    }
+    for (int n=0; n<32; n++) {
+        twiddle[n][0] =  cos(2*M_PI*n/32.0);
+        twiddle[n][1] = -sin(2*M_PI*n/32.0);
+    }
+}
+
+/*f cpu_circle_dft_pack
+ * Pack DFT terms 0 to 3 of one pixel as circle_dft.glsl does
+ */
+static inline void
+cpu_circle_dft_pack(float *out, const float re[4], const float im[4])
+{
+    out[0] = float_of_bits(pack_power_angle(fabsf(re[0]/32.0f), 0));
+    for (int k=1; k<4; k++) {
+        out[k] = float_of_bits(pack_power_angle(sqrtf(re[k]*re[k]+im[k]*im[k]), flt_angle(re[k],im[k])));
+    }
+}
+
+/*f cpu_circle_dft_bilinear
+ * Any size of texture - sample the circle as the shader does
+ */
+static void
+cpu_circle_dft_bilinear(const t_cpu_kernel_args *args, int y0, int y1)
+{
+    const t_cpu_kernel_defines *d = args->defines;
+    const t_cpu_image *src = &args->src[0];
+    float circle_ofs[32][2];
+    float twiddle[32][2];
+    cpu_circle_dft_setup(d, circle_ofs, twiddle);
+    for (int y=y0; y<y1; y++) {
+        float v = (y+0.5f)/args->height;
+        float *out = args->dst + y*args->width*4;
+        for (int x=0; x<args->width; x++) {
+            float u = (x+0.5f)/args->width;
+            float td[32], re[4], im[4];
+            for (int n=0; n<32; n++) {
+                td[n] = cpu_texture(src, u+circle_ofs[n][0]*STEP, v+circle_ofs[n][1]*STEP, d->circle_component);
+            }
+            for (int k=0; k<4; k++) {
+                re[k] = im[k] = 0.0f;
+                for (int n=0; n<32; n++) {
+                    re[k] += td[n]*twiddle[(k*n)&31][0];
+                    im[k] += td[n]*twiddle[(k*n)&31][1];
+                }
+            }
+            cpu_circle_dft_pack(out+x*4, re, im);
+        }
+    }
+}
+
+/*f cpu_circle_dft - circle_dft.glsl
+ * Only terms 0 to 3 of the 32-point DFT of the circle are used, so
+ * they are accumulated directly from the samples with precomputed
+ * twiddles rather than with the shader's full FFT.
+ *
+ * For a 1024x1024 source the same size as the destination each circle
+ * sample is at a fixed texel offset from the pixel, so its bilinear
+ * weights are the same for every pixel. The circle component of the
+ * rows needed is copied to a plane with a zero halo, and the samples
+ * and DFT terms of CPU_DFT_GROUP adjacent pixels are then computed
+ * together, one vector per 4 pixels.
+ */
+static void
+cpu_circle_dft(const t_cpu_kernel_args *args, int y0, int y1)
+{
+    const t_cpu_kernel_defines *d = args->defines;
+    const t_cpu_image *src = &args->src[0];
+    int width = args->width;
+    if ((src->width!=width) || (src->height!=args->height) ||
+        (width!=1024) || (args->height!=1024)) {
+        cpu_circle_dft_bilinear(args, y0, y1);
+        return;
+    }
+
+    float circle_ofs[32][2];
+    float twiddle[32][2];
+    int   tap_ofs[32];
+    float tap_weight[32][4];
+    int halo;
+    cpu_circle_dft_setup(d, circle_ofs, twiddle);
+
+    halo = 1;
+    for (int n=0; n<32; n++) {
+        for (int j=0; j<2; j++) {
+            int e = abs((int)floorf(circle_ofs[n][j]))+1;
+            if (e>halo) halo=e;
+        }
+    }
+    int pw = width+2*halo+CPU_DFT_GROUP;
+    int ph = (y1-y0)+2*halo;
+    for (int n=0; n<32; n++) {
+        float fx, fy;
+        int ox, oy;
+        ox = (int)floorf(circle_ofs[n][0]);
+        oy = (int)floorf(circle_ofs[n][1]);
+        fx = circle_ofs[n][0]-ox;
+        fy = circle_ofs[n][1]-oy;
+        tap_ofs[n] = (halo+oy)*pw + (halo+ox);
+        tap_weight[n][0] = (1-fx)*(1-fy);
+        tap_weight[n][1] = fx*(1-fy);
+        tap_weight[n][2] = (1-fx)*fy;
+        tap_weight[n][3] = fx*fy;
+    }
+
+    float *plane = (float *)malloc(sizeof(float)*pw*ph); // texel (x-halo, y0-halo+j) at plane[j*pw+x]
+    for (int j=0; j<ph; j++) {
+        for (int i=0; i<pw; i++) {
+            plane[j*pw+i] = cpu_texel(src, i-halo, y0-halo+j, d->circle_component);
+        }
+    }
+
+    for (int y=y0; y<y1; y++) {
+        float *out = args->dst + y*width*4;
+        const float *row = plane + (y-y0)*pw;
+        for (int x0=0; x0<width; x0+=CPU_DFT_GROUP) {
+            t_cpu_vec4 re[4][CPU_DFT_GROUP/4], im[4][CPU_DFT_GROUP/4];
+            float re_f[4][CPU_DFT_GROUP], im_f[4][CPU_DFT_GROUP];
+            for (int k=0; k<4; k++) {
+                for (int h=0; h<CPU_DFT_GROUP/4; h++) {
+                    re[k][h] = im[k][h] = cpu_vec4_zero();
+                }
+            }
+            for (int n=0; n<32; n++) {
+                const float *p = row + tap_ofs[n] + x0;
+                for (int h=0; h<CPU_DFT_GROUP/4; h++) {
+                    t_cpu_vec4 t;
+                    t = cpu_vec4_zero();
+                    t = cpu_vec4_madd(t, cpu_vec4_load(p+4*h),      tap_weight[n][0]);
+                    t = cpu_vec4_madd(t, cpu_vec4_load(p+4*h+1),    tap_weight[n][1]);
+                    t = cpu_vec4_madd(t, cpu_vec4_load(p+4*h+pw),   tap_weight[n][2]);
+                    t = cpu_vec4_madd(t, cpu_vec4_load(p+4*h+pw+1), tap_weight[n][3]);
+                    re[0][h] = cpu_vec4_add(re[0][h], t);
+                    for (int k=1; k<4; k++) {
+                        re[k][h] = cpu_vec4_madd(re[k][h], t, twiddle[(k*n)&31][0]);
+                        im[k][h] = cpu_vec4_madd(im[k][h], t, twiddle[(k*n)&31][1]);
+                    }
+                }
+            }
+            for (int k=0; k<4; k++) {
+                for (int h=0; h<CPU_DFT_GROUP/4; h++) {
+                    cpu_vec4_store(&re_f[k][4*h], re[k][h]);
+                    cpu_vec4_store(&im_f[k][4*h], im[k][h]);
+                }
+            }
+            for (int i=0; (i<CPU_DFT_GROUP) && (x0+i<width); i++) {
+                float pre[4], pim[4];
+                for (int k=0; k<4; k++) {
+                    pre[k] = re_f[k][i];
+                    pim[k] = im_f[k][i];
+                }
+                cpu_circle_dft_pack(out+(x0+i)*4, pre, pim);
+            }
+        }
+    }
+    free(plane);
+}
+
+/*f cpu_dft_diff - circle_dft_diff.glsl for one pixel
+ * Set rgb for the target descriptor src_dft compared with base_dft
+ */
+static inline void
+cpu_dft_diff(const unsigned int base_dft[4], const unsigned int src_dft[4], float out[3])
+{
+    float p0, a0, p1, a1, diff, adiff, rotation, cs[2];
+
+    diff = 1.0f;
+
+    unpack_power_angle(src_dft[1], &p0, &a0);
+    unpack_power_angle(base_dft[1], &p1, &a1);
+    diff = diff * power_diff(p0,p1);
+    rotation = flt_angle_diff(a0, a1);
+
+    unpack_power_angle(src_dft[3], &p0, &a0);
+    unpack_power_angle(base_dft[3], &p1, &a1);
+    diff = diff * power_diff(p0,p1);
+    adiff = flt_angle_diff(a0, a1);
+    adiff = 1.0f-flt_angle_diff_scale_abs(rotation, 3.0f, adiff)/4.0f;
+    diff = adiff*diff;
+
+    unpack_power_angle(src_dft[2], &p0, &a0);
+    unpack_power_angle(base_dft[2], &p1, &a1);
+    diff = diff * power_diff(p0,p1);
+    adiff = flt_angle_diff(a0, a1);
+    adiff = 1.0f-flt_angle_diff_scale_abs(rotation, 2.0f, adiff)/4.0f;
+    diff = adiff*diff;
+
+    unpack_power_angle(src_dft[0], &p0, &a0);
+    unpack_power_angle(base_dft[0], &p1, &a1);
+    diff = diff * power_diff(p0,p1);
+    out[2] = diff;
+    flt_angle_cs(rotation, cs);
+    diff = (diff<0)?0:diff;
+    out[0] = cs[0]*diff;
+    out[1] = cs[1]*diff;
+}
+
+/*f cpu_circle_dft_diff - circle_dft_diff.glsl
+ */
+static void
+cpu_circle_dft_diff(const t_cpu_kernel_args *args, int y0, int y1)
+{
+    unsigned int base_dft[4];
+    cpu_texel_bits(&args->src[0], (int)args->uv_base_x, (int)args->uv_base_y, base_dft);
+    for (int y=y0; y<y1; y++) {
+        int src_y = (int)(1024.0f*((y+0.5f)/args->height));
+        float *out = args->dst + y*args->width*4;
+        for (int x=0; x<args->width; x++) {
+            int src_x = (int)(1024.0f*((x+0.5f)/args->width));
+            unsigned int src_dft[4];
+
+            cpu_texel_bits(&args->src[1], src_x, src_y, src_dft);
+            cpu_dft_diff(base_dft, src_dft, out+x*4);
+            out[x*4+3] = 0.0f;
+        }
+    }
+}
+
+/*f cpu_circle_dft_diff_combine - circle_dft_diff_combine.glsl
+ */
+static void
+cpu_circle_dft_diff_combine(const t_cpu_kernel_args *args, int y0, int y1)
+{
+    const t_cpu_kernel_defines *d = args->defines;
+    const t_cpu_image *src = args->src;
+    for (int y=y0; y<y1; y++) {
+        int src_y = (int)(1024.0f*((y+0.5f)/args->height));
+        float *out = args->dst + y*args->width*4;
+        for (int x=0; x<args->width; x++) {
+            int src_x = (int)(1024.0f*((x+0.5f)/args->width));
+            float max_dxy_l2 = 0.0f;
+            float max_dxy_sum[2] = {0.0f, 0.0f};
+            for (int a=0; a<d->num_discrete_offsets; a++) {
+                int dx = d->discrete_offsets[a][0];
+                int dy = d->discrete_offsets[a][1];
+                float sum[2], l2;
+                for (int c=0; c<2; c++) {
+                    sum[c] = ( cpu_texel(&src[0], src_x+dx, src_y+dy, c) +
+                               cpu_texel(&src[1], src_x-dy, src_y+dx, c) +
+                               cpu_texel(&src[2], src_x-dx, src_y-dy, c) +
+                               cpu_texel(&src[3], src_x+dy, src_y-dx, c) );
+                }
+                l2 = sum[0]*sum[0]+sum[1]*sum[1];
+                if (l2>max_dxy_l2) {
+                    max_dxy_l2 = l2;
+                    max_dxy_sum[0] = sum[0];
+                    max_dxy_sum[1] = sum[1];
+                }
+            }
+            out[x*4+0] = max_dxy_l2;
+            out[x*4+1] = max_dxy_sum[0]/4;
+            out[x*4+2] = max_dxy_sum[1]/4;
+            out[x*4+3] = 0.0f;
+        }
+    }
+}
+
+/*v cpu_kernel_defs
+ */
+static const t_cpu_kernel_def cpu_kernel_defs[] = {
+    {"yuv_from_rgb",            cpu_kernel_yuv_from_rgb,            1, CPU_ROWS_PER_CHUNK, cpu_yuv_from_rgb},
+    {"gauss",                   cpu_kernel_gauss,                   1, CPU_ROWS_PER_CHUNK, cpu_gauss},
+    {"harris",                  cpu_kernel_harris,                  1, CPU_HARRIS_TILE,    cpu_harris},
+    {"circle_dft",              cpu_kernel_circle_dft,              1, CPU_DFT_ROWS,       cpu_circle_dft},
+    {"circle_dft_diff",         cpu_kernel_circle_dft_diff,         2, CPU_ROWS_PER_CHUNK, cpu_circle_dft_diff},
+    {"circle_dft_diff_combine", cpu_kernel_circle_dft_diff_combine, 4, CPU_ROWS_PER_CHUNK, cpu_circle_dft_diff_combine},
+    {NULL, cpu_kernel_yuv_from_rgb, 0, 0, NULL}
+};
+
+/*a Define expressions
+ */
+static const char *expression_sum(const char *ptr, double *value);
+
+/*f expression_skip_space
+ */
+static const char *
+expression_skip_space(const char *ptr)
+{
+    while (isspace(ptr[0])) ptr++;
+    return ptr;
+}
+
+/*f expression_factor
+ * <number>[f] | (<sum>) | -<factor> | +<factor>
+ */
+static const char *
+expression_factor(const char *ptr, double *value)
+{
+    char *end;
+    ptr = expression_skip_space(ptr);
+    if (ptr[0]=='(') {
+        ptr = expression_sum(ptr+1, value);
+        if (!ptr) return NULL;
+        ptr = expression_skip_space(ptr);
+        if (ptr[0]!=')') return NULL;
+        return ptr+1;
+    }
+    if ((ptr[0]=='-') || (ptr[0]=='+')) {
+        int negate = (ptr[0]=='-');
+        ptr = expression_factor(ptr+1, value);
+        if (ptr && negate) *value = -*value;
+        return ptr;
+    }
+    *value = strtod(ptr, &end);
+    if (end==ptr) return NULL;
+    if ((end[0]=='f') || (end[0]=='F')) end++;
+    return end;
+}
+
+/*f expression_product
+ */
+static const char *
+expression_product(const char *ptr, double *value)
+{
+    ptr = expression_factor(ptr, value);
+    while (ptr) {
+        double rhs;
+        ptr = expression_skip_space(ptr);
+        if ((ptr[0]!='*') && (ptr[0]!='/'))
+            break;
+        char op = ptr[0];
+        ptr = expression_factor(ptr+1, &rhs);
+        if (!ptr) break;
+        *value = (op=='*') ? (*value*rhs) : (*value/rhs);
+    }
+    return ptr;
+}
+
+/*f expression_sum
+ */
+static const char *
+expression_sum(const char *ptr, double *value)
+{
+    ptr = expression_product(ptr, value);
+    while (ptr) {
+        double rhs;
+        ptr = expression_skip_space(ptr);
+        if ((ptr[0]!='+') && (ptr[0]!='-'))
+            break;
+        char op = ptr[0];
+        ptr = expression_product(ptr+1, &rhs);
+        if (!ptr) break;
+        *value = (op=='+') ? (*value+rhs) : (*value-rhs);
+    }
+    return ptr;
+}
+
+/*f expression_evaluate
+ * Evaluate a constant arithmetic define such as '(3456.0/5184.0)';
+ * return 0 on success
+ */
+static int
+expression_evaluate(const char *string, double *value)
+{
+    const char *end;
+    end = expression_sum(string, value);
+    if (!end) return 1;
+    end = expression_skip_space(end);
+    return (end[0]!=0);
+}
+
+/*a c_filter_cpu methods
+ */
+/*f c_filter_cpu constructor
+ */
+c_filter_cpu::c_filter_cpu(const t_cpu_kernel_def *kernel_def, t_len_string *textures, t_len_string *parameter_string)
+    : c_filter(textures, parameter_string)
+{
+    this->kernel_def = kernel_def;
+    memset(&defines, 0, sizeof(defines));
+    num_dest_textures = 1;
+    if (!kernel_def) {
+        parse_error = "No CPU kernel for filter";
+        return;
+    }
+    if (num_textures!=kernel_def->num_src+1) {
+        parse_error = "Failed to parse CPU filter texture options - wrong number of '(<src>+,<dst>)' texture numbers";
+    }
+}
+
+/*f c_filter_cpu destructor
+ */
+c_filter_cpu::~c_filter_cpu()
+{
+    return;
+}
+
+/*f c_filter_cpu::define_real
+ */
+int c_filter_cpu::define_real(const char *name, float *value, int required)
+{
+    const char *string;
+    double d;
+    string = get_define(name);
+    if (!string) {
+        if (!required) return 0;
+        fprintf(stderr, "CPU filter '%s' requires -D%s\n", kernel_def->name, name);
+        parse_error = "CPU filter missing a required define";
+        return 1;
+    }
+    if (expression_evaluate(string, &d)) {
+        fprintf(stderr, "CPU filter '%s' could not evaluate -D%s=%s\n", kernel_def->name, name, string);
+        parse_error = "CPU filter could not evaluate a define";
+        return 1;
+    }
+    *value = d;
+    return 0;
+}
+
+/*f c_filter_cpu::define_int
+ */
+int c_filter_cpu::define_int(const char *name, int *value, int required)
+{
+    float f = *value;
+    if (define_real(name, &f, required))
+        return 1;
+    *value = (int)f;
+    return 0;
+}
+
+/*f c_filter_cpu::compile_offsets
+ * OFFSETS must name offsets_2d_25 or offsets_2d_81
+ */
+int c_filter_cpu::compile_offsets(void)
+{
+    const char *offsets;
+    int max_offsets;
+    defines.num_offsets = 9;
+    if (define_int("NUM_OFFSETS", &defines.num_offsets, 0))
+        return 1;
+    offsets = get_define("OFFSETS");
+    if (offsets && !strcmp(offsets, "offsets_2d_25")) {
+        // As base_functions.glsl - the middle entry of each column is +STEP, not 0
+        static const int dy_25[5] = {-2, -1, 1, 1, 2};
+        for (int i=0; i<25; i++) {
+            defines.offsets[i][0] = (i/5)-2;
+            defines.offsets[i][1] = dy_25[i%5];
+        }
+        max_offsets = 25;
+    } else if (offsets && !strcmp(offsets, "offsets_2d_81")) {
+        for (int i=0; i<81; i++) {
+            defines.offsets[i][0] = (i/9)-4;
+            defines.offsets[i][1] = (i%9)-4;
+        }
+        max_offsets = 81;
+    } else {
+        parse_error = "CPU filter requires -DOFFSETS=offsets_2d_25 or offsets_2d_81";
+        return 1;
+    }
+    if ((defines.num_offsets<1) || (defines.num_offsets>max_offsets)) {
+        parse_error = "CPU filter NUM_OFFSETS out of range for OFFSETS";
+        return 1;
+    }
+    defines.offset_extent = 0;
+    for (int i=0; i<defines.num_offsets; i++) {
+        for (int j=0; j<2; j++) {
+            int e = abs((int)defines.offsets[i][j]);
+            if (e>defines.offset_extent) defines.offset_extent=e;
+        }
+    }
+    return 0;
+}
+
+/*f c_filter_cpu::compile_weights
+ * X_NOT_Y and WEIGHTS (gauss_offset_weights9) are required
+ */
+int c_filter_cpu::compile_weights(void)
+{
+    const char *x_not_y, *weights;
+    x_not_y = get_define("X_NOT_Y");
+    if (x_not_y && !strcmp(x_not_y, "true")) {
+        defines.x_not_y = 1;
+    } else if (x_not_y && !strcmp(x_not_y, "false")) {
+        defines.x_not_y = 0;
+    } else {
+        parse_error = "CPU filter requires -DX_NOT_Y=true or false";
+        return 1;
+    }
+    weights = get_define("WEIGHTS");
+    if (!weights || strcmp(weights, "gauss_offset_weights9")) {
+        parse_error = "CPU filter requires -DWEIGHTS=gauss_offset_weights9";
+        return 1;
+    }
+    defines.weights = gauss_offset_weights9;
+    defines.num_weights = 9;
+    if (define_int("NUM_WEIGHTS", &defines.num_weights, 1))
+        return 1;
+    if ((defines.num_weights<1) || (defines.num_weights>9)) {
+        parse_error = "CPU filter NUM_WEIGHTS out of range for WEIGHTS";
+        return 1;
+    }
+    return 0;
+}
+
+/*f c_filter_cpu::compile_circle
+ */
+int c_filter_cpu::compile_circle(void)
+{
+    float dft_circle_radius, circle_radius;
+    int num_circle_steps;
+    const char *component;
+
+    circle_radius = 1.0;
+    num_circle_steps = 8;
+    if (define_real("DFT_CIRCLE_RADIUS", &dft_circle_radius, 1)) return 1;
+    if (define_real("CIRCLE_RADIUS", &circle_radius, 0)) return 1;
+    if (define_int("NUM_CIRCLE_STEPS", &num_circle_steps, 0)) return 1;
+    if (num_circle_steps!=8) {
+        parse_error = "CPU filter only supports NUM_CIRCLE_STEPS of 8";
+        return 1;
+    }
+    if (get_define("SINGLE_COMPONENT")) {
+        parse_error = "CPU filter does not support SINGLE_COMPONENT";
+        return 1;
+    }
+    defines.circle_radius = dft_circle_radius*circle_radius;
+
+    defines.circle_component = 0;
+    component = get_define("CIRCLE_COMPONENT");
+    if (component) {
+        static const char *rgba="rgba";
+        static const char *xyzw="xyzw";
+        const char *c;
+        if (component[1]!=0) component = "";
+        if ((c=strchr(rgba, component[0]))!=NULL && c[0]) {
+            defines.circle_component = c-rgba;
+        } else if ((c=strchr(xyzw, component[0]))!=NULL && c[0]) {
+            defines.circle_component = c-xyzw;
+        } else {
+            parse_error = "CPU filter CIRCLE_COMPONENT must be one of r, g, b or a";
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*f c_filter_cpu::compile_discrete_offsets
+ */
+int c_filter_cpu::compile_discrete_offsets(void)
+{
+    const char *offsets;
+    int max_offsets;
+    defines.num_discrete_offsets = 9;
+    if (define_int("NUM_OFFSETS", &defines.num_discrete_offsets, 0))
+        return 1;
+    offsets = get_define("DISCRETE_CIRCLE_OFS");
+    if (offsets && !strcmp(offsets, "discrete_circle_offsets_4_32")) {
+        defines.discrete_offsets = discrete_circle_offsets_4_32;
+        max_offsets = 32;
+    } else if (offsets && !strcmp(offsets, "discrete_circle_offsets_4_16")) {
+        defines.discrete_offsets = discrete_circle_offsets_4_16;
+        max_offsets = 16;
+    } else {
+        parse_error = "CPU filter requires -DDISCRETE_CIRCLE_OFS=discrete_circle_offsets_4_32 or _4_16";
+        return 1;
+    }
+    if ((defines.num_discrete_offsets<1) || (defines.num_discrete_offsets>max_offsets)) {
+        parse_error = "CPU filter NUM_OFFSETS out of range for DISCRETE_CIRCLE_OFS";
+        return 1;
+    }
+    return 0;
+}
+
+/*f c_filter_cpu::do_compile
+ * Evaluate the defines the kernel depends on
+ */
+int c_filter_cpu::do_compile(void)
+{
+    int rc=0;
+    if (parse_error) return 1;
+
+    SL_TIMER_ENTRY(timers[filter_timer_compile]);
+    switch (kernel_def->kernel) {
+    case cpu_kernel_yuv_from_rgb:
+        defines.intensity_xscale = 1.0;
+        defines.intensity_yscale = 1.0;
+        defines.intensity_xofs   = 0.0;
+        defines.intensity_yofs   = 0.0;
+        if (get_define("INTENSITY_XSCALE")) {
+            rc = ( define_real("INTENSITY_XSCALE", &defines.intensity_xscale, 1) ||
+                   define_real("INTENSITY_XOFS",   &defines.intensity_xofs,   1) ||
+                   define_real("INTENSITY_YSCALE", &defines.intensity_yscale, 1) ||
+                   define_real("INTENSITY_YOFS",   &defines.intensity_yofs,   1) );
+        }
+        break;
+    case cpu_kernel_gauss:
+        rc = compile_weights();
+        break;
+    case cpu_kernel_harris:
+        rc = compile_offsets();
+        break;
+    case cpu_kernel_circle_dft:
+        rc = compile_circle();
+        break;
+    case cpu_kernel_circle_dft_diff:
+        break;
+    case cpu_kernel_circle_dft_diff_combine:
+        rc = compile_discrete_offsets();
+        break;
+    }
+    if ((rc==0) && (get_define("GL_POSITION") || get_define("UV_TO_FRAG"))) {
+        parse_error = "CPU filters do not support vertex shader defines";
+        rc = 1;
+    }
+    SL_TIMER_EXIT(timers[filter_timer_compile]);
+    return rc;
+}
+
+/*f c_filter_cpu::do_execute
+ */
+int c_filter_cpu::do_execute(t_exec_context *ec)
+{
+    t_cpu_kernel_args args;
+    t_texture_ptr dst;
+    double uv_base;
+
+    if (parse_error) return 1;
+    if (projections[0] && projections[1]) {
+        fprintf(stderr, "CPU filter '%s' cannot draw through projections\n", kernel_def->name);
+        return 1;
+    }
+
+    SL_TIMER_ENTRY(timers[filter_timer_execute]);
+
+    args.defines = &defines;
+    for (int i=0; i<kernel_def->num_src; i++) {
+        t_texture_ptr src = bound_texture(ec, i);
+        if (!src) {
+            SL_TIMER_EXIT(timers[filter_timer_execute]);
+            return 1;
+        }
+        args.src[i].width  = texture_header(src)->width;
+        args.src[i].height = texture_header(src)->height;
+        args.src[i].data   = (const float *)texture_get_buffer(src, GL_RGBA);
+        if (!args.src[i].data) {
+            SL_TIMER_EXIT(timers[filter_timer_execute]);
+            return 1;
+        }
+    }
+    dst = bound_texture(ec, num_textures-1);
+    if (!dst) {
+        SL_TIMER_EXIT(timers[filter_timer_execute]);
+        return 1;
+    }
+    args.width  = texture_header(dst)->width;
+    args.height = texture_header(dst)->height;
+    args.dst    = (float *)texture_host_buffer(dst);
+
+    args.uv_base_x = 0.0f;
+    args.uv_base_y = 0.0f;
+    if (get_parameter_real("uv_base_x", &uv_base)==0) args.uv_base_x = uv_base;
+    if (get_parameter_real("uv_base_y", &uv_base)==0) args.uv_base_y = uv_base;
+
+    t_cpu_kernel_fn fn = kernel_def->fn;
+    thread_pool_default()->parallel_for(args.height, kernel_def->rows_per_chunk,
+                                        [&](int y0, int y1) {fn(&args, y0, y1);} );
+
+    texture_buffer_updated(dst);
+
+    SL_TIMER_EXIT(timers[filter_timer_execute]);
+    return 0;
+}
+
+/*a Corner matching
+ */
+/*f cpu_match_corner_rows
+ * Score rows y0 to y1-1 (columns x0 to x1-1) of the target against one
+ * corner, as circle_dft_diff_combine's output rows for find
+ */
+static void
+cpu_match_corner_rows(const t_cpu_image *src, const t_cpu_image *tgt, const t_point_value *corner,
+                      const t_corner_match_parameters *parameters, const int (*offsets)[2],
+                      int x0, int x1, int y0, int y1, float *rows)
+{
+    static const int corner_dirs[4][2] = {{1,0}, {0,1}, {-1,0}, {0,-1}};
+    unsigned int base_dft[4][4];
+    int pw, ph;
+
+    for (int i=0; i<4; i++) {
+        cpu_texel_bits(src,
+                       corner->x+corner_dirs[i][0]*parameters->descriptor_offset,
+                       corner->y+corner_dirs[i][1]*parameters->descriptor_offset,
+                       base_dft[i]);
+    }
+
+    // Differences (rg of circle_dft_diff) for each base, over the band plus a border
+    // that is zero outside the texture as texelFetch is
+    pw = (x1-x0)+2*CPU_MATCH_REACH;
+    ph = (y1-y0)+2*CPU_MATCH_REACH;
+    std::vector<float> diffs(4*pw*ph*2, 0.0f);
+    for (int j=0; j<ph; j++) {
+        int y = y0-CPU_MATCH_REACH+j;
+        if ((y<0) || (y>=tgt->height)) continue;
+        for (int i=0; i<pw; i++) {
+            int x = x0-CPU_MATCH_REACH+i;
+            unsigned int src_dft[4];
+            float out[3];
+            if ((x<0) || (x>=tgt->width)) continue;
+            cpu_texel_bits(tgt, x, y, src_dft);
+            for (int b=0; b<4; b++) {
+                cpu_dft_diff(base_dft[b], src_dft, out);
+                diffs[((b*ph+j)*pw+i)*2+0] = out[0];
+                diffs[((b*ph+j)*pw+i)*2+1] = out[1];
+            }
+        }
+    }
+
+    // circle_dft_diff_combine
+    int tap[4][CPU_MATCH_OFFSETS_MAX];
+    for (int a=0; a<parameters->num_offsets; a++) {
+        int dx = offsets[a][0];
+        int dy = offsets[a][1];
+        tap[0][a] = ((0*ph+dy)*pw+dx)*2;
+        tap[1][a] = ((1*ph+dx)*pw-dy)*2;
+        tap[2][a] = ((2*ph-dy)*pw-dx)*2;
+        tap[3][a] = ((3*ph-dx)*pw+dy)*2;
+    }
+    for (int y=y0; y<y1; y++) {
+        float *row = rows + (y-y0)*tgt->width*4;
+        for (int x=x0; x<x1; x++) {
+            const float *d = &diffs[((y-y0+CPU_MATCH_REACH)*pw+(x-x0+CPU_MATCH_REACH))*2];
+            float max_dxy_l2 = 0.0f;
+            float max_dxy_sum[2] = {0.0f, 0.0f};
+            for (int a=0; a<parameters->num_offsets; a++) {
+                float sum[2], l2;
+                for (int c=0; c<2; c++) {
+                    sum[c] = d[tap[0][a]+c] + d[tap[1][a]+c] + d[tap[2][a]+c] + d[tap[3][a]+c];
+                }
+                l2 = sum[0]*sum[0]+sum[1]*sum[1];
+                if (l2>max_dxy_l2) {
+                    max_dxy_l2 = l2;
+                    max_dxy_sum[0] = sum[0];
+                    max_dxy_sum[1] = sum[1];
+                }
+            }
+            row[x*4+0] = max_dxy_l2;
+            row[x*4+1] = max_dxy_sum[0]/4;
+            row[x*4+2] = max_dxy_sum[1]/4;
+        }
+    }
+}
+
+/*a External functions
+ */
+/*f cpu_kernel_def_of_filename
+ */
+static const t_cpu_kernel_def *
+cpu_kernel_def_of_filename(t_len_string *filename)
+{
+    for (int i=0; cpu_kernel_defs[i].name; i++) {
+        if ( ((int)strlen(cpu_kernel_defs[i].name)==filename->len) &&
+             !strncmp(cpu_kernel_defs[i].name, filename->ptr, filename->len) ) {
+            return &cpu_kernel_defs[i];
+        }
+    }
+    return NULL;
+}
+
+/*f filter_cpu_has_kernel
+ */
+int
+filter_cpu_has_kernel(t_len_string *filename)
+{
+    return cpu_kernel_def_of_filename(filename)!=NULL;
+}
+
+/*f filter_cpu_create
+ */
+c_filter *
+filter_cpu_create(t_len_string *filename, t_len_string *textures, t_len_string *parameter_string)
+{
+    return new c_filter_cpu(cpu_kernel_def_of_filename(filename), textures, parameter_string);
+}
+
+/*f filter_cpu_corner_match_defaults
+ * The values batch uses: descriptors 4 pixels from the corner, 32 offsets,
+ * and find with min_distance=2.5&max_elements=100&minimum=0.1
+ */
+void
+filter_cpu_corner_match_defaults(t_corner_match_parameters *parameters)
+{
+    parameters->descriptor_offset = 4;
+    parameters->num_offsets = 32;
+    parameters->perimeter = 10;
+    parameters->minimum = 0.1;
+    parameters->min_distance = 2.5;
+    parameters->max_candidates = 100;
+    parameters->max_matches = 30;
+}
+
+/*f filter_cpu_match_corners
+ */
+int
+filter_cpu_match_corners(t_texture_ptr source_dft, t_texture_ptr target_dft,
+                         const t_point_value *corners, int num_corners,
+                         const t_corner_match_parameters *parameters,
+                         t_point_value *matches, int *num_matches)
+{
+    const int (*offsets)[2];
+    t_cpu_image src, tgt;
+    int x0, x1, y0, y1;
+
+    if (parameters->num_offsets==32) {
+        offsets = discrete_circle_offsets_4_32;
+    } else if (parameters->num_offsets==16) {
+        offsets = discrete_circle_offsets_4_16;
+    } else {
+        fprintf(stderr, "Corner matching supports 16 or 32 offsets, not %d\n", parameters->num_offsets);
+        return 1;
+    }
+    for (int c=0; c<num_corners; c++) {
+        num_matches[c] = 0;
+    }
+
+    src.width  = texture_header(source_dft)->width;
+    src.height = texture_header(source_dft)->height;
+    src.data   = (const float *)texture_get_buffer(source_dft, GL_RGBA);
+    tgt.width  = texture_header(target_dft)->width;
+    tgt.height = texture_header(target_dft)->height;
+    tgt.data   = (const float *)texture_get_buffer(target_dft, GL_RGBA);
+    if (!src.data || !tgt.data)
+        return 1;
+
+    x0 = parameters->perimeter;
+    x1 = tgt.width-parameters->perimeter;
+    y0 = parameters->perimeter;
+    y1 = tgt.height-parameters->perimeter;
+    if ((parameters->max_candidates<=0) || (parameters->max_matches<=0))
+        return 0;
+
+    // find selects on the thread pool, so the corners are taken in turn
+    std::vector<t_point_value> points(parameters->max_candidates);
+    for (int c=0; c<num_corners; c++) {
+        int n;
+        n = find_select_points([&](int band_y0, int band_y1, std::vector<float> *buffer) {
+                buffer->assign((band_y1-band_y0)*tgt.width*4, 0.0f);
+                cpu_match_corner_rows(&src, &tgt, &corners[c], parameters, offsets,
+                                      x0, x1, band_y0, band_y1, &(*buffer)[0]);
+                return (const float *)&(*buffer)[0];
+            },
+            tgt.width, x0, x1, y0, y1, parameters->minimum, parameters->max_candidates, &points[0]);
+        if (n>0) {
+            n = find_suppress_near_points(&points[0], n, tgt.width, tgt.height, parameters->min_distance, 0.0);
+        }
+        if (n>parameters->max_matches) n=parameters->max_matches;
+        for (int i=0; i<n; i++) {
+            matches[c*parameters->max_matches+i] = points[i];
+        }
+        num_matches[c] = n;
+    }
+    return 0;
+}
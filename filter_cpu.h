@@ -0,0 +1,92 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          filter_cpu.h
+ * @brief         CPU implementations of GLSL image filters
+ *
+ */
+
+/*a Wrapper
+ */
+#ifdef __INC_FILTER_CPU
+#else
+#define __INC_FILTER_CPU
+
+/*a Includes
+ */
+#include "filter.h"
+
+/*a Types
+ */
+/*t t_corner_match_parameters
+ * The circle_dft_diff_combine and find settings for filter_cpu_match_corners
+ */
+typedef struct
+{
+    int    descriptor_offset; // Distance from each corner of its four circle_dft descriptors
+    int    num_offsets;       // NUM_OFFSETS: 32 or 16 (discrete_circle_offsets_4_32 or _4_16)
+    int    perimeter;         // As find
+    double minimum;           // As find
+    double min_distance;      // As find
+    int    max_candidates;    // As find's max_elements, before removing near points
+    int    max_matches;       // Matches returned per corner
+} t_corner_match_parameters;
+
+/*a External functions
+ */
+/*f filter_cpu_has_kernel
+ * Return 1 if shaders/<filename>.glsl has a CPU implementation
+ */
+extern int
+filter_cpu_has_kernel(t_len_string *filename);
+
+/*f filter_cpu_create
+ * Create a CPU filter; the filename, textures and parameters are as for
+ * a 'glsl' filter, including the '-D' defines the shader would use
+ */
+extern c_filter *
+filter_cpu_create(t_len_string *filename, t_len_string *textures, t_len_string *parameter_string);
+
+/*f filter_cpu_corner_match_defaults
+ */
+extern void
+filter_cpu_corner_match_defaults(t_corner_match_parameters *parameters);
+
+/*f filter_cpu_match_corners
+ * For each corner, the points of the target that circle_dft_diff (at the
+ * four descriptors around the corner), circle_dft_diff_combine and find
+ * would produce, best first; source_dft and target_dft are circle_dft
+ * outputs, read back if they are GL textures. The points are selected
+ * by find_select_points, so it must not be called from within a thread
+ * pool chunk.
+ *
+ * matches must have room for max_matches per corner; corner c's are at
+ * matches[c*max_matches], num_matches[c] of them. Return 0 on success
+ */
+extern int
+filter_cpu_match_corners(t_texture_ptr source_dft, t_texture_ptr target_dft,
+                         const t_point_value *corners, int num_corners,
+                         const t_corner_match_parameters *parameters,
+                         t_point_value *matches, int *num_matches);
+
+/*a Wrapper
+ */
+#endif
+
+/*a Editor preferences and notes
+mode: c ***
+c-basic-offset: 4 ***
+c-default-style: (quote ((c-mode . "k&r") (c++-mode . "k&r"))) ***
+outline-regexp: "/\\\*a\\\|[\t ]*\/\\\*[b-z][\t ]" ***
+*/
@@ -0,0 +1,573 @@
+/*a Documentation
+ * Tests of the CPU filter kernels on host textures, against reference
+ * versions of the shaders computed in double precision; so no OpenGL
+ * context is required.
+ *
+ * The reference samples textures as GL does for the filters: bilinear,
+ * with a zero border, at the centre of each destination pixel.
+ *
+ * Corner matching is tested against the filter chain it replaces
+ */
+/*a Includes
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include "filter.h"
+#include "filter_cpu.h"
+#include "texture.h"
+#include "thread_pool.h"
+#include "test.h"
+
+/*a Defines
+ */
+#define REF_STEP (1.0/1024)
+
+/*a Support functions
+ */
+/*f gl_get_errors
+ */
+int gl_get_errors(const char *msg)
+{
+    return 0;
+}
+
+/*f run_filter
+ * Compile and execute a CPU filter whose textures are (0,...,n-1), and
+ * return the points it found (with the number in *num_points), to be
+ * freed by the caller
+ */
+static t_point_value *run_filter(const char *filter_string, t_texture_ptr *textures, int num_textures, int *num_points)
+{
+    t_exec_context ec;
+    c_filter *filter;
+
+    memset(&ec, 0, sizeof(ec));
+    for (int i=0; i<num_textures; i++) {
+        ec.textures[i] = textures[i];
+    }
+    ec.use_ids = 1;
+    *num_points = 0;
+    filter = filter_from_string(filter_string);
+    if (!filter) {
+        assert(0, WHERE, "Failed to create filter '%s'", filter_string);
+        return NULL;
+    }
+    assert(filter->parse_error==NULL, WHERE, "Failed to parse filter '%s'", filter_string);
+    assert(filter->compile()==0, WHERE, "Failed to compile filter '%s'", filter_string);
+    assert(filter->execute(&ec)==0, WHERE, "Failed to execute filter '%s'", filter_string);
+    delete filter;
+    *num_points = ec.num_points;
+    return ec.points;
+}
+
+/*f run_kernel
+ * As run_filter, for a kernel, the last texture being the destination
+ */
+static void run_kernel(const char *filter_string, t_texture_ptr *textures, int num_textures)
+{
+    int n;
+    free(run_filter(filter_string, textures, num_textures, &n));
+}
+
+/*f fill_image
+ * Fill a host texture with a smooth pattern plus noise, different in
+ * each component, with values from 0 to 1
+ */
+static void fill_image(t_texture_ptr texture, unsigned int seed)
+{
+    const t_texture_header *hdr = texture_header(texture);
+    float *raw_img = (float *)texture_host_buffer(texture);
+    srand(seed);
+    for (int y=0; y<hdr->height; y++) {
+        for (int x=0; x<hdr->width; x++) {
+            for (int c=0; c<4; c++) {
+                double v;
+                v = 0.5 + 0.3*sin(x*(0.11+0.03*c)+y*0.07) * cos(y*(0.13-0.02*c)-x*0.05);
+                v += 0.2*(rand()/(double)RAND_MAX-0.5);
+                raw_img[(y*hdr->width+x)*4+c] = v;
+            }
+        }
+    }
+}
+
+/*f ref_texel
+ */
+static double ref_texel(t_texture_ptr texture, int x, int y, int c)
+{
+    const t_texture_header *hdr = texture_header(texture);
+    if ((x<0) || (y<0) || (x>=hdr->width) || (y>=hdr->height))
+        return 0.0;
+    return ((const float *)texture_host_buffer(texture))[(y*hdr->width+x)*4+c];
+}
+
+/*f ref_texture
+ * As GLSL texture(), bilinear with a zero border, for one component
+ */
+static double ref_texture(t_texture_ptr texture, double u, double v, int c)
+{
+    const t_texture_header *hdr = texture_header(texture);
+    double tx, ty, fx, fy;
+    int x, y;
+    tx = u*hdr->width-0.5;
+    ty = v*hdr->height-0.5;
+    x = (int)floor(tx);
+    y = (int)floor(ty);
+    fx = tx-x;
+    fy = ty-y;
+    return ( (ref_texel(texture,x,y,  c)*(1-fx) + ref_texel(texture,x+1,y,  c)*fx)*(1-fy) +
+             (ref_texel(texture,x,y+1,c)*(1-fx) + ref_texel(texture,x+1,y+1,c)*fx)*fy );
+}
+
+/*f dst_value
+ */
+static float dst_value(t_texture_ptr texture, int x, int y, int c)
+{
+    const t_texture_header *hdr = texture_header(texture);
+    return ((const float *)texture_host_buffer(texture))[(y*hdr->width+x)*4+c];
+}
+
+/*a Tests
+ */
+/*f test_yuv_from_rgb
+ * yuv_from_rgb.glsl samples the source at the scaled and offset
+ * destination position; the kernel is single precision, so it should
+ * match to within 1E-6
+ */
+static void test_yuv_from_rgb(void)
+{
+    t_texture_ptr textures[2];
+    double max_error;
+
+    textures[0] = texture_create_host(37, 29);
+    textures[1] = texture_create_host(23, 19);
+    fill_image(textures[0], 1);
+    run_kernel("glsl:yuv_from_rgb(0,1)&-DINTENSITY_XSCALE=(3.0/4.0)&-DINTENSITY_XOFS=0.1&-DINTENSITY_YSCALE=1.25&-DINTENSITY_YOFS=-0.05",
+               textures, 2);
+    max_error = 0.0;
+    for (int y=0; y<19; y++) {
+        for (int x=0; x<23; x++) {
+            double u = (x+0.5)/23*(3.0/4.0)+0.1;
+            double v = (y+0.5)/19*1.25-0.05;
+            double r = ref_texture(textures[0], u, v, 0);
+            double g = ref_texture(textures[0], u, v, 1);
+            double b = ref_texture(textures[0], u, v, 2);
+            double yuv[3];
+            yuv[0] = 0.299*r + 0.587*g + 0.114*b;
+            yuv[1] = (-0.169*r -0.331*g + 0.499*b)+0.5;
+            yuv[2] = ( 0.499*r -0.418*g - 0.0813*b)+0.5;
+            for (int c=0; c<3; c++) {
+                double error = fabs(dst_value(textures[1], x, y, c)-yuv[c]);
+                if (error>max_error) max_error=error;
+            }
+        }
+    }
+    assert(max_error<1E-6, WHERE, "yuv_from_rgb differs from reference by %g", max_error);
+    texture_destroy(textures[0]);
+    texture_destroy(textures[1]);
+}
+
+/*f gauss_max_error
+ * Run gauss.glsl with gauss_offset_weights9 in one direction on a
+ * source, and return the largest difference from the reference
+ */
+static double gauss_max_error(int width, int height, int x_not_y)
+{
+    static const double weights[9] = {0.000229, 0.005977, 0.060598, 0.241732, 0.382928,
+                                      0.241732, 0.060598, 0.005977, 0.000229};
+    t_texture_ptr textures[2];
+    char filter_string[256];
+    double max_error;
+
+    textures[0] = texture_create_host(width, height);
+    textures[1] = texture_create_host(width, height);
+    fill_image(textures[0], 2);
+    snprintf(filter_string, sizeof(filter_string), "glsl:gauss(0,1)&-DX_NOT_Y=%s&-DNUM_WEIGHTS=9&-DWEIGHTS=gauss_offset_weights9",
+             x_not_y?"true":"false");
+    run_kernel(filter_string, textures, 2);
+    max_error = 0.0;
+    for (int y=0; y<height; y++) {
+        for (int x=0; x<width; x++) {
+            double u = (x+0.5)/width;
+            double v = (y+0.5)/height;
+            for (int c=0; c<4; c++) {
+                double sum = 0.0;
+                for (int i=0; i<9; i++) {
+                    double ofs = (i-4)*REF_STEP;
+                    sum += weights[i]*ref_texture(textures[0], u+(x_not_y?ofs:0), v+(x_not_y?0:ofs), c);
+                }
+                double error = fabs(dst_value(textures[1], x, y, c)-sum);
+                if (error>max_error) max_error=error;
+            }
+        }
+    }
+    texture_destroy(textures[0]);
+    texture_destroy(textures[1]);
+    return max_error;
+}
+
+/*f test_gauss
+ * Blur in x and in y on a small texture (sampled bilinearly) and on
+ * textures 1024 texels in the blur direction (whole texel taps). The
+ * kernel accumulates nine single precision products of values up to 1,
+ * and should match to within 5E-7
+ */
+static void test_gauss(void)
+{
+    double error;
+    error = gauss_max_error(41, 33, 1);
+    assert(error<5E-7, WHERE, "gauss in x on 41x33 differs from reference by %g", error);
+    error = gauss_max_error(41, 33, 0);
+    assert(error<5E-7, WHERE, "gauss in y on 41x33 differs from reference by %g", error);
+    error = gauss_max_error(1024, 24, 1);
+    assert(error<5E-7, WHERE, "gauss in x on 1024x24 differs from reference by %g", error);
+    error = gauss_max_error(24, 1024, 0);
+    assert(error<5E-7, WHERE, "gauss in y on 24x1024 differs from reference by %g", error);
+}
+
+/*f ref_harris
+ * harris.glsl at a destination pixel with offsets_2d_25 (whose middle
+ * entry of each column is +STEP, not 0), with the window sums
+ * initialised and a response of 0 where the determinant is not positive
+ */
+static double ref_harris(t_texture_ptr texture, int width, int height, int x, int y)
+{
+    static const int dy_25[5] = {-2, -1, 1, 1, 2};
+    double u = (x+0.5)/width;
+    double v = (y+0.5)/height;
+    double Ix2, Iy2, Ixy, det;
+    Ix2 = Iy2 = Ixy = 0.0;
+    for (int i=0; i<25; i++) {
+        double su = u + ((i/5)-2)*REF_STEP;
+        double sv = v + dy_25[i%5]*REF_STEP;
+        double Ix = ref_texture(texture, su+REF_STEP/2, sv, 0) - ref_texture(texture, su-REF_STEP/2, sv, 0);
+        double Iy = ref_texture(texture, su, sv+REF_STEP/2, 0) - ref_texture(texture, su, sv-REF_STEP/2, 0);
+        Ix2 += Ix*Ix;
+        Iy2 += Iy*Iy;
+        Ixy += Ix*Iy;
+    }
+    det = Ix2*Iy2-Ixy*Ixy;
+    return (det>0) ? sqrt(sqrt(det)) : 0.0;
+}
+
+/*f harris_max_error
+ * Run harris.glsl on a source the size of the destination, and return
+ * the largest difference from the reference over rows y where y%step
+ * is 0 or step-1, and the largest response in *max_value
+ */
+static double harris_max_error(int width, int height, int step, double *max_value)
+{
+    t_texture_ptr textures[2];
+    double max_error;
+
+    textures[0] = texture_create_host(width, height);
+    textures[1] = texture_create_host(width, height);
+    fill_image(textures[0], 3);
+    run_kernel("glsl:harris(0,1)&-DNUM_OFFSETS=25&-DOFFSETS=offsets_2d_25", textures, 2);
+    max_error = 0.0;
+    *max_value = 0.0;
+    for (int y=0; y<height; y++) {
+        if (((y%step)!=0) && ((y%step)!=step-1))
+            continue;
+        for (int x=0; x<width; x++) {
+            double value = ref_harris(textures[0], width, height, x, y);
+            double error = fabs(dst_value(textures[1], x, y, 0)-value);
+            if (error>max_error) max_error=error;
+            if (value>*max_value) *max_value=value;
+        }
+    }
+    texture_destroy(textures[0]);
+    texture_destroy(textures[1]);
+    return max_error;
+}
+
+/*f test_harris
+ * A small texture uses the bilinear path, and a 1024x1024 texture the
+ * tiled central difference path (checked on the rows either side of
+ * each boundary between tiles, which include the image edges). The
+ * kernel's window sums are single precision, and should match to
+ * within 1E-6 of responses of up to about 1
+ */
+static void test_harris(void)
+{
+    double error, max_value;
+    error = harris_max_error(45, 37, 1, &max_value);
+    assert(error<1E-6, WHERE, "harris on 45x37 differs from reference by %g", error);
+    assert(max_value>0.01, WHERE, "harris on 45x37 has largest response %g", max_value);
+    error = harris_max_error(1024, 1024, 64, &max_value);
+    assert(error<1E-6, WHERE, "harris on 1024x1024 differs from reference by %g", error);
+    assert(max_value>0.01, WHERE, "harris on 1024x1024 has largest response %g", max_value);
+}
+
+/*f ref_flt_angle
+ * As flt_angle in base_functions.glsl: the angle of (c,s) in octants,
+ * 0 to 8
+ */
+static double ref_flt_angle(double c, double s)
+{
+    double ac, as, angle;
+    ac = fabs(c);
+    as = fabs(s);
+    angle = (ac>as)?(as/ac):(2.0-ac/as);
+    angle = (c<0)?4-angle:angle;
+    angle = (s<0)?8-angle:angle;
+    return angle;
+}
+
+/*f ref_circle_dft
+ * circle_dft.glsl at a destination pixel: the power and angle of terms
+ * 0 to 3 of the DFT of 32 samples around a circle of the radius (in
+ * STEPs), before packing. Term 0 is scaled by 1/32 and has angle 0
+ */
+static void ref_circle_dft(t_texture_ptr texture, int width, int height, int x, int y, double radius, int component,
+                           double power[4], double angle[4])
+{
+    double u = (x+0.5)/width;
+    double v = (y+0.5)/height;
+    double td[32];
+    for (int i=0; i<8; i++) {
+        double c = radius*REF_STEP*cos(i*M_PI/16);
+        double s = radius*REF_STEP*sin(i*M_PI/16);
+        td[i   ] = ref_texture(texture, u+c, v+s, component);
+        td[i+8 ] = ref_texture(texture, u-s, v+c, component);
+        td[i+16] = ref_texture(texture, u-c, v-s, component);
+        td[i+24] = ref_texture(texture, u+s, v-c, component);
+    }
+    for (int k=0; k<4; k++) {
+        double re, im;
+        re = im = 0.0;
+        for (int n=0; n<32; n++) {
+            re += td[n]*cos(2*M_PI*k*n/32);
+            im -= td[n]*sin(2*M_PI*k*n/32);
+        }
+        if (k==0) {
+            power[k] = fabs(re/32);
+            angle[k] = 0;
+        } else {
+            power[k] = sqrt(re*re+im*im);
+            angle[k] = ref_flt_angle(re, im);
+        }
+    }
+}
+
+/*f circle_dft_max_error
+ * Run circle_dft.glsl (radius 6, green component) on a source the
+ * size of the destination, and compare with the reference over rows y
+ * where y%step is 0 or step-1. Return the largest power error, and in
+ * *max_angle_steps the largest angle error in steps of the packing
+ * (1/32 of an octant) for terms with a power of at least 0.01.
+ */
+static double circle_dft_max_error(int width, int height, int step, int *max_angle_steps)
+{
+    t_texture_ptr textures[2];
+    double max_error;
+
+    textures[0] = texture_create_host(width, height);
+    textures[1] = texture_create_host(width, height);
+    fill_image(textures[0], 4);
+    run_kernel("glsl:circle_dft(0,1)&-DNUM_CIRCLE_STEPS=8&-DDFT_CIRCLE_RADIUS=6&-DCIRCLE_COMPONENT=g", textures, 2);
+    max_error = 0.0;
+    *max_angle_steps = 0;
+    for (int y=0; y<height; y++) {
+        if (((y%step)!=0) && ((y%step)!=step-1))
+            continue;
+        for (int x=0; x<width; x++) {
+            double power[4], angle[4];
+            ref_circle_dft(textures[0], width, height, x, y, 6.0, 1, power, angle);
+            for (int k=0; k<4; k++) {
+                unsigned int pa;
+                float value = dst_value(textures[1], x, y, k);
+                memcpy(&pa, &value, sizeof(pa));
+                double ref_power = (power[k]>=1.0) ? ((1<<24)-1)/(4096.0*4096.0) : power[k];
+                double error = fabs((pa>>8)/(4096.0*4096.0)-ref_power);
+                if (error>max_error) max_error=error;
+                if (power[k]<0.01)
+                    continue;
+                int angle_steps = abs((int)(pa&0xff)-((int)(angle[k]*32)&0xff));
+                if (angle_steps>128) angle_steps=256-angle_steps;
+                if (angle_steps>*max_angle_steps) *max_angle_steps=angle_steps;
+            }
+        }
+    }
+    texture_destroy(textures[0]);
+    texture_destroy(textures[1]);
+    return max_error;
+}
+
+/*f test_circle_dft
+ * A small texture uses the bilinear path, and a 1024x1024 texture the
+ * fixed tap path (checked on the rows either side of each boundary
+ * between bands, which include the image edges). The kernel sums 32
+ * single precision samples per term, so the power should be within
+ * 2E-5; the packed angle is truncated, so may differ by a step.
+ */
+static void test_circle_dft(void)
+{
+    double error;
+    int angle_steps;
+    error = circle_dft_max_error(40, 36, 1, &angle_steps);
+    assert(error<2E-5, WHERE, "circle_dft on 40x36 power differs from reference by %g", error);
+    assert(angle_steps<=1, WHERE, "circle_dft on 40x36 angle differs from reference by %d steps", angle_steps);
+    error = circle_dft_max_error(1024, 1024, 32, &angle_steps);
+    assert(error<2E-5, WHERE, "circle_dft on 1024x1024 power differs from reference by %g", error);
+    assert(angle_steps<=1, WHERE, "circle_dft on 1024x1024 angle differs from reference by %d steps", angle_steps);
+}
+
+/*f combine_corner_chained
+ * Run circle_dft_diff at the four descriptors around a corner (into
+ * textures 2 to 5) and circle_dft_diff_combine (into texture 6), as the
+ * filter chain does; textures 0 and 1 are the source and target
+ * circle_dft outputs
+ */
+static void combine_corner_chained(t_texture_ptr *textures, const t_point_value *corner, int descriptor_offset)
+{
+    static const int corner_dirs[4][2] = {{1,0}, {0,1}, {-1,0}, {0,-1}};
+    char filter_string[256];
+
+    for (int i=0; i<4; i++) {
+        snprintf(filter_string, sizeof(filter_string), "glsl:circle_dft_diff(0,1,%d)&uv_base_x=%d&uv_base_y=%d", 2+i,
+                 corner->x+corner_dirs[i][0]*descriptor_offset,
+                 corner->y+corner_dirs[i][1]*descriptor_offset);
+        run_kernel(filter_string, textures, 7);
+    }
+    run_kernel("glsl:circle_dft_diff_combine(2,3,4,5,6)&-DDISCRETE_CIRCLE_OFS=discrete_circle_offsets_4_32&-DNUM_OFFSETS=32",
+               textures, 7);
+}
+
+/*f match_corners_compare
+ * Check that filter_cpu_match_corners returns, for each corner and set
+ * of parameters, exactly the first max_matches points of find on the
+ * filter chain's circle_dft_diff_combine output; each corner must have
+ * more than a batch of candidates for find
+ */
+static void match_corners_compare(t_texture_ptr *textures, const t_point_value *corners, int num_corners,
+                                  const t_corner_match_parameters *parameters, int num_parameters)
+{
+    std::vector<std::vector<t_point_value>> matches(num_parameters);
+    std::vector<std::vector<int>> num_matches(num_parameters);
+    char filter_string[256];
+
+    for (int s=0; s<num_parameters; s++) {
+        matches[s].resize(num_corners*parameters[s].max_matches);
+        num_matches[s].resize(num_corners);
+        assert(filter_cpu_match_corners(textures[0], textures[1], corners, num_corners, &parameters[s],
+                                        &matches[s][0], &num_matches[s][0])==0,
+               WHERE, "filter_cpu_match_corners failed");
+    }
+    for (int c=0; c<num_corners; c++) {
+        combine_corner_chained(textures, &corners[c], parameters[0].descriptor_offset);
+        for (int s=0; s<num_parameters; s++) {
+            const t_corner_match_parameters *prm = &parameters[s];
+            t_point_value *points;
+            int n, num_candidates, p;
+
+            p = prm->perimeter;
+            num_candidates = 0;
+            for (int y=p; y<1024-p; y++) {
+                for (int x=p; x<1024-p; x++) {
+                    if (dst_value(textures[6], x, y, 0)>prm->minimum) num_candidates++;
+                }
+            }
+            assert(num_candidates>1024, WHERE, "corner (%d,%d) has only %d candidates",
+                   corners[c].x, corners[c].y, num_candidates);
+
+            snprintf(filter_string, sizeof(filter_string), "find:a(6)&perimeter=%d&min_distance=%f&max_elements=%d&minimum=%f",
+                     p, prm->min_distance, prm->max_candidates, prm->minimum);
+            points = run_filter(filter_string, textures, 7, &n);
+            if (n>prm->max_matches) n=prm->max_matches;
+            assert(num_matches[s][c]==n, WHERE, "corner (%d,%d) matched %d points, filter chain %d",
+                   corners[c].x, corners[c].y, num_matches[s][c], n);
+            for (int i=0; (i<n) && (i<num_matches[s][c]); i++) {
+                const t_point_value *m = &matches[s][c*prm->max_matches+i];
+                assert((m->x==points[i].x) && (m->y==points[i].y) && (m->value==points[i].value) &&
+                       (m->vec_x==points[i].vec_x) && (m->vec_y==points[i].vec_y),
+                       WHERE, "corner (%d,%d) match %d is (%d,%d) %g (%g,%g), filter chain (%d,%d) %g (%g,%g)",
+                       corners[c].x, corners[c].y, i,
+                       m->x, m->y, m->value, m->vec_x, m->vec_y,
+                       points[i].x, points[i].y, points[i].value, points[i].vec_x, points[i].vec_y);
+            }
+            free(points);
+        }
+    }
+}
+
+/*f test_match_corners
+ * The target is first the source shifted by (7,5) with noise, so each
+ * corner has many candidates, and then a tiling of a 32x32 patch of the
+ * source, so equal values recur across more than a batch of candidates
+ * and which of them are kept depends on find's batches. Both are
+ * matched with the defaults (find keeping 100), returning all that find
+ * returns, and with the settings of c_image_match (find keeping 2500)
+ */
+static void test_match_corners(void)
+{
+    static const int corner_xy[][2] = {{512,512}, {20,20}, {1003,1003}};
+    int num_corners = sizeof(corner_xy)/sizeof(corner_xy[0]);
+    t_texture_ptr images[3];
+    t_texture_ptr textures[7];
+    t_point_value corners[sizeof(corner_xy)/sizeof(corner_xy[0])];
+    t_corner_match_parameters parameters[2];
+
+    for (int i=0; i<7; i++) {
+        textures[i] = texture_create_host(1024, 1024);
+    }
+    for (int i=0; i<3; i++) {
+        images[i] = texture_create_host(1024, 1024);
+    }
+    fill_image(images[0], 5);
+    fill_image(textures[2], 6);
+    for (int y=0; y<1024; y++) {
+        for (int x=0; x<1024; x++) {
+            float *shifted = &((float *)texture_host_buffer(images[1]))[(y*1024+x)*4];
+            float *tiled   = &((float *)texture_host_buffer(images[2]))[(y*1024+x)*4];
+            shifted[0] = dst_value(images[0], (x+7)%1024, (y+5)%1024, 0) + 0.05*(dst_value(textures[2], x, y, 0)-0.5);
+            tiled[0]   = dst_value(images[0], 500+x%32, 500+y%32, 0);
+        }
+    }
+    for (int c=0; c<num_corners; c++) {
+        memset(&corners[c], 0, sizeof(t_point_value));
+        corners[c].x = corner_xy[c][0];
+        corners[c].y = corner_xy[c][1];
+    }
+
+    filter_cpu_corner_match_defaults(&parameters[0]);
+    filter_cpu_corner_match_defaults(&parameters[1]);
+    parameters[0].max_matches = parameters[0].max_candidates;
+    parameters[1].minimum = 0.04;
+    parameters[1].max_candidates = 2500;
+    parameters[1].max_matches = 10;
+
+    for (int t=1; t<3; t++) {
+        for (int i=0; i<2; i++) {
+            t_texture_ptr dft_textures[2] = {images[(i==0)?0:t], textures[i]};
+            run_kernel("glsl:circle_dft(0,1)&-DNUM_CIRCLE_STEPS=8&-DDFT_CIRCLE_RADIUS=4&-DCIRCLE_COMPONENT=r", dft_textures, 2);
+        }
+        match_corners_compare(textures, corners, num_corners, parameters, 2);
+    }
+    for (int i=0; i<7; i++) {
+        texture_destroy(textures[i]);
+    }
+    for (int i=0; i<3; i++) {
+        texture_destroy(images[i]);
+    }
+}
+
+/*a Toplevel
+ */
+/*f main
+ */
+extern int main(int argc, char **argv)
+{
+    filter_set_backend(filter_backend_cpu);
+    thread_pool_default(4);
+    test_yuv_from_rgb();
+    test_gauss();
+    test_harris();
+    test_circle_dft();
+    test_match_corners();
+    if (failures>0) {
+        exit(4);
+    }
+}
@@ -0,0 +1,290 @@
+/*a Documentation
+  A filter pipeline is the ordered list of filter strings that main and
+  batch used to keep as a flat array, with a fixed set of 1024x1024
+  textures created up front for every exec context texture number.
+
+  Here the texture numbers in the filter strings are logical: the
+  pipeline derives from each filter's texture list (sources then
+  num_dest_textures destinations) the stage that first writes, and the
+  stages that read, each number. Numbers that are never live at the
+  same stage share a physical texture, assigned greedily in stage
+  order; a texture freed by a stage is not reused by that same stage,
+  as a GL filter cannot read and render to one texture.
+
+  A texture read before any stage writes it (e.g. a dummy source for
+  an ALU shader) gets a texture from that stage on, whose contents are
+  undefined.
+
+  The number of physical textures, and hence the peak texture memory,
+  is known after compile and before anything is allocated or run.
+ */
+/*a Includes
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "filter_pipeline.h"
+
+/*a c_filter_pipeline constructor and destructor
+ */
+/*f c_filter_pipeline constructor
+ */
+c_filter_pipeline::c_filter_pipeline(int width, int height, int host_textures)
+{
+    this->width = width;
+    this->height = height;
+    this->host_textures = host_textures;
+    repeat_start = MAX_PIPELINE_FILTERS;
+    num_filters = 0;
+    num_physical = 0;
+    physical = NULL;
+    peak_texture_bytes = 0;
+    parse_error = NULL;
+    for (int i=0; i<MAX_EC_TEXTURES; i++) {
+        inputs[i] = NULL;
+        logical[i].is_input = 0;
+        logical[i].is_output = 0;
+        logical[i].first_use = -1;
+        logical[i].last_use = -1;
+        logical[i].first_write = -1;
+        logical[i].physical = -1;
+    }
+}
+
+/*f c_filter_pipeline destructor
+ */
+c_filter_pipeline::~c_filter_pipeline()
+{
+    if (physical) {
+        for (int i=0; i<num_physical; i++) {
+            if (physical[i]) texture_destroy(physical[i]);
+        }
+        free(physical);
+    }
+    for (int i=0; i<num_filters; i++) {
+        if (filters[i]) delete filters[i];
+    }
+}
+
+/*a c_filter_pipeline methods
+ */
+/*f c_filter_pipeline::add_filter
+ * Add the next stage; return its stage number, or -1 if the pipeline is full
+ *
+ * A filter string that fails to parse is reported by compile
+ */
+int c_filter_pipeline::add_filter(const char *filter_string)
+{
+    if (num_filters>=MAX_PIPELINE_FILTERS) {
+        parse_error = "Too many filters in pipeline";
+        return -1;
+    }
+    filter_strings[num_filters] = filter_string;
+    filters[num_filters] = filter_from_string(filter_string);
+    return num_filters++;
+}
+
+/*f c_filter_pipeline::set_input
+ * Texture 'ec_id' is provided by the caller (e.g. a loaded image)
+ */
+void c_filter_pipeline::set_input(int ec_id, t_texture_ptr texture)
+{
+    if ((ec_id<0) || (ec_id>=MAX_EC_TEXTURES))
+        return;
+    inputs[ec_id] = texture;
+}
+
+/*f c_filter_pipeline::set_output
+ * Texture 'ec_id' is used by the caller after the last stage, so its
+ * physical texture is not shared with a later texture number
+ */
+void c_filter_pipeline::set_output(int ec_id)
+{
+    if ((ec_id<0) || (ec_id>=MAX_EC_TEXTURES))
+        return;
+    logical[ec_id].is_output = 1;
+}
+
+/*f c_filter_pipeline::analyse
+ * Find the live range of each texture number; return 0 on success
+ */
+int c_filter_pipeline::analyse(void)
+{
+    int repeat_first_access[MAX_EC_TEXTURES]; // 0 for none, 1 for read, 2 for write
+
+    for (int i=0; i<MAX_EC_TEXTURES; i++) {
+        logical[i].is_input = (inputs[i]!=NULL);
+        logical[i].first_use = -1;
+        logical[i].last_use = -1;
+        logical[i].first_write = -1;
+        logical[i].physical = -1;
+        repeat_first_access[i] = 0;
+    }
+
+    for (int s=0; s<num_filters; s++) {
+        c_filter *f = filters[s];
+        for (int t=0; t<f->num_textures; t++) {
+            t_pipeline_texture *lt;
+            int ec_id, is_write;
+            if (f->textures[t].texture) continue; // bound to the filter, not the exec context
+            ec_id = f->textures[t].ec_id;
+            if ((ec_id<0) || (ec_id>=MAX_EC_TEXTURES)) {
+                fprintf(stderr, "Filter '%s' uses texture %d out of range\n", filter_strings[s], ec_id);
+                parse_error = "Filter texture number out of range";
+                return 1;
+            }
+            lt = &logical[ec_id];
+            is_write = (t>=f->num_textures-f->num_dest_textures);
+            if (is_write && (lt->first_write<0)) lt->first_write = s;
+            if (lt->first_use<0) lt->first_use = s;
+            lt->last_use = s;
+            if ((s>=repeat_start) && (repeat_first_access[ec_id]==0)) {
+                repeat_first_access[ec_id] = is_write ? 2 : 1;
+            }
+        }
+    }
+
+    // A value read by a repeated stage before it is rewritten must survive every repeat
+    for (int i=0; i<MAX_EC_TEXTURES; i++) {
+        if ((repeat_first_access[i]==1) || (logical[i].is_output && (logical[i].first_use>=0))) {
+            logical[i].last_use = num_filters-1;
+        }
+    }
+    return 0;
+}
+
+/*f c_filter_pipeline::assign_physical
+ * Greedy interval assignment in stage order, lowest free texture first
+ */
+void c_filter_pipeline::assign_physical(void)
+{
+    int in_use[MAX_EC_TEXTURES];
+
+    num_physical = 0;
+    for (int s=0; s<num_filters; s++) {
+        for (int p=0; p<num_physical; p++) {
+            in_use[p] = 0;
+        }
+        for (int i=0; i<MAX_EC_TEXTURES; i++) {
+            t_pipeline_texture *lt = &logical[i];
+            if ((lt->physical>=0) && (lt->last_use>=s)) {
+                in_use[lt->physical] = 1;
+            }
+        }
+        for (int i=0; i<MAX_EC_TEXTURES; i++) {
+            t_pipeline_texture *lt = &logical[i];
+            int p;
+            if (lt->is_input || (lt->first_use!=s))
+                continue;
+            for (p=0; p<num_physical; p++) {
+                if (!in_use[p]) break;
+            }
+            if (p==num_physical) num_physical++;
+            in_use[p] = 1;
+            lt->physical = p;
+        }
+    }
+    peak_texture_bytes = (size_t)num_physical*width*height*4*sizeof(float);
+}
+
+/*f c_filter_pipeline::compile
+ * Compile every filter and assign textures; return 0 on success
+ *
+ * Every filter's compile is started before any is completed, so that
+ * the driver may compile the shaders in parallel
+ */
+int c_filter_pipeline::compile(void)
+{
+    int started[MAX_PIPELINE_FILTERS];
+    int failures=0;
+    if (parse_error) return 1;
+    for (int i=0; i<num_filters; i++) {
+        started[i] = 0;
+        if (!filters[i]) {
+            fprintf(stderr, "Filter '%s' not recognized\n", filter_strings[i]);
+            failures++;
+            continue;
+        }
+        if (filters[i]->parse_error) {
+            fprintf(stderr, "Filter '%s' parse error: %s\n", filter_strings[i], filters[i]->parse_error);
+            failures++;
+            continue;
+        }
+        if (filters[i]->compile_start()!=0) {
+            failures++;
+            continue;
+        }
+        started[i] = 1;
+    }
+    for (int i=0; i<num_filters; i++) {
+        if (started[i] && (filters[i]->compile_complete()!=0)) failures++;
+    }
+    if (failures>0) {
+        parse_error = "Failed to compile pipeline filters";
+        return 1;
+    }
+    if (analyse()!=0)
+        return 1;
+    assign_physical();
+    return 0;
+}
+
+/*f c_filter_pipeline::allocate
+ * Create the physical textures and fill in the exec context textures
+ */
+int c_filter_pipeline::allocate(t_exec_context *ec)
+{
+    if (!physical) {
+        physical = (t_texture_ptr *)calloc(num_physical+1, sizeof(t_texture_ptr));
+        for (int p=0; p<num_physical; p++) {
+            physical[p] = host_textures ? texture_create_host(width, height) : texture_create(width, height);
+            if (!physical[p]) {
+                parse_error = "Failed to create pipeline texture";
+                return 1;
+            }
+        }
+    }
+    for (int i=0; i<MAX_EC_TEXTURES; i++) {
+        if (logical[i].is_input) {
+            ec->textures[i] = inputs[i];
+        } else if (logical[i].physical>=0) {
+            ec->textures[i] = physical[logical[i].physical];
+        } else {
+            ec->textures[i] = NULL;
+        }
+    }
+    return 0;
+}
+
+/*f c_filter_pipeline::execute
+ * Execute stages first_stage up to (but not including) end_stage
+ *
+ * Each stage is completed only after the next has been started, so a
+ * readback (e.g. for find) overlaps the following filter's drawing
+ */
+void c_filter_pipeline::execute(t_exec_context *ec, int first_stage, int end_stage)
+{
+    c_filter *pending = NULL;
+    if (end_stage>num_filters) end_stage=num_filters;
+    for (int s=first_stage; s<end_stage; s++) {
+        filters[s]->execute_start(ec);
+        if (pending) pending->execute_complete(ec);
+        pending = filters[s];
+    }
+    if (pending) pending->execute_complete(ec);
+}
+
+/*f c_filter_pipeline::report
+ */
+void c_filter_pipeline::report(FILE *f)
+{
+    int num_logical=0;
+    for (int i=0; i<MAX_EC_TEXTURES; i++) {
+        if (logical[i].is_input || (logical[i].first_use<0)) continue;
+        fprintf(f, "  texture %2d: stages %3d to %3d, first written by %3d, in physical texture %d\n",
+                i, logical[i].first_use, logical[i].last_use, logical[i].first_write, logical[i].physical);
+        num_logical++;
+    }
+    fprintf(f, "Pipeline of %d filters uses %d intermediate textures in %d %dx%d textures, peak %.1fMB\n",
+            num_filters, num_logical, num_physical, width, height,
+            peak_texture_bytes/(1024.0*1024.0));
+}
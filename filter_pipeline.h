@@ -0,0 +1,106 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          filter_pipeline.h
+ * @brief         Ordered filter chains with shared intermediate textures
+ *
+ */
+
+/*a Wrapper
+ */
+#ifdef __INC_FILTER_PIPELINE
+#else
+#define __INC_FILTER_PIPELINE
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include "filter.h"
+
+/*a Defines
+ */
+#define MAX_PIPELINE_FILTERS 256
+
+/*a Types
+ */
+/*t t_pipeline_texture
+ * Liveness of one exec context texture number over the pipeline stages
+ */
+typedef struct
+{
+    int is_input;    // Provided by the caller with set_input
+    int is_output;   // Read by the caller after the pipeline, with set_output
+    int first_use;   // First stage reading or writing it, -1 if unused
+    int last_use;    // Last stage that needs its contents
+    int first_write; // First stage writing it, -1 if never written
+    int physical;    // Index in to physical textures, -1 if input or unused
+} t_pipeline_texture;
+
+/*c c_filter_pipeline
+ * An ordered list of filters whose texture numbers are logical; the
+ * pipeline works out from each filter's texture list which stages
+ * read and write each number, and backs numbers whose lifetimes do
+ * not overlap with the same physical texture.
+ *
+ * Stages from repeat_start onwards may be executed any number of
+ * times (e.g. once per point to match); a texture they read before
+ * writing is kept live to the end of the pipeline, as is any texture
+ * marked with set_output.
+ */
+class c_filter_pipeline
+{
+private:
+    int width;
+    int height;
+    int host_textures;
+    int repeat_start;
+    t_texture_ptr inputs[MAX_EC_TEXTURES];
+    t_pipeline_texture logical[MAX_EC_TEXTURES];
+    t_texture_ptr *physical;
+    const char *filter_strings[MAX_PIPELINE_FILTERS];
+    c_filter *filters[MAX_PIPELINE_FILTERS];
+
+    int analyse(void);
+    void assign_physical(void);
+
+public:
+    c_filter_pipeline(int width, int height, int host_textures);
+    ~c_filter_pipeline();
+    int add_filter(const char *filter_string);
+    void set_repeat_start(int stage) { repeat_start = stage; }
+    void set_input(int ec_id, t_texture_ptr texture);
+    void set_output(int ec_id);
+    int compile(void);
+    int allocate(t_exec_context *ec);
+    void execute(t_exec_context *ec, int first_stage, int end_stage);
+    void report(FILE *f);
+    c_filter *filter(int stage) { return filters[stage]; }
+
+    int num_filters;
+    int num_physical;
+    size_t peak_texture_bytes;
+    const char *parse_error;
+};
+
+/*a Wrapper
+ */
+#endif
+
+/*a Editor preferences and notes
+mode: c ***
+c-basic-offset: 4 ***
+c-default-style: (quote ((c-mode . "k&r") (c++-mode . "k&r"))) ***
+outline-regexp: "/\\\*a\\\|[\t ]*\/\\\*[b-z][\t ]" ***
+*/
@@ -0,0 +1,363 @@
+/*a Documentation
+ * Tests of the filters run on host textures (with the CPU backend),
+ * so no OpenGL context is required
+ */
+/*a Includes
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include "filter.h"
+#include "texture.h"
+#include "thread_pool.h"
+#include "test.h"
+
+/*a Support functions
+ */
+/*f gl_get_errors
+ */
+int gl_get_errors(const char *msg)
+{
+    return 0;
+}
+
+/*f run_filter
+ * Compile and execute a filter on the textures, and return the points
+ * it found (with the number in *num_points), to be freed by the caller
+ */
+static t_point_value *run_filter(const char *filter_string, t_texture_ptr *textures, int num_textures, int *num_points)
+{
+    t_exec_context ec;
+    c_filter *filter;
+
+    memset(&ec, 0, sizeof(ec));
+    for (int i=0; i<num_textures; i++) {
+        ec.textures[i] = textures[i];
+    }
+    ec.use_ids = 1;
+    *num_points = 0;
+    filter = filter_from_string(filter_string);
+    if (!filter) {
+        assert(0, WHERE, "Failed to create filter '%s'", filter_string);
+        return NULL;
+    }
+    assert(filter->parse_error==NULL, WHERE, "Failed to parse filter '%s'", filter_string);
+    assert(filter->compile()==0, WHERE, "Failed to compile filter '%s'", filter_string);
+    assert(filter->execute(&ec)==0, WHERE, "Failed to execute filter '%s'", filter_string);
+    delete filter;
+    *num_points = ec.num_points;
+    return ec.points;
+}
+
+/*a Reference find
+ */
+/*t t_reference_candidate
+ */
+typedef struct
+{
+    float value;
+    int x;
+    int y;
+    int place;
+} t_reference_candidate;
+
+/*f reference_cmp_candidate
+ * The comparison the find filter sorted its batches with
+ */
+static int reference_cmp_candidate(const void *a, const void *b)
+{
+    const t_reference_candidate *pa, *pb;
+    pa = (const t_reference_candidate *)a;
+    pb = (const t_reference_candidate *)b;
+    float diff = pb->value - pa->value;
+    if (diff<0) return -1;
+    return 1;
+}
+
+/*f reference_find
+ * The find filter as it was before the scan was split in to bands: the
+ * image is scanned in order, and each batch of 1024 candidates better
+ * than the worst kept is sorted and then inserted; then points near a
+ * stronger point are removed
+ */
+static int reference_find(const float *raw_img, int w, int h, int perimeter, int max_elements, float minimum, float min_distance, t_point_value *points)
+{
+    static const int max_new_points = 1024;
+    t_reference_candidate new_points[max_new_points];
+    float elements_minimum;
+    int num_new_points, n;
+
+    elements_minimum = -1.0;
+    if (elements_minimum<minimum) elements_minimum=minimum;
+    n = 0;
+    num_new_points = 0;
+    for (int y=perimeter; y<h-perimeter; y++) {
+        for (int x=perimeter; x<w-perimeter; x++) {
+            float value_xy = raw_img[(y*w+x)*4+0];
+            bool last = (y==h-perimeter-1) && (x==w-perimeter-1);
+            if (value_xy>elements_minimum) {
+                new_points[num_new_points].x     = x;
+                new_points[num_new_points].y     = y;
+                new_points[num_new_points].value = value_xy;
+                num_new_points++;
+            }
+            if ((!last) && (num_new_points<max_new_points))
+                continue;
+            if (num_new_points==0)
+                continue;
+            if (num_new_points>1) {
+                qsort(new_points, num_new_points, sizeof(t_reference_candidate), reference_cmp_candidate);
+            }
+            int i, j;
+            j=0;
+            for (i=0; (i<n) && (j<num_new_points);) {
+                if (points[i].value > new_points[j].value) {
+                    i++;
+                    continue;
+                }
+                if (i+j>=max_elements) break;
+                new_points[j].place = i+j;
+                j++;
+            }
+            while ((j<num_new_points) && (n+j<max_elements)) {
+                new_points[j].place = n+j;
+                j++;
+            }
+            int l = max_elements-j;
+            if (l>n) l=n;
+            n = l+j;
+            j--;
+            while (j>=0) {
+                int k = new_points[j].place;
+                if (k-j < l) {
+                    memmove(&points[k+1], &points[k-j], sizeof(t_point_value)*(l-(k-j)));
+                }
+                int px = new_points[j].x;
+                int py = new_points[j].y;
+                points[k].x     = px;
+                points[k].y     = py;
+                points[k].value = new_points[j].value;
+                points[k].vec_x = raw_img[(py*w+px)*4+1];
+                points[k].vec_y = raw_img[(py*w+px)*4+2];
+                l=k-j;
+                j--;
+            }
+            elements_minimum = points[n-1].value;
+            num_new_points = 0;
+        }
+    }
+
+    float min_distance_sq;
+    min_distance_sq = min_distance * min_distance;
+    for (int i=0; i<n; i++) {
+        int j;
+        j = i+1;
+        while (j<n) {
+            float dx, dy, d_sq;
+            dx = points[i].x-points[j].x;
+            dy = points[i].y-points[j].y;
+            d_sq = dx*dx+dy*dy;
+            if (d_sq>min_distance_sq) {
+                j++;
+                continue;
+            }
+            n--;
+            if (j<n) {
+                memmove(&points[j], &points[j+1], sizeof(t_point_value)*(n-j));
+            }
+        }
+    }
+    return n;
+}
+
+/*a Tests
+ */
+/*f fill_image
+ * Fill a host texture with values from 0 to 1; with num_levels>0 the
+ * values are quantized to that many levels, so many of them tie
+ */
+static void fill_image(t_texture_ptr texture, int w, int h, int num_levels, unsigned int seed)
+{
+    float *raw_img = (float *)texture_host_buffer(texture);
+    srand(seed);
+    for (int i=0; i<w*h; i++) {
+        float value = rand()/(float)RAND_MAX;
+        if (num_levels>0) value = ((int)(value*num_levels))/(float)num_levels;
+        raw_img[i*4+0] = value;
+        raw_img[i*4+1] = (float)(i%w);
+        raw_img[i*4+2] = (float)(i/w);
+        raw_img[i*4+3] = 1.0;
+    }
+}
+
+/*f test_find_matches_reference
+ * Check that the find filter finds the same points, in the same order,
+ * as the reference for one set of parameters
+ */
+static void test_find_matches_reference(t_texture_ptr texture, int w, int h, int perimeter, int max_elements, float minimum, float min_distance)
+{
+    char filter_string[256];
+    t_point_value *points, *ref_points;
+    int n, ref_n;
+
+    snprintf(filter_string, sizeof(filter_string), "find:a(0)&perimeter=%d&max_elements=%d&minimum=%f&min_distance=%f",
+             perimeter, max_elements, minimum, min_distance);
+    points = run_filter(filter_string, &texture, 1, &n);
+    ref_points = (t_point_value *)malloc(sizeof(t_point_value)*max_elements);
+    ref_n = reference_find((const float *)texture_host_buffer(texture), w, h, perimeter, max_elements, minimum, min_distance, ref_points);
+    assert(n==ref_n, WHERE, "%s found %d points, reference %d", filter_string, n, ref_n);
+    for (int i=0; (i<n) && (i<ref_n); i++) {
+        int same = ((points[i].x==ref_points[i].x) && (points[i].y==ref_points[i].y) &&
+                    (points[i].value==ref_points[i].value) &&
+                    (points[i].vec_x==ref_points[i].vec_x) && (points[i].vec_y==ref_points[i].vec_y));
+        assert(same, WHERE, "%s point %d is (%d,%d) %f, reference (%d,%d) %f",
+               filter_string, i, points[i].x, points[i].y, points[i].value,
+               ref_points[i].x, ref_points[i].y, ref_points[i].value);
+        if (!same) break;
+    }
+    free(points);
+    free(ref_points);
+}
+
+/*f test_find
+ * Compare the find filter with the reference on random images, with and
+ * without many tied values, for few and many candidates and elements
+ */
+static void test_find(void)
+{
+    static const int max_elements[] = {1, 2, 10, 100, 1000, 1023, 1024, 1025, 3000, 20000};
+    static const int num_levels[] = {0, 4, 64, 1024};
+    int w=211, h=97;
+    t_texture_ptr texture;
+
+    texture = texture_create_host(w, h);
+    for (int l=0; l<(int)(sizeof(num_levels)/sizeof(int)); l++) {
+        fill_image(texture, w, h, num_levels[l], 1+l);
+        for (int m=0; m<(int)(sizeof(max_elements)/sizeof(int)); m++) {
+            test_find_matches_reference(texture, w, h, 10, max_elements[m], 0.0, 0.0);
+            test_find_matches_reference(texture, w, h, 3, max_elements[m], 0.97, 0.0);
+            test_find_matches_reference(texture, w, h, 0, max_elements[m], 0.5, 2.5);
+            test_find_matches_reference(texture, w, h, 10, max_elements[m], 0.9, 10.0);
+        }
+    }
+    texture_destroy(texture);
+
+    // Fewer candidates than a batch
+    texture = texture_create_host(30, 20);
+    fill_image(texture, 30, 20, 4, 7);
+    test_find_matches_reference(texture, 30, 20, 2, 100, 0.0, 0.0);
+    test_find_matches_reference(texture, 30, 20, 2, 1000, 0.5, 0.0);
+    texture_destroy(texture);
+}
+
+/*f test_find_batches
+ * Compare the find filter with the reference where the first batch of
+ * candidates decides which later candidates are taken
+ */
+static void test_find_batches(void)
+{
+    int w=1024, h=32;
+    t_texture_ptr texture;
+    float *raw_img;
+
+    texture = texture_create_host(w, h);
+    raw_img = (float *)texture_host_buffer(texture);
+
+    // One more candidate than a batch, all the same; later ones are
+    // kept first, but the last is not better than the worst kept
+    for (int i=0; i<w*h; i++) {
+        raw_img[i*4+0] = (i<1025) ? 0.5 : 0.0;
+    }
+    test_find_matches_reference(texture, w, h, 0, 1, 0.0, 0.0);
+    test_find_matches_reference(texture, w, h, 0, 3, 0.0, 0.0);
+    test_find_matches_reference(texture, w, h, 0, 1025, 0.0, 0.0);
+
+    // The first batch ends with 0.9, 0.8, 0.5 then one more 0.5; the
+    // best 3 of the first 1025 candidates end with the second 0.5, but
+    // as it is not better than the first batch it is not taken
+    for (int i=0; i<w*h; i++) {
+        raw_img[i*4+0] = (i<1021) ? 0.2 : 0.0;
+    }
+    raw_img[1021*4+0] = 0.9;
+    raw_img[1022*4+0] = 0.8;
+    raw_img[1023*4+0] = 0.5;
+    raw_img[1024*4+0] = 0.5;
+    test_find_matches_reference(texture, w, h, 0, 3, 0.0, 0.0);
+    test_find_matches_reference(texture, w, h, 0, 4, 0.0, 0.0);
+
+    texture_destroy(texture);
+
+    // A batch of 0.5 then a batch of 0.6 with a 0.7 in it; the 0.7 is
+    // then the worst kept, so a later 0.7 is not taken. The bands of
+    // rows are narrower than two batches at the first width, and wider
+    // at the second
+    for (w=1024; w<=4096; w*=4) {
+        texture = texture_create_host(w, h);
+        raw_img = (float *)texture_host_buffer(texture);
+        for (int i=0; i<w*h; i++) {
+            raw_img[i*4+0] = (i<1024) ? 0.5 : ((i<2048) ? 0.6 : 0.0);
+        }
+        raw_img[1500*4+0] = 0.7;
+        raw_img[2100*4+0] = 0.7;
+        test_find_matches_reference(texture, w, h, 0, 1, 0.0, 0.0);
+        test_find_matches_reference(texture, w, h, 0, 2, 0.0, 0.0);
+        texture_destroy(texture);
+    }
+}
+
+/*f test_find_parameters
+ * Check that parameters given as strings in the filter string are
+ * converted to the find filter's integer and real parameters
+ */
+static void test_find_parameters(void)
+{
+    int w=64, h=48;
+    t_texture_ptr texture;
+    t_point_value *points;
+    int n;
+
+    texture = texture_create_host(w, h);
+    fill_image(texture, w, h, 0, 3);
+
+    points = run_filter("find:a(0)&max_elements=3&min_distance=0", &texture, 1, &n);
+    assert(n==3, WHERE, "Expected 3 points with max_elements=3, got %d", n);
+    free(points);
+
+    points = run_filter("find:a(0)&max_elements=1000&min_distance=0&minimum=0.9&perimeter=5", &texture, 1, &n);
+    assert(n>0, WHERE, "Expected points above a minimum of 0.9");
+    for (int i=0; i<n; i++) {
+        assert(points[i].value>0.9, WHERE, "Point %d value %f not above minimum of 0.9", i, points[i].value);
+        assert((points[i].x>=5) && (points[i].x<w-5) && (points[i].y>=5) && (points[i].y<h-5), WHERE,
+               "Point %d (%d,%d) inside perimeter of 5", i, points[i].x, points[i].y);
+    }
+    free(points);
+
+    points = run_filter("find:a(0)&max_elements=1000&min_distance=2.5&minimum=0.5", &texture, 1, &n);
+    for (int i=0; i<n; i++) {
+        for (int j=i+1; j<n; j++) {
+            float dx = points[i].x-points[j].x;
+            float dy = points[i].y-points[j].y;
+            assert(dx*dx+dy*dy>2.5*2.5, WHERE, "Points %d and %d within min_distance of 2.5", i, j);
+        }
+    }
+    free(points);
+    texture_destroy(texture);
+}
+
+/*a Toplevel
+ */
+/*f main
+ */
+extern int main(int argc, char **argv)
+{
+    filter_set_backend(filter_backend_cpu);
+    thread_pool_default(4); // So that the find scan is split in to bands
+    test_find_parameters();
+    test_find();
+    test_find_batches();
+    if (failures>0) {
+        exit(4);
+    }
+}
@@ -14,6 +14,8 @@
  */
 #include <Python.h>
 #include <OpenGL/gl3.h>
+#include "gl_context.h"
+#include "filter_cpu.h"
 #include "python_filter.h"
 #include "python_texture.h"
 #include "python_image_correlator.h"
@@ -42,12 +44,130 @@ int gl_get_errors(const char *msg)
     return num_errors;
 }
 
+/*f gjslib_c_gl_context
+ * Create an OpenGL context for the module (once), so that filters and
+ * textures can be used without a window; type is "egl", "osmesa" or
+ * "sdl", defaulting to the first the build supports
+ */
+static t_gl_context_ptr gjslib_c_context = NULL;
+static PyObject *
+gjslib_c_gl_context(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    const char *type_name = NULL;
+    t_gl_context_type type;
+
+    static const char *kwlist[] = {"type", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", (char **)kwlist, 
+                                     &type_name))
+        return NULL;
+
+    if (gjslib_c_context) {
+        Py_RETURN_NONE;
+    }
+    type = gl_context_default_type();
+    if (type_name && (gl_context_type_from_string(type_name, &type)!=0)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unsupported OpenGL context type");
+        return NULL;
+    }
+    gjslib_c_context = gl_context_create(type);
+    if (!gjslib_c_context) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to create OpenGL context");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/*f gjslib_c_match_corners
+ * Match a list of (x,y) corners (or find's points) in the source
+ * circle_dft texture against the target circle_dft texture; return a
+ * list (one per corner) of lists of (x,y,value,vec_x,vec_y), as find's
+ * points
+ */
+static PyObject *
+gjslib_c_match_corners(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *source, *target, *corner_list;
+    t_texture_ptr source_dft, target_dft;
+    t_corner_match_parameters parameters;
+    t_point_value *corners, *matches;
+    int *num_matches;
+    int num_corners;
+    PyObject *result;
+
+    static const char *kwlist[] = {"source", "target", "corners",
+                                   "max_matches", "max_candidates", "min_distance", "minimum", "perimeter", NULL};
+
+    filter_cpu_corner_match_defaults(&parameters);
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOO|iiddi", (char **)kwlist, 
+                                     &source, &target, &corner_list,
+                                     &parameters.max_matches, &parameters.max_candidates,
+                                     &parameters.min_distance, &parameters.minimum, &parameters.perimeter))
+        return NULL;
+
+    if (!python_texture_data(source, 0, (void *)&source_dft) ||
+        !python_texture_data(target, 0, (void *)&target_dft)) {
+        PyErr_SetString(PyExc_TypeError, "Source and target must be textures");
+        return NULL;
+    }
+    if (!PySequence_Check(corner_list)) {
+        PyErr_SetString(PyExc_TypeError, "Corners must be a list of (x,y)");
+        return NULL;
+    }
+    if (parameters.max_matches<1) parameters.max_matches=1;
+
+    num_corners = PySequence_Size(corner_list);
+    corners = (t_point_value *)calloc(num_corners+1, sizeof(t_point_value));
+    matches = (t_point_value *)malloc(sizeof(t_point_value)*(num_corners+1)*parameters.max_matches);
+    num_matches = (int *)calloc(num_corners+1, sizeof(int));
+    for (int i=0; i<num_corners; i++) {
+        PyObject *corner = PySequence_GetItem(corner_list, i);
+        int ok = (corner && PyArg_ParseTuple(corner, "ii|fff", &corners[i].x, &corners[i].y,
+                                             &corners[i].value, &corners[i].vec_x, &corners[i].vec_y));
+        Py_XDECREF(corner);
+        if (!ok) {
+            free(corners);
+            free(matches);
+            free(num_matches);
+            PyErr_SetString(PyExc_TypeError, "Corners must be a list of (x,y)");
+            return NULL;
+        }
+    }
+
+    if (filter_cpu_match_corners(source_dft, target_dft, corners, num_corners, &parameters, matches, num_matches)!=0) {
+        free(corners);
+        free(matches);
+        free(num_matches);
+        PyErr_SetString(PyExc_RuntimeError, "Failed to match corners");
+        return NULL;
+    }
+
+    result = PyList_New(0);
+    for (int i=0; i<num_corners; i++) {
+        PyObject *list = PyList_New(0);
+        for (int j=0; j<num_matches[i]; j++) {
+            t_point_value *pv = &matches[i*parameters.max_matches+j];
+            PyObject *point = Py_BuildValue("iifff", pv->x, pv->y, (double)pv->value, (double)pv->vec_x, (double)pv->vec_y);
+            PyList_Append(list, point);
+            Py_DECREF(point);
+        }
+        PyList_Append(result, list);
+        Py_DECREF(list);
+    }
+    free(corners);
+    free(matches);
+    free(num_matches);
+    return result;
+}
+
 /*a Statics
  */
 /*v gjslib_c_module_methods
  */
 static PyMethodDef gjslib_c_module_methods[] =
 {
+    {"gl_context", (PyCFunction)gjslib_c_gl_context, METH_VARARGS|METH_KEYWORDS, "Create an OpenGL context with no window"},
+    {"match_corners", (PyCFunction)gjslib_c_match_corners, METH_VARARGS|METH_KEYWORDS, "Match corners between two circle_dft textures"},
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
@@ -0,0 +1,388 @@
+/*a Documentation
+  The filters only render to textures through frame buffer objects, so
+  all they need is a current OpenGL 3.3 core context; no window or
+  default frame buffer is used.
+
+  SDL provides this with a small hidden window, which needs a display
+  server. EGL provides it without one, from the first of:
+
+    the Mesa surfaceless platform (EGL_MESA_platform_surfaceless)
+    a device platform display (EGL_EXT_platform_device), e.g. a GPU node
+    the default display
+
+  with a 1x1 pbuffer surface, or no surface at all if the display has
+  no pbuffer configuration but supports EGL_KHR_surfaceless_context.
+  OSMesa renders in software in to a 1x1 host buffer.
+ */
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <OpenGL/gl3.h>
+#include "gl_context.h"
+#ifdef GL_CONTEXT_SDL
+#include <SDL.h>
+#endif
+#ifdef GL_CONTEXT_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef GL_CONTEXT_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+/*a Defines
+ */
+#define MAX_EGL_DEVICES 8
+
+/*a Types
+ */
+/*t t_gl_context
+ */
+typedef struct t_gl_context
+{
+    t_gl_context_type type;
+#ifdef GL_CONTEXT_SDL
+    SDL_Window    *sdl_window;
+    SDL_GLContext sdl_context;
+#endif
+#ifdef GL_CONTEXT_EGL
+    EGLDisplay egl_display;
+    EGLSurface egl_surface;
+    EGLContext egl_context;
+#endif
+#ifdef GL_CONTEXT_OSMESA
+    OSMesaContext osmesa_context;
+    unsigned char osmesa_buffer[4];
+#endif
+} t_gl_context;
+
+/*a SDL context
+ */
+#ifdef GL_CONTEXT_SDL
+/*f sdl_check_error
+ */
+static void
+sdl_check_error(void)
+{
+    const char *error;
+    error = SDL_GetError();
+    if (*error != '\0') {
+        fprintf(stderr,"SDL Error: %s\n", error);
+        SDL_ClearError();
+    }
+}
+
+/*f sdl_context_create
+ */
+static int
+sdl_context_create(t_gl_context *context)
+{
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        sdl_check_error();
+        return 0;
+    }
+
+    SDL_GL_SetAttribute( SDL_GL_RED_SIZE, 8 );
+    SDL_GL_SetAttribute( SDL_GL_GREEN_SIZE, 8 );
+    SDL_GL_SetAttribute( SDL_GL_BLUE_SIZE, 8 );
+    SDL_GL_SetAttribute( SDL_GL_ALPHA_SIZE, 8 );
+
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    sdl_check_error();
+
+    context->sdl_window = SDL_CreateWindow("OpenGL Test",SDL_WINDOWPOS_UNDEFINED,SDL_WINDOWPOS_UNDEFINED,64, 64,
+                                           SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    sdl_check_error();
+    if (!context->sdl_window) {
+        SDL_Quit();
+        return 0;
+    }
+
+    context->sdl_context = SDL_GL_CreateContext(context->sdl_window);
+    if (!context->sdl_context) {
+        sdl_check_error();
+        SDL_DestroyWindow(context->sdl_window);
+        SDL_Quit();
+        return 0;
+    }
+    return 1;
+}
+
+/*f sdl_context_destroy
+ */
+static void
+sdl_context_destroy(t_gl_context *context)
+{
+    SDL_GL_DeleteContext(context->sdl_context);
+    SDL_DestroyWindow(context->sdl_window);
+    SDL_Quit();
+}
+#endif
+
+/*a EGL context
+ */
+#ifdef GL_CONTEXT_EGL
+/*f egl_has_extension
+ */
+static int
+egl_has_extension(const char *extensions, const char *name)
+{
+    int len;
+    if (!extensions) return 0;
+    len = strlen(name);
+    for (const char *p=strstr(extensions, name); p; p=strstr(p+len, name)) {
+        if (((p==extensions) || (p[-1]==' ')) && ((p[len]==0) || (p[len]==' ')))
+            return 1;
+    }
+    return 0;
+}
+
+/*f egl_initialize
+ */
+static EGLDisplay
+egl_initialize(EGLDisplay display)
+{
+    EGLint major, minor;
+    if (display==EGL_NO_DISPLAY)
+        return EGL_NO_DISPLAY;
+    if (!eglInitialize(display, &major, &minor))
+        return EGL_NO_DISPLAY;
+    return display;
+}
+
+/*f egl_get_display
+ */
+static EGLDisplay
+egl_get_display(void)
+{
+    const char *client_extensions;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+    EGLDisplay display;
+
+    client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    if (get_platform_display && egl_has_extension(client_extensions, "EGL_MESA_platform_surfaceless")) {
+        display = egl_initialize(get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL));
+        if (display!=EGL_NO_DISPLAY) return display;
+    }
+
+    if (get_platform_display && egl_has_extension(client_extensions, "EGL_EXT_platform_device")) {
+        PFNEGLQUERYDEVICESEXTPROC query_devices;
+        EGLDeviceEXT devices[MAX_EGL_DEVICES];
+        EGLint num_devices;
+        query_devices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+        if (query_devices && query_devices(MAX_EGL_DEVICES, devices, &num_devices)) {
+            for (int i=0; i<num_devices; i++) {
+                display = egl_initialize(get_platform_display(EGL_PLATFORM_DEVICE_EXT, devices[i], NULL));
+                if (display!=EGL_NO_DISPLAY) return display;
+            }
+        }
+    }
+
+    return egl_initialize(eglGetDisplay(EGL_DEFAULT_DISPLAY));
+}
+
+/*f egl_context_create
+ */
+static int
+egl_context_create(t_gl_context *context)
+{
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_NONE };
+    const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE };
+    const char *extensions;
+    EGLConfig config;
+    EGLint num_configs;
+
+    context->egl_display = egl_get_display();
+    if (context->egl_display==EGL_NO_DISPLAY) {
+        fprintf(stderr,"Failed to find an EGL display\n");
+        return 0;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr,"EGL display does not support OpenGL\n");
+        eglTerminate(context->egl_display);
+        return 0;
+    }
+
+    extensions = eglQueryString(context->egl_display, EGL_EXTENSIONS);
+    context->egl_surface = EGL_NO_SURFACE;
+    config = (EGLConfig)0;
+    if (eglChooseConfig(context->egl_display, config_attribs, &config, 1, &num_configs) && (num_configs>0)) {
+        context->egl_surface = eglCreatePbufferSurface(context->egl_display, config, pbuffer_attribs);
+    } else if (!egl_has_extension(extensions, "EGL_KHR_no_config_context") ||
+               !egl_has_extension(extensions, "EGL_KHR_surfaceless_context")) {
+        fprintf(stderr,"EGL display has neither a pbuffer configuration nor surfaceless contexts\n");
+        eglTerminate(context->egl_display);
+        return 0;
+    }
+
+    context->egl_context = eglCreateContext(context->egl_display, config, EGL_NO_CONTEXT, context_attribs);
+    if (context->egl_context==EGL_NO_CONTEXT) {
+        fprintf(stderr,"Failed to create EGL OpenGL 3.3 core context (error %x)\n", eglGetError());
+        if (context->egl_surface!=EGL_NO_SURFACE) eglDestroySurface(context->egl_display, context->egl_surface);
+        eglTerminate(context->egl_display);
+        return 0;
+    }
+    if (!eglMakeCurrent(context->egl_display, context->egl_surface, context->egl_surface, context->egl_context)) {
+        fprintf(stderr,"Failed to make EGL context current (error %x)\n", eglGetError());
+        eglDestroyContext(context->egl_display, context->egl_context);
+        if (context->egl_surface!=EGL_NO_SURFACE) eglDestroySurface(context->egl_display, context->egl_surface);
+        eglTerminate(context->egl_display);
+        return 0;
+    }
+    return 1;
+}
+
+/*f egl_context_destroy
+ */
+static void
+egl_context_destroy(t_gl_context *context)
+{
+    eglMakeCurrent(context->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(context->egl_display, context->egl_context);
+    if (context->egl_surface!=EGL_NO_SURFACE) eglDestroySurface(context->egl_display, context->egl_surface);
+    eglTerminate(context->egl_display);
+}
+#endif
+
+/*a OSMesa context
+ */
+#ifdef GL_CONTEXT_OSMESA
+/*f osmesa_context_create
+ */
+static int
+osmesa_context_create(t_gl_context *context)
+{
+    const int attribs[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_DEPTH_BITS, 0,
+        OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, 3,
+        OSMESA_CONTEXT_MINOR_VERSION, 3,
+        0 };
+    context->osmesa_context = OSMesaCreateContextAttribs(attribs, NULL);
+    if (!context->osmesa_context) {
+        fprintf(stderr,"Failed to create OSMesa OpenGL 3.3 core context\n");
+        return 0;
+    }
+    if (!OSMesaMakeCurrent(context->osmesa_context, context->osmesa_buffer, GL_UNSIGNED_BYTE, 1, 1)) {
+        fprintf(stderr,"Failed to make OSMesa context current\n");
+        OSMesaDestroyContext(context->osmesa_context);
+        return 0;
+    }
+    return 1;
+}
+
+/*f osmesa_context_destroy
+ */
+static void
+osmesa_context_destroy(t_gl_context *context)
+{
+    OSMesaDestroyContext(context->osmesa_context);
+}
+#endif
+
+/*a External functions
+ */
+/*f gl_context_default_type
+ */
+t_gl_context_type
+gl_context_default_type(void)
+{
+#if defined(GL_CONTEXT_EGL)
+    return gl_context_type_egl;
+#elif defined(GL_CONTEXT_OSMESA)
+    return gl_context_type_osmesa;
+#elif defined(GL_CONTEXT_SDL)
+    return gl_context_type_sdl;
+#else
+    return gl_context_type_none;
+#endif
+}
+
+/*f gl_context_type_from_string
+ */
+int
+gl_context_type_from_string(const char *name, t_gl_context_type *type)
+{
+#ifdef GL_CONTEXT_SDL
+    if (!strcmp(name, "sdl")) { *type = gl_context_type_sdl; return 0; }
+#endif
+#ifdef GL_CONTEXT_EGL
+    if (!strcmp(name, "egl")) { *type = gl_context_type_egl; return 0; }
+#endif
+#ifdef GL_CONTEXT_OSMESA
+    if (!strcmp(name, "osmesa")) { *type = gl_context_type_osmesa; return 0; }
+#endif
+    return 1;
+}
+
+/*f gl_context_create
+ */
+t_gl_context_ptr
+gl_context_create(t_gl_context_type type)
+{
+    t_gl_context *context;
+    int ok;
+
+    context = (t_gl_context *)malloc(sizeof(t_gl_context));
+    context->type = type;
+    ok = 0;
+    switch (type) {
+#ifdef GL_CONTEXT_SDL
+    case gl_context_type_sdl:    ok = sdl_context_create(context); break;
+#endif
+#ifdef GL_CONTEXT_EGL
+    case gl_context_type_egl:    ok = egl_context_create(context); break;
+#endif
+#ifdef GL_CONTEXT_OSMESA
+    case gl_context_type_osmesa: ok = osmesa_context_create(context); break;
+#endif
+    default:
+        fprintf(stderr,"OpenGL context type %d not supported by this build\n", (int)type);
+        break;
+    }
+    if (!ok) {
+        free(context);
+        return NULL;
+    }
+    fprintf(stderr, "Using OpenGL version %s\n", (const char *)glGetString(GL_VERSION));
+    return context;
+}
+
+/*f gl_context_destroy
+ */
+void
+gl_context_destroy(t_gl_context_ptr context)
+{
+    if (!context)
+        return;
+    switch (context->type) {
+#ifdef GL_CONTEXT_SDL
+    case gl_context_type_sdl:    sdl_context_destroy(context); break;
+#endif
+#ifdef GL_CONTEXT_EGL
+    case gl_context_type_egl:    egl_context_destroy(context); break;
+#endif
+#ifdef GL_CONTEXT_OSMESA
+    case gl_context_type_osmesa: osmesa_context_destroy(context); break;
+#endif
+    default:
+        break;
+    }
+    free(context);
+}
@@ -0,0 +1,78 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          gl_context.h
+ * @brief         OpenGL 3.3 core context creation, with or without a display
+ *
+ */
+
+/*a Wrapper
+ */
+#ifdef __INC_GL_CONTEXT
+#else
+#define __INC_GL_CONTEXT
+
+/*a Types
+ */
+/*t t_gl_context_type
+ * Which providers are available depends on the build: GL_CONTEXT_SDL,
+ * GL_CONTEXT_EGL and GL_CONTEXT_OSMESA
+ */
+typedef enum
+{
+    gl_context_type_none,
+    gl_context_type_sdl,    // Hidden SDL window; needs a display
+    gl_context_type_egl,    // Surfaceless or pbuffer EGL context; no display needed
+    gl_context_type_osmesa, // Mesa off-screen software context
+} t_gl_context_type;
+
+/*t t_gl_context_ptr
+ */
+typedef struct t_gl_context *t_gl_context_ptr;
+
+/*a External functions
+ */
+/*f gl_context_default_type
+ * The first of EGL, OSMesa and SDL that the build supports
+ */
+extern t_gl_context_type
+gl_context_default_type(void);
+
+/*f gl_context_type_from_string
+ * Return 0 and set type for "sdl", "egl" or "osmesa" if supported by the build
+ */
+extern int
+gl_context_type_from_string(const char *name, t_gl_context_type *type);
+
+/*f gl_context_create
+ * Create an OpenGL 3.3 core context and make it current; NULL on failure
+ */
+extern t_gl_context_ptr
+gl_context_create(t_gl_context_type type);
+
+/*f gl_context_destroy
+ */
+extern void
+gl_context_destroy(t_gl_context_ptr context);
+
+/*a Wrapper
+ */
+#endif
+
+/*a Editor preferences and notes
+mode: c ***
+c-basic-offset: 4 ***
+c-default-style: (quote ((c-mode . "k&r") (c++-mode . "k&r"))) ***
+outline-regexp: "/\\\*a\\\|[\t ]*\/\\\*[b-z][\t ]" ***
+*/
@@ -37,11 +37,16 @@
 #include <math.h>
 #include "quaternion.h"
 #include "lens_projection.h"
+#include "thread_pool.h"
 #include <string>
 
 /*a Defines
  */
 #define MAX_POLY_COEFFS 8
+// Points converted together, a stage at a time, by the array methods
+#define LENS_PROJECTION_BLOCK 64
+// Minimum points for use_threads to use the thread pool
+#define LENS_PROJECTION_PARALLEL_MIN 4096
 
 /*a Types
  */
@@ -76,6 +81,10 @@ polynomial_calc(const t_polynomial *poly, double x)
     return r;
 }
 
+/*v c_lens_projection::last_state_id
+ */
+uint64_t c_lens_projection::last_state_id;
+
 /*f add_named_polynomial
  */
 std::map<std::string, struct t_named_polynomial *>c_lens_projection::named_polynomials;
@@ -119,6 +128,9 @@ c_lens_projection::c_lens_projection(void)
     offset_to_angle = &c_lens_projection::offset_to_angle_equidistant;
     angle_to_offset = &c_lens_projection::angle_to_offset_equidistant;
     orientation = c_quaternion::identity();
+    lookup_interpolation = lens_lookup_none;
+    lookup_entries = 0;
+    changed();
     if (named_polynomials.count("__linear")==0) {
         static double linear_poly[1]={1.0};
         add_named_polynomial("__linear", 1, linear_poly, 1, linear_poly);
@@ -137,6 +149,7 @@ void c_lens_projection::orient(const c_quaternion &orientation)
 {
     this->orientation = orientation;
     this->orientation.normalize();
+    changed();
 }
 
 /*f c_lens_projection::set_lens
@@ -169,14 +182,19 @@ void c_lens_projection::set_lens(double frame_width, double focal_length, t_lens
         break;
     }
     }
+    build_lookup_tables();
+    changed();
 }
 
 /*f c_lens_projection::set_sensor
+  The lookup tables map offsets as fractions of the frame, so do not
+  depend on the sensor
  */
 void c_lens_projection::set_sensor(double width, double height)
 {
     this->width = width;
     this->height = height;
+    changed();
 }
 
 /*f c_lens_projection::set_polynomial
@@ -189,6 +207,107 @@ c_lens_projection::set_polynomial(const char *name)
     offset_to_angle = &c_lens_projection::offset_to_angle_polynomial;
     angle_to_offset = &c_lens_projection::angle_to_offset_polynomial;
     polynomial = named_polynomials[name];
+    build_lookup_tables();
+    changed();
+    return 0;
+}
+
+/*a Lookup tables
+ */
+/*f c_lens_projection::set_lookup_table
+ */
+void c_lens_projection::set_lookup_table(int num_entries, t_lens_lookup_interpolation interpolation)
+{
+    if (num_entries<4) interpolation = lens_lookup_none;
+    lookup_interpolation = interpolation;
+    lookup_entries = num_entries;
+    build_lookup_tables();
+    changed();
+}
+
+/*f c_lens_projection::get_lookup_max_error
+ */
+void c_lens_projection::get_lookup_max_error(double errors[2]) const
+{
+    errors[0] = 0.0;
+    errors[1] = 0.0;
+    if (lookup_interpolation==lens_lookup_none)
+        return;
+    errors[0] = lookup_offset_to_angle.max_error;
+    errors[1] = lookup_angle_to_offset.max_error;
+}
+
+/*f c_lens_projection::build_lookup_tables
+  Offsets are covered up to LENS_LOOKUP_MAX_OFFSET, and angles up to
+  the angle of that offset (at most pi); beyond these the model is used
+ */
+void c_lens_projection::build_lookup_tables(void)
+{
+    double max_angle;
+    if (lookup_interpolation==lens_lookup_none) {
+        lookup_offset_to_angle.values.clear();
+        lookup_angle_to_offset.values.clear();
+        return;
+    }
+    max_angle = fabs((this->*offset_to_angle)(LENS_LOOKUP_MAX_OFFSET));
+    if (max_angle>M_PI) max_angle=M_PI;
+    build_lookup_table(&lookup_offset_to_angle, LENS_LOOKUP_MAX_OFFSET, 1);
+    build_lookup_table(&lookup_angle_to_offset, max_angle, 0);
+}
+
+/*f c_lens_projection::build_lookup_table
+  Sample offset_to_angle (or angle_to_offset) at lookup_entries points
+  across [-x_max, x_max], and find the maximum error by comparing the
+  interpolation with the model at several points within every interval
+ */
+void c_lens_projection::build_lookup_table(t_lens_lookup_table *table, double x_max, int to_angle)
+{
+    int n = lookup_entries;
+    table->values.clear();
+    table->max_error = 0.0;
+    table->x_max = x_max;
+    if (!(x_max>0.0))
+        return;
+    table->step = 2*x_max/(n-1);
+    table->inv_step = 1.0/table->step;
+    table->values.resize(n+2);
+    for (int j=0; j<n+2; j++) {
+        double x = -x_max+(j-1)*table->step;
+        table->values[j] = to_angle ? (this->*offset_to_angle)(x) : (this->*angle_to_offset)(x);
+    }
+    for (int j=0; j<n-1; j++) {
+        for (int k=1; k<8; k++) {
+            double x = -x_max+(j+k/8.0)*table->step;
+            double y, exact;
+            exact = to_angle ? (this->*offset_to_angle)(x) : (this->*angle_to_offset)(x);
+            lookup(table, x, &y);
+            if (fabs(y-exact)>table->max_error) table->max_error=fabs(y-exact);
+        }
+    }
+}
+
+/*f c_lens_projection::lookup
+  Interpolate the table at x; return 1 if x is outside the table (with y unset)
+
+  Cubic interpolation is Catmull-Rom through the four nearest samples
+ */
+int c_lens_projection::lookup(const t_lens_lookup_table *table, double x, double *y) const
+{
+    double t, f;
+    int j;
+    const double *v;
+    if (!(fabs(x)<=table->x_max) || table->values.empty())
+        return 1;
+    t = (x+table->x_max)*table->inv_step;
+    j = (int)t;
+    if (j>(int)table->values.size()-4) j=(int)table->values.size()-4;
+    f = t-j;
+    v = &(table->values[j]); // v[1] is the sample at or below x
+    if (lookup_interpolation==lens_lookup_linear) {
+        *y = v[1] + f*(v[2]-v[1]);
+    } else {
+        *y = v[1] + 0.5*f*(v[2]-v[0] + f*(2*v[0]-5*v[1]+4*v[2]-v[3] + f*(3*(v[1]-v[2])+v[3]-v[0])));
+    }
     return 0;
 }
 
@@ -274,7 +393,8 @@ void c_lens_projection::xy_to_roll_yaw(const double xy[2], double ry[2]) const
 {
     double r = sqrt(xy[0]*xy[0]/width/width+xy[1]*xy[1]/height/height);
     double roll = atan2(xy[1]*width, xy[0]*height);
-    double yaw  = (this->*offset_to_angle)(r); 
+    double yaw;
+    offsets_to_angles(1, &r, &yaw);
     ry[0] = roll;
     ry[1] = yaw;
 }
@@ -284,7 +404,8 @@ void c_lens_projection::xy_to_roll_yaw(const double xy[2], double ry[2]) const
  */
 void c_lens_projection::roll_yaw_to_xy(const double ry[2], double xy[2]) const
 {
-    double r = (this->*angle_to_offset)(ry[1]);
+    double r;
+    angles_to_offsets(1, &ry[1], &r);
     xy[0] = width  * r * cos(ry[0]);
     xy[1] = height * r * sin(ry[0]);
 }
@@ -294,9 +415,9 @@ void c_lens_projection::roll_yaw_to_xy(const double ry[2], double xy[2]) const
  */
 c_quaternion c_lens_projection::orientation_of_xy(const double xy[2]) const
 {
-    double ry[2];
-    xy_to_roll_yaw(xy, ry);
-    return this->orientation * c_quaternion::roll(ry[0],0) * c_quaternion::yaw(ry[1],0);
+    double rijk[4];
+    orientation_of_xy_block(1, xy, rijk);
+    return c_quaternion::rijk(rijk[0], rijk[1], rijk[2], rijk[3]);
 }
 
 /*f c_lens_projection::xy_of_orientation
@@ -304,32 +425,178 @@ c_quaternion c_lens_projection::orientation_of_xy(const double xy[2]) const
  */
 void c_lens_projection::xy_of_orientation(const c_quaternion *orientation, double xy[2]) const
 {
-    c_quaternion q = c_quaternion(this->orientation);
-    c_quaternion qc;
-    c_quaternion mapped_001;
-    double rxyz[4];
-    double roll, yaw;
-    double ry[2];
-
-    q.conjugate();          // invert this camera orientation
-    q = q * (*orientation); // add the input orientation
-
-    q.normalize();
-    // q is now input orientation - camera orientation
-    // Find how (0,0,1) is mapped through q
-    qc = c_quaternion(q);
-    qc.conjugate();
-    mapped_001 = q * c_quaternion::rijk(0,0,0,1) * qc;
-
-    // recover as rxyz[1..3]
-    mapped_001.get_rijk(rxyz);
-
-    yaw  = acos(rxyz[3]); // yaw that gets mapped z back to 1
-    roll = atan2(rxyz[1], rxyz[2]); // to get (x,y) mapped to (0,0) after z is mapped back to 1
-    ry[0] = -roll;
-    ry[1] = -yaw;
-    roll_yaw_to_xy(ry, xy);
-    return;
+    double rijk[4];
+    orientation->get_rijk(rijk);
+    xy_of_orientation_block(1, rijk, xy);
+}
+
+/*a Array methods
+ */
+/*f c_lens_projection::offsets_to_angles
+  Array form of offset_to_angle; the standard projections are loops
+  the compiler can keep in registers (or vectorize)
+
+  With a lookup table the table is used for offsets within it
+ */
+void c_lens_projection::offsets_to_angles(int n, const double *offsets, double *angles) const
+{
+    if (lookup_interpolation!=lens_lookup_none) {
+        for (int i=0; i<n; i++) {
+            if (lookup(&lookup_offset_to_angle, offsets[i], &angles[i]))
+                angles[i] = (this->*offset_to_angle)(offsets[i]);
+        }
+    } else if (offset_to_angle==&c_lens_projection::offset_to_angle_equidistant) {
+        for (int i=0; i<n; i++) angles[i] = offsets[i]*frame_width/focal_length;
+    } else if (offset_to_angle==&c_lens_projection::offset_to_angle_rectilinear) {
+        for (int i=0; i<n; i++) angles[i] = atan2(offsets[i]*frame_width, focal_length);
+    } else if (offset_to_angle==&c_lens_projection::offset_to_angle_stereographic) {
+        for (int i=0; i<n; i++) angles[i] = 2*atan2(offsets[i]*frame_width, 2*focal_length);
+    } else {
+        for (int i=0; i<n; i++) angles[i] = (this->*offset_to_angle)(offsets[i]);
+    }
+}
+
+/*f c_lens_projection::angles_to_offsets
+  Array form of angle_to_offset
+ */
+void c_lens_projection::angles_to_offsets(int n, const double *angles, double *offsets) const
+{
+    if (lookup_interpolation!=lens_lookup_none) {
+        for (int i=0; i<n; i++) {
+            if (lookup(&lookup_angle_to_offset, angles[i], &offsets[i]))
+                offsets[i] = (this->*angle_to_offset)(angles[i]);
+        }
+    } else if (angle_to_offset==&c_lens_projection::angle_to_offset_equidistant) {
+        for (int i=0; i<n; i++) offsets[i] = angles[i]*focal_length/frame_width;
+    } else if (angle_to_offset==&c_lens_projection::angle_to_offset_rectilinear) {
+        for (int i=0; i<n; i++) offsets[i] = tan(angles[i])*focal_length/frame_width;
+    } else if (angle_to_offset==&c_lens_projection::angle_to_offset_stereographic) {
+        for (int i=0; i<n; i++) offsets[i] = 2*tan(angles[i]/2)*focal_length/frame_width;
+    } else {
+        for (int i=0; i<n; i++) offsets[i] = (this->*angle_to_offset)(angles[i]);
+    }
+}
+
+/*f c_lens_projection::orientation_of_xy_block
+  Up to LENS_PROJECTION_BLOCK points, a stage at a time over arrays
+
+  The result is orientation * roll(roll) * yaw(yaw) (see xy_to_roll_yaw),
+  with the quaternion products expanded for roll=(cr,0,0,sr) and
+  yaw=(cy,sy,0,0), giving the same values as the c_quaternion operations
+ */
+void c_lens_projection::orientation_of_xy_block(int n, const double *xy, double *rijk) const
+{
+    double offset[LENS_PROJECTION_BLOCK];
+    double roll[LENS_PROJECTION_BLOCK];
+    double yaw[LENS_PROJECTION_BLOCK];
+    double o[4];
+
+    for (int p=0; p<n; p++) {
+        double x=xy[2*p+0], y=xy[2*p+1];
+        offset[p] = sqrt(x*x/width/width+y*y/height/height);
+        roll[p]   = atan2(y*width, x*height);
+    }
+    offsets_to_angles(n, offset, yaw);
+    orientation.get_rijk(o);
+    for (int p=0; p<n; p++) {
+        double cr=cos(roll[p]/2), sr=sin(roll[p]/2);
+        double cy=cos(yaw[p]/2),  sy=sin(yaw[p]/2);
+        double r, i, j, k;
+        r = o[0]*cr - o[3]*sr; // orientation * roll
+        i = o[1]*cr + o[2]*sr;
+        j = o[2]*cr - o[1]*sr;
+        k = o[0]*sr + o[3]*cr;
+        rijk[4*p+0] = r*cy - i*sy; // * yaw
+        rijk[4*p+1] = r*sy + i*cy;
+        rijk[4*p+2] = j*cy + k*sy;
+        rijk[4*p+3] = k*cy - j*sy;
+    }
+}
+
+/*f c_lens_projection::xy_of_orientation_block
+  Up to LENS_PROJECTION_BLOCK points, a stage at a time over arrays
+
+  Each orientation q is taken relative to the camera (~orientation * q,
+  normalized), and (x,y,z), the image of (0,0,1) under it, found from
+  q * (0,0,0,1) * ~q; yaw is acos(z) and roll atan2(x,y), and both are
+  negated for roll_yaw_to_xy
+ */
+void c_lens_projection::xy_of_orientation_block(int n, const double *rijk, double *xy) const
+{
+    double mx[LENS_PROJECTION_BLOCK];
+    double my[LENS_PROJECTION_BLOCK];
+    double mz[LENS_PROJECTION_BLOCK];
+    double offset[LENS_PROJECTION_BLOCK];
+    double o[4];
+
+    orientation.get_rijk(o);
+    for (int p=0; p<n; p++) {
+        const double *q2 = rijk+4*p;
+        double r, i, j, k, l;
+        double pr, pi, pj, pk;
+        r = o[0]*q2[0] + o[1]*q2[1] + o[2]*q2[2] + o[3]*q2[3]; // ~orientation * q
+        i = o[0]*q2[1] - o[1]*q2[0] - o[2]*q2[3] + o[3]*q2[2];
+        j = o[0]*q2[2] - o[2]*q2[0] - o[3]*q2[1] + o[1]*q2[3];
+        k = o[0]*q2[3] - o[3]*q2[0] - o[1]*q2[2] + o[2]*q2[1];
+        l = sqrt(r*r + i*i + j*j + k*k); // normalize, as c_quaternion::normalize
+        if ((l<=-1E-20) || (l>=1E-20)) {
+            l = 1.0/l;
+            r*=l; i*=l; j*=l; k*=l;
+        }
+        pr = -k; pi = j; pj = -i; pk = r; // q * (0,0,0,1)
+        mx[p] = -pr*i + pi*r - pj*k + pk*j; // * ~q
+        my[p] = -pr*j + pj*r - pk*i + pi*k;
+        mz[p] = -pr*k + pk*r - pi*j + pj*i;
+    }
+    for (int p=0; p<n; p++) {
+        double roll = atan2(mx[p], my[p]);
+        mz[p] = -acos(mz[p]); // -yaw
+        mx[p] = cos(-roll);
+        my[p] = sin(-roll);
+    }
+    angles_to_offsets(n, mz, offset);
+    for (int p=0; p<n; p++) {
+        xy[2*p+0] = width  * offset[p] * mx[p];
+        xy[2*p+1] = height * offset[p] * my[p];
+    }
+}
+
+/*f c_lens_projection::orientation_of_xy_array
+ */
+void c_lens_projection::orientation_of_xy_array(int n, const double *xy, double *rijk, int use_threads) const
+{
+    int num_blocks = (n+LENS_PROJECTION_BLOCK-1)/LENS_PROJECTION_BLOCK;
+    auto convert_blocks = [&](int start, int end) {
+        for (int b=start; b<end; b++) {
+            int p = b*LENS_PROJECTION_BLOCK;
+            int np = (n-p<LENS_PROJECTION_BLOCK) ? (n-p) : LENS_PROJECTION_BLOCK;
+            orientation_of_xy_block(np, xy+2*p, rijk+4*p);
+        }
+    };
+    if (use_threads && (n>=LENS_PROJECTION_PARALLEL_MIN)) {
+        thread_pool_default()->parallel_for(num_blocks, 4, convert_blocks);
+    } else {
+        convert_blocks(0, num_blocks);
+    }
+}
+
+/*f c_lens_projection::xy_of_orientation_array
+ */
+void c_lens_projection::xy_of_orientation_array(int n, const double *rijk, double *xy, int use_threads) const
+{
+    int num_blocks = (n+LENS_PROJECTION_BLOCK-1)/LENS_PROJECTION_BLOCK;
+    auto convert_blocks = [&](int start, int end) {
+        for (int b=start; b<end; b++) {
+            int p = b*LENS_PROJECTION_BLOCK;
+            int np = (n-p<LENS_PROJECTION_BLOCK) ? (n-p) : LENS_PROJECTION_BLOCK;
+            xy_of_orientation_block(np, rijk+4*p, xy+2*p);
+        }
+    };
+    if (use_threads && (n>=LENS_PROJECTION_PARALLEL_MIN)) {
+        thread_pool_default()->parallel_for(num_blocks, 4, convert_blocks);
+    } else {
+        convert_blocks(0, num_blocks);
+    }
 }
 
 /*f c_lens_projection::__str__
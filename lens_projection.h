@@ -26,9 +26,18 @@
 /*a Includes
  */
 #include "quaternion.h"
+#include <stdint.h>
 #include <map>
 #include <string>
+#include <vector>
 
+/*a Defines
+ */
+// Largest offset (fraction of frame width from the center) covered by lookup tables
+#define LENS_LOOKUP_MAX_OFFSET 1.5
+
+/*a Types
+ */
 /*t t_lens_projection_type
  */
 typedef enum
@@ -40,6 +49,27 @@ typedef enum
     lens_projection_type_polynomial    = 3
 } t_lens_projection_type;
 
+/*t t_lens_lookup_interpolation
+ */
+typedef enum
+{
+    lens_lookup_none,   // Evaluate the lens model for every point
+    lens_lookup_linear,
+    lens_lookup_cubic,  // Catmull-Rom
+} t_lens_lookup_interpolation;
+
+/*t t_lens_lookup_table
+ * Uniformly sampled function over [-x_max, x_max], with one extra
+ * sample beyond each end for cubic interpolation
+ */
+typedef struct
+{
+    double x_max;
+    double step, inv_step;
+    std::vector<double> values; // values[j] is f(-x_max+(j-1)*step)
+    double max_error;           // Largest interpolation error found when built
+} t_lens_lookup_table;
+
 /*f c_lens_projection
  * Lens projection
  */
@@ -56,6 +86,13 @@ private:
     double angle_to_offset_rectilinear(double angle) const;
     double angle_to_offset_stereographic(double angle) const;
     double angle_to_offset_polynomial(double angle) const;
+    int lookup(const t_lens_lookup_table *table, double x, double *y) const;
+    void build_lookup_table(t_lens_lookup_table *table, double x_max, int to_angle);
+    void build_lookup_tables(void);
+    void offsets_to_angles(int n, const double *offsets, double *angles) const;
+    void angles_to_offsets(int n, const double *angles, double *offsets) const;
+    void orientation_of_xy_block(int n, const double *xy, double *rijk) const;
+    void xy_of_orientation_block(int n, const double *rijk, double *xy) const;
 
     double width, height; // in 'sensor' or 'image' units (e.g. pixels)
     double frame_width;   // in lens units, same as focal length
@@ -65,8 +102,15 @@ private:
     f_offset_to_angle offset_to_angle;
     f_angle_to_offset angle_to_offset;
     struct t_named_polynomial *polynomial;
+    uint64_t state_id;
+    t_lens_lookup_interpolation lookup_interpolation;
+    int lookup_entries;
+    t_lens_lookup_table lookup_offset_to_angle;
+    t_lens_lookup_table lookup_angle_to_offset;
 
     static std::map<std::string, struct t_named_polynomial *>named_polynomials;
+    static uint64_t last_state_id;
+    void changed(void) { state_id = ++last_state_id; }
 public:
     c_lens_projection(void);
     ~c_lens_projection();
@@ -84,15 +128,32 @@ public:
     inline void   get_sensor(double wh[2]) { wh[0]=width; wh[1]=height; }
     inline double get_sensor_width(void)  { return width; }
     inline double get_sensor_height(void) { return height; }
-    inline c_quaternion &get_orientation(void) { return orientation; }
+    inline const c_quaternion &get_orientation(void) const { return orientation; }
+    // A new state id, unique over all projections, is given by every change
+    // (orient, set_lens, set_sensor, set_polynomial), so it can key caches
+    // of data derived from the projection
+    inline uint64_t get_state_id(void) const { return state_id; }
     void orient(const c_quaternion &orientation);
     void set_lens(double frame_width, double focal_length, t_lens_projection_type lens_type);
     void set_sensor(double width, double height);
     int set_polynomial(const char *name);
+    // Use tables of num_entries samples (rebuilt whenever the lens changes)
+    // for the offset/angle mapping, rather than the lens model, for offsets
+    // up to LENS_LOOKUP_MAX_OFFSET; num_entries of 0 (or lens_lookup_none)
+    // evaluates the model for every point
+    void set_lookup_table(int num_entries, t_lens_lookup_interpolation interpolation);
+    // The largest errors of the tables found when built: in angle (radians)
+    // of offset to angle, and in offset (fraction of frame width) of angle to offset
+    void get_lookup_max_error(double errors[2]) const;
     void xy_to_roll_yaw(const double xy[2], double ry[2]) const;
     void roll_yaw_to_xy(const double ry[2], double xy[2]) const;
     c_quaternion orientation_of_xy(const double xy[2]) const;
     void xy_of_orientation(const c_quaternion *orientation, double xy[2]) const;
+    // Array forms: n (x,y) pairs to or from n packed (r,i,j,k) orientations;
+    // with use_threads, large arrays are split over the default thread pool
+    // (so they must not be called from inside a thread pool chunk)
+    void orientation_of_xy_array(int n, const double *xy, double *rijk, int use_threads=0) const;
+    void xy_of_orientation_array(int n, const double *rijk, double *xy, int use_threads=0) const;
 
     void __str__(char *buffer, int buf_size) const;
 };
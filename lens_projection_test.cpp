@@ -25,6 +25,142 @@ static void display(const char *msg, c_quaternion &a)
     fprintf(stderr, "%s : %s\n",msg, buffer);
 }
 
+/*a Reference projection
+ */
+/*t t_reference_lens
+ * A lens as plain values, for the reference formulas below
+ */
+typedef struct
+{
+    t_lens_projection_type type;
+    double frame_width;
+    double focal_length;
+    double width;
+    double height;
+    const double *poly;     // Polynomial lens coefficients, lowest first
+    const double *inv_poly;
+    int poly_length;
+} t_reference_lens;
+
+/*v Test polynomial lens
+ */
+static const double test_poly[4]     = {0.0, 1.0, 0.0, -0.02};
+static const double test_inv_poly[4] = {0.0, 1.0, 0.0, 0.02};
+
+/*f reference_lens
+ */
+static t_reference_lens
+reference_lens(t_lens_projection_type type, double frame_width, double focal_length, double width, double height)
+{
+    t_reference_lens lens;
+    lens.type = type;
+    lens.frame_width = frame_width;
+    lens.focal_length = focal_length;
+    lens.width = width;
+    lens.height = height;
+    lens.poly = test_poly;
+    lens.inv_poly = test_inv_poly;
+    lens.poly_length = 4;
+    return lens;
+}
+
+/*f reference_poly
+ */
+static double
+reference_poly(const double *coeffs, int length, double x)
+{
+    double r=0, xn=1;
+    for (int i=0; i<length; i++) {
+        r += coeffs[i]*xn;
+        xn *= x;
+    }
+    return r;
+}
+
+/*f reference_offset_to_angle
+ * The lens models as documented in lens_projection.cpp, one at a time
+ */
+static double
+reference_offset_to_angle(const t_reference_lens *lens, double offset)
+{
+    double o = offset*lens->frame_width;
+    switch (lens->type) {
+    case lens_projection_type_rectilinear:   return atan2(o, lens->focal_length);
+    case lens_projection_type_stereographic: return 2*atan2(o, 2*lens->focal_length);
+    case lens_projection_type_polynomial:    return reference_poly(lens->poly, lens->poly_length, o/lens->focal_length);
+    default: break;
+    }
+    return o/lens->focal_length;
+}
+
+/*f reference_angle_to_offset
+ */
+static double
+reference_angle_to_offset(const t_reference_lens *lens, double angle)
+{
+    double f = lens->focal_length/lens->frame_width;
+    switch (lens->type) {
+    case lens_projection_type_rectilinear:   return tan(angle)*f;
+    case lens_projection_type_stereographic: return 2*tan(angle/2)*f;
+    case lens_projection_type_polynomial:    return reference_poly(lens->inv_poly, lens->poly_length, angle)*f;
+    default: break;
+    }
+    return angle*f;
+}
+
+/*f reference_xy_to_roll_yaw
+ */
+static void
+reference_xy_to_roll_yaw(const t_reference_lens *lens, const double xy[2], double ry[2])
+{
+    double r = sqrt(xy[0]*xy[0]/lens->width/lens->width+xy[1]*xy[1]/lens->height/lens->height);
+    ry[0] = atan2(xy[1]*lens->width, xy[0]*lens->height);
+    ry[1] = reference_offset_to_angle(lens, r);
+}
+
+/*f reference_roll_yaw_to_xy
+ */
+static void
+reference_roll_yaw_to_xy(const t_reference_lens *lens, const double ry[2], double xy[2])
+{
+    double r = reference_angle_to_offset(lens, ry[1]);
+    xy[0] = lens->width  * r * cos(ry[0]);
+    xy[1] = lens->height * r * sin(ry[0]);
+}
+
+/*f reference_orientation_of_xy
+ * Camera orientation * roll * yaw, with quaternion operations
+ */
+static c_quaternion
+reference_orientation_of_xy(const t_reference_lens *lens, const c_quaternion &orientation, const double xy[2])
+{
+    double ry[2];
+    reference_xy_to_roll_yaw(lens, xy, ry);
+    return orientation * c_quaternion::roll(ry[0],0) * c_quaternion::yaw(ry[1],0);
+}
+
+/*f reference_xy_of_orientation
+ * Map (0,0,1) through the orientation relative to the camera, and
+ * find the roll and yaw that take it back to (0,0,1)
+ */
+static void
+reference_xy_of_orientation(const t_reference_lens *lens, const c_quaternion &orientation, const c_quaternion &q, double xy[2])
+{
+    c_quaternion rq, rqc, mapped_001;
+    double rxyz[4], ry[2];
+    rq = orientation;
+    rq.conjugate();
+    rq = rq * q;
+    rq.normalize();
+    rqc = rq;
+    rqc.conjugate();
+    mapped_001 = rq * c_quaternion::rijk(0,0,0,1) * rqc;
+    mapped_001.get_rijk(rxyz);
+    ry[0] = -atan2(rxyz[1], rxyz[2]);
+    ry[1] = -acos(rxyz[3]);
+    reference_roll_yaw_to_xy(lens, ry, xy);
+}
+
 /*a Basic tests
  */
 static void
@@ -105,12 +241,145 @@ test_map(void)
     
 }
 
+/*a Array tests
+ */
+/*f test_arrays_match
+ * Compare the array and single point conversions (which share the
+ * block code) with the reference formulas
+ */
+static void
+test_arrays_match(c_lens_projection &lp, const t_reference_lens *lens)
+{
+    double xy[200], rijk[400], xy2[200];
+    c_quaternion orientation = lp.get_orientation();
+    for (int i=0; i<100; i++) {
+        int j=i;
+        xy[2*i+0] = (j%10)/6.0-0.4; j/=10;
+        xy[2*i+1] = (j%10)/6.0-0.4; j/=10;
+    }
+    lp.orientation_of_xy_array(100, xy, rijk);
+    lp.xy_of_orientation_array(100, rijk, xy2);
+    for (int i=0; i<100; i++) {
+        double xy_ref[2], xy_single[2];
+        c_quaternion q_ref = reference_orientation_of_xy(lens, orientation, xy+2*i);
+        c_quaternion q = lp.orientation_of_xy(xy+2*i);
+        assert_dbeq(rijk[4*i+0], q_ref.r(), WHERE, "Array orientation of xy");
+        assert_dbeq(rijk[4*i+1], q_ref.i(), WHERE, "Array orientation of xy");
+        assert_dbeq(rijk[4*i+2], q_ref.j(), WHERE, "Array orientation of xy");
+        assert_dbeq(rijk[4*i+3], q_ref.k(), WHERE, "Array orientation of xy");
+        assert_dbeq(q.r(), q_ref.r(), WHERE, "Orientation of xy");
+        assert_dbeq(q.i(), q_ref.i(), WHERE, "Orientation of xy");
+        assert_dbeq(q.j(), q_ref.j(), WHERE, "Orientation of xy");
+        assert_dbeq(q.k(), q_ref.k(), WHERE, "Orientation of xy");
+        reference_xy_of_orientation(lens, orientation, q_ref, xy_ref);
+        lp.xy_of_orientation(&q_ref, xy_single);
+        assert_dbeq(xy2[2*i+0], xy_ref[0], WHERE, "Array XY of orientation");
+        assert_dbeq(xy2[2*i+1], xy_ref[1], WHERE, "Array XY of orientation");
+        assert_dbeq(xy_single[0], xy_ref[0], WHERE, "XY of orientation");
+        assert_dbeq(xy_single[1], xy_ref[1], WHERE, "XY of orientation");
+        if (lens->type==lens_projection_type_polynomial) continue; // Its inverse is approximate
+        assert_dbeq(xy2[2*i+0], xy[2*i+0], WHERE, "Array XY to and from orientation");
+        assert_dbeq(xy2[2*i+1], xy[2*i+1], WHERE, "Array XY to and from orientation");
+    }
+}
+
+/*f test_arrays
+ */
+static void
+test_arrays(void)
+{
+    c_lens_projection lp;
+    t_reference_lens lens = reference_lens(lens_projection_type_equidistant, 36.0, 35.0, 1.0, 1.0);
+    test_arrays_match(lp, &lens);
+
+    lp.orient(c_quaternion::of_euler(10.0,20.0,30.0,1));
+    test_arrays_match(lp, &lens);
+
+    lp.set_lens(36.0, 20.0, lens_projection_type_rectilinear);
+    lens = reference_lens(lens_projection_type_rectilinear, 36.0, 20.0, 1.0, 1.0);
+    test_arrays_match(lp, &lens);
+
+    lp.set_lens(36.0, 20.0, lens_projection_type_stereographic);
+    lens = reference_lens(lens_projection_type_stereographic, 36.0, 20.0, 1.0, 1.0);
+    test_arrays_match(lp, &lens);
+
+    lp.set_sensor(1.5, 1.0);
+    lens = reference_lens(lens_projection_type_stereographic, 36.0, 20.0, 1.5, 1.0);
+    test_arrays_match(lp, &lens);
+
+    c_lens_projection::add_named_polynomial("test_poly", 4, test_poly, 4, test_inv_poly);
+    lp.set_lens(36.0, 20.0, lens_projection_type_polynomial);
+    lp.set_polynomial("test_poly");
+    lens = reference_lens(lens_projection_type_polynomial, 36.0, 20.0, 1.5, 1.0);
+    test_arrays_match(lp, &lens);
+}
+
+/*f test_lookup_match
+ * Compare a lens using a lookup table with the reference formulas, to
+ * within the maximum error the table reports
+ */
+static void
+test_lookup_match(c_lens_projection &lp, const t_reference_lens *lens, double max_angle_error)
+{
+    double errors[2];
+    lp.get_lookup_max_error(errors);
+    assert(errors[0]<max_angle_error, WHERE, "Lookup table angle error %g", errors[0]);
+    assert(errors[1]>0.0, WHERE, "Lookup table offset error not measured");
+    for (int i=0; i<200; i++) {
+        double xy[2], ry[2], ry_exact[2], xy2[2], xy2_exact[2];
+        xy[0] = (i%20)/15.0-0.6;
+        xy[1] = (i/20)/15.0-0.3;
+        lp.xy_to_roll_yaw(xy, ry);
+        reference_xy_to_roll_yaw(lens, xy, ry_exact);
+        assert(fabs(ry[1]-ry_exact[1])<=errors[0]+EPSILON, WHERE, "Lookup offset to angle error %g", ry[1]-ry_exact[1]);
+        lp.roll_yaw_to_xy(ry_exact, xy2);
+        reference_roll_yaw_to_xy(lens, ry_exact, xy2_exact);
+        assert(fabs(xy2[0]-xy2_exact[0])<=lens->width*errors[1]+EPSILON, WHERE, "Lookup angle to offset error %g", xy2[0]-xy2_exact[0]);
+        assert(fabs(xy2[1]-xy2_exact[1])<=lens->height*errors[1]+EPSILON, WHERE, "Lookup angle to offset error %g", xy2[1]-xy2_exact[1]);
+    }
+}
+
+/*f test_lookup
+ * The tables do not depend on the sensor, so set_sensor keeps them
+ */
+static void
+test_lookup(void)
+{
+    c_lens_projection lp;
+    t_reference_lens lens = reference_lens(lens_projection_type_equidistant, 36.0, 35.0, 1.0, 1.0);
+    lp.set_lookup_table(1024, lens_lookup_cubic);
+    test_lookup_match(lp, &lens, 1E-12);
+
+    lp.set_lens(36.0, 20.0, lens_projection_type_rectilinear);
+    lens = reference_lens(lens_projection_type_rectilinear, 36.0, 20.0, 1.0, 1.0);
+    test_lookup_match(lp, &lens, 1E-6);
+
+    lp.set_lens(36.0, 20.0, lens_projection_type_stereographic);
+    lens = reference_lens(lens_projection_type_stereographic, 36.0, 20.0, 1.0, 1.0);
+    test_lookup_match(lp, &lens, 1E-6);
+
+    lp.set_sensor(1.5, 1.0);
+    lens = reference_lens(lens_projection_type_stereographic, 36.0, 20.0, 1.5, 1.0);
+    test_lookup_match(lp, &lens, 1E-6);
+
+    c_lens_projection::add_named_polynomial("test_poly", 4, test_poly, 4, test_inv_poly);
+    lp.set_lens(36.0, 20.0, lens_projection_type_polynomial);
+    lp.set_polynomial("test_poly");
+    lens = reference_lens(lens_projection_type_polynomial, 36.0, 20.0, 1.5, 1.0);
+    test_lookup_match(lp, &lens, 1E-6);
+
+    lp.set_lookup_table(1024, lens_lookup_linear);
+    test_lookup_match(lp, &lens, 1E-4);
+}
+
 /*a Toplevel
  */
 extern int main(int argc, char **argv)
 {
     test_init();
     test_map();
+    test_arrays();
+    test_lookup();
     if (failures>0) {
         exit(4);
     }
@@ -4,9 +4,7 @@ Example
  */
 /*a Includes
  */
-#include <SDL.h> 
-#include <SDL_opengl.h>
-#include <SDL_image.h>
+#include <OpenGL/gl3.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <getopt.h>
@@ -14,28 +12,12 @@ Example
 #include "texture.h"
 #include "shader.h"
 #include "filter.h"
+#include "gl_context.h"
+#include "filter_pipeline.h"
 
 /*a Defines
  */
 
-/*a Types
- */
-/*t c_main
- */
-class c_main
-{
-public:
-    c_main(void);
-    ~c_main();
-    void check_sdl_error(void);
-    int init(void);
-    void exit(void);
-    int create_window(void);
-
-    SDL_Window    *window;
-    SDL_GLContext glContext;
-};
-
 /*a Helper functions
  */
 /*f gl_get_errors
@@ -52,96 +34,6 @@ int gl_get_errors(const char *msg)
     return num_errors;
 }
 
-/*a Main methods
- */
-/*f c_main constructor
- */
-c_main::c_main(void)
-{
-    window = NULL;
-}
-
-/*f c_main::check_sdl_error
- */
-void
-c_main::check_sdl_error(void)
-{
-	const char *error;
-    error = SDL_GetError();
-	if (*error != '\0') {
-		fprintf(stderr,"SDL Error: %s\n", error);
-		SDL_ClearError();
-	}
-}
-
-/*f c_main::init
-*/
-int c_main::init(void)
-{
-    if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
-        return 0;
-    }
-
-    SDL_GL_SetAttribute( SDL_GL_RED_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_GREEN_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_BLUE_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_ALPHA_SIZE, 8 );
-
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-    check_sdl_error();
-
-    fprintf(stderr,"Main Init() completed\n");
-    return 1;
-}
-
-/*f c_main::exit
-*/
-void
-c_main::exit(void)
-{
-    if (window) {
-        SDL_DestroyWindow(window);
-        window = NULL;
-    }
-    SDL_Quit();
-}
-
-/*f c_main::create_window
- */
-int
-c_main::create_window()
-{
-    int flags;
-    int width;
-    int height;
-    width = 64;
-    height = 64;
-
-    flags = SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE;
-    window = SDL_CreateWindow("OpenGL Test",SDL_WINDOWPOS_UNDEFINED,SDL_WINDOWPOS_UNDEFINED,width, height, flags);
-    check_sdl_error();
-
-    if (!window) {
-        return 0;
-    }
-
-    glContext = SDL_GL_CreateContext(window);
-    if (!glContext) {
-        return 0;
-    }
-
-    if (1) {
-        int major, minor;
-        SDL_GL_GetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, &major );
-        SDL_GL_GetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, &minor );
-        check_sdl_error();
-        fprintf(stderr, "Using OpenGL version %d.%d\n",major,minor);
-    }
-    return 1;
-}
-
 /*a Options
  */
 /*v long_options
@@ -151,6 +43,8 @@ static struct option long_options[] =
     {"filter",   required_argument, 0, 'f'},
     {"infile",   required_argument, 0, 'i'},
     {"textures", required_argument, 0, 'n'},
+    {"cpu",      no_argument,       0, 'c'},
+    {"context",  required_argument, 0, 'g'},
     {0, 0, 0, 0}
 };
 
@@ -166,9 +60,10 @@ typedef struct
 */
 typedef struct
 {
-    int num_textures;
     t_option_list images;
     t_option_list filters;
+    int cpu;
+    t_gl_context_type context_type;
 } t_options;
 
 /*f option_add_to_list
@@ -183,9 +78,10 @@ static void option_add_to_list(t_option_list *option_list, const char *string)
 static int get_options(int argc, char **argv, t_options *options)
 {
     int c;
-    options->num_textures = 0;
     options->images.num=0;
     options->filters.num=0;
+    options->cpu=0;
+    options->context_type = gl_context_default_type();
     while (1)
     {
         int option_index = 0;
@@ -203,7 +99,16 @@ static int get_options(int argc, char **argv, t_options *options)
             option_add_to_list(&options->images, optarg);
             break;
         case 'n':
-            options->num_textures = atoi(optarg);
+            fprintf(stderr,"Ignoring --textures; the pipeline creates the textures its filters need\n");
+            break;
+        case 'c':
+            options->cpu = 1;
+            break;
+        case 'g':
+            if (gl_context_type_from_string(optarg, &options->context_type)!=0) {
+                fprintf(stderr,"Unsupported OpenGL context type '%s'\n", optarg);
+                return 0;
+            }
             break;
         default:
             break;
@@ -219,64 +124,62 @@ static int get_options(int argc, char **argv, t_options *options)
 int main(int argc,char *argv[])
 {
     int i;
-    c_main *m;
-    c_filter *filters[256];
+    t_gl_context_ptr gl_context;
+    c_filter_pipeline *pipeline;
     t_options options;
     t_exec_context ec;
     ec.use_ids = 1;
 
-    m = new c_main();
-    if (m->init()==0) {
-        fprintf(stderr,"Initializtion failed\n");
-        return 4;
-    }
-    if (!m->create_window()) {
-        fprintf(stderr,"Create window failed\n");
+    if (get_options(argc, argv, &options)==0) {
         return 4;
     }
 
-    shader_init();
-
-    if (get_options(argc, argv, &options)==0) {
-        return 4;
+    gl_context = NULL;
+    if (options.cpu) {
+        // Run the glsl filters on host textures with no GL context
+        filter_set_backend(filter_backend_cpu);
+    } else {
+        gl_context = gl_context_create(options.context_type);
+        if (!gl_context) {
+            fprintf(stderr,"Failed to create OpenGL context\n");
+            return 4;
+        }
+        shader_init();
     }
 
+    pipeline = new c_filter_pipeline(1024, 1024, options.cpu);
     for (int i=0; i<options.filters.num; i++) {
-        filters[i] = filter_from_string(options.filters.strings[i]);
+        pipeline->add_filter(options.filters.strings[i]);
     }
 
-    int failures=0;
-    for (int i=0; i<options.filters.num; i++) {
-        if (!filters[i]) {
-            failures++;
-            continue;
-        }
-        if (filters[i]->parse_error) {
-            fprintf(stderr, "Filter '%s' parse error: %s\n", options.filters.strings[i], filters[i]->parse_error);
-            failures++;
-            continue;
-        }
-        if (filters[i]->compile()!=0) failures++;
+    if (!options.cpu) {
+        texture_draw_init();
     }
-    if (failures>0) {
-        exit(4);
+    for (i=0; i<options.images.num; i++) {
+        if (options.cpu) {
+            pipeline->set_input(i, texture_load_host(options.images.strings[i]));
+        } else {
+            pipeline->set_input(i, texture_load(options.images.strings[i], GL_RGB));
+        }
     }
 
-    texture_draw_init();
-    for (i=0; i<options.images.num; i++) {
-        ec.textures[i] = texture_load(options.images.strings[i], GL_RGB);
+    if (pipeline->compile()!=0) {
+        exit(4);
     }
-    for (i=options.images.num; i<options.images.num+options.num_textures; i++) {
-        ec.textures[i] = texture_create(1024, 1024);
+    pipeline->report(stderr);
+    if (pipeline->allocate(&ec)!=0) {
+        fprintf(stderr,"%s\n", pipeline->parse_error);
+        exit(4);
     }
-    fprintf(stderr,"Made %d textures\n", i);
     ec.points = NULL;
 
-    for (int i=0; i<options.filters.num; i++) {
-        fprintf(stderr, "Execute '%s'\n", options.filters.strings[i]);
-        filters[i]->execute(&ec);
+    // One execute of all the stages, so each readback overlaps the next stage
+    pipeline->execute(&ec, 0, pipeline->num_filters);
+    for (int i=0; i<pipeline->num_filters; i++) {
+        fprintf(stderr, "Executed '%s' in %.0fus\n", options.filters.strings[i],
+                SL_TIMER_US_FROM_CLKS(SL_TIMER_VALUE(pipeline->filter(i)->timers[filter_timer_execute])));
     }
 
-    m->exit();
+    gl_context_destroy(gl_context);
     return 0;
 }
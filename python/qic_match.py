@@ -139,6 +139,11 @@ max_q_dists_for_score = {
 #a Support functions
 #f init_opengl
 def init_opengl():
+    try:
+        gjslib_c.gl_context()
+        return
+    except RuntimeError:
+        pass
     OpenGL.GLUT.glutInit(sys.argv)
     OpenGL.GLUT.glutInitDisplayMode(OpenGL.GLUT.GLUT_3_2_CORE_PROFILE)
     #|GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH)
@@ -217,7 +222,12 @@ def quaternion_image_correlate(ipqm, images, focal_length=50.0, accuracy="80pix3
     ci0 = ipqm.camera_images[images[0]]
     ci1 = ipqm.camera_images[images[1]]
 
-    ipqm.qic = gjslib_c.quaternion_image_correlator()
+    if ipqm.qic is None:
+        ipqm.qic = gjslib_c.quaternion_image_correlator()
+        pass
+    else:
+        ipqm.qic.reset() # Reuse the correlator's memory from the last pair
+        pass
     ipqm.qic.min_cos_angle_src_q = min_cos_seps_same_pt[accuracy]
     ipqm.qic.min_cos_angle_tgt_q = min_cos_seps_same_pt[accuracy]
     ipqm.qic.min_cos_sep_score   = min_cos_seps_for_score[accuracy] # tgt point must be within this separation for any match of src->tgt to count
@@ -287,17 +297,9 @@ class c_camera_image(object):
     def orientation_of_xy(self,xy):
         return self.lp.orientation_of_xy(xy)
     def orientation_of_xy_list(self, xy_list):
-        q_list = []
-        for xy in xy_list:
-            q_list.append(self.lp.orientation_of_xy(xy))
-            pass
-        return q_list
+        return self.lp.orientation_of_xy_array(xy_list)
     def xy_of_orientation_list(self, q_list):
-        xy_list = []
-        for q in q_list:
-            xy_list.append(self.lp.xy_of_orientation(q))
-            pass
-        return xy_list
+        return self.lp.xy_of_orientation_array(q_list)
 
 #c c_image_match
 class c_image_match(object):
@@ -314,12 +316,9 @@ class c_image_match(object):
         self.equalize = c_windowed_equalization_filter()
         self.harris = c_harris_filter()
         self.find_corners = c_find_filter(extra_parameters={"min_distance":self.min_corner_distance, "minimum":0.05, "max_elements":2500})
-        self.find_matches = c_find_filter(extra_parameters={"min_distance":self.min_match_distance, "minimum":0.04,  "max_elements":2500})
         self.circle_dft = c_circle_dft_filter(extra_defines={"DFT_CIRCLE_RADIUS":self.radius,
                                                              "CIRCLE_COMPONENT":"r",
                                                              })
-        self.circle_dft_diff         = c_circle_dft_diff_filter()
-        self.circle_dft_diff_combine = c_circle_dft_diff_combine_filter()
         pass
     def get_matches(self, tb):
         """tb must be at least 10 textures, and the first is the source image, second is the target image"""
@@ -337,18 +336,18 @@ class c_image_match(object):
 
         print "Found %d corners (will restrict to max %d)"%(self.find_corners.f.num_points, self.max_corners)
         corners = self.find_corners.f.points[:self.max_corners]
+        # All corners are matched in one pass, equivalent to circle_dft_diff (at the
+        # four points 'radius' from the corner), circle_dft_diff_combine and find_matches
+        corner_matches = gjslib_c.match_corners(source=tb[2], target=tb[3], corners=corners,
+                                                max_matches    = self.max_matches_per_corner,
+                                                max_candidates = 2500,
+                                                min_distance   = self.min_match_distance,
+                                                minimum        = 0.04)
         matches = {}
         for i in range(len(corners)):
             pt = corners[i]
             xy = (pt[0],pt[1])
-            for i, dxy in [(0,(1,0)), (1,(0,1)), (2,(-1,0)), (3,(0,-1))]:
-                self.circle_dft_diff.set_parameters( {"uv_base_x":xy[0]+dxy[0]*self.radius,
-                                                      "uv_base_y":xy[1]+dxy[1]*self.radius} )
-                self.circle_dft_diff.execute( (tb[2], tb[3], tb[5+i]) )
-                pass
-            self.circle_dft_diff_combine.execute( (tb[5], tb[6], tb[7], tb[8], tb[9]) )
-            self.find_matches.execute( (tb[9],) )
-            matches[xy] = self.find_matches.f.points[0:self.max_matches_per_corner]
+            matches[xy] = corner_matches[i]
             pass
         return matches
     def times(self):
@@ -357,9 +356,6 @@ class c_image_match(object):
                 "harris":self.harris.times(),
                 "circle_dft":self.circle_dft.times(),
                 "find_corners":self.find_corners.times(),
-                "circle_dft_diff":self.circle_dft_diff.times(),
-                "circle_dft_diff_combine":self.circle_dft_diff_combine.times(),
-                "find_matches":self.find_matches.times(),
                 }
     pass
 
@@ -422,16 +418,16 @@ class c_image_pair_quaternion_match(object):
         ci1 = self.camera_images[images[1]]
         ci0_tp = projections[0]
         ci1_tp = projections[1]
-        q0_list = []
-        q1_list = []
+        xy_list = []
         for i in range(4):
             for j in range(21):
                 xy = j/10.0-1.0 # in range -1<=xy<1
                 xy = [ (xy,-1.0), (1.0,xy), (-xy,1.0), (-1.0,-xy) ][i] # (-1,-1)<=xy<=(1,1)
-                q0_list.append(ci0_tp.orientation_of_xy(xy))
-                q1_list.append(ci1_tp.orientation_of_xy(xy))
+                xy_list.append(xy)
                 pass
             pass
+        q0_list = ci0_tp.orientation_of_xy_array(xy_list)
+        q1_list = ci1_tp.orientation_of_xy_array(xy_list)
         ci0_q0_xy_list = ci0.xy_of_orientation_list(q0_list)
         ci1_q0_xy_list = ci1.xy_of_orientation_list(q0_list)
         ci0_q1_xy_list = ci0.xy_of_orientation_list(q1_list)
@@ -644,32 +640,7 @@ class c_image_pair_quaternion_match(object):
     #f find_mappings_to_try_qic
     def find_mappings_to_try_qic(self, min_q_dist=0.0002, max_q_dist=0.5): # default of 0.5 degrees min sep
         print "Building from qic list of src_from_tgt_q (min_q_dist %f, max_q_dist %f)"%(min_q_dist,max_q_dist)
-        mappings_to_try = []
-        mappings_to_try.append(gjslib_c.quaternion(1)) # Ensure identity is on the list
-        for src_qx in self.qic.src_qs():
-            for tgt_qx in self.qic.tgt_qs_of_src_q(src_qx):
-                #print src_qx, tgt_qx
-                src_tgt_mappings = self.qic.src_tgt_mappings(src_qx, tgt_qx)
-                for (src_q0, src_q1, tgt_q0, tgt_q1, src_from_tgt_q) in src_tgt_mappings:
-                    #print src_q0, tgt_q0, src_q1, tgt_q1, src_from_tgt_q
-                    add_to_list = True
-                    for src_from_tgt_qx in mappings_to_try:
-                        dq = src_from_tgt_q.distance_to(src_from_tgt_qx)
-                        if dq<min_q_dist:
-                            add_to_list = False
-                            break
-                        if dq>max_q_dist:
-                            add_to_list = False
-                            break
-                        pass
-                    if not add_to_list: continue
-                    mappings_to_try.append(src_from_tgt_q)
-                    if (len(mappings_to_try)%500)==0:
-                        print "Have %d mappings, continuing"%len(mappings_to_try)
-                        pass
-                    pass
-                pass
-            pass
+        mappings_to_try = self.qic.candidate_orients(min_q_dist=min_q_dist, max_q_dist=max_q_dist) # Identity is first on the list
         return mappings_to_try
     #f find_best_target_matches_qic
     def find_best_target_matches_qic(self,
@@ -682,9 +653,10 @@ class c_image_pair_quaternion_match(object):
         result = []
         mappings_to_try = self.find_mappings_to_try_qic(min_q_dist, max_q_dist)
         print "Trying %d mappings"%(len(mappings_to_try))
-        for src_from_tgt_q in mappings_to_try:
-            score = self.qic.score_orient(src_from_tgt_q)
+        scores = self.qic.score_orients(mappings_to_try, min_score=2)
+        for (src_from_tgt_q, score) in zip(mappings_to_try, scores):
             if (score>2):
+                self.qic.score_orient(src_from_tgt_q) # c_best_match uses the qic match list of this orientation
                 result.append(self.c_best_match(src_from_tgt_q, score, self.qic))
                 pass
             pass
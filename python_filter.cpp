@@ -188,8 +188,21 @@ python_filter_method_parameter(PyObject* self, PyObject* args, PyObject *kwds)
             py_obj->filter->set_parameter(name, (int)PyInt_AsLong(value));
         } else if (PyLong_Check(value)) {
             py_obj->filter->set_parameter(name, (int)PyLong_AsLong(value));
+        } else if (PySequence_Check(value) &&
+                   (PySequence_Size(value)>0) &&
+                   (PySequence_Size(value)<=MAX_FILTER_UNIFORM_VALUES)) {
+            float values[MAX_FILTER_UNIFORM_VALUES];
+            int num_values = PySequence_Size(value);
+            for (int i=0; i<num_values; i++) {
+                PyObject *item = PySequence_GetItem(value, i);
+                values[i] = item ? PyFloat_AsDouble(item) : 0.0;
+                Py_XDECREF(item);
+            }
+            if (PyErr_Occurred())
+                return NULL;
+            py_obj->filter->set_parameter(name, values, num_values);
         } else {
-            PyErr_SetString(PyExc_RuntimeError, "Need float or int to set parameter");
+            PyErr_SetString(PyExc_RuntimeError, "Need float, int or a sequence of up to 16 numbers to set parameter");
         }
     }
     Py_RETURN_NONE;
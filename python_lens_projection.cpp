@@ -44,9 +44,12 @@ static PyObject *python_lens_projection_class_method_add_named_polynomial(PyObje
 static PyObject *python_lens_projection_method_set_lens(PyObject* self, PyObject* args, PyObject *kwds);
 static PyObject *python_lens_projection_method_set_sensor(PyObject* self, PyObject* args, PyObject *kwds);
 static PyObject *python_lens_projection_method_set_polynomial(PyObject* self, PyObject* args, PyObject *kwds);
+static PyObject *python_lens_projection_method_set_lookup_table(PyObject* self, PyObject* args, PyObject *kwds);
 static PyObject *python_lens_projection_method_orient(PyObject* self, PyObject* args, PyObject *kwds);
 static PyObject *python_lens_projection_method_orientation_of_xy(PyObject* self, PyObject* args, PyObject *kwds);
 static PyObject *python_lens_projection_method_xy_of_orientation(PyObject* self, PyObject* args, PyObject *kwds);
+static PyObject *python_lens_projection_method_orientation_of_xy_array(PyObject* self, PyObject* args, PyObject *kwds);
+static PyObject *python_lens_projection_method_xy_of_orientation_array(PyObject* self, PyObject* args, PyObject *kwds);
 
 /*a Static variables
  */
@@ -57,9 +60,12 @@ PyMethodDef python_lens_projection_methods[] = {
     {"set_lens",    (PyCFunction)python_lens_projection_method_set_lens,   METH_VARARGS|METH_KEYWORDS},
     {"set_sensor",  (PyCFunction)python_lens_projection_method_set_sensor, METH_VARARGS|METH_KEYWORDS},
     {"set_polynomial",    (PyCFunction)python_lens_projection_method_set_polynomial,   METH_VARARGS|METH_KEYWORDS},
+    {"set_lookup_table",  (PyCFunction)python_lens_projection_method_set_lookup_table, METH_VARARGS|METH_KEYWORDS},
     {"orient",      (PyCFunction)python_lens_projection_method_orient,     METH_VARARGS|METH_KEYWORDS},
     {"orientation_of_xy",  (PyCFunction)python_lens_projection_method_orientation_of_xy,     METH_VARARGS|METH_KEYWORDS},
     {"xy_of_orientation",  (PyCFunction)python_lens_projection_method_xy_of_orientation,     METH_VARARGS|METH_KEYWORDS},
+    {"orientation_of_xy_array",  (PyCFunction)python_lens_projection_method_orientation_of_xy_array,     METH_VARARGS|METH_KEYWORDS},
+    {"xy_of_orientation_array",  (PyCFunction)python_lens_projection_method_xy_of_orientation_array,     METH_VARARGS|METH_KEYWORDS},
     {NULL, NULL},
 };
 
@@ -220,6 +226,30 @@ python_lens_projection_method_set_polynomial(PyObject* self, PyObject* args, PyO
     Py_RETURN_NONE;
 }
 
+/*f python_lens_projection_method_set_lookup_table
+ * Return the maximum (angle, offset) errors of the tables; entries of 0 disables them
+ */
+static PyObject *
+python_lens_projection_method_set_lookup_table(PyObject* self, PyObject* args, PyObject *kwds)
+{
+    t_PyObject_lens_projection *py_obj = (t_PyObject_lens_projection *)self;
+
+    int entries=1024;
+    int cubic=1;
+    double errors[2]={0.0,0.0};
+    static const char *kwlist[] = {"entries", "cubic", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ii", (char **)kwlist, 
+                                     &entries, &cubic))
+        return NULL;
+
+    if (py_obj->lens_projection) {
+        py_obj->lens_projection->set_lookup_table(entries, cubic ? lens_lookup_cubic : lens_lookup_linear);
+        py_obj->lens_projection->get_lookup_max_error(errors);
+    }
+    return Py_BuildValue("dd", errors[0], errors[1]);
+}
+
 /*f python_lens_projection_method_orient
  */
 static PyObject *
@@ -237,7 +267,7 @@ python_lens_projection_method_orient(PyObject* self, PyObject* args, PyObject *k
     if (py_obj->lens_projection) {
         c_quaternion *quaternion;
         if (python_quaternion_data(orientation, 0, (void *)&quaternion)) {
-            py_obj->lens_projection->orient(quaternion->copy());
+            py_obj->lens_projection->orient(*quaternion);
         } else {
             PyErr_SetString(PyExc_RuntimeError, "Orientation must be a quaternion");
             return NULL;
@@ -300,6 +330,181 @@ python_lens_projection_method_xy_of_orientation(PyObject* self, PyObject* args,
     Py_RETURN_NONE;
 }
 
+/*f python_lens_projection_doubles
+ * Read n groups of 'stride' doubles from an object supporting the
+ * buffer protocol (format 'd'), or from a sequence of tuples (or, for
+ * a stride of 4, quaternions); return NULL with an exception set on
+ * error, else an array to be freed with PyMem_Free
+ */
+static double *
+python_lens_projection_doubles(PyObject *obj, int stride, int *n)
+{
+    double *values;
+    if (PyObject_CheckBuffer(obj)) {
+        Py_buffer view;
+        if (PyObject_GetBuffer(obj, &view, PyBUF_FORMAT|PyBUF_C_CONTIGUOUS)!=0)
+            return NULL;
+        if ((view.itemsize!=sizeof(double)) ||
+            (view.format && strcmp(view.format, "d")) ||
+            ((view.len % (stride*sizeof(double)))!=0)) {
+            PyBuffer_Release(&view);
+            PyErr_Format(PyExc_ValueError, "Buffer must be of doubles, %d per point", stride);
+            return NULL;
+        }
+        *n = view.len / (stride*sizeof(double));
+        values = (double *)PyMem_Malloc(view.len+1);
+        memcpy(values, view.buf, view.len);
+        PyBuffer_Release(&view);
+        return values;
+    }
+
+    PyObject *seq = PySequence_Fast(obj, "Need a buffer of doubles or a sequence of points");
+    if (!seq) return NULL;
+    *n = PySequence_Fast_GET_SIZE(seq);
+    values = (double *)PyMem_Malloc(sizeof(double)*stride*(*n)+1);
+    for (int i=0; i<*n; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        c_quaternion *quaternion;
+        if ((stride==4) && python_quaternion_data(item, 0, (void *)&quaternion)) {
+            quaternion->get_rijk(values+4*i);
+            continue;
+        }
+        PyObject *point = PySequence_Fast(item, "Each point must be a sequence of numbers");
+        if (point && (PySequence_Fast_GET_SIZE(point)!=stride)) {
+            PyErr_Format(PyExc_ValueError, "Each point must have %d values", stride);
+        }
+        for (int j=0; (j<stride) && !PyErr_Occurred(); j++) {
+            values[stride*i+j] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(point, j));
+        }
+        Py_XDECREF(point);
+        if (PyErr_Occurred()) {
+            Py_DECREF(seq);
+            PyMem_Free(values);
+            return NULL;
+        }
+    }
+    Py_DECREF(seq);
+    return values;
+}
+
+/*f python_lens_projection_doubles_out
+ * Get a writable buffer of (at least) n doubles from 'out'; return 0 on
+ * success, with the buffer to be released by the caller
+ */
+static int
+python_lens_projection_doubles_out(PyObject *out, int n, Py_buffer *view)
+{
+    if (PyObject_GetBuffer(out, view, PyBUF_WRITABLE|PyBUF_FORMAT|PyBUF_C_CONTIGUOUS)!=0)
+        return 1;
+    if ((view->itemsize!=sizeof(double)) ||
+        (view->format && strcmp(view->format, "d")) ||
+        (view->len < (Py_ssize_t)(n*sizeof(double)))) {
+        PyBuffer_Release(view);
+        PyErr_Format(PyExc_ValueError, "Output buffer must be of at least %d doubles", n);
+        return 1;
+    }
+    return 0;
+}
+
+/*f python_lens_projection_method_orientation_of_xy_array
+ * xy is a buffer of 2n doubles, or a sequence of n (x,y) tuples; the
+ * orientations are written to rijk (a writable buffer of 4n doubles) if
+ * given, else returned as a list of quaternions
+ */
+static PyObject *
+python_lens_projection_method_orientation_of_xy_array(PyObject* self, PyObject* args, PyObject *kwds)
+{
+    t_PyObject_lens_projection *py_obj = (t_PyObject_lens_projection *)self;
+
+    PyObject *xy, *rijk=NULL;
+    int use_threads=0;
+    static const char *kwlist[] = {"xy", "rijk", "use_threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oi", (char **)kwlist, 
+                                     &xy, &rijk, &use_threads))
+        return NULL;
+
+    if (!py_obj->lens_projection)
+        Py_RETURN_NONE;
+
+    int n;
+    double *xy_d = python_lens_projection_doubles(xy, 2, &n);
+    if (!xy_d) return NULL;
+
+    if (rijk && (rijk!=Py_None)) {
+        Py_buffer view;
+        if (python_lens_projection_doubles_out(rijk, 4*n, &view)) {
+            PyMem_Free(xy_d);
+            return NULL;
+        }
+        py_obj->lens_projection->orientation_of_xy_array(n, xy_d, (double *)view.buf, use_threads);
+        PyBuffer_Release(&view);
+        PyMem_Free(xy_d);
+        Py_INCREF(rijk);
+        return rijk;
+    }
+
+    double *rijk_d = (double *)PyMem_Malloc(sizeof(double)*4*n+1);
+    py_obj->lens_projection->orientation_of_xy_array(n, xy_d, rijk_d, use_threads);
+    PyObject *list = PyList_New(n);
+    for (int i=0; i<n; i++) {
+        c_quaternion *q = new c_quaternion(rijk_d[4*i+0], rijk_d[4*i+1], rijk_d[4*i+2], rijk_d[4*i+3]);
+        PyList_SET_ITEM(list, i, python_quaternion_from_c(q));
+    }
+    PyMem_Free(rijk_d);
+    PyMem_Free(xy_d);
+    return list;
+}
+
+/*f python_lens_projection_method_xy_of_orientation_array
+ * orientations is a buffer of 4n doubles (r,i,j,k), or a sequence of n
+ * quaternions; the (x,y) are written to xy (a writable buffer of 2n
+ * doubles) if given, else returned as a list of tuples
+ */
+static PyObject *
+python_lens_projection_method_xy_of_orientation_array(PyObject* self, PyObject* args, PyObject *kwds)
+{
+    t_PyObject_lens_projection *py_obj = (t_PyObject_lens_projection *)self;
+
+    PyObject *orientations, *xy=NULL;
+    int use_threads=0;
+    static const char *kwlist[] = {"orientations", "xy", "use_threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oi", (char **)kwlist, 
+                                     &orientations, &xy, &use_threads))
+        return NULL;
+
+    if (!py_obj->lens_projection)
+        Py_RETURN_NONE;
+
+    int n;
+    double *rijk_d = python_lens_projection_doubles(orientations, 4, &n);
+    if (!rijk_d) return NULL;
+
+    if (xy && (xy!=Py_None)) {
+        Py_buffer view;
+        if (python_lens_projection_doubles_out(xy, 2*n, &view)) {
+            PyMem_Free(rijk_d);
+            return NULL;
+        }
+        py_obj->lens_projection->xy_of_orientation_array(n, rijk_d, (double *)view.buf, use_threads);
+        PyBuffer_Release(&view);
+        PyMem_Free(rijk_d);
+        Py_INCREF(xy);
+        return xy;
+    }
+
+    double *xy_d = (double *)PyMem_Malloc(sizeof(double)*2*n+1);
+    py_obj->lens_projection->xy_of_orientation_array(n, rijk_d, xy_d, use_threads);
+    PyObject *list = PyList_New(n);
+    for (int i=0; i<n; i++) {
+        PyList_SET_ITEM(list, i, Py_BuildValue("dd", xy_d[2*i+0], xy_d[2*i+1]));
+    }
+    PyMem_Free(xy_d);
+    PyMem_Free(rijk_d);
+    return list;
+}
+
 /*f python_lens_projection_str
  */
 static PyObject *
@@ -664,7 +664,7 @@ python_quaternion_method_rotate_vector(PyObject* self, PyObject* args, PyObject
         c_vector *vector;
         if (python_vector_data(vec_obj, 0, &vector)) {
             c_vector *v;
-            v = new c_vector(*(py_obj->quaternion) * c_quaternion(*vector) * *(py_obj->quaternion->copy()->conjugate()));
+            v = new c_vector(py_obj->quaternion->rotate_vector(*vector));
             return python_vector_from_c(v);
         }
     }
@@ -13,6 +13,7 @@
 /*a Includes
  */
 #include <Python.h>
+#include <vector>
 #include "python_quaternion.h"
 #include "python_quaternion_image_correlator.h"
 #include "quaternion_image_correlator.h"
@@ -40,7 +41,10 @@ static PyObject *python_quaternion_image_correlator_str(PyObject *self);
 
 static PyObject *python_quaternion_image_correlator_method_add_match(PyObject* self, PyObject* args, PyObject *kwds);
 static PyObject *python_quaternion_image_correlator_method_create_mappings(PyObject* self, PyObject* args);
+static PyObject *python_quaternion_image_correlator_method_reset(PyObject* self, PyObject* args);
+static PyObject *python_quaternion_image_correlator_method_candidate_orients(PyObject* self, PyObject* args, PyObject *kwds);
 static PyObject *python_quaternion_image_correlator_method_score_orient(PyObject* self, PyObject* args, PyObject *kwds);
+static PyObject *python_quaternion_image_correlator_method_score_orients(PyObject* self, PyObject* args, PyObject *kwds);
 static PyObject *python_quaternion_image_correlator_method_src_qs(PyObject* self, PyObject* args);
 static PyObject *python_quaternion_image_correlator_method_tgt_qs_of_src_q(PyObject* self, PyObject* args, PyObject *kwds);
 static PyObject *python_quaternion_image_correlator_method_src_tgt_mappings(PyObject* self, PyObject* args, PyObject *kwds);
@@ -55,10 +59,13 @@ static PyObject *python_quaternion_image_correlator_method_src_tgt_mappings_of_b
 PyMethodDef python_quaternion_image_correlator_methods[] = {
     {"add_match",       (PyCFunction)python_quaternion_image_correlator_method_add_match,         METH_VARARGS|METH_KEYWORDS},
     {"create_mappings", (PyCFunction)python_quaternion_image_correlator_method_create_mappings,   METH_NOARGS},
+    {"reset",           (PyCFunction)python_quaternion_image_correlator_method_reset,             METH_NOARGS},
     {"src_qs",          (PyCFunction)python_quaternion_image_correlator_method_src_qs,            METH_NOARGS},
     {"tgt_qs_of_src_q", (PyCFunction)python_quaternion_image_correlator_method_tgt_qs_of_src_q,   METH_VARARGS|METH_KEYWORDS},
     {"src_tgt_mappings", (PyCFunction)python_quaternion_image_correlator_method_src_tgt_mappings, METH_VARARGS|METH_KEYWORDS},
+    {"candidate_orients", (PyCFunction)python_quaternion_image_correlator_method_candidate_orients, METH_VARARGS|METH_KEYWORDS},
     {"score_orient",    (PyCFunction)python_quaternion_image_correlator_method_score_orient,      METH_VARARGS|METH_KEYWORDS},
+    {"score_orients",   (PyCFunction)python_quaternion_image_correlator_method_score_orients,     METH_VARARGS|METH_KEYWORDS},
     {"scores",          (PyCFunction)python_quaternion_image_correlator_method_scores,            METH_NOARGS},
     {"best_matches",    (PyCFunction)python_quaternion_image_correlator_method_best_matches,      METH_VARARGS|METH_KEYWORDS},
     {"src_tgt_mappings_of_best_matches",    (PyCFunction)python_quaternion_image_correlator_method_src_tgt_mappings_of_best_matches,      METH_VARARGS|METH_KEYWORDS},
@@ -155,6 +162,20 @@ python_quaternion_image_correlator_method_create_mappings(PyObject* self, PyObje
     Py_RETURN_NONE;
 }
 
+/*f python_quaternion_image_correlator_method_reset
+ * Forget every match, keeping the memory for the next image pair
+ */
+static PyObject *
+python_quaternion_image_correlator_method_reset(PyObject* self, PyObject* args)
+{
+    t_PyObject_quaternion_image_correlator *py_obj = (t_PyObject_quaternion_image_correlator *)self;
+
+    if (py_obj->quaternion_image_correlator) {
+        py_obj->quaternion_image_correlator->reset();
+    }
+    Py_RETURN_NONE;
+}
+
 /*f python_quaternion_image_correlator_method_src_qs
  */
 static PyObject *
@@ -163,9 +184,10 @@ python_quaternion_image_correlator_method_src_qs(PyObject* self, PyObject* args)
     t_PyObject_quaternion_image_correlator *py_obj = (t_PyObject_quaternion_image_correlator *)self;
 
     if (py_obj->quaternion_image_correlator) {
-        PyObject *list = PyList_New(0);
-        for (auto src_q : py_obj->quaternion_image_correlator->src_qs) {
-            PyList_Append(list, python_quaternion_from_c((c_quaternion *)src_q));
+        c_quaternion_image_correlator *qic=py_obj->quaternion_image_correlator;
+        PyObject *list = PyList_New(qic->src_qs.size());
+        for (size_t i=0; i<qic->src_qs.size(); i++) {
+            PyList_SET_ITEM(list, i, python_quaternion_from_c(qic->src_qs[i]->copy()));
         }
         return list;
     }
@@ -189,10 +211,12 @@ python_quaternion_image_correlator_method_tgt_qs_of_src_q(PyObject* self, PyObje
         c_quaternion_image_correlator *qic=py_obj->quaternion_image_correlator;
         c_quaternion *src_q;
         if (python_quaternion_data(src_q_obj, 0, (void *)&src_q)) {
-            const c_quaternion *src_qx=qic->find_closest_src_qx(src_q, NULL);
-            PyObject *list = PyList_New(0);
-            for (auto src_qx_ml : qic->matches_by_src_q[src_qx]) {
-                PyList_Append(list, python_quaternion_from_c((c_quaternion *)qic->qstm_tgt_q(src_qx_ml)));
+            int src_index=qic->find_closest_src_qx_index(src_q, NULL);
+            if (src_index<0) return PyList_New(0);
+            const t_quaternion_image_src_tgt_match_list &match_list = qic->matches_of_src_q(src_index);
+            PyObject *list = PyList_New(match_list.size());
+            for (size_t i=0; i<match_list.size(); i++) {
+                PyList_SET_ITEM(list, i, python_quaternion_from_c(qic->qstm_tgt_q(match_list[i])->copy()));
             }
             return list;
         }
@@ -219,21 +243,22 @@ python_quaternion_image_correlator_method_src_tgt_mappings(PyObject* self, PyObj
         c_quaternion *src_q, *tgt_q;
         if ( python_quaternion_data(src_q_obj, 0, (void *)&src_q) &&
              python_quaternion_data(tgt_q_obj, 0, (void *)&tgt_q) ) {
-            const c_quaternion *src_qx=qic->find_closest_src_qx(src_q, NULL);
-            auto qstm=qic->find_closest_tgt_qx(src_qx, tgt_q, NULL);
-            PyObject *list = PyList_New(0);
-            for (int i=0; ; i++) {
+            int src_index=qic->find_closest_src_qx_index(src_q, NULL);
+            auto qstm=qic->find_closest_tgt_qx(src_index, tgt_q, NULL);
+            int n=0;
+            while (qstm && qic->nth_src_tgt_q_mapping(qstm, n, NULL)) n++;
+            PyObject *list = PyList_New(n);
+            for (int i=0; i<n; i++) {
                 const c_quaternion *src_tgt_qs[4];
                 const c_quaternion *src_from_tgt_q;
                 src_from_tgt_q = qic->nth_src_tgt_q_mapping(qstm, i, src_tgt_qs);
-                if (!src_from_tgt_q) break;
-                PyList_Append(list, Py_BuildValue("OOOOO",
-                                                  python_quaternion_from_c(src_tgt_qs[0]->copy()),
-                                                  python_quaternion_from_c(src_tgt_qs[1]->copy()),
-                                                  python_quaternion_from_c(src_tgt_qs[2]->copy()),
-                                                  python_quaternion_from_c(src_tgt_qs[3]->copy()),
-                                                  python_quaternion_from_c(src_from_tgt_q->copy())
-                                  ));
+                PyList_SET_ITEM(list, i, Py_BuildValue("NNNNN",
+                                                         python_quaternion_from_c(src_tgt_qs[0]->copy()),
+                                                         python_quaternion_from_c(src_tgt_qs[1]->copy()),
+                                                         python_quaternion_from_c(src_tgt_qs[2]->copy()),
+                                                         python_quaternion_from_c(src_tgt_qs[3]->copy()),
+                                                         python_quaternion_from_c(src_from_tgt_q->copy())
+                                         ));
             }
             return list;
         }
@@ -241,6 +266,35 @@ python_quaternion_image_correlator_method_src_tgt_mappings(PyObject* self, PyObj
     Py_RETURN_NONE;
 }
 
+/*f python_quaternion_image_correlator_method_candidate_orients
+ * List of src_from_tgt orientations of the pair mappings, starting
+ * with the identity, each at least min_q_dist and at most max_q_dist
+ * from those before it
+ */
+static PyObject *
+python_quaternion_image_correlator_method_candidate_orients(PyObject* self, PyObject* args, PyObject *kwds)
+{
+    t_PyObject_quaternion_image_correlator *py_obj = (t_PyObject_quaternion_image_correlator *)self;
+
+    double min_q_dist=0.0002, max_q_dist=0.5;
+    static const char *kwlist[] = {"min_q_dist", "max_q_dist", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|dd", (char **)kwlist, 
+                                     &min_q_dist, &max_q_dist))
+        return NULL;
+
+    if (py_obj->quaternion_image_correlator) {
+        std::vector<c_quaternion> candidates;
+        candidates = py_obj->quaternion_image_correlator->candidate_src_from_tgts(min_q_dist, max_q_dist);
+        PyObject *list = PyList_New(candidates.size());
+        for (size_t i=0; i<candidates.size(); i++) {
+            PyList_SET_ITEM(list, i, python_quaternion_from_c(candidates[i].copy()));
+        }
+        return list;
+    }
+    Py_RETURN_NONE;
+}
+
 /*f python_quaternion_image_correlator_method_score_orient
  */
 static PyObject *
@@ -264,6 +318,51 @@ python_quaternion_image_correlator_method_score_orient(PyObject* self, PyObject*
     Py_RETURN_NONE;
 }
 
+/*f python_quaternion_image_correlator_method_score_orients
+ * Score a sequence of orientations in parallel, returning a list of
+ * scores; this does not change the match list used by 'scores' or
+ * 'best_matches'. With min_score, a score that cannot exceed it may
+ * be returned as less than its true value.
+ */
+static PyObject *
+python_quaternion_image_correlator_method_score_orients(PyObject* self, PyObject* args, PyObject *kwds)
+{
+    t_PyObject_quaternion_image_correlator *py_obj = (t_PyObject_quaternion_image_correlator *)self;
+
+    PyObject *orientations=NULL;
+    double min_score=-1.0;
+    static const char *kwlist[] = {"orientations", "min_score", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|d", (char **)kwlist, 
+                                     &orientations, &min_score))
+        return NULL;
+
+    if (py_obj->quaternion_image_correlator) {
+        PyObject *seq = PySequence_Fast(orientations, "orientations must be a tuple or list");
+        if (!seq) return NULL;
+        int len = PySequence_Size(seq);
+        std::vector<const c_quaternion *> qs(len);
+        std::vector<t_quaternion_image_match_score> scores(len);
+        for (int i=0; i<len; i++) {
+            c_quaternion *quaternion;
+            if (!python_quaternion_data(PySequence_Fast_GET_ITEM(seq, i), 0, (void *)&quaternion)) {
+                PyErr_SetString(PyExc_RuntimeError, "Non-quaternion object in orientations");
+                Py_DECREF(seq);
+                return NULL;
+            }
+            qs[i] = quaternion;
+        }
+        Py_DECREF(seq);
+        py_obj->quaternion_image_correlator->score_src_from_tgts(len, qs.data(), scores.data(), min_score);
+        PyObject *list = PyList_New(len);
+        for (int i=0; i<len; i++) {
+            PyList_SET_ITEM(list, i, PyFloat_FromDouble(scores[i].score));
+        }
+        return list;
+    }
+    Py_RETURN_NONE;
+}
+
 /*f python_quaternion_image_correlator_method_scores
  */
 static PyObject *
@@ -273,11 +372,12 @@ python_quaternion_image_correlator_method_scores(PyObject* self, PyObject* args)
 
     if (py_obj->quaternion_image_correlator) {
         c_quaternion_image_correlator *qic=py_obj->quaternion_image_correlator;
-        PyObject *list = PyList_New(0);
-        for (auto qstmsc : qic->total_score.match_list) {
-            PyList_Append(list, Py_BuildValue("OO",
-                                              python_quaternion_from_c(qic->qstm_src_q(qstmsc.qstm)->copy()),
-                                              python_quaternion_from_c(qic->qstm_tgt_q(qstmsc.qstm)->copy()) ));
+        const t_quaternion_image_src_tgt_match_score_list &match_list = qic->total_score.match_list;
+        PyObject *list = PyList_New(match_list.size());
+        for (size_t i=0; i<match_list.size(); i++) {
+            PyList_SET_ITEM(list, i, Py_BuildValue("NN",
+                                                   python_quaternion_from_c(qic->qstm_src_q(match_list[i].qstm)->copy()),
+                                                   python_quaternion_from_c(qic->qstm_tgt_q(match_list[i].qstm)->copy()) ));
         }
         return list;
     }
@@ -300,14 +400,14 @@ python_quaternion_image_correlator_method_best_matches(PyObject* self, PyObject*
 
     if (py_obj->quaternion_image_correlator) {
         c_quaternion_image_correlator *qic=py_obj->quaternion_image_correlator;
-        const t_quaternion_image_src_tgt_match_count_list *match_list;
-        match_list = qic->best_matches_of_list(&qic->total_score.match_list, min_score);
-        PyObject *list = PyList_New(0);
-        for (auto qstmc : *match_list) {
-            PyList_Append(list, Py_BuildValue("iOO",
-                                              qstmc.count,
-                                              python_quaternion_from_c(qic->qstm_src_q(qstmc.qstm)->copy()),
-                                              python_quaternion_from_c(qic->qstm_tgt_q(qstmc.qstm)->copy()) ));
+        t_quaternion_image_src_tgt_match_count_list match_list;
+        match_list = qic->best_matches_of_list(qic->total_score.match_list, min_score);
+        PyObject *list = PyList_New(match_list.size());
+        for (size_t i=0; i<match_list.size(); i++) {
+            PyList_SET_ITEM(list, i, Py_BuildValue("iNN",
+                                                   match_list[i].count,
+                                                   python_quaternion_from_c(qic->qstm_src_q(match_list[i].qstm)->copy()),
+                                                   python_quaternion_from_c(qic->qstm_tgt_q(match_list[i].qstm)->copy()) ));
         }
         return list;
     }
@@ -331,26 +431,24 @@ python_quaternion_image_correlator_method_src_tgt_mappings_of_best_matches(PyObj
 
     if (py_obj->quaternion_image_correlator) {
         c_quaternion_image_correlator *qic=py_obj->quaternion_image_correlator;
-        const t_quaternion_image_src_tgt_match_count_list *best_matches;
-        const t_quaternion_image_src_tgt_pair_mapping_list *src_tgt_mapping_list;
+        t_quaternion_image_src_tgt_match_count_list best_matches;
+        t_quaternion_image_src_tgt_pair_mapping_list src_tgt_mapping_list;
 
-        best_matches = qic->best_matches_of_list(&qic->total_score.match_list, min_score);
+        best_matches = qic->best_matches_of_list(qic->total_score.match_list, min_score);
         src_tgt_mapping_list = qic->src_tgt_mappings_from_best_matches(best_matches, min_count);
-        PyObject *list = PyList_New(0);
-        for (auto qstpm : *src_tgt_mapping_list) {
+        PyObject *list = PyList_New(src_tgt_mapping_list.size());
+        for (size_t i=0; i<src_tgt_mapping_list.size(); i++) {
             const c_quaternion *src_tgt_qs[4];
             const c_quaternion *src_from_tgt_q;
-            src_from_tgt_q = qic->qstpm_data(qstpm, src_tgt_qs);
-            PyList_Append(list, Py_BuildValue("OOOOO",
-                                              python_quaternion_from_c(src_tgt_qs[0]->copy()),
-                                              python_quaternion_from_c(src_tgt_qs[1]->copy()),
-                                              python_quaternion_from_c(src_tgt_qs[2]->copy()),
-                                              python_quaternion_from_c(src_tgt_qs[3]->copy()),
-                                              python_quaternion_from_c(src_from_tgt_q->copy())
-                              ));
+            src_from_tgt_q = qic->qstpm_data(src_tgt_mapping_list[i], src_tgt_qs);
+            PyList_SET_ITEM(list, i, Py_BuildValue("NNNNN",
+                                                     python_quaternion_from_c(src_tgt_qs[0]->copy()),
+                                                     python_quaternion_from_c(src_tgt_qs[1]->copy()),
+                                                     python_quaternion_from_c(src_tgt_qs[2]->copy()),
+                                                     python_quaternion_from_c(src_tgt_qs[3]->copy()),
+                                                     python_quaternion_from_c(src_from_tgt_q->copy())
+                                     ));
         }
-        delete (best_matches);
-        delete (src_tgt_mapping_list);
         return list;
     }
     Py_RETURN_NONE;
@@ -556,39 +556,31 @@ c_quaternion *c_quaternion::multiply(const c_quaternion *other, int premultiply)
 }
 
 /*f c_quaternion::rotate_vector
+  Returns this * vector * ~this (see quaternion_value.h)
  */
-c_quaternion &c_quaternion::rotate_vector(const c_vector &vector) const
+c_quaternion c_quaternion::rotate_vector(const c_vector &vector) const
 {
-    c_quaternion *r = new c_quaternion();
-    *r = (*this) * c_quaternion(vector) * this->copy()->conjugate();
-    return *r;
+    return c_quaternion(value().rotate_vector(vector.value()));
 }
 
 /*f c_quaternion::angle_axis
+  The rotation of (0,0,1), as used by the correlators, needs no products
  */
-c_quaternion &c_quaternion::angle_axis(const c_quaternion &other, c_vector &vector) const
+c_quaternion c_quaternion::angle_axis(const c_quaternion &other, const c_vector &vector) const
 {
-    c_quaternion a, b;
-    c_quaternion *r = new c_quaternion();
-    double cos_angle, sin_angle;
-    //fprintf(stderr,"vector:%lf,%lf,%lf\n",vector.coords()[0],vector.coords()[1],vector.coords()[2]);
-    a = this->rotate_vector(vector);
-    //fprintf(stderr,"a:%lf,%lf,%lf,%lf\n",a.r(),a.i(),a.j(),a.k());
-    b = other.rotate_vector(vector);
-    //fprintf(stderr,"b:%lf,%lf,%lf,%lf\n",b.r(),b.i(),b.j(),b.k());
-    c_vector axis = c_vector(&a).angle_axis_to_v(c_vector(&b), &cos_angle, &sin_angle);
-    //fprintf(stderr,"axis:%lf,%lf,%lf - %lf,%lf\n",axis.coords()[0],axis.coords()[1],axis.coords()[2],cos_angle,sin_angle);
-    *r = c_quaternion::of_rotation(cos_angle, sin_angle, axis.coords());
-    return *r;
+    const double *c = vector.coords();
+    if ((c[0]==0) && (c[1]==0) && (c[2]==1)) {
+        return c_quaternion(value().angle_axis_z(other.value()));
+    }
+    return c_quaternion(value().angle_axis(other.value(), vector.value()));
 }
 
 /*f c_quaternion::distance_to
+  1-real((this/other)^2), found without the products (see quaternion_value.h)
  */
 double c_quaternion::distance_to(const c_quaternion &other) const
 {
-    c_quaternion q;
-    q = (*this / other);
-    return 1-((q*q).r());
+    return value().distance_to(other.value());
 }
 
 /*a Others
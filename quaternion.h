@@ -25,7 +25,7 @@
 
 /*a Includes
  */
-
+#include "quaternion_value.h"
 
 /*a Types
  */
@@ -73,6 +73,8 @@ public:
     c_quaternion(void);
     c_quaternion(const class c_vector &vector);
     c_quaternion(double r, double i, double j, double k);
+    c_quaternion(const t_quatd &q) { quat.r=q.r; quat.i=q.i; quat.j=q.j; quat.k=q.k; }
+    inline t_quatd value(void) const { return t_quatd::rijk(quat.r, quat.i, quat.j, quat.k); }
     c_quaternion *copy(void) const;
 
     inline double r(void) const {return quat.r;};
@@ -101,8 +103,8 @@ public:
     // ('other' applied to that vector).
     // The axis will be perpendicular to the axes of rotation represented by 'this'
     // and 'other'
-    c_quaternion &rotate_vector(const class c_vector &vector) const;
-    c_quaternion &angle_axis(const c_quaternion &other, class c_vector &vector) const;
+    c_quaternion rotate_vector(const class c_vector &vector) const;
+    c_quaternion angle_axis(const c_quaternion &other, const class c_vector &vector) const;
     double distance_to(const c_quaternion &other) const;
     char *__str__(char *buffer, int buf_size) const;
     
@@ -1,4 +1,10 @@
 /*a Documentation
+  Every stored src_qx and tgt_qx carries its direction, the unit
+  vector it maps vector_z to. Closeness tests that used
+  angle_axis(other, vector_z).r() use the dot product d of the two
+  directions instead: that r() is the cosine of half the angle between
+  the directions, i.e. sqrt((1+d)/2) (see cos_half_angle), so the
+  thresholds are unchanged.
  */
 /*a Includes
  */
@@ -8,14 +14,22 @@
 #include <stdlib.h>
 #include <math.h>
 #include <vector>
-#include <map>
 #include "filter.h" // for point_value
 #include "vector.h"
 #include "quaternion.h"
+#include "thread_pool.h"
 
 /*a Defines
 */
 #define DEFAULT_MATCH_LENGTH (32)
+// Margin on the cosine bounds create_mappings uses to reject tgt pairs before test_add
+#define MAPPING_COS_MARGIN (1E-9)
+// Margin on the max_q_dist that candidate_src_from_tgts bounds by angle, for the rounding of distance_to
+#define CANDIDATE_DIST_MARGIN (1E-9)
+// create_mappings splits the src_qs in to about this many chunks per thread
+#define MAPPING_CHUNKS_PER_THREAD (16)
+// score_src_from_tgts splits the candidates in to about this many chunks per thread
+#define SCORE_CHUNKS_PER_THREAD (8)
 
 /*a Base types
  */
@@ -36,6 +50,36 @@ typedef struct
     t_point_value pv;
 } t_qi_src_tgt_pv;
 
+/*f direction_of
+  Unit vector that q maps vector_z to
+ */
+static inline t_vec3d
+direction_of(const c_quaternion *q)
+{
+    return q->value().rotate_vector_z().normalized();
+}
+
+/*f cos_half_angle
+  angle_axis(...).r() for two directions whose dot product is d
+ */
+static inline double
+cos_half_angle(double d)
+{
+    if (d>=1)  return 1;
+    if (d<=-1) return 0;
+    return sqrt((1+d)/2);
+}
+
+/*f angle_axis_of_directions
+  As angle_axis(other, vector_z).as_rotation(axis) for directions a to b
+ */
+static inline void
+angle_axis_of_directions(const t_vec3d &a, const t_vec3d &b, t_angle_axis *angle_axis)
+{
+    c_quaternion q_diff = c_quaternion(t_quatd::angle_axis_between(a, b));
+    angle_axis->angle = q_diff.as_rotation(angle_axis->axis);
+}
+
 /*c c_qi_src_tgt_pair_mapping - pair of src_qs mapped to pair of tgt_qs
 
     A quaternion_mapping is a mapping from a pair of source
@@ -85,11 +129,13 @@ class c_qi_src_tgt_pair_mapping
 public:
     static c_qi_src_tgt_pair_mapping *test_add( const c_qi_src_tgt_match *qstm0,
                                                 const c_qi_src_tgt_match *qstm1,
-                                                double max_angle_diff_ratio );
-    c_qi_src_tgt_pair_mapping(const c_qi_src_tgt_match *qstm0,
-                              const c_qi_src_tgt_match *qstm1,
-                              const t_angle_axis *src_angle_axis,
-                              const t_angle_axis *tgt_angle_axis);
+                                                const t_angle_axis *src_angle_axis,
+                                                double max_angle_diff_ratio,
+                                                c_arena<c_qi_src_tgt_pair_mapping> *arena );
+    void init(const c_qi_src_tgt_match *qstm0,
+              const c_qi_src_tgt_match *qstm1,
+              const t_angle_axis *src_angle_axis,
+              const t_angle_axis *tgt_angle_axis);
     void calculate(c_quaternion &src_from_tgt_orient, const t_angle_axis *src_angle_axis, const t_angle_axis *tgt_angle_axis);
     inline double distance_to(const c_quaternion *src_from_tgt_q) {
         return src_from_tgt_q->distance_to(src_from_tgt_orient);
@@ -109,18 +155,22 @@ public:
 class c_qi_src_tgt_match
 {
 public:
-    c_qi_src_tgt_match(const c_quaternion *src_qx, const c_quaternion *tgt_qx);
+    void init(const c_quaternion *src_qx, const t_vec3d &src_dir, const c_quaternion *tgt_qx);
     int add_match(const c_quaternion *src_q, const c_quaternion *tgt_q, const t_point_value *pv);
-    double tgt_distance(const c_quaternion *tgt_q) const;
+    double tgt_distance(const t_vec3d &tgt_q_dir) const;
     void reset_mappings(void);
     inline void add_mapping(c_qi_src_tgt_pair_mapping *stpm) {mappings.push_back(stpm);}
     double score_src_from_tgt(const c_quaternion *src_from_tgt_q, double min_cos_sep, double max_q_dist) const;
 
     const c_quaternion *src_qx;
     const c_quaternion *tgt_qx;
+    t_vec3d src_dir; // direction_of(src_qx)
+    t_vec3d tgt_dir; // direction_of(tgt_qx)
+    int id;          // Position in the correlator's qstms
+    int index;       // Position in the match list of src_qx
+    int src_index;   // Position of src_qx in the correlator's src_qs
     std::vector<t_qi_src_tgt_pv> matches;
     std::vector<c_qi_src_tgt_pair_mapping *> mappings;
-    int marked;
 };
 
 /*a Statics
@@ -132,14 +182,20 @@ static c_vector vector_z=c_vector(3,z);
 
 /*a c_qi_src_tgt_match methods
  */
-/*f c_qi_src_tgt_match::c_qi_src_tgt_match
+/*f c_qi_src_tgt_match::init
+  qstms come from the correlator's arena, so this may be a reused
+  qstm; its matches and mappings keep their capacity
 */
-c_qi_src_tgt_match::c_qi_src_tgt_match(const c_quaternion *src_qx, const c_quaternion *tgt_qx)
+void
+c_qi_src_tgt_match::init(const c_quaternion *src_qx, const t_vec3d &src_dir, const c_quaternion *tgt_qx)
 {
     this->src_qx = src_qx;
     this->tgt_qx = tgt_qx;
-    this->matches = std::vector<t_qi_src_tgt_pv>();
+    this->src_dir = src_dir;
+    this->tgt_dir = direction_of(tgt_qx);
+    this->matches.clear();
     this->matches.reserve(DEFAULT_MATCH_LENGTH);
+    this->mappings.clear();
 }
 
 /*f c_qi_src_tgt_match::add_match
@@ -155,15 +211,22 @@ c_qi_src_tgt_match::add_match(const c_quaternion *src_q, const c_quaternion *tgt
     return 0;
 }
 
+/*f c_qi_src_tgt_match::reset_mappings
+*/
+void
+c_qi_src_tgt_match::reset_mappings(void)
+{
+    mappings.clear();
+}
+
 /*f c_qi_src_tgt_match::tgt_distance
   Calculate a measure of distance between this tgt and another, where each is a point mapping
-  of vector_z
+  of vector_z; the other is given by its direction
 */
 double
-c_qi_src_tgt_match::tgt_distance(const c_quaternion *tgt_q) const
+c_qi_src_tgt_match::tgt_distance(const t_vec3d &tgt_q_dir) const
 {
-    c_quaternion tgt_q_diff = this->tgt_qx->angle_axis(tgt_q, vector_z);
-    return tgt_q_diff.r();
+    return cos_half_angle(tgt_dir.dot(tgt_q_dir));
 }
 
 /*f c_qi_src_tgt_match::score_src_from_tgt
@@ -177,7 +240,8 @@ double
 c_qi_src_tgt_match::score_src_from_tgt(const c_quaternion *src_from_tgt_q, double min_cos_sep, double max_q_dist) const
 {
     double score = 0;
-    double dst = ((*src_from_tgt_q)*(*tgt_qx)).angle_axis(src_qx,vector_z).r();
+    t_vec3d mapped_dir = src_from_tgt_q->value().rotate_vector(tgt_dir).ijk();
+    double dst = cos_half_angle(mapped_dir.dot(src_dir)/mapped_dir.modulus());
     if (dst<min_cos_sep) return score;
 
     //if verbose: print "passed src_q/tgt_qx mapping"
@@ -192,12 +256,13 @@ c_qi_src_tgt_match::score_src_from_tgt(const c_quaternion *src_from_tgt_q, doubl
 
 /*a c_qi_src_tgt_pair_mapping methods
  */
-/*f c_qi_src_tgt_pair_mapping::c_qi_src_tgt_pair_mapping
+/*f c_qi_src_tgt_pair_mapping::init
 */
-c_qi_src_tgt_pair_mapping::c_qi_src_tgt_pair_mapping(const c_qi_src_tgt_match *qstm0,
-                                                     const c_qi_src_tgt_match *qstm1,
-                                                     const t_angle_axis *src_angle_axis,
-                                                     const t_angle_axis *tgt_angle_axis)
+void
+c_qi_src_tgt_pair_mapping::init(const c_qi_src_tgt_match *qstm0,
+                                const c_qi_src_tgt_match *qstm1,
+                                const t_angle_axis *src_angle_axis,
+                                const t_angle_axis *tgt_angle_axis)
 {
     this->qstms[0] = qstm0;
     this->qstms[1] = qstm1;
@@ -213,24 +278,28 @@ c_qi_src_tgt_pair_mapping::c_qi_src_tgt_pair_mapping(const c_qi_src_tgt_match *q
 }
 
 /*f c_qi_src_tgt_pair_mapping::test_add
+  src_angle_axis is the rotation between the src_qx directions of
+  qstm0 and qstm1, which is common to all qstms of those src_qxs
+
+  A viable mapping is allocated from arena
 */
 c_qi_src_tgt_pair_mapping *
 c_qi_src_tgt_pair_mapping::test_add(const c_qi_src_tgt_match *qstm0,
                                     const c_qi_src_tgt_match *qstm1,
-                                    double max_angle_diff_ratio )
+                                    const t_angle_axis *src_angle_axis,
+                                    double max_angle_diff_ratio,
+                                    c_arena<c_qi_src_tgt_pair_mapping> *arena )
 {
-    c_quaternion src_q_diff = qstm0->src_qx->angle_axis(qstm1->src_qx, vector_z);
-    c_quaternion tgt_q_diff = qstm0->tgt_qx->angle_axis(qstm1->tgt_qx, vector_z);
-
-    t_angle_axis src_angle_axis;
+    c_qi_src_tgt_pair_mapping *qstpm;
     t_angle_axis tgt_angle_axis;
-    src_angle_axis.angle = src_q_diff.as_rotation(src_angle_axis.axis);
-    tgt_angle_axis.angle = tgt_q_diff.as_rotation(tgt_angle_axis.axis);
+    angle_axis_of_directions(qstm0->tgt_dir, qstm1->tgt_dir, &tgt_angle_axis);
 
-    if (fabs((src_angle_axis.angle-tgt_angle_axis.angle)) >=
-        fabs(src_angle_axis.angle*max_angle_diff_ratio))
+    if (fabs((src_angle_axis->angle-tgt_angle_axis.angle)) >=
+        fabs(src_angle_axis->angle*max_angle_diff_ratio))
         return NULL;
-    return new c_qi_src_tgt_pair_mapping(qstm0, qstm1, &src_angle_axis, &tgt_angle_axis);
+    qstpm = arena->alloc();
+    qstpm->init(qstm0, qstm1, src_angle_axis, &tgt_angle_axis);
+    return qstpm;
 }
 
 /*f c_qi_src_tgt_pair_mapping::calculate
@@ -238,8 +307,8 @@ c_qi_src_tgt_pair_mapping::test_add(const c_qi_src_tgt_match *qstm0,
 void
 c_qi_src_tgt_pair_mapping::calculate(c_quaternion &src_from_tgt_orient, const t_angle_axis *src_angle_axis, const t_angle_axis *tgt_angle_axis)
 {
-    c_vector sp0 = c_vector(qstms[0]->src_qx->rotate_vector(vector_z));
-    c_vector tp0 = c_vector(qstms[0]->tgt_qx->rotate_vector(vector_z));
+    c_vector sp0 = c_vector(qstms[0]->src_dir);
+    c_vector tp0 = c_vector(qstms[0]->tgt_dir);
     c_vector diff_axis;
 
     c_quaternion diff_q = src_angle_axis->axis.angle_axis_to_v(tgt_angle_axis->axis);
@@ -281,6 +350,9 @@ c_quaternion_image_correlator::c_quaternion_image_correlator(void)
     max_angle_diff_ratio = 0.02;  // for src->src/tgt->tgt to be permitted, 2% difference at most in angle between points on great circle
     min_cos_sep_score    = 0.9999; // 80pix35, 0.81 degrees
     max_q_dist_score     =0.0004; // 80pix35, 0.81 degrees
+    src_q_grid_cell = 0;
+    tgt_q_grid_cell = 0;
+    max_total_score = 0;
 
     //min_q_dist        = min_q_dists["80pix35"];
     //min_cos_sep       = min_cos_seps["80pix35"];
@@ -288,110 +360,224 @@ c_quaternion_image_correlator::c_quaternion_image_correlator(void)
     //max_q_dist_score  = min_q_dists["80pix35"];
 }
 
-/*f c_quaternion_image_correlator::find_close_src_qx
+/*f c_quaternion_image_correlator::~c_quaternion_image_correlator
+ */
+c_quaternion_image_correlator::~c_quaternion_image_correlator(void)
+{
+    for (auto arena : mapping_arenas) {
+        delete arena;
+    }
+}
+
+/*f c_quaternion_image_correlator::reset
+  Forget every match, src_qx, tgt_qx and mapping, ready for another
+  image pair; the arenas and lists keep their memory for reuse, so
+  pointers from before (e.g. from best_matches_of_list) are invalid
 */
-const c_quaternion *
-c_quaternion_image_correlator::find_close_src_qx(const c_quaternion *src_q, double *cos_angle_ptr) const
-{
-    for (auto src_qx : src_qs) {
-        double cos_angle;
-        cos_angle = src_qx->angle_axis(src_q, vector_z).r();
-        if (cos_angle>min_cos_angle_src_q) {
-            if (cos_angle_ptr) *cos_angle_ptr=cos_angle;
-            return src_qx;
+void
+c_quaternion_image_correlator::reset(void)
+{
+    for (size_t i=0; i<src_qs.size(); i++) {
+        src_q_match_lists[i].clear();
+    }
+    src_qs.clear();
+    src_q_dirs.clear();
+    qstms.clear();
+    src_q_grid.reset(src_q_grid.get_radius());
+    tgt_q_grid.reset(tgt_q_grid.get_radius());
+    quaternion_arena.reset();
+    qstm_arena.reset();
+    for (auto arena : mapping_arenas) {
+        arena->reset();
+    }
+    src_q_max_scores.clear();
+    max_total_score = 0;
+    total_score.score = 0;
+    total_score.match_list.clear();
+}
+
+/*f c_quaternion_image_correlator::update_grids
+  Size the grids from the thresholds (which may be changed at any
+  time), rebuilding a grid if its size has changed, so that any src_qx
+  or tgt_qx close enough to match is within the grid radius
+*/
+void
+c_quaternion_image_correlator::update_grids(void)
+{
+    double src_cell = c_direction_grid::chord_of_cos_half_angle(min_cos_angle_src_q)*(1+1E-6);
+    double tgt_cell = c_direction_grid::chord_of_cos_half_angle(min_cos_angle_tgt_q)*(1+1E-6);
+    if (src_cell!=src_q_grid_cell) {
+        src_q_grid_cell = src_cell;
+        src_q_grid.reset(src_cell);
+        for (size_t i=0; i<src_q_dirs.size(); i++) {
+            src_q_grid.add(src_q_dirs[i], i);
+        }
+    }
+    if (tgt_cell!=tgt_q_grid_cell) {
+        tgt_q_grid_cell = tgt_cell;
+        tgt_q_grid.reset(tgt_cell);
+        for (size_t i=0; i<qstms.size(); i++) {
+            tgt_q_grid.add(qstms[i]->tgt_dir, i, qstms[i]->src_index);
         }
     }
-    return NULL;
 }
 
-/*f c_quaternion_image_correlator::find_closest_src_qx
+/*f c_quaternion_image_correlator::find_close_src_qx
+  Return the index of the first src_qx (in order of addition) close
+  enough to src_q_dir, or -1; only src_qxs in the grid cells around
+  src_q_dir can be close enough
 */
-const c_quaternion *
-c_quaternion_image_correlator::find_closest_src_qx(const c_quaternion *src_q, double *cos_angle_ptr) const
+int
+c_quaternion_image_correlator::find_close_src_qx(const t_vec3d &src_q_dir) const
 {
-    double max_cos_angle;
-    const c_quaternion *closest_src_qx=NULL;
+    int first=-1;
+    src_q_grid.for_each_near(src_q_dir, [&](int i) {
+            if ((first>=0) && (i>first)) return;
+            if (cos_half_angle(src_q_dirs[i].dot(src_q_dir))>min_cos_angle_src_q) first=i;
+        });
+    return first;
+}
+
+/*f c_quaternion_image_correlator::find_closest_src_qx_index
+  The closest in the grid cells around src_q is the closest of all if
+  it is near enough that no closer src_qx can be outside those cells
 
-    for (auto src_qx : src_qs) {
-        double cos_angle;
-        cos_angle = src_qx->angle_axis(src_q, vector_z).r();
-        if ((!closest_src_qx) || (cos_angle>max_cos_angle)) {
-            closest_src_qx = src_qx;
+  Returns the index of the closest src_qx, or -1 if there are none
+*/
+int
+c_quaternion_image_correlator::find_closest_src_qx_index(const c_quaternion *src_q, double *cos_angle_ptr) const
+{
+    double max_cos_angle=0, max_d=0;
+    int closest=-1;
+    t_vec3d src_q_dir = direction_of(src_q);
+    auto consider = [&](int i) {
+        double d = src_q_dirs[i].dot(src_q_dir);
+        double cos_angle = cos_half_angle(d);
+        if ((closest<0) || (cos_angle>max_cos_angle) || ((cos_angle==max_cos_angle) && (i<closest))) {
+            closest = i;
             max_cos_angle = cos_angle;
+            max_d = d;
+        }
+    };
+
+    src_q_grid.for_each_near(src_q_dir, consider);
+    if ((closest<0) || !src_q_grid.covers(max_d)) {
+        closest = -1;
+        for (size_t i=0; i<src_qs.size(); i++) {
+            consider(i);
         }
     }
-    return closest_src_qx;
+    if (closest<0) return -1;
+    if (cos_angle_ptr) *cos_angle_ptr=max_cos_angle;
+    return closest;
+}
+
+/*f c_quaternion_image_correlator::find_closest_src_qx
+*/
+const c_quaternion *
+c_quaternion_image_correlator::find_closest_src_qx(const c_quaternion *src_q, double *cos_angle_ptr) const
+{
+    int closest = find_closest_src_qx_index(src_q, cos_angle_ptr);
+    if (closest<0) return NULL;
+    return src_qs[closest];
 }
 
 /*f c_quaternion_image_correlator::find_closest_tgt_qx
+  As find_closest_src_qx, for the tgt_qxs of src_qs[src_index]
  */
 const c_qi_src_tgt_match *
-c_quaternion_image_correlator::find_closest_tgt_qx( const c_quaternion *src_qx,
+c_quaternion_image_correlator::find_closest_tgt_qx( int src_index,
                                                     const c_quaternion *tgt_q,
                                                     double *cos_angle_ptr) const
 {
-    double max_cos_angle;
+    double max_cos_angle=0, max_d=0;
     const c_qi_src_tgt_match *closest_qstm=NULL;
-
-    if (matches_by_src_q.count(src_qx)<1) return NULL;
-    auto src_qx_ml = &(matches_by_src_q.at(src_qx));
-    for (auto qstm : *src_qx_ml) {
-        double cos_angle;
-        cos_angle = tgt_q->angle_axis(qstm->tgt_qx, vector_z).r();
-        if ((!closest_qstm) || (cos_angle>max_cos_angle)) {
+    t_vec3d tgt_q_dir;
+    auto consider = [&](const c_qi_src_tgt_match *qstm) {
+        double d = qstm->tgt_dir.dot(tgt_q_dir);
+        double cos_angle = cos_half_angle(d);
+        if ((!closest_qstm) || (cos_angle>max_cos_angle) ||
+            ((cos_angle==max_cos_angle) && (qstm->index<closest_qstm->index))) {
             closest_qstm = qstm;
             max_cos_angle = cos_angle;
+            max_d = d;
+        }
+    };
+
+    if ((src_index<0) || (src_index>=(int)src_qs.size())) return NULL;
+    auto src_qx_ml = &(src_q_match_lists[src_index]);
+    if (src_qx_ml->empty()) return NULL;
+    tgt_q_dir = direction_of(tgt_q);
+    tgt_q_grid.for_each_near(tgt_q_dir, [&](int i) { consider(qstms[i]); }, src_index);
+    if ((!closest_qstm) || !tgt_q_grid.covers(max_d)) {
+        closest_qstm = NULL;
+        for (auto qstm : *src_qx_ml) {
+            consider(qstm);
         }
     }
-    if (cos_angle_ptr) *cos_angle_ptr=max_cos_angle;
+    if (closest_qstm && cos_angle_ptr) *cos_angle_ptr=max_cos_angle;
     return closest_qstm;
 }
 
 /*f c_quaternion_image_correlator::find_or_add_tgt_q_to_src_q
+  Find the first qstm of src_qs[src_qx_index] (in list order) whose
+  tgt_qx is close enough to tgt_q, using the grid, or add a new one
 */
 c_qi_src_tgt_match *
-c_quaternion_image_correlator::find_or_add_tgt_q_to_src_q(const c_quaternion *src_qx,
+c_quaternion_image_correlator::find_or_add_tgt_q_to_src_q(int src_qx_index,
                                                           t_quaternion_image_src_tgt_match_list *src_tgt_match_list,
                                                           const c_quaternion *tgt_q)
 {
     c_qi_src_tgt_match *closest_qstm;
+    t_vec3d tgt_q_dir = direction_of(tgt_q);
     closest_qstm = NULL;
-    for (auto qstm : *src_tgt_match_list) {
-        double d;
-        d = qstm->tgt_distance(tgt_q);
-        if (d>min_cos_angle_tgt_q) {
-            closest_qstm = qstm;
-            break;
-        }
-    }
+    tgt_q_grid.for_each_near(tgt_q_dir, [&](int i) {
+            c_qi_src_tgt_match *qstm = qstms[i];
+            if (closest_qstm && (qstm->index>closest_qstm->index)) return;
+            if (qstm->tgt_distance(tgt_q_dir)>min_cos_angle_tgt_q) closest_qstm=qstm;
+        }, src_qx_index);
     if (!closest_qstm) {
-        closest_qstm = new c_qi_src_tgt_match(src_qx, tgt_q->copy());
-        if (closest_qstm) {
-            src_tgt_match_list->push_back(closest_qstm);
-        }
+        c_quaternion *tgt_qx = quaternion_arena.alloc();
+        *tgt_qx = *tgt_q;
+        closest_qstm = qstm_arena.alloc();
+        closest_qstm->init(src_qs[src_qx_index], src_q_dirs[src_qx_index], tgt_qx);
+        closest_qstm->id = qstms.size();
+        closest_qstm->index = src_tgt_match_list->size();
+        closest_qstm->src_index = src_qx_index;
+        src_tgt_match_list->push_back(closest_qstm);
+        tgt_q_grid.add(closest_qstm->tgt_dir, qstms.size(), src_qx_index);
+        qstms.push_back(closest_qstm);
     }
     return closest_qstm;
 }
 
 /*f c_quaternion_image_correlator::add_src_q
+  Add a src_qx, returning its index
 */
-const c_quaternion *
+int
 c_quaternion_image_correlator::add_src_q(const c_quaternion *src_q)
 {
-    c_quaternion *src_qx = src_q->copy();
+    c_quaternion *src_qx = quaternion_arena.alloc();
+    *src_qx = *src_q;
+    src_q_grid.add(direction_of(src_qx), src_qs.size());
     src_qs.push_back(src_qx);
-    matches_by_src_q[src_qx] = t_quaternion_image_src_tgt_match_list();
-    return src_qx;
+    src_q_dirs.push_back(direction_of(src_qx));
+    // Lists beyond src_qs are left from before a reset, already cleared
+    if (src_q_match_lists.size()<src_qs.size()) {
+        src_q_match_lists.push_back(t_quaternion_image_src_tgt_match_list());
+    }
+    return src_qs.size()-1;
 }
 
 /*f c_quaternion_image_correlator::find_of_add_src_q (find current src_q mapping point close enough to proposed src_q, or add a new match)
+  Returns the index of the src_qx
 */
-const c_quaternion *
+int
 c_quaternion_image_correlator::find_or_add_src_q(const c_quaternion *src_q)
 {
-    const c_quaternion *close_src_qx;
-    close_src_qx = find_close_src_qx(src_q, NULL);
-    if (close_src_qx) return close_src_qx;
+    int close_src_qx;
+    close_src_qx = find_close_src_qx(direction_of(src_q));
+    if (close_src_qx>=0) return close_src_qx;
     return add_src_q(src_q);
 }
 
@@ -402,13 +588,14 @@ c_quaternion_image_correlator::add_match(const c_quaternion *src_q,
                                          const c_quaternion *tgt_q,
                                          const t_point_value *pv)
 {
-    const c_quaternion *src_qx;
+    int src_qx_index;
     t_quaternion_image_src_tgt_match_list *match_list;
     c_qi_src_tgt_match *match; // src_qx,tgt_qx match - list of matches that are close enough to src_q and then close enough to tgt_q
 
-    src_qx = find_or_add_src_q(src_q);
-    match_list = &(matches_by_src_q.find(src_qx)->second);
-    match = find_or_add_tgt_q_to_src_q(src_qx, match_list, tgt_q);
+    update_grids();
+    src_qx_index = find_or_add_src_q(src_q);
+    match_list = &(src_q_match_lists[src_qx_index]);
+    match = find_or_add_tgt_q_to_src_q(src_qx_index, match_list, tgt_q);
     if (!match) {
         return -1;
     }
@@ -416,58 +603,217 @@ c_quaternion_image_correlator::add_match(const c_quaternion *src_q,
     return 0;
 }
 
+/*f c_quaternion_image_correlator::create_mappings_of_src_q
+ * Add to each qstm of src_qs[i0] its viable mappings to the qstms of
+ * every other src_qx, creating them in arena
+ *
+ * Only the qstms of src_qs[i0] are changed, so this may run for
+ * different i0 at the same time
+*/
+void
+c_quaternion_image_correlator::create_mappings_of_src_q(size_t i0,
+                                                        c_arena<c_qi_src_tgt_pair_mapping> *arena)
+{
+    const t_quaternion_image_src_tgt_match_list *src_q0_ml, *src_q1_ml;
+    c_qi_src_tgt_pair_mapping *qm;
+
+    src_q0_ml = &(src_q_match_lists[i0]);
+    if (src_q0_ml->empty()) return;
+    for (size_t i1=0; i1<src_qs.size(); i1++) {
+        t_angle_axis src_angle_axis;
+        double max_angle, cos_min, cos_max;
+        if (i1==i0) continue;
+        src_q1_ml = &(src_q_match_lists[i1]);
+        if (src_q1_ml->empty()) continue;
+        angle_axis_of_directions(src_q_dirs[i0], src_q_dirs[i1], &src_angle_axis);
+        // test_add needs the tgt angle within max_angle_diff_ratio of the src
+        // angle; outside the cosines of those bounds (with a margin for
+        // rounding) it must fail
+        max_angle = src_angle_axis.angle*(1+max_angle_diff_ratio);
+        cos_min = (max_angle>=M_PI) ? -1 : cos(max_angle);
+        cos_max = cos(src_angle_axis.angle*(1-max_angle_diff_ratio));
+        cos_min -= MAPPING_COS_MARGIN;
+        cos_max += MAPPING_COS_MARGIN;
+        for (auto qstm0 : *src_q0_ml) {
+            for (auto qstm1 : *src_q1_ml) {
+                double d = qstm0->tgt_dir.dot(qstm1->tgt_dir);
+                if ((d<cos_min) || (d>cos_max)) continue;
+                qm = c_qi_src_tgt_pair_mapping::test_add(qstm0, qstm1, &src_angle_axis, max_angle_diff_ratio, arena);
+                if (!qm) continue;
+                qstm0->add_mapping(qm);
+            }
+        }
+    }
+}
+
 /*f c_quaternion_image_correlator::create_mappings
  * For every pair of src_qx's (src_q0,src_q1):
  *  for each tgt_q0, tgt_q1 in src_q0, src_q1:
  *    create a c_qi_src_tgt_pair_mapping from (src_q0, src_q1) to (tgt_q0, tgt_q1)
  *    IF such a mapping is viable (e.g. rotation angle from src_q0->1 is same as tgt_q0->q1)
+ *
+ * The src_q0s are split in to chunks across the default thread pool,
+ * each chunk with its own arena. Mappings from an earlier call are
+ * discarded first, reusing their arenas. A mapping is only added to the
+ * qstms of its src_q0, and each src_q0 is handled by one chunk in the
+ * serial order, so the mapping lists are the same as a serial run
+ * would produce, whatever the number of threads. Without use_threads
+ * that serial run is made, as a single chunk.
 */
 int
-c_quaternion_image_correlator::create_mappings(void)
+c_quaternion_image_correlator::create_mappings(int use_threads)
 {
-    //const c_quaternion *src_q0, *src_q1;
-    //c_qi_src_tgt_match *qstm0, *qstm1;
-    const c_quaternion *tgt_q0, *tgt_q1;
-    t_quaternion_image_src_tgt_match_list *src_q0_ml, *src_q1_ml;
-    c_qi_src_tgt_pair_mapping *qm;
+    c_thread_pool *pool = thread_pool_default();
+    int num_src_qs = src_qs.size();
+    int grain, num_chunks;
+
+    for (auto qstm : qstms) {
+        qstm->reset_mappings();
+    }
+    for (auto arena : mapping_arenas) {
+        arena->reset();
+    }
+    if (num_src_qs==0) {
+        find_max_scores();
+        return 0;
+    }
 
-    for (auto src_q0 : src_qs) {
-        for (auto src_q1 : src_qs) {
-            if (src_q0==src_q1) continue;
-            src_q0_ml = &(matches_by_src_q[src_q0]);
-            src_q1_ml = &(matches_by_src_q[src_q1]);
-            for (auto qstm0 : *src_q0_ml) {
-                tgt_q0 = qstm0->tgt_qx;
-                for (auto qstm1 : *src_q1_ml) {
-                    tgt_q1 = qstm1->tgt_qx;
-                    qm = c_qi_src_tgt_pair_mapping::test_add(qstm0, qstm1, max_angle_diff_ratio);
-                    if (!qm) continue;
-                    qstm0->add_mapping(qm);
+    grain = num_src_qs/(pool->num_threads*MAPPING_CHUNKS_PER_THREAD);
+    if (grain<1) grain=1;
+    if (!use_threads) grain=num_src_qs;
+    num_chunks = (num_src_qs+grain-1)/grain;
+    while ((int)mapping_arenas.size()<num_chunks) {
+        mapping_arenas.push_back(new c_arena<c_qi_src_tgt_pair_mapping>());
+    }
+
+    pool->parallel_for(num_src_qs, grain, [&](int start, int end) {
+            c_arena<c_qi_src_tgt_pair_mapping> *arena = mapping_arenas[start/grain];
+            for (int i0=start; i0<end; i0++) {
+                create_mappings_of_src_q(i0, arena);
+            }
+        });
+    find_max_scores();
+    return 0;
+}
+
+/*f c_quaternion_image_correlator::find_max_scores
+ * A qstm scores at most one per mapping, so a src_qx scores at most
+ * the most mappings of any of its qstms; only create_mappings adds
+ * mappings, so these bounds hold until it is next called
+*/
+void
+c_quaternion_image_correlator::find_max_scores(void)
+{
+    src_q_max_scores.assign(src_qs.size(), 0.0);
+    max_total_score = 0;
+    for (auto qstm : qstms) {
+        double max_score = qstm->mappings.size();
+        if (max_score>src_q_max_scores[qstm->src_index]) {
+            max_total_score += max_score-src_q_max_scores[qstm->src_index];
+            src_q_max_scores[qstm->src_index] = max_score;
+        }
+    }
+}
+
+/*f c_quaternion_image_correlator::candidate_src_from_tgts
+ * Collect the src_from_tgt_orient of every pair mapping (of each
+ * src_qx in order, each of its qstms in order), after the identity,
+ * keeping one only if its distance_to every one already kept is at
+ * least min_q_dist and at most max_q_dist
+ *
+ * Kept orientations closer than min_q_dist are found with a grid.
+ * Every kept orientation is within max_q_dist of the identity, which
+ * is kept first; in angle terms (distance_to is 2*sin^2 of the angle
+ * between unit quaternions, which obeys the triangle inequality) a
+ * candidate whose angle from the identity plus the largest such angle
+ * of those kept is within that of max_q_dist must be close enough to
+ * all of them, and the others are checked one by one. The angle
+ * bound is for a max_q_dist a margin less than that given, as
+ * distance_to is rounded. Unit quaternions are never further apart
+ * than 2, so for a max_q_dist beyond 2 (by that margin) only the
+ * identity is checked.
+*/
+std::vector<c_quaternion>
+c_quaternion_image_correlator::candidate_src_from_tgts(double min_q_dist, double max_q_dist) const
+{
+    std::vector<t_quatd> kept;
+    c_quaternion_grid grid;
+    double max_angle, kept_max_angle, max_sin2;
+    int check_far;
+
+    check_far = (max_q_dist<2+CANDIDATE_DIST_MARGIN);
+    max_sin2 = (max_q_dist-CANDIDATE_DIST_MARGIN)/2;
+    max_sin2 = (max_sin2<0) ? 0 : ((max_sin2>1) ? 1 : max_sin2);
+    max_angle = asin(sqrt(max_sin2)) - MAPPING_COS_MARGIN;
+    kept_max_angle = 0;
+    grid.reset(c_quaternion_grid::chord_of_distance(min_q_dist)*(1+1E-6));
+    kept.push_back(t_quatd::identity());
+    grid.add(kept[0], 0);
+
+    for (size_t src_index=0; src_index<src_qs.size(); src_index++) {
+        for (auto qstm : src_q_match_lists[src_index]) {
+            for (auto qstpm : qstm->mappings) {
+                t_quatd q = qstpm->src_from_tgt_orient.value();
+                double d, angle;
+                int too_near=0;
+                if (q.distance_to(kept[0])>max_q_dist) continue;
+                grid.for_each_near(q, [&](int i) {
+                        if (q.distance_to(kept[i])<min_q_dist) too_near=1;
+                    });
+                if (too_near) continue;
+                d = fabs(q.normalized().r);
+                angle = acos((d>1)?1:d);
+                if (check_far && (angle+kept_max_angle>max_angle)) {
+                    int too_far=0;
+                    for (auto k : kept) {
+                        if (q.distance_to(k)>max_q_dist) {too_far=1; break;}
+                    }
+                    if (too_far) continue;
                 }
+                if (angle>kept_max_angle) kept_max_angle=angle;
+                grid.add(q, kept.size());
+                kept.push_back(q);
             }
         }
     }
-    return 0;
+
+    std::vector<c_quaternion> result;
+    result.reserve(kept.size());
+    for (auto k : kept) {
+        result.push_back(c_quaternion(k));
+    }
+    return result;
 }
 
-/*f c_quaternion_image_correlator::score_src_from_tgt
+/*f c_quaternion_image_correlator::score_of_src_from_tgt
  *
  * For each src_qx
  *  For each tgt_qx that the src_qx maps to
  *   Generate a score
  *   If the score is the best for src_qx ->, then record as max
  *  Add up max scores as the total score
+ *
+ * If min_score is not negative then scoring stops once the src_qxs
+ * still to be scored cannot take the total above min_score; the
+ * result then has a score (and match list) of only the src_qxs scored
+ * so far, which is at most min_score
+ *
+ * This does not change the correlator, so many may run at once
 */
-double
-c_quaternion_image_correlator::score_src_from_tgt(const c_quaternion *src_from_tgt_q)
+t_quaternion_image_match_score
+c_quaternion_image_correlator::score_of_src_from_tgt(const c_quaternion *src_from_tgt_q, double min_score) const
 {
-    total_score.score = 0;
-    total_score.match_list.clear();
-    for (auto src_qx_ml : matches_by_src_q) {
+    t_quaternion_image_match_score result;
+    double score_remaining = max_total_score;
+    result.score = 0;
+    for (size_t src_index=0; src_index<src_qs.size(); src_index++) {
+        const t_quaternion_image_src_tgt_match_list &src_qx_ml = src_q_match_lists[src_index];
         t_qstm_score max_qstm_score;
+        if (src_qx_ml.empty()) continue;
+        if ((min_score>=0) && (result.score+score_remaining<=min_score)) break;
         max_qstm_score.score = 0;
         max_qstm_score.qstm = NULL;
-        for (auto qstm : src_qx_ml.second) {
+        for (auto qstm : src_qx_ml) {
             double score;
             score = qstm->score_src_from_tgt(src_from_tgt_q, min_cos_sep_score, max_q_dist_score);
             if (score>max_qstm_score.score) {
@@ -476,42 +822,43 @@ c_quaternion_image_correlator::score_src_from_tgt(const c_quaternion *src_from_t
             }
         }
         if (max_qstm_score.qstm) {
-            total_score.score += max_qstm_score.score;
-            total_score.match_list.push_back(max_qstm_score);
+            result.score += max_qstm_score.score;
+            result.match_list.push_back(max_qstm_score);
         }
+        if (src_index<src_q_max_scores.size()) score_remaining -= src_q_max_scores[src_index];
     }
-    return total_score.score;
+    return result;
 }
 
-/*t t_qstm_count_vector
- */
-typedef std::vector<t_qstm_count> t_qstm_count_vector;
-
-/*t t_used_matches
- */
-typedef std::map<const c_quaternion *, t_qstm_count_vector> t_used_matches;
-
-/*f used_matches_inc
- */
-static void
-used_matches_inc(t_used_matches &used_matches, const c_qi_src_tgt_match *qstm, int permit_add)
-{
-    int n;
-    t_qstm_count_vector *qstmc = &(used_matches[qstm->src_qx]);
-    n = qstmc->size();
-    for (int i=0; i<n; i++) {
-        if ((*qstmc)[i].qstm == qstm) {
-            (&(*qstmc)[i])->count++;
-            return;
-        }
-    }
-    if (!permit_add) return;
-    t_qstm_count qstm_count;
-    qstm_count.count = 1;
-    qstm_count.qstm = qstm;
-    used_matches[qstm->src_qx].push_back(qstm_count);
+/*f c_quaternion_image_correlator::score_src_from_tgt
+ * Score src_from_tgt_q, keeping its match list in total_score for
+ * best_matches_of_list
+*/
+double
+c_quaternion_image_correlator::score_src_from_tgt(const c_quaternion *src_from_tgt_q)
+{
+    total_score = score_of_src_from_tgt(src_from_tgt_q);
+    return total_score.score;
 }
 
+/*f c_quaternion_image_correlator::score_src_from_tgts
+ * Score num_qs candidates in to scores[], split across the default
+ * thread pool; each is as score_of_src_from_tgt with min_score
+*/
+void
+c_quaternion_image_correlator::score_src_from_tgts(int num_qs,
+                                                   const c_quaternion *const *src_from_tgt_qs,
+                                                   t_quaternion_image_match_score *scores,
+                                                   double min_score) const
+{
+    c_thread_pool *pool = thread_pool_default();
+    int grain = num_qs/(pool->num_threads*SCORE_CHUNKS_PER_THREAD);
+    pool->parallel_for(num_qs, grain, [&](int start, int end) {
+            for (int i=start; i<end; i++) {
+                scores[i] = score_of_src_from_tgt(src_from_tgt_qs[i], min_score);
+            }
+        });
+}
 
 /*f c_quaternion_image_correlator::best_matches_of_list
  *
@@ -526,7 +873,7 @@ used_matches_inc(t_used_matches &used_matches, const c_qi_src_tgt_match *qstm, i
  * So, for each src_qx we need a list of tgt_qx that _all_ the max_qstms demand of it, along with counts
  * Then the highest count tgt_qx can be the chosen mapping for that src_qx
  *
- * This will lead to a set of src_qx->tgt_qx mappings (which must be in matches_by_src_q[])
+ * This will lead to a set of src_qx->tgt_qx mappings (which must be in the src_qx match lists)
  *
  * However, the src_qx->tgt_qx mappings that are chosen can be searched for chosen src_q/tgt_q matches,
  * and this will yield a list of chosen mapping pairs (each of which has a src->tgt transformation quaternion).
@@ -538,7 +885,7 @@ used_matches_inc(t_used_matches &used_matches, const c_qi_src_tgt_match *qstm, i
  * The algorithm is then:
  *
  * Clear used matches
- * clear map of used matches[src_qx] = list of (qstm, count)
+ * clear count (and order of first use) of every qstm, indexed by qstm id
  * clear 'best_matches' in each src_qx
  *
  * Accumulate used matches
@@ -548,8 +895,8 @@ used_matches_inc(t_used_matches &used_matches, const c_qi_src_tgt_match *qstm, i
  *       add qstpm->qstm1 to set of used matches if not there, and increment its count
  *
  * Find highest counts, generate best_matches
- * for src_qx in used_matches:
- *   find highest count qstm, and record qstm,count in 'best_matches' for src_qx
+ * for src_qx in order:
+ *   find highest count qstm (the first used if tied), and record qstm,count in 'best_matches' for src_qx
  *
  * for src_qx:
  *   work out vf, vu for best_qstm
@@ -557,49 +904,49 @@ used_matches_inc(t_used_matches &used_matches, const c_qi_src_tgt_match *qstm, i
  *
  * determine quaternion of transformation looking at vf with up of vu
 */
-const t_quaternion_image_src_tgt_match_count_list *
-c_quaternion_image_correlator::best_matches_of_list(const t_quaternion_image_src_tgt_match_score_list *match_list,
-                                                    double min_score)
+t_quaternion_image_src_tgt_match_count_list
+c_quaternion_image_correlator::best_matches_of_list(const t_quaternion_image_src_tgt_match_score_list &match_list,
+                                                    double min_score) const
 {
-    t_quaternion_image_src_tgt_match_count_list *result;
-    t_used_matches used_matches;
-
-    /*b Clear used_matches
-     */
-    for (auto src_qx : src_qs) {
-        used_matches[src_qx] = t_qstm_count_vector();
-    }
+    t_quaternion_image_src_tgt_match_count_list result;
+    std::vector<int> counts(qstms.size(), 0); // 0 if not used
+    std::vector<int> first_use(qstms.size(), 0);
+    int num_used=0;
 
-    /*b Accumulate used_matches
+    /*b Accumulate used matches
      * Only add in those that are in the match list
      * The others should increment the counts if the mapping already exists
      */
-    for (auto qstmsc : *match_list) {
+    for (const auto &qstmsc : match_list) {
         if (qstmsc.score > min_score) {
-            used_matches_inc(used_matches, qstmsc.qstm, 1);
+            int id = qstmsc.qstm->id;
+            if (counts[id]==0) first_use[id] = num_used++;
+            counts[id]++;
         }
     }
-    for (auto qstmsc : *match_list) {
+    for (const auto &qstmsc : match_list) {
         for (auto qstpm : qstmsc.qstm->mappings) {
-            used_matches_inc(used_matches, qstpm->qstms[1], 0);
+            int id = qstpm->qstms[1]->id;
+            if (counts[id]>0) counts[id]++;
         }
     }
 
     /*b Find highest counts, generate result as list of best_matches
      */
-    result = new t_quaternion_image_src_tgt_match_count_list();
-    for (auto src_qx : used_matches) {
+    for (size_t src_index=0; src_index<src_qs.size(); src_index++) {
         t_qstm_count best_match;
         best_match.count = 0;
         best_match.qstm = NULL;
-        for (auto qstm_count : src_qx.second) {
-            if (qstm_count.count>best_match.count) {
-                best_match.count = qstm_count.count;
-                best_match.qstm = qstm_count.qstm;
+        for (auto qstm : src_q_match_lists[src_index]) {
+            int id = qstm->id;
+            if ((counts[id]>best_match.count) ||
+                ((counts[id]>0) && (counts[id]==best_match.count) && (first_use[id]<first_use[best_match.qstm->id]))) {
+                best_match.count = counts[id];
+                best_match.qstm = qstm;
             }
         }
-        if (best_match.qstm) { // should always be true
-            result->push_back(best_match);
+        if (best_match.qstm) {
+            result.push_back(best_match);
         }
     }
 
@@ -628,38 +975,29 @@ c_quaternion_image_correlator::best_matches_of_list(const t_quaternion_image_src
  *       add qstm,qstm,src_from_tgt_q to the list
  *
 */
-const t_quaternion_image_src_tgt_pair_mapping_list *
-c_quaternion_image_correlator::src_tgt_mappings_from_best_matches(const t_quaternion_image_src_tgt_match_count_list *best_matches,
-                                                                  int min_count)
+t_quaternion_image_src_tgt_pair_mapping_list
+c_quaternion_image_correlator::src_tgt_mappings_from_best_matches(const t_quaternion_image_src_tgt_match_count_list &best_matches,
+                                                                  int min_count) const
 {
-    t_quaternion_image_src_tgt_pair_mapping_list *result;
-    t_used_matches used_matches;
-
-    /*b Clear used_matches
-     */
-    for (auto src_qx_ml : matches_by_src_q) {
-        for (auto qstm : src_qx_ml.second) {
-            qstm->marked = 0;
-        }
-    }
+    t_quaternion_image_src_tgt_pair_mapping_list result;
+    std::vector<char> marked(qstms.size(), 0); // Indexed by qstm id
 
     /*b Mark suitable best_matches 
      * For each qstm on the best_matches list:
      *   Mark as on the list
      */
-    for (auto qstmc : *best_matches) {
+    for (const auto &qstmc : best_matches) {
         if (qstmc.count > min_count) {
-            ((c_qi_src_tgt_match *)qstmc.qstm)->marked = 1;
+            marked[qstmc.qstm->id] = 1;
         }
     }
 
     /*b Add any src/tgt pairing that has both qstms marked to the result
      */
-    result = new t_quaternion_image_src_tgt_pair_mapping_list();
-    for (auto qstmc : *best_matches) {
+    for (const auto &qstmc : best_matches) {
         for (auto qstpm : qstmc.qstm->mappings) {
-            if (qstpm->qstms[1]->marked) {
-                result->push_back(qstpm);
+            if (marked[qstpm->qstms[1]->id]) {
+                result.push_back(qstpm);
             }
         }
     }
@@ -26,8 +26,9 @@
 /*a Includes
  */
 #include <vector>
-#include <map>
 #include "quaternion.h"
+#include "direction_grid.h"
+#include "arena.h"
 #include "filter.h"
 
 /*a Defines
@@ -80,21 +81,47 @@ typedef struct
 class c_quaternion_image_correlator
 {
 private:
-    const c_quaternion *find_or_add_src_q(const c_quaternion *src_q);
-    const c_quaternion *add_src_q(const c_quaternion *src_q);
-    class c_qi_src_tgt_match *find_or_add_tgt_q_to_src_q(const c_quaternion *src_qx,
+    void update_grids(void);
+    int find_or_add_src_q(const c_quaternion *src_q);
+    int add_src_q(const c_quaternion *src_q);
+    class c_qi_src_tgt_match *find_or_add_tgt_q_to_src_q(int src_qx_index,
                                                          t_quaternion_image_src_tgt_match_list *src_tgt_match_list,
                                                          const c_quaternion *tgt_q);
-    const c_quaternion *find_close_src_qx(const c_quaternion *src_q, double *cos_angle) const;
+    int find_close_src_qx(const t_vec3d &src_q_dir) const;
+    void create_mappings_of_src_q(size_t i0,
+                                  c_arena<class c_qi_src_tgt_pair_mapping> *arena);
+    void find_max_scores(void);
+
+    c_direction_grid src_q_grid; // Indices in to src_qs
+    c_direction_grid tgt_q_grid; // Indices in to qstms, by tgt_qx direction
+    double src_q_grid_cell;
+    double tgt_q_grid_cell;
+    std::vector<class c_qi_src_tgt_match *> qstms; // Every qstm, by id (in order of creation)
+    std::vector<t_quaternion_image_src_tgt_match_list> src_q_match_lists; // qstms of each src_qx, by index; those beyond src_qs are spare
+    c_arena<c_quaternion> quaternion_arena; // Storage of src_qxs and tgt_qxs
+    c_arena<class c_qi_src_tgt_match> qstm_arena; // Storage of qstms
+    std::vector<c_arena<class c_qi_src_tgt_pair_mapping> *> mapping_arenas; // Storage of pair mappings, one per create_mappings chunk
+    std::vector<double> src_q_max_scores; // Most any src_qx can score, by index, from create_mappings
+    double max_total_score; // Sum of src_q_max_scores
 public:
+    int find_closest_src_qx_index(const c_quaternion *src_q, double *cos_angle) const;
     const c_quaternion *find_closest_src_qx(const c_quaternion *src_q, double *cos_angle) const;
-    const class c_qi_src_tgt_match *find_closest_tgt_qx(const c_quaternion *src_qx, const c_quaternion *tgt_q, double *cos_angle) const;
+    const class c_qi_src_tgt_match *find_closest_tgt_qx(int src_index, const c_quaternion *tgt_q, double *cos_angle) const;
+    inline const t_quaternion_image_src_tgt_match_list &matches_of_src_q(int src_index) const { return src_q_match_lists[src_index]; }
     c_quaternion_image_correlator(void);
+    ~c_quaternion_image_correlator(void);
+    void reset(void);
     int add_match(const c_quaternion *src_q,
                   const c_quaternion *tgt_q,
                   const t_point_value *pv);
-    int create_mappings(void);
+    int create_mappings(int use_threads=1);
     double score_src_from_tgt(const c_quaternion *src_from_tgt_q);
+    t_quaternion_image_match_score score_of_src_from_tgt(const c_quaternion *src_from_tgt_q, double min_score=-1) const;
+    std::vector<c_quaternion> candidate_src_from_tgts(double min_q_dist, double max_q_dist) const;
+    void score_src_from_tgts(int num_qs,
+                             const c_quaternion *const *src_from_tgt_qs,
+                             t_quaternion_image_match_score *scores,
+                             double min_score=-1) const;
     const c_quaternion *qstm_tgt_q(const class c_qi_src_tgt_match *qstm) const;
     const c_quaternion *qstm_src_q(const class c_qi_src_tgt_match *qstm) const;
     const c_quaternion *nth_src_tgt_q_mapping(const class c_qi_src_tgt_match *qstm,
@@ -102,13 +129,13 @@ public:
                                               const c_quaternion *src_tgt_qs[4]) const;
     const c_quaternion *qstpm_data(const class c_qi_src_tgt_pair_mapping *qstpm,
                                    const c_quaternion *src_tgt_qs[4]) const;
-    const t_quaternion_image_src_tgt_match_count_list *best_matches_of_list(const t_quaternion_image_src_tgt_match_score_list *match_list,
-                                                                            double min_score=0.0);
-    const t_quaternion_image_src_tgt_pair_mapping_list *src_tgt_mappings_from_best_matches(const t_quaternion_image_src_tgt_match_count_list *best_matches,
-                                                                                           int min_count=0);
+    t_quaternion_image_src_tgt_match_count_list best_matches_of_list(const t_quaternion_image_src_tgt_match_score_list &match_list,
+                                                                     double min_score=0.0) const;
+    t_quaternion_image_src_tgt_pair_mapping_list src_tgt_mappings_from_best_matches(const t_quaternion_image_src_tgt_match_count_list &best_matches,
+                                                                                    int min_count=0) const;
 
     std::vector<const c_quaternion *> src_qs;
-    std::map<const c_quaternion *, t_quaternion_image_src_tgt_match_list> matches_by_src_q;
+    std::vector<t_vec3d> src_q_dirs; // Unit vector each of src_qs maps vector_z to
     double min_cos_angle_src_q;
     double min_cos_angle_tgt_q;
     double min_cos_sep_score;
@@ -0,0 +1,681 @@
+/*a Documentation
+  Tests of c_quaternion_image_correlator against simple (slow) versions
+  of what it finds
+ */
+/*a Includes
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <vector>
+#include "quaternion_image_correlator.h"
+#include "vector.h"
+#include "filter.h" // for point_value
+#include "thread_pool.h"
+#include "test.h"
+
+/*a Support functions
+ */
+/*f random_real
+ */
+static double random_real(double min, double max)
+{
+    return min + (max-min)*(rand()/(double)RAND_MAX);
+}
+
+/*f random_rotation
+ * Unit quaternion with r of r_min to r_max (and random sign) and a
+ * random axis
+ */
+static c_quaternion random_rotation(double r_min, double r_max)
+{
+    double r = random_real(r_min, r_max);
+    double i = random_real(-1,1), j = random_real(-1,1), k = random_real(-1,1);
+    double s = sqrt((1-r*r)/(i*i+j*j+k*k));
+    if (rand()&1) r=-r;
+    return c_quaternion::rijk(r, i*s, j*s, k*s);
+}
+
+/*f add_random_matches
+ * Add num_points src orientations (within ten degrees of straight
+ * ahead) each matched to its image under one of rotations, or (one in
+ * three) to an unrelated orientation; every other src is also matched
+ * from a second src near it
+ */
+static void add_random_matches(c_quaternion_image_correlator &qic, int num_points, std::vector<c_quaternion> &rotations)
+{
+    t_point_value pv;
+    pv.x = 0;
+    pv.y = 0;
+    pv.value = 1;
+    for (int n=0; n<num_points; n++) {
+        c_quaternion src_q = c_quaternion::of_euler(0, random_real(-10,10), random_real(-10,10), 1);
+        c_quaternion tgt_q = rotations[rand()%rotations.size()] * src_q;
+        if (rand()%3==0) {
+            tgt_q = c_quaternion::of_euler(0, random_real(-10,10), random_real(-10,10), 1);
+        }
+        qic.add_match(&src_q, &tgt_q, &pv);
+        if (n&1) {
+            c_quaternion src_q2 = src_q * c_quaternion::of_euler(0, 0.3, 0.2, 1);
+            qic.add_match(&src_q2, &tgt_q, &pv);
+        }
+    }
+}
+
+/*f candidates_of_mappings
+ * The src_from_tgt orientations of every pair mapping of a correlator,
+ * in the order that candidate_src_from_tgts visits them
+ */
+static std::vector<c_quaternion> candidates_of_mappings(c_quaternion_image_correlator &qic)
+{
+    std::vector<c_quaternion> candidates;
+    for (size_t src_index=0; src_index<qic.src_qs.size(); src_index++) {
+        for (auto qstm : qic.matches_of_src_q(src_index)) {
+            const c_quaternion *q;
+            for (int n=0; (q=qic.nth_src_tgt_q_mapping(qstm, n, NULL))!=NULL; n++) {
+                candidates.push_back(*q);
+            }
+        }
+    }
+    return candidates;
+}
+
+/*f candidates_kept
+ * Keep each candidate (after the identity) whose distance_to every
+ * one already kept is at least min_q_dist and at most max_q_dist
+ */
+static std::vector<c_quaternion> candidates_kept(std::vector<c_quaternion> &candidates, double min_q_dist, double max_q_dist)
+{
+    std::vector<c_quaternion> kept;
+    kept.push_back(c_quaternion::identity());
+    for (auto &q : candidates) {
+        int keep=1;
+        for (auto &k : kept) {
+            double d = q.distance_to(k);
+            if ((d<min_q_dist) || (d>max_q_dist)) {keep=0; break;}
+        }
+        if (keep) kept.push_back(q);
+    }
+    return kept;
+}
+
+/*f mapping_values
+ * The number of pair mappings of every qstm of a correlator, and the
+ * quaternions of each (its src_qs, tgt_qs and src_from_tgt
+ * orientation), in order
+ */
+static std::vector<double> mapping_values(c_quaternion_image_correlator &qic)
+{
+    std::vector<double> values;
+    for (size_t src_index=0; src_index<qic.src_qs.size(); src_index++) {
+        for (auto qstm : qic.matches_of_src_q(src_index)) {
+            const c_quaternion *src_tgt_qs[4];
+            const c_quaternion *q;
+            int n;
+            for (n=0; (q=qic.nth_src_tgt_q_mapping(qstm, n, src_tgt_qs))!=NULL; n++) {
+                double rijk[4];
+                for (int i=0; i<4; i++) {
+                    src_tgt_qs[i]->get_rijk(rijk);
+                    values.insert(values.end(), rijk, rijk+4);
+                }
+                q->get_rijk(rijk);
+                values.insert(values.end(), rijk, rijk+4);
+            }
+            values.push_back(n);
+        }
+    }
+    return values;
+}
+
+/*f add_seeded_matches
+ * As add_random_matches with rotations of its own, repeatable by seed
+ */
+static void add_seeded_matches(c_quaternion_image_correlator &qic, int seed, int num_points)
+{
+    std::vector<c_quaternion> rotations;
+    srand(seed);
+    rotations.push_back(random_rotation(0.0, 1.0));
+    rotations.push_back(random_rotation(0.99, 1.0));
+    add_random_matches(qic, num_points, rotations);
+}
+
+/*a Basic tests
+ */
+/*f test_empty
+ * A correlator with no matches
+ */
+static void
+test_empty(c_quaternion_image_correlator &qic)
+{
+    c_quaternion q = c_quaternion::identity();
+    assert(qic.src_qs.size()==0, WHERE, "Empty correlator has %d src_qs", (int)qic.src_qs.size());
+    assert(qic.find_closest_src_qx_index(&q, NULL)==-1, WHERE, "Empty correlator has a closest src_qx");
+    assert(qic.find_closest_tgt_qx(0, &q, NULL)==NULL, WHERE, "Empty correlator has a closest tgt_qx");
+    assert(qic.create_mappings()==0, WHERE, "Empty correlator create_mappings failed");
+    assert(qic.score_src_from_tgt(&q)==0, WHERE, "Empty correlator scores");
+    assert(qic.total_score.match_list.size()==0, WHERE, "Empty correlator has a match list");
+    assert(qic.candidate_src_from_tgts(0.0002, 0.5).size()==1, WHERE, "Empty correlator has candidates besides the identity");
+}
+
+/*f test_init
+ * A new correlator, and one reset after use, are empty
+ */
+static void
+test_init(void)
+{
+    c_quaternion_image_correlator qic;
+    test_empty(qic);
+    add_seeded_matches(qic, 5, 100);
+    qic.create_mappings();
+    assert(qic.src_qs.size()>0, WHERE, "No src_qs added");
+    qic.reset();
+    test_empty(qic);
+}
+
+/*f test_reset
+ * A correlator reset and reused must give what a new one does
+ */
+static void
+test_reset(void)
+{
+    c_quaternion_image_correlator reused, fresh;
+    add_seeded_matches(reused, 5, 300);
+    reused.create_mappings();
+    reused.reset();
+    add_seeded_matches(reused, 6, 200);
+    reused.create_mappings();
+    add_seeded_matches(fresh, 6, 200);
+    fresh.create_mappings();
+
+    assert(reused.src_qs.size()==fresh.src_qs.size(), WHERE, "Reused correlator has %d src_qs, new one %d",
+           (int)reused.src_qs.size(), (int)fresh.src_qs.size());
+    for (size_t i=0; (i<reused.src_qs.size()) && (i<fresh.src_qs.size()); i++) {
+        if (reused.src_qs[i]->distance_to(*fresh.src_qs[i])!=0) {
+            assert(0, WHERE, "Reused correlator src_qx %d differs", (int)i);
+            break;
+        }
+    }
+    assert(mapping_values(reused)==mapping_values(fresh), WHERE, "Reused correlator mappings differ");
+
+    std::vector<c_quaternion> candidates = fresh.candidate_src_from_tgts(0.0002, 0.5);
+    std::vector<c_quaternion> reused_candidates = reused.candidate_src_from_tgts(0.0002, 0.5);
+    assert(reused_candidates.size()==candidates.size(), WHERE, "Reused correlator has %d candidates, new one %d",
+           (int)reused_candidates.size(), (int)candidates.size());
+    for (size_t i=0; (i<candidates.size()) && (i<reused_candidates.size()); i++) {
+        double score = fresh.score_src_from_tgt(&candidates[i]);
+        if ((reused_candidates[i].distance_to(candidates[i])!=0) ||
+            (reused.score_src_from_tgt(&candidates[i])!=score)) {
+            assert(0, WHERE, "Reused correlator candidate %d differs", (int)i);
+            break;
+        }
+    }
+}
+
+/*a Grid tests
+ */
+/*f boundary_coord
+ * A coordinate in -1 to 1 on a cell boundary (a multiple of 2*radius),
+ * or on the boundary between the halves of a cell that for_each_near
+ * uses (an odd multiple of radius), or (one in three) random
+ */
+static double boundary_coord(double radius)
+{
+    int k = (int)floor(1/radius);
+    switch (rand()%3) {
+    case 0: return 2*radius*((rand()%(k+1))-k/2);
+    case 1: return radius*(2*((rand()%(k+1))-k/2)+1);
+    default: break;
+    }
+    return random_real(-1,1);
+}
+
+/*f boundary_direction
+ * A unit direction with x and y from boundary_coord
+ */
+static t_vec3d boundary_direction(double radius)
+{
+    for (;;) {
+        double x = boundary_coord(radius);
+        double y = boundary_coord(radius);
+        double z2 = 1-x*x-y*y;
+        if (z2<0) continue;
+        return t_vec3d::xyz(x, y, (rand()&1) ? sqrt(z2) : -sqrt(z2));
+    }
+}
+
+/*f random_direction
+ */
+static t_vec3d random_direction(void)
+{
+    for (;;) {
+        t_vec3d v = t_vec3d::xyz(random_real(-1,1), random_real(-1,1), random_real(-1,1));
+        if ((v.modulus_squared()>0.01) && (v.modulus_squared()<=1)) return v.normalized();
+    }
+}
+
+/*f test_direction_grid
+ * Every direction within radius of a query, in its group, must be
+ * visited by for_each_near, and none of other groups; the directions
+ * and queries include ones on cell boundaries, and ones just within
+ * radius of a query
+ */
+static void
+test_direction_grid(void)
+{
+    static const double radii[] = {1E-3, 0.0141, 0.1, 0.5, 1.9, 2.0};
+    srand(8);
+    for (auto radius : radii) {
+        c_direction_grid grid;
+        std::vector<t_vec3d> dirs;
+        std::vector<int> groups;
+        std::vector<t_vec3d> queries;
+        grid.reset(radius);
+        for (int n=0; n<200; n++) {
+            queries.push_back((n&1) ? boundary_direction(radius) : random_direction());
+        }
+        for (int n=0; n<2000; n++) {
+            t_vec3d d;
+            if (n%3==0) {
+                d = boundary_direction(radius);
+            } else {
+                const t_vec3d &q = queries[rand()%queries.size()];
+                d = (q + random_direction()*(radius*random_real(0.9,1.0))).normalized();
+            }
+            dirs.push_back(d);
+            groups.push_back(rand()%3);
+            grid.add(d, n, groups[n]);
+        }
+        for (auto &q : queries) {
+            for (int group=0; group<3; group++) {
+                std::vector<int> visited(dirs.size(), 0);
+                int wrong_group = 0;
+                grid.for_each_near(q, [&](int id) {
+                        visited[id]++;
+                        if (groups[id]!=group) wrong_group++;
+                    }, group);
+                assert(wrong_group==0, WHERE, "Directions of another group visited with radius %g", radius);
+                for (size_t i=0; i<dirs.size(); i++) {
+                    if ((groups[i]!=group) || ((dirs[i]-q).modulus()>radius)) continue;
+                    if (visited[i]!=1) {
+                        assert(0, WHERE, "Direction %d at %g of query with radius %g visited %d times",
+                               (int)i, (dirs[i]-q).modulus(), radius, visited[i]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*f quaternion_chord
+ * Distance between quaternions a and sign*b in 4D
+ */
+static double quaternion_chord(const t_quatd &a, const t_quatd &b, double sign)
+{
+    double dr=a.r-sign*b.r, di=a.i-sign*b.i, dj=a.j-sign*b.j, dk=a.k-sign*b.k;
+    return sqrt(dr*dr+di*di+dj*dj+dk*dk);
+}
+
+/*f test_quaternion_grid
+ * Every quaternion within radius of a query or its negation must be
+ * visited by for_each_near; quaternions and queries include ones on
+ * cell boundaries and ones with r at or near 0 (where q and -q are
+ * near each other, and either may have been added)
+ */
+static void
+test_quaternion_grid(void)
+{
+    static const double radii[] = {1E-3, 0.01, 0.1, 0.5, 1.414};
+    srand(9);
+    for (auto radius : radii) {
+        c_quaternion_grid grid;
+        std::vector<t_quatd> qs;
+        std::vector<t_quatd> queries;
+        grid.reset(radius);
+        for (int n=0; n<300; n++) {
+            t_vec3d v = (n%3==0) ? boundary_direction(radius) : random_direction();
+            double r;
+            switch (n%4) {
+            case 0:  r = 0; break;
+            case 1:  r = random_real(-radius, radius); break;
+            case 2:  r = boundary_coord(radius); break;
+            default: r = random_real(-1,1); break;
+            }
+            queries.push_back(t_quatd::rijk(r, v.x, v.y, v.z).normalized());
+        }
+        for (int n=0; n<3000; n++) {
+            t_quatd q;
+            if (n%3==0) {
+                t_vec3d v = boundary_direction(radius);
+                q = t_quatd::rijk((n%2) ? 0 : boundary_coord(radius), v.x, v.y, v.z).normalized();
+            } else {
+                const t_quatd &c = queries[rand()%queries.size()];
+                t_vec3d v = random_direction();
+                double s = radius*random_real(0.9,1.0)*0.5;
+                q = t_quatd::rijk(c.r+random_real(-s,s), c.i+v.x*s, c.j+v.y*s, c.k+v.z*s).normalized();
+                if (rand()&1) q = q*-1.0;
+            }
+            qs.push_back(q);
+            grid.add(q, n);
+        }
+        for (auto &q : queries) {
+            std::vector<int> visited(qs.size(), 0);
+            grid.for_each_near(q, [&](int id) { visited[id]++; });
+            for (size_t i=0; i<qs.size(); i++) {
+                double d0 = quaternion_chord(qs[i], q, 1);
+                double d1 = quaternion_chord(qs[i], q, -1);
+                if (((d0<d1)?d0:d1)>radius) continue;
+                if (!visited[i]) {
+                    assert(0, WHERE, "Quaternion %d at %g of query (r %g) with radius %g not visited",
+                           (int)i, (d0<d1)?d0:d1, q.r, radius);
+                }
+            }
+        }
+    }
+}
+
+/*f test_close_src_qx
+ * add_match finds the first src_qx (and then the first tgt_qx of it)
+ * close enough to each match with the grids; compare the src_qxs and
+ * tgt_qxs it keeps with those of checking every one in order
+ */
+static void
+test_close_src_qx(void)
+{
+    c_quaternion_image_correlator qic;
+    std::vector<c_quaternion> centres;
+    std::vector<c_quaternion> src_qxs;
+    std::vector<std::vector<c_quaternion>> tgt_qxs;
+    t_point_value pv;
+    pv.x = 0;
+    pv.y = 0;
+    pv.value = 1;
+    srand(10);
+    for (int n=0; n<20; n++) {
+        centres.push_back(c_quaternion::of_euler(0, random_real(-5,5), random_real(-5,5), 1));
+    }
+    auto close = [&](const c_quaternion &a, const c_quaternion &b, double min_cos_angle) {
+        double d = a.value().rotate_vector_z().normalized().dot(b.value().rotate_vector_z().normalized());
+        double cos_angle = (d>=1) ? 1 : ((d<=-1) ? 0 : sqrt((1+d)/2));
+        return cos_angle>min_cos_angle;
+    };
+    for (int n=0; n<2000; n++) {
+        c_quaternion src_q = centres[rand()%centres.size()] * c_quaternion::of_euler(0, random_real(-1.5,1.5), random_real(-1.5,1.5), 1);
+        c_quaternion tgt_q = centres[rand()%centres.size()] * c_quaternion::of_euler(0, random_real(-1.5,1.5), random_real(-1.5,1.5), 1);
+        qic.add_match(&src_q, &tgt_q, &pv);
+        size_t i, j;
+        for (i=0; i<src_qxs.size(); i++) {
+            if (close(src_qxs[i], src_q, qic.min_cos_angle_src_q)) break;
+        }
+        if (i==src_qxs.size()) {
+            src_qxs.push_back(src_q);
+            tgt_qxs.push_back(std::vector<c_quaternion>());
+        }
+        for (j=0; j<tgt_qxs[i].size(); j++) {
+            if (close(tgt_qxs[i][j], tgt_q, qic.min_cos_angle_tgt_q)) break;
+        }
+        if (j==tgt_qxs[i].size()) tgt_qxs[i].push_back(tgt_q);
+    }
+    assert(qic.src_qs.size()==src_qxs.size(), WHERE, "Correlator has %d src_qxs, expected %d",
+           (int)qic.src_qs.size(), (int)src_qxs.size());
+    for (size_t i=0; (i<qic.src_qs.size()) && (i<src_qxs.size()); i++) {
+        const t_quaternion_image_src_tgt_match_list &match_list = qic.matches_of_src_q(i);
+        if ((qic.src_qs[i]->distance_to(src_qxs[i])!=0) || (match_list.size()!=tgt_qxs[i].size())) {
+            assert(0, WHERE, "src_qx %d (with %d tgt_qxs) differs from that expected (with %d)",
+                   (int)i, (int)match_list.size(), (int)tgt_qxs[i].size());
+            continue;
+        }
+        for (size_t j=0; j<match_list.size(); j++) {
+            if (qic.qstm_tgt_q(match_list[j])->distance_to(tgt_qxs[i][j])!=0) {
+                assert(0, WHERE, "tgt_qx %d of src_qx %d differs from that expected", (int)j, (int)i);
+                break;
+            }
+        }
+    }
+}
+
+/*a Lookup tests
+ */
+/*f query_near
+ * An orientation a random fraction of a degree or two from q, or
+ * (one in four) anywhere within fifteen degrees of straight ahead
+ */
+static c_quaternion query_near(const c_quaternion &q)
+{
+    if (rand()%4==0) {
+        return c_quaternion::of_euler(0, random_real(-15,15), random_real(-15,15), 1);
+    }
+    return q * c_quaternion::of_euler(0, random_real(-2,2), random_real(-2,2), 1);
+}
+
+/*f test_closest
+ * find_closest_src_qx_index and find_closest_tgt_qx use the cached
+ * directions (and grids around them); compare them with a search of
+ * every src_qx (or tgt_qx) by angle_axis of vector_z, allowing only
+ * for rounding between equally close ones
+ */
+static void
+test_closest(void)
+{
+    static const double z[3] = {0,0,1};
+    c_vector vector_z(3, z);
+    c_quaternion_image_correlator qic;
+    add_seeded_matches(qic, 7, 300);
+    int num_src_qs = qic.src_qs.size();
+    for (int n=0; n<2000; n++) {
+        c_quaternion src_q = query_near(*qic.src_qs[rand()%num_src_qs]);
+        double cos_angle=-1, best=-1;
+        int best_index=-1;
+        int index = qic.find_closest_src_qx_index(&src_q, &cos_angle);
+        for (int i=0; i<num_src_qs; i++) {
+            double r = qic.src_qs[i]->angle_axis(src_q, vector_z).r();
+            if (r>best) {best=r; best_index=i;}
+        }
+        assert(index>=0, WHERE, "No closest src_qx");
+        if (index<0) continue;
+        double r = qic.src_qs[index]->angle_axis(src_q, vector_z).r();
+        assert((index==best_index) || (fabs(r-best)<1E-12), WHERE, "Closest src_qx %d (%.15f), expected %d (%.15f)",
+               index, r, best_index, best);
+        assert(fabs(cos_angle-r)<1E-12, WHERE, "Closest src_qx cos angle %.15f, expected %.15f", cos_angle, r);
+
+        const t_quaternion_image_src_tgt_match_list &match_list = qic.matches_of_src_q(index);
+        c_quaternion tgt_q = query_near(*qic.qstm_tgt_q(match_list[rand()%match_list.size()]));
+        const class c_qi_src_tgt_match *best_qstm=NULL;
+        best = -1;
+        const class c_qi_src_tgt_match *qstm = qic.find_closest_tgt_qx(index, &tgt_q, &cos_angle);
+        for (auto m : match_list) {
+            double r = qic.qstm_tgt_q(m)->angle_axis(tgt_q, vector_z).r();
+            if (r>best) {best=r; best_qstm=m;}
+        }
+        assert(qstm!=NULL, WHERE, "No closest tgt_qx");
+        if (!qstm) continue;
+        r = qic.qstm_tgt_q(qstm)->angle_axis(tgt_q, vector_z).r();
+        assert((qstm==best_qstm) || (fabs(r-best)<1E-12), WHERE, "Closest tgt_qx has %.15f, expected %.15f", r, best);
+        assert(fabs(cos_angle-r)<1E-12, WHERE, "Closest tgt_qx cos angle %.15f, expected %.15f", cos_angle, r);
+    }
+}
+
+/*a Mapping tests
+ */
+/*f test_create_mappings
+ * Mappings created across the thread pool must be those of a serial
+ * run, in the same order
+ */
+static void
+test_create_mappings(void)
+{
+    srand(3);
+    for (int t=0; t<3; t++) {
+        c_quaternion_image_correlator qic;
+        std::vector<c_quaternion> rotations;
+        rotations.push_back(random_rotation(0.0, 1.0));
+        rotations.push_back(random_rotation(0.99, 1.0));
+        add_random_matches(qic, 300, rotations);
+
+        qic.create_mappings(0);
+        std::vector<double> serial = mapping_values(qic);
+        qic.create_mappings(1);
+        std::vector<double> parallel = mapping_values(qic);
+        assert(serial.size()>1000, WHERE, "Only %d mapping values", (int)serial.size());
+        assert(parallel==serial, WHERE, "Parallel create_mappings differs from serial (%d, %d values)",
+               (int)parallel.size(), (int)serial.size());
+        qic.create_mappings(0);
+        assert(mapping_values(qic)==serial, WHERE, "Repeated serial create_mappings differs");
+    }
+}
+
+/*a Scoring tests
+ */
+/*f scores_equal
+ */
+static int
+scores_equal(const t_quaternion_image_match_score &a, const t_quaternion_image_match_score &b)
+{
+    if ((a.score!=b.score) || (a.match_list.size()!=b.match_list.size()))
+        return 0;
+    for (size_t i=0; i<a.match_list.size(); i++) {
+        if ((a.match_list[i].score!=b.match_list[i].score) || (a.match_list[i].qstm!=b.match_list[i].qstm))
+            return 0;
+    }
+    return 1;
+}
+
+/*f test_score_orients
+ * Scores of candidates in parallel, with and without a min_score, must
+ * be those of scoring each alone wherever they are above min_score
+ */
+static void
+test_score_orients(void)
+{
+    c_quaternion_image_correlator qic;
+    std::vector<c_quaternion> rotations;
+    srand(4);
+    rotations.push_back(random_rotation(0.0, 1.0));
+    rotations.push_back(random_rotation(0.99, 1.0));
+    add_random_matches(qic, 300, rotations);
+    qic.create_mappings();
+
+    std::vector<c_quaternion> candidates = qic.candidate_src_from_tgts(0.0002, 0.5);
+    int n = candidates.size();
+    std::vector<const c_quaternion *> qs(n);
+    std::vector<t_quaternion_image_match_score> exact(n);
+    double max_score = 0;
+    for (int i=0; i<n; i++) {
+        qs[i] = &candidates[i];
+        exact[i] = qic.score_of_src_from_tgt(qs[i]);
+        if (exact[i].score>max_score) max_score=exact[i].score;
+    }
+    assert(n>100, WHERE, "Only %d candidates", n);
+    assert(qic.score_src_from_tgt(qs[0])==exact[0].score, WHERE, "score_src_from_tgt differs from score_of_src_from_tgt");
+
+    double min_scores[] = {-1, 0, max_score/2, max_score};
+    for (auto min_score : min_scores) {
+        std::vector<t_quaternion_image_match_score> scores(n);
+        int num_above=0;
+        qic.score_src_from_tgts(n, qs.data(), scores.data(), min_score);
+        for (int i=0; i<n; i++) {
+            if (exact[i].score>min_score) {
+                num_above++;
+                assert(scores_equal(scores[i], exact[i]), WHERE, "Score %d with min_score %g is %g, alone %g",
+                       i, min_score, scores[i].score, exact[i].score);
+            } else {
+                assert(scores[i].score<=min_score, WHERE, "Score %d is %g, above min_score %g but alone only %g",
+                       i, scores[i].score, min_score, exact[i].score);
+            }
+            t_quaternion_image_match_score single = qic.score_of_src_from_tgt(qs[i], min_score);
+            assert(scores_equal(scores[i], single), WHERE, "Score %d with min_score %g differs from scoring it alone", i, min_score);
+        }
+        if (min_score==max_score/2) {
+            assert((num_above>0) && (num_above<n), WHERE, "Scores all on one side of %g", min_score);
+        }
+    }
+}
+
+/*a Candidate tests
+ */
+/*f test_candidates_match
+ * Check candidate_src_from_tgts keeps exactly what candidates_kept does
+ */
+static void
+test_candidates_match(c_quaternion_image_correlator &qic, double min_q_dist, double max_q_dist)
+{
+    std::vector<c_quaternion> candidates = candidates_of_mappings(qic);
+    std::vector<c_quaternion> expected = candidates_kept(candidates, min_q_dist, max_q_dist);
+    std::vector<c_quaternion> kept = qic.candidate_src_from_tgts(min_q_dist, max_q_dist);
+    assert(kept.size()==expected.size(), WHERE, "Candidates kept with min %g max %g: %d, expected %d",
+           min_q_dist, max_q_dist, (int)kept.size(), (int)expected.size());
+    for (size_t n=0; (n<kept.size()) && (n<expected.size()); n++) {
+        const t_quatd &a = kept[n].value();
+        const t_quatd &b = expected[n].value();
+        if ((a.r!=b.r) || (a.i!=b.i) || (a.j!=b.j) || (a.k!=b.k)) {
+            assert(0, WHERE, "Candidate %d kept with min %g max %g differs from that expected",
+                   (int)n, min_q_dist, max_q_dist);
+            break;
+        }
+    }
+}
+
+/*f test_candidates
+ * Mappings from rotations both general and with r near 0 (so that q
+ * and -q are close), deduplicated with various bounds
+ */
+static void
+test_candidates(void)
+{
+    static const double q_dists[][2] = {
+        {0.0002, 0.5},
+        {0.00004, 0.01},
+        {0.0, 2.0},
+        {0.0, 0.0004},
+        {-1.0, 1.0},
+        {-1.0, 3.0},
+        {0.001, 2.0},
+        {0.01, 0.001},
+        {1E-6, 1.9999},
+        {0.0, 0.0},
+    };
+    // With this seed the first (largest) set has distances rounded to beyond 2
+    static const int num_points[] = {1000, 200, 200, 200};
+    srand(2);
+    for (int t=0; t<4; t++) {
+        c_quaternion_image_correlator qic;
+        std::vector<c_quaternion> rotations;
+        rotations.push_back(random_rotation(0.0, 1.0));
+        rotations.push_back(random_rotation(0.0, 0.001));
+        rotations.push_back(random_rotation(0.0, 0.001));
+        rotations.push_back(random_rotation(0.999, 1.0));
+        add_random_matches(qic, num_points[t], rotations);
+        qic.create_mappings();
+
+        std::vector<c_quaternion> candidates = candidates_of_mappings(qic);
+        int num_near_r0 = 0;
+        for (auto &q : candidates) {
+            if (fabs(q.r())<0.01) num_near_r0++;
+        }
+        assert(candidates.size()>100, WHERE, "Only %d mapping candidates", (int)candidates.size());
+        assert(num_near_r0>0, WHERE, "No mapping candidates near r=0");
+
+        for (auto &qd : q_dists) {
+            test_candidates_match(qic, qd[0], qd[1]);
+        }
+    }
+}
+
+/*a Toplevel
+ */
+extern int main(int argc, char **argv)
+{
+    thread_pool_default(4); // So that create_mappings and score_src_from_tgts are split
+    test_init();
+    test_reset();
+    test_closest();
+    test_direction_grid();
+    test_quaternion_grid();
+    test_close_src_qx();
+    test_create_mappings();
+    test_score_orients();
+    test_candidates();
+    if (failures>0) {
+        exit(4);
+    }
+}
@@ -315,6 +315,30 @@ test_euler(void)
     assert_dbeq( a.modulus(), 1, WHERE, "Modulus of from_euler should be 1");
 }
 
+/*f test_value
+  tests the value quaternion fast paths against the products
+ */
+static void
+test_value(void)
+{
+    t_vec3d z = t_vec3d::xyz(0,0,1);
+    for (int i=0; i<12*12*12; i++) {
+        int j=i;
+        t_quatd a = c_quaternion::of_euler(30.0*(j%12), 15.0*(j/12%12)-90, 30.0*(j/144), 1).value();
+        t_quatd b = c_quaternion::of_euler(20.0*(j%12), 10.0*(j/12%12)-60, 25.0*(j/144), 1).value();
+        t_quatd r = a.rotate_vector(z);
+        t_vec3d rz = a.rotate_vector_z();
+        t_quatd q = a*b.reciprocal();
+        t_quatd qs = (a*2.0)*(b*3.0).reciprocal();
+        assert_dbeq( rz.x, r.i, WHERE, "Rotation of vector_z");
+        assert_dbeq( rz.y, r.j, WHERE, "Rotation of vector_z");
+        assert_dbeq( rz.z, r.k, WHERE, "Rotation of vector_z");
+        assert_dbeq( a.distance_to(b), 1-(q*q).r, WHERE, "Distance to");
+        assert_dbeq( a.distance_to_unit(b), 1-(q*q).r, WHERE, "Distance to unit");
+        assert_dbeq( (a*2.0).distance_to(b*3.0), 1-(qs*qs).r, WHERE, "Distance to scaled");
+    }
+}
+
 /*a Toplevel
  */
 extern int main(int argc, char **argv)
@@ -324,6 +348,7 @@ extern int main(int argc, char **argv)
     test_arithmetic();
     test_scaling();
     test_euler();
+    test_value();
     if (failures>0) {
         exit(4);
     }
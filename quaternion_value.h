@@ -0,0 +1,166 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          quaternion_value.h
+ * @brief         Value (non-allocating) quaternions and 3-vectors
+ *
+ * c_quaternion and c_vector forward their products, rotations and
+ * angle/axis calculations to these; they may also be used directly
+ * in inner loops, with T of float or double
+ */
+
+/*a Wrapper
+ */
+#ifdef __INC_QUATERNION_VALUE
+#else
+#define __INC_QUATERNION_VALUE
+
+/*a Includes
+ */
+#include <math.h>
+
+/*a Defines
+ */
+// Moduli below this are treated as zero, as in quaternion.cpp and vector.cpp
+#define QUATERNION_VALUE_EPSILON (1E-20)
+
+/*a Types
+ */
+/*t t_vec3
+ */
+template <typename T>
+struct t_vec3
+{
+    T x, y, z;
+
+    static inline t_vec3 xyz(T x, T y, T z) { t_vec3 v; v.x=x; v.y=y; v.z=z; return v; }
+    static inline t_vec3 of_coords(const T *c) { return xyz(c[0], c[1], c[2]); }
+
+    inline t_vec3 operator+(const t_vec3 &o) const { return xyz(x+o.x, y+o.y, z+o.z); }
+    inline t_vec3 operator-(const t_vec3 &o) const { return xyz(x-o.x, y-o.y, z-o.z); }
+    inline t_vec3 operator*(T s) const { return xyz(x*s, y*s, z*s); }
+
+    inline void get_coords(T *c) const { c[0]=x; c[1]=y; c[2]=z; }
+    inline T dot(const t_vec3 &o) const { return x*o.x + y*o.y + z*o.z; }
+    inline t_vec3 cross(const t_vec3 &o) const { return xyz(y*o.z - z*o.y, z*o.x - x*o.z, x*o.y - y*o.x); }
+    inline T modulus_squared(void) const { return x*x + y*y + z*z; }
+    inline T modulus(void) const { return sqrt(modulus_squared()); }
+    // Zero vector if the modulus is (near) zero, as c_vector::normalize
+    inline t_vec3 normalized(void) const {
+        T l = modulus();
+        if ((l>-QUATERNION_VALUE_EPSILON) && (l<QUATERNION_VALUE_EPSILON)) return xyz(0,0,0);
+        return (*this)*(1.0/l);
+    }
+    // Unit axis of the great-circle rotation from 'this' to 'other', with
+    // the cosine and sine of its angle (see c_vector::angle_axis_to_v)
+    inline t_vec3 angle_axis_to_v(const t_vec3 &other, T *cos_angle, T *sin_angle) const {
+        T tl = modulus();
+        T ol = other.modulus();
+        t_vec3 axis = cross(other)*(1.0/(tl*ol));
+        *cos_angle = dot(other) / (tl*ol);
+        *sin_angle = axis.modulus();
+        return axis.normalized();
+    }
+};
+
+/*t t_quat
+ */
+template <typename T>
+struct t_quat
+{
+    T r, i, j, k;
+
+    static inline t_quat rijk(T r, T i, T j, T k) { t_quat q; q.r=r; q.i=i; q.j=j; q.k=k; return q; }
+    static inline t_quat identity(void) { return rijk(1,0,0,0); }
+    static inline t_quat of_vector(const t_vec3<T> &v) { return rijk(0, v.x, v.y, v.z); }
+    // As c_quaternion::from_rotation(cos_angle, sin_angle, axis)
+    static inline t_quat of_rotation(T cos_angle, T sin_angle, const t_vec3<T> &axis) {
+        T c, s;
+        if (cos_angle>=1)  return rijk(1,0,0,0);
+        if (cos_angle<=-1) return rijk(0,1,0,0); // 180 degrees around _any_ axis
+        c = sqrt((1+cos_angle)/2);
+        s = sqrt(1-c*c);
+        if (sin_angle<0) s=-s;
+        return rijk(c, s*axis.x, s*axis.y, s*axis.z);
+    }
+
+    inline t_quat operator*(const t_quat &b) const {
+        return rijk(r*b.r - i*b.i - j*b.j - k*b.k,
+                    r*b.i + i*b.r + j*b.k - k*b.j,
+                    r*b.j + j*b.r + k*b.i - i*b.k,
+                    r*b.k + k*b.r + i*b.j - j*b.i);
+    }
+    inline t_quat operator*(T s) const { return rijk(r*s, i*s, j*s, k*s); }
+    inline t_quat operator~(void) const { return rijk(r, -i, -j, -k); }
+
+    inline t_vec3<T> ijk(void) const { return t_vec3<T>::xyz(i, j, k); }
+    inline T dot(const t_quat &o) const { return r*o.r + i*o.i + j*o.j + k*o.k; }
+    inline T modulus_squared(void) const { return dot(*this); }
+    inline T modulus(void) const { return sqrt(modulus_squared()); }
+    inline t_quat normalized(void) const {
+        T l = modulus();
+        if ((l>-QUATERNION_VALUE_EPSILON) && (l<QUATERNION_VALUE_EPSILON)) return *this;
+        return (*this)*(1.0/l);
+    }
+    inline t_quat reciprocal(void) const { return (~(*this))*(1.0/modulus_squared()); }
+
+    // q * v * ~q; the result is a pure quaternion (scaled by |q|^2)
+    inline t_quat rotate_vector(const t_vec3<T> &v) const { return (*this) * of_vector(v) * ~(*this); }
+    // ijk of q * (0,0,1) * ~q, without the products
+    inline t_vec3<T> rotate_vector_z(void) const {
+        return t_vec3<T>::xyz(2*(i*k + r*j), 2*(j*k - r*i), r*r - i*i - j*j + k*k);
+    }
+    // Great-circle rotation from 'this' applied to v to 'other' applied to v
+    inline t_quat angle_axis(const t_quat &other, const t_vec3<T> &v) const {
+        return angle_axis_between(rotate_vector(v).ijk(), other.rotate_vector(v).ijk());
+    }
+    inline t_quat angle_axis_z(const t_quat &other) const {
+        return angle_axis_between(rotate_vector_z(), other.rotate_vector_z());
+    }
+    static inline t_quat angle_axis_between(const t_vec3<T> &a, const t_vec3<T> &b) {
+        T cos_angle, sin_angle;
+        t_vec3<T> axis = a.angle_axis_to_v(b, &cos_angle, &sin_angle);
+        return of_rotation(cos_angle, sin_angle, axis);
+    }
+    // 1 - real((this/other)^2); zero for the same rotation
+    //
+    // this/other = this*~other/|other|^2 has real part d=this.other and
+    // |ijk|^2 = |this|^2|other|^2 - d^2, so no products are needed
+    inline T distance_to(const t_quat &other) const {
+        T d  = dot(other);
+        T mo = other.modulus_squared();
+        return 1 - (2*d*d - modulus_squared()*mo)/(mo*mo);
+    }
+    // distance_to when both are unit quaternions
+    inline T distance_to_unit(const t_quat &other) const {
+        T d = dot(other);
+        return 2*(1 - d*d);
+    }
+};
+
+typedef t_vec3<double> t_vec3d;
+typedef t_vec3<float>  t_vec3f;
+typedef t_quat<double> t_quatd;
+typedef t_quat<float>  t_quatf;
+
+/*a Wrapper
+ */
+#endif
+
+/*a Editor preferences and notes
+mode: c ***
+c-basic-offset: 4 ***
+c-default-style: (quote ((c-mode . "k&r") (c++-mode . "k&r"))) ***
+outline-regexp: "/\\\*a\\\|[\t ]*\/\\\*[b-z][\t ]" ***
+*/
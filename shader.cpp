@@ -1,21 +1,86 @@
 /*a Documentation
+  Shader sources are built in to the binary: the Makefile generates
+  shader_bundle.cpp from the .glsl files in shaders, so a program or
+  Python module does not need the shaders directory (or a particular
+  working directory) to run. Setting the GJSLIB_SHADER_DIR environment variable
+  reads shaders from that directory in preference, for development; a
+  shader in neither is read from its path relative to the working
+  directory. Each source is read and preprocessed (comments and
+  trailing spaces removed, keeping the line numbering) once per process.
+
+  Linked programs are cached for the process, keyed by the vertex and
+  fragment shader filenames and the defines; filters with the same
+  shader and defines share one program (each filter uploads all of its
+  uniforms when it uses a program another filter used last, so sharing
+  is safe). shader_delete drops a reference,
+  and shader_cache_flush deletes programs no filter is using.
+
+  Compiling is split in two: shader_load_and_link_start issues the
+  compiles and the link, and shader_load_and_link_complete checks the
+  result. Starting every program before completing any lets a driver
+  with KHR_parallel_shader_compile (whose default is to use as many
+  compiler threads as it has) build the programs concurrently, rather
+  than stalling on each status query in turn.
+
+  If a cache directory is set (shader_cache_set_directory, or the
+  GJSLIB_SHADER_CACHE environment variable) and the driver supports
+  program binaries, each linked program is also saved there, named by a
+  hash of the shader sources, defines, base functions and the GL
+  renderer and version; a later run loads the binary with glProgramBinary
+  rather than compiling, and falls back to compiling if it is rejected.
  */
 /*a Includes
  */
 #include <OpenGL/gl3.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <map>
+#include <string>
 #include "shader.h"
 
+/*a Defines
+ */
+#define SHADER_BINARY_MAGIC 0x50534a47 // 'GJSP'
+
 /*a Types
  */
+/*t t_shader_program
+ */
+typedef struct
+{
+    GLuint program_id;
+    int references;
+    int linked;               // 0 until shader_load_and_link_complete has checked it
+    GLuint shader_ids[2];     // Vertex and fragment shaders while the link is pending
+    char *binary_filename;    // Where to save the program once linked, if anywhere
+    std::string vertex_shader;
+    std::string fragment_shader;
+    std::string shader_defines;
+} t_shader_program;
+
+/*t t_shader_binary_header
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t length;
+} t_shader_binary_header;
+
+/*a Statics
+ */
+static std::map<std::string, t_shader_program> shader_programs;
+static std::map<std::string, std::string> shader_sources;
+static char *shader_cache_directory;
+static int shader_cache_directory_set;
 
 /*a Static methods
  */
 /*f file_read
  */
-static const char *
+static char *
 file_read(const char *filename)
 {
     FILE *f;
@@ -24,19 +89,109 @@ file_read(const char *filename)
 
     f = fopen(filename,"r");
     if (!f) {
-        fprintf(stderr, "Failed to open file '%s'\n",filename);
         return NULL;
     }
     fseek(f, 0L, SEEK_END);
     file_length = ftell(f);
     rewind(f);
     ptr = (char *)malloc(file_length+1);
-    fread(ptr,1,file_length,f);
+    file_length = fread(ptr,1,file_length,f);
     fclose(f);
     ptr[file_length]=0;
     return ptr;
 }
 
+/*f shader_preprocess
+ * Remove comments and trailing white space, keeping every newline so
+ * that compiler messages still refer to the source lines
+ */
+static std::string
+shader_preprocess(const char *code)
+{
+    std::string result;
+    size_t line_start;
+
+    result.reserve(strlen(code));
+    line_start = 0;
+    while (*code) {
+        if ((code[0]=='/') && (code[1]=='/')) {
+            while (*code && (*code!='\n')) code++;
+            continue;
+        }
+        if ((code[0]=='/') && (code[1]=='*')) {
+            code += 2;
+            while (*code && !((code[0]=='*') && (code[1]=='/'))) {
+                if (*code=='\n') result.push_back('\n');
+                code++;
+            }
+            if (*code) code += 2;
+            result.push_back(' ');
+            continue;
+        }
+        if (*code=='\n') {
+            size_t end = result.length();
+            while ((end>line_start) && ((result[end-1]==' ') || (result[end-1]=='\t') || (result[end-1]=='\r'))) end--;
+            result.resize(end);
+            result.push_back('\n');
+            line_start = end+1;
+            code++;
+            continue;
+        }
+        result.push_back(*code++);
+    }
+    return result;
+}
+
+/*f shader_source
+ * Return the preprocessed source of a shader, such as
+ * "shaders/gauss.glsl", or NULL if it cannot be found
+ */
+static const char *
+shader_source(const char *filename)
+{
+    const char *shader_dir;
+    const char *code;
+    char *file_code;
+
+    auto ssi = shader_sources.find(filename);
+    if (ssi!=shader_sources.end()) {
+        return ssi->second.c_str();
+    }
+
+    code = NULL;
+    file_code = NULL;
+    shader_dir = getenv("GJSLIB_SHADER_DIR");
+    if (shader_dir && shader_dir[0]) {
+        const char *basename = strrchr(filename, '/');
+        int len = strlen(shader_dir)+strlen(filename)+2;
+        char *path = (char *)malloc(len);
+        snprintf(path, len, "%s/%s", shader_dir, basename?basename+1:filename);
+        file_code = file_read(path);
+        free(path);
+    }
+    if (!file_code) {
+        for (int i=0; shader_bundle[i].filename; i++) {
+            if (!strcmp(shader_bundle[i].filename, filename)) {
+                code = shader_bundle[i].code;
+                break;
+            }
+        }
+    }
+    if (!file_code && !code) {
+        file_code = file_read(filename);
+    }
+    if (file_code) {
+        code = file_code;
+    }
+    if (!code) {
+        fprintf(stderr, "Failed to find shader '%s'\n", filename);
+        return NULL;
+    }
+    shader_sources[filename] = shader_preprocess(code);
+    free(file_code);
+    return shader_sources[filename].c_str();
+}
+
 /*a External functions
  */
 static const char *shader_base_functions_filename="shaders/base_functions.glsl";
@@ -44,115 +199,450 @@ static const char *shader_base_functions_code;
 extern int
 shader_init(void)
 {
+    if (!shader_cache_directory_set) {
+        shader_cache_set_directory(getenv("GJSLIB_SHADER_CACHE"));
+    }
     if (!shader_base_functions_code) {
-        shader_base_functions_code = file_read(shader_base_functions_filename);
+        shader_base_functions_code = shader_source(shader_base_functions_filename);
         if (!shader_base_functions_code) return 1;
     }
     return 0;
 }
 
-/*f shader_load
+/*f shader_code_parts
+ * The strings given to glShaderSource for a shader
  */
-GLuint
-shader_load(const char *shader_filename, GLenum shader_type, const char *shader_defines)
+static void
+shader_code_parts(const char *shader_code, const char *shader_defines, const char *shader_code_files[4])
+{
+    shader_code_files[0] = "#version 330\n";
+    shader_code_files[1] = "";
+    if (shader_defines) 
+        shader_code_files[1] = shader_defines;
+    shader_code_files[2] = shader_base_functions_code;
+    shader_code_files[3] = shader_code;
+}
+
+/*f shader_compile_start
+ * Issue the compile of a shader without waiting for it; 0 if the source is not found
+ */
+static GLuint
+shader_compile_start(const char *shader_filename, GLenum shader_type, const char *shader_defines)
 {
     const char *shader_code_files[4];
     const char *shader_code;
     GLuint shader_id;
-    GLint compile_result;
 
-    shader_code = file_read(shader_filename);
+    shader_code = shader_source(shader_filename);
     if (!shader_code) return 0;
 
     shader_id = glCreateShader(shader_type);
-    shader_code_files[0] = "#version 330\n";
-    shader_code_files[1] = "";
-    if (shader_defines) 
-        shader_code_files[1] = shader_defines;
-    shader_code_files[2] = shader_base_functions_code;
-    shader_code_files[3] = shader_code;
+    shader_code_parts(shader_code, shader_defines, shader_code_files);
     glShaderSource(shader_id, 4, shader_code_files, NULL);
     glCompileShader(shader_id);
+    return shader_id;
+}
+
+/*f shader_compile_complete
+ * Return 0 if the shader compiled, else report the errors with the numbered source
+ */
+static int
+shader_compile_complete(GLuint shader_id, const char *shader_filename, const char *shader_defines)
+{
+    const char *shader_code_files[4];
+    GLint compile_result;
 
     glGetShaderiv(shader_id,GL_COMPILE_STATUS, &compile_result);
-    if (compile_result==GL_FALSE) {
-        char error_buf[256];
-        //int line=1;
-        glGetShaderInfoLog(shader_id, sizeof(error_buf), NULL, error_buf);
-        fprintf(stderr," Failed to compile shader '%s'\n%s\n", shader_filename, error_buf);
-        shader_id = 0;
-        if (1) {
-            int line=1;
-            for (int i=0; i<4; i++) {
-                const char *text = shader_code_files[i];
-                while (1) {
-                    const char *next_line;
-                    next_line = strchr(text,'\n');
-                    if (!next_line)
-                        break;
-                    fprintf(stderr, "%d: ", line);
-                    for (int j=0; j<=next_line-text; j++) {
-                        fputc(text[j],stderr);
-                    }
-                    line++;
-                    text = next_line+1;
-                }
+    if (compile_result!=GL_FALSE)
+        return 0;
+
+    char error_buf[256];
+    glGetShaderInfoLog(shader_id, sizeof(error_buf), NULL, error_buf);
+    fprintf(stderr," Failed to compile shader '%s'\n%s\n", shader_filename, error_buf);
+    shader_code_parts(shader_source(shader_filename), shader_defines, shader_code_files);
+    int line=1;
+    for (int i=0; i<4; i++) {
+        const char *text = shader_code_files[i];
+        while (1) {
+            const char *next_line;
+            next_line = strchr(text,'\n');
+            if (!next_line)
+                break;
+            fprintf(stderr, "%d: ", line);
+            for (int j=0; j<=next_line-text; j++) {
+                fputc(text[j],stderr);
             }
+            line++;
+            text = next_line+1;
         }
     }
-
-    free((void *)shader_code);
-    return shader_id;
+    return 1;
 }
 
-/*f shader_load_and_link
+/*f shader_load
  */
 GLuint
-shader_load_and_link(GLuint program_id, const char *vertex_shader, const char *fragment_shader, const char *shader_defines)
+shader_load(const char *shader_filename, GLenum shader_type, const char *shader_defines)
 {
-    GLuint vertex_shader_id;
-    GLuint fragment_shader_id;
-    GLint link_result;
+    GLuint shader_id;
 
     if (shader_init()!=0)
         return 0;
-    if (program_id==0) {
-        program_id = glCreateProgram();
-    }
-    if ((vertex_shader_id=shader_load(vertex_shader, GL_VERTEX_SHADER, shader_defines))==0) {
+    shader_id = shader_compile_start(shader_filename, shader_type, shader_defines);
+    if (shader_id==0)
         return 0;
-    }
-    if ((fragment_shader_id=shader_load(fragment_shader, GL_FRAGMENT_SHADER, shader_defines))==0) {
+    if (shader_compile_complete(shader_id, shader_filename, shader_defines)!=0) {
+        glDeleteShader(shader_id);
         return 0;
     }
+    return shader_id;
+}
 
-    glAttachShader(program_id, vertex_shader_id);
-    glAttachShader(program_id, fragment_shader_id);
+/*f shader_link_start
+ * Issue the compiles and the link; return 0 if they were issued
+ */
+static int
+shader_link_start(GLuint program_id, const char *vertex_shader, const char *fragment_shader, const char *shader_defines, GLuint shader_ids[2])
+{
+    shader_ids[0] = shader_compile_start(vertex_shader, GL_VERTEX_SHADER, shader_defines);
+    shader_ids[1] = shader_compile_start(fragment_shader, GL_FRAGMENT_SHADER, shader_defines);
+    if ((shader_ids[0]==0) || (shader_ids[1]==0)) {
+        if (shader_ids[0]) glDeleteShader(shader_ids[0]);
+        if (shader_ids[1]) glDeleteShader(shader_ids[1]);
+        return 1;
+    }
+    glAttachShader(program_id, shader_ids[0]);
+    glAttachShader(program_id, shader_ids[1]);
     glLinkProgram(program_id);
+    return 0;
+}
 
+/*f shader_link_complete
+ * Wait for the link and release the shaders; return 0 if it linked
+ */
+static int
+shader_link_complete(GLuint program_id, const char *vertex_shader, const char *fragment_shader, const char *shader_defines, GLuint shader_ids[2])
+{
+    GLint link_result;
+    int rc;
+
+    rc = 0;
     glGetProgramiv(program_id, GL_LINK_STATUS, &link_result);
     if (link_result==GL_FALSE) {
-        char error_buf[256];
-        glGetShaderInfoLog(program_id, sizeof(error_buf), NULL, error_buf);
-        fprintf(stderr," Failure\n%s\n",error_buf);
+        rc = 1;
+        if ((shader_compile_complete(shader_ids[0], vertex_shader, shader_defines)==0) &&
+            (shader_compile_complete(shader_ids[1], fragment_shader, shader_defines)==0)) {
+            char error_buf[256];
+            glGetProgramInfoLog(program_id, sizeof(error_buf), NULL, error_buf);
+            fprintf(stderr," Failed to link '%s' and '%s'\n%s\n", vertex_shader, fragment_shader, error_buf);
+        }
+    }
+
+    glDetachShader(program_id, shader_ids[0]);
+    glDetachShader(program_id, shader_ids[1]);
+
+    glDeleteShader(shader_ids[0]);
+    glDeleteShader(shader_ids[1]);
+    shader_ids[0] = 0;
+    shader_ids[1] = 0;
+    return rc;
+}
+
+/*f shader_link
+ */
+static GLuint
+shader_link(GLuint program_id, const char *vertex_shader, const char *fragment_shader, const char *shader_defines)
+{
+    GLuint shader_ids[2];
+    if (shader_link_start(program_id, vertex_shader, fragment_shader, shader_defines, shader_ids)!=0)
+        return 0;
+    if (shader_link_complete(program_id, vertex_shader, fragment_shader, shader_defines, shader_ids)!=0)
+        return 0;
+    return program_id;
+}
+
+/*f shader_hash
+ * FNV-1a, including the terminating zero so that concatenations differ
+ */
+static uint64_t
+shader_hash(uint64_t hash, const char *string)
+{
+    if (!string) string="";
+    do {
+        hash ^= (unsigned char)(*string);
+        hash *= 0x100000001b3ULL;
+    } while (*string++);
+    return hash;
+}
+
+/*f shader_binary_filename
+ * Return a malloced filename in the cache directory for the program, or
+ * NULL if programs are not to be cached on disk
+ */
+static char *
+shader_binary_filename(const char *vertex_shader, const char *fragment_shader, const char *shader_defines)
+{
+    GLint num_formats;
+    const char *vertex_code, *fragment_code;
+    uint64_t hash;
+    char *filename;
+    int len;
+
+    if (!shader_cache_directory)
+        return NULL;
+    num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    if (num_formats<=0)
+        return NULL;
+
+    vertex_code = shader_source(vertex_shader);
+    fragment_code = shader_source(fragment_shader);
+    if (!vertex_code || !fragment_code) {
+        return NULL;
+    }
+    hash = 0xcbf29ce484222325ULL;
+    hash = shader_hash(hash, vertex_code);
+    hash = shader_hash(hash, fragment_code);
+    hash = shader_hash(hash, shader_defines);
+    hash = shader_hash(hash, shader_base_functions_code);
+    hash = shader_hash(hash, (const char *)glGetString(GL_VENDOR));
+    hash = shader_hash(hash, (const char *)glGetString(GL_RENDERER));
+    hash = shader_hash(hash, (const char *)glGetString(GL_VERSION));
+
+    len = strlen(shader_cache_directory)+32;
+    filename = (char *)malloc(len);
+    snprintf(filename, len, "%s/%016llx.bin", shader_cache_directory, (unsigned long long)hash);
+    return filename;
+}
+
+/*f shader_binary_load
+ * Return 1 if the program was loaded from the file and links; a
+ * header whose length the file cannot hold, or a failed allocation,
+ * is a cache miss
+ */
+static int
+shader_binary_load(GLuint program_id, const char *filename)
+{
+    FILE *f;
+    t_shader_binary_header hdr;
+    void *binary;
+    long file_size;
+    GLint link_result;
+
+    f = fopen(filename, "rb");
+    if (!f)
         return 0;
+    file_size = -1;
+    if (fseek(f, 0, SEEK_END)==0) {
+        file_size = ftell(f);
+        rewind(f);
+    }
+    binary = NULL;
+    if ((fread(&hdr, sizeof(hdr), 1, f)==1) && (hdr.magic==SHADER_BINARY_MAGIC) &&
+        (hdr.length>0) && (file_size>=(long)sizeof(hdr)) &&
+        (hdr.length<=(unsigned long)file_size-sizeof(hdr))) {
+        binary = malloc(hdr.length);
+        if (binary && (fread(binary, 1, hdr.length, f)!=hdr.length)) {
+            free(binary);
+            binary = NULL;
+        }
+    }
+    fclose(f);
+    if (!binary)
+        return 0;
+
+    glProgramBinary(program_id, hdr.format, binary, hdr.length);
+    free(binary);
+    link_result = GL_FALSE;
+    glGetProgramiv(program_id, GL_LINK_STATUS, &link_result);
+    while (glGetError()!=GL_NO_ERROR) {} // A stale binary is an error we expect
+    return (link_result==GL_TRUE);
+}
+
+/*f shader_binary_save
+ * Written to a temporary file and renamed, so concurrent runs never see part of a binary
+ */
+static void
+shader_binary_save(GLuint program_id, const char *filename)
+{
+    t_shader_binary_header hdr;
+    GLint length;
+    GLenum format;
+    void *binary;
+    char *tmp_filename;
+    FILE *f;
+    int len, ok;
+
+    length = 0;
+    glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length<=0)
+        return;
+    binary = malloc(length);
+    glGetProgramBinary(program_id, length, NULL, &format, binary);
+
+    len = strlen(filename)+8;
+    tmp_filename = (char *)malloc(len);
+    snprintf(tmp_filename, len, "%s.tmp", filename);
+    f = fopen(tmp_filename, "wb");
+    if (f) {
+        hdr.magic = SHADER_BINARY_MAGIC;
+        hdr.format = format;
+        hdr.length = length;
+        ok = (fwrite(&hdr, sizeof(hdr), 1, f)==1);
+        ok = ok && (fwrite(binary, 1, length, f)==(size_t)length);
+        ok = (fclose(f)==0) && ok;
+        if (!ok || (rename(tmp_filename, filename)!=0)) {
+            remove(tmp_filename);
+        }
     }
+    free(tmp_filename);
+    free(binary);
+}
+
+/*f shader_load_and_link_start
+ * Return the cached program for the shaders and defines, issuing its
+ * compile and link if it is not yet cached; 0 if a shader is not found
+ */
+GLuint
+shader_load_and_link_start(const char *vertex_shader, const char *fragment_shader, const char *shader_defines)
+{
+    std::string key;
+    t_shader_program sp;
+    GLuint program_id;
+
+    if (shader_init()!=0)
+        return 0;
 
-    glDetachShader(program_id, vertex_shader_id);
-    glDetachShader(program_id, fragment_shader_id);
+    key = std::string(vertex_shader) + "\n" + fragment_shader + "\n" + (shader_defines?shader_defines:"");
+    auto spi = shader_programs.find(key);
+    if (spi!=shader_programs.end()) {
+        spi->second.references++;
+        return spi->second.program_id;
+    }
 
-    glDeleteShader(vertex_shader_id);
-    glDeleteShader(fragment_shader_id);
+    sp.references = 1;
+    sp.linked = 0;
+    sp.shader_ids[0] = 0;
+    sp.shader_ids[1] = 0;
+    sp.binary_filename = shader_binary_filename(vertex_shader, fragment_shader, shader_defines);
+    sp.vertex_shader = vertex_shader;
+    sp.fragment_shader = fragment_shader;
+    sp.shader_defines = shader_defines?shader_defines:"";
+    program_id = glCreateProgram();
+    if (sp.binary_filename && shader_binary_load(program_id, sp.binary_filename)) {
+        sp.linked = 1;
+        free(sp.binary_filename);
+        sp.binary_filename = NULL;
+    } else {
+        glDeleteProgram(program_id);
+        program_id = glCreateProgram();
+        if (sp.binary_filename) {
+            glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        if (shader_link_start(program_id, vertex_shader, fragment_shader, shader_defines, sp.shader_ids)!=0) {
+            glDeleteProgram(program_id);
+            free(sp.binary_filename);
+            return 0;
+        }
+    }
+    sp.program_id = program_id;
+    shader_programs[key] = sp;
     return program_id;
 }
 
+/*f shader_load_and_link_complete
+ * Wait for a program from shader_load_and_link_start to link; return it,
+ * or 0 if it failed (in which case the program no longer exists)
+ */
+GLuint
+shader_load_and_link_complete(GLuint program_id)
+{
+    if (program_id==0)
+        return 0;
+    for (auto spi=shader_programs.begin(); spi!=shader_programs.end(); ++spi) {
+        t_shader_program *sp = &spi->second;
+        if (sp->program_id!=program_id)
+            continue;
+        if (sp->linked)
+            return program_id;
+        if (shader_link_complete(program_id, sp->vertex_shader.c_str(), sp->fragment_shader.c_str(),
+                                 sp->shader_defines.c_str(), sp->shader_ids)!=0) {
+            glDeleteProgram(program_id);
+            free(sp->binary_filename);
+            shader_programs.erase(spi);
+            return 0;
+        }
+        if (sp->binary_filename) {
+            shader_binary_save(program_id, sp->binary_filename);
+            free(sp->binary_filename);
+            sp->binary_filename = NULL;
+        }
+        sp->linked = 1;
+        return program_id;
+    }
+    return 0;
+}
+
+/*f shader_load_and_link
+ * With a program_id of 0, return the cached program for the shaders and
+ * defines, creating it if required; else link in to program_id
+ */
+GLuint
+shader_load_and_link(GLuint program_id, const char *vertex_shader, const char *fragment_shader, const char *shader_defines)
+{
+    if (program_id!=0) {
+        if (shader_init()!=0)
+            return 0;
+        return shader_link(program_id, vertex_shader, fragment_shader, shader_defines);
+    }
+    program_id = shader_load_and_link_start(vertex_shader, fragment_shader, shader_defines);
+    return shader_load_and_link_complete(program_id);
+}
 
 /*f shader_delete
+ * Drop a reference to a cached program; others are deleted
  */
 void
 shader_delete(GLuint program_id)
 {
-    if (program_id!=0) {
-        glDeleteShader(program_id);
+    if (program_id==0)
+        return;
+    for (auto spi=shader_programs.begin(); spi!=shader_programs.end(); ++spi) {
+        if (spi->second.program_id==program_id) {
+            if (spi->second.references>0) spi->second.references--;
+            return;
+        }
+    }
+    glDeleteProgram(program_id);
+}
+
+/*f shader_cache_flush
+ */
+void
+shader_cache_flush(void)
+{
+    for (auto spi=shader_programs.begin(); spi!=shader_programs.end();) {
+        if (spi->second.references==0) {
+            if (spi->second.shader_ids[0]) glDeleteShader(spi->second.shader_ids[0]);
+            if (spi->second.shader_ids[1]) glDeleteShader(spi->second.shader_ids[1]);
+            free(spi->second.binary_filename);
+            glDeleteProgram(spi->second.program_id);
+            spi = shader_programs.erase(spi);
+        } else {
+            ++spi;
+        }
+    }
+}
+
+/*f shader_cache_set_directory
+ */
+void
+shader_cache_set_directory(const char *directory)
+{
+    free(shader_cache_directory);
+    shader_cache_directory = NULL;
+    if (directory && directory[0]) {
+        shader_cache_directory = strdup(directory);
     }
+    shader_cache_directory_set = 1;
 }
@@ -30,6 +30,20 @@
 /*a Defines
  */
 
+/*a Types
+ */
+/*t t_shader_bundle_entry
+ * The shaders built in to the binary, in shader_bundle.cpp which the
+ * Makefile generates from the .glsl files in shaders; terminated by a NULL filename
+ */
+typedef struct
+{
+    const char *filename; // As used by filters, e.g. "shaders/gauss.glsl"
+    const char *code;
+} t_shader_bundle_entry;
+
+extern const t_shader_bundle_entry shader_bundle[];
+
 /*a External functions
  */
 extern int
@@ -39,15 +53,44 @@ extern GLuint
 shader_load(const char *shader_filename, GLenum shader_type, const char *shader_defines);
 
 /*f shader_load_and_link
+ * With a program_id of 0 the program is shared with other callers using
+ * the same shaders and defines
  */
 extern GLuint
 shader_load_and_link(GLuint program_id, const char *vertex_shader, const char *fragment_shader, const char *shader_defines);
 
+/*f shader_load_and_link_start
+ * As shader_load_and_link with a program_id of 0, but only issue the
+ * compile and link; start all of a pipeline's programs and then complete
+ * them, so that the driver may compile them in parallel
+ */
+extern GLuint
+shader_load_and_link_start(const char *vertex_shader, const char *fragment_shader, const char *shader_defines);
+
+/*f shader_load_and_link_complete
+ * Return the program once linked, or 0 if it failed to compile or link
+ */
+extern GLuint
+shader_load_and_link_complete(GLuint program_id);
+
 /*f shader_delete
  */
 extern void
 shader_delete(GLuint program_id);
 
+/*f shader_cache_flush
+ * Delete cached programs that are no longer in use
+ */
+extern void
+shader_cache_flush(void);
+
+/*f shader_cache_set_directory
+ * Directory for program binaries kept between runs; NULL to not keep them.
+ * Defaults to the GJSLIB_SHADER_CACHE environment variable
+ */
+extern void
+shader_cache_set_directory(const char *directory);
+
 /*a Wrapper
  */
 #endif
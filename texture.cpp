@@ -1,13 +1,50 @@
 /*a Documentation
+  GL textures are pooled: texture_destroy keeps the GL texture, and the
+  next texture_create or texture_load of the same size and format
+  reuses it rather than calling glGenTextures and glTexImage2D again.
+
+  The host RGBA float buffer of a GL texture is only allocated when the
+  texture is first read back (or its host buffer is asked for); host
+  textures have theirs from creation.
+
+  The pool and its statistics are not thread-safe, as for GL itself.
+
+  Readback may be asynchronous: texture_readback_start has glGetTexImage
+  write in to a pixel buffer object and puts a fence after it, so the
+  caller can issue further GL work before texture_readback_wait (or
+  texture_get_buffer, or texture_save) waits for the fence and copies
+  the pixels to the host buffer. Each texture has two pixel buffers, so
+  a second readback can be started before the first is waited for.
+  The components and type of each readback are recorded, and
+  texture_get_buffer (or texture_get_buffer_uint) only returns a
+  pending readback of the components and type it reads; otherwise it
+  waits for those pending and reads the texture itself. A fence not
+  signalled within TEXTURE_READBACK_TIMEOUT seconds, or a failed wait,
+  is reported and the buffer is returned as NULL.
+
+  The meshes drawn by texture_draw_through_projections are cached, keyed
+  by the state ids of the two lens projections (which change on orient,
+  set_lens, set_sensor or set_polynomial) and the division counts. A
+  repeated projection is one draw call from the cached vertex array,
+  without computing the mesh again; a miss rebuilds the least recently
+  used entry in to its existing GL buffers.
  */
 /*a Includes
  */
 #include <OpenGL/gl3.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include "lens_projection.h"
 #include "texture.h"
 #include "image_io.h"
+#include <vector>
+
+/*a Defines
+ */
+#define TEXTURE_MESH_CACHE_SIZE 16
+#define TEXTURE_READBACK_TIMEOUT 10
 
 /*a Types
  */
@@ -17,17 +54,122 @@ typedef struct t_texture
 {
     t_texture_header hdr;
     void *raw_buffer;
+    GLuint readback_pbo[2];
+    GLsync readback_fence[2];
+    int readback_components[2]; // Components of the readback to each PBO
+    GLenum readback_type[2];    // Type of the readback to each PBO
+    int readback_next;    // PBO the next readback is issued to
+    int readback_pending; // Number of readbacks issued and not yet waited for
 } t_texture;
 
+/*t t_texture_pool_entry
+ */
+typedef struct
+{
+    int width;
+    int height;
+    GLuint format;
+    GLuint gl_id;
+} t_texture_pool_entry;
+
+/*t t_texture_mesh
+ * A cached mesh for texture_draw_through_projections
+ */
+typedef struct
+{
+    uint64_t projection_states[2]; // State ids of the projections; 0 if unused
+    int num_x_divisions;
+    int num_y_divisions;
+    GLuint vertex_array;
+    GLuint buffers[2];             // Vertices (x,y,z,u,v) and triangle indices
+    size_t buffer_bytes[2];        // Allocated size of each buffer
+    int num_indices;
+    unsigned int last_used;
+} t_texture_mesh;
+
+/*a Statics
+ */
+static std::vector<t_texture_pool_entry> texture_pool;
+static t_texture_pool_stats pool_stats;
+static t_texture_mesh texture_mesh_cache[TEXTURE_MESH_CACHE_SIZE];
+static unsigned int texture_mesh_uses;
+static std::vector<float> texture_mesh_vertices;
+static std::vector<GLuint> texture_mesh_indices;
+
 /*a Static functions
  */
+/*f texture_gl_bytes
+ * Approximate GL storage of a texture; RGB textures are stored as RGBA8
+ */
+static size_t
+texture_gl_bytes(int width, int height, GLuint format)
+{
+    if (format==0) return 0;
+    if (format==GL_RGBA32F) return (size_t)width*height*4*sizeof(float);
+    return (size_t)width*height*4;
+}
+
+/*f texture_raw_bytes
+ */
+static size_t
+texture_raw_bytes(t_texture *texture)
+{
+    return (size_t)texture->hdr.width*texture->hdr.height*4*sizeof(float);
+}
+
 /*f texture_buffers
- * Create buffers etc for the texture
+ * Return the host buffer for the texture, allocating it on first use
  */
-static void
+static void *
 texture_buffers(t_texture *texture)
 {
-    texture->raw_buffer = malloc(texture->hdr.width * texture->hdr.height * 4*sizeof(float));
+    if (!texture->raw_buffer) {
+        texture->raw_buffer = malloc(texture_raw_bytes(texture));
+        pool_stats.live_bytes += texture_raw_bytes(texture);
+    }
+    return texture->raw_buffer;
+}
+
+/*f texture_alloc
+ * Allocate a texture structure; for a GL format, take a GL texture of
+ * the same size and format from the pool if there is one, else gl_id
+ * is left as 0 for the caller to generate
+ */
+static t_texture *
+texture_alloc(int width, int height, GLuint format)
+{
+    t_texture *texture;
+
+    texture = (t_texture *)malloc(sizeof(t_texture));
+    texture->hdr.width = width;
+    texture->hdr.height = height;
+    texture->hdr.format = format;
+    texture->hdr.gl_id = 0;
+    texture->raw_buffer = NULL;
+    for (int i=0; i<2; i++) {
+        texture->readback_pbo[i] = 0;
+        texture->readback_fence[i] = 0;
+        texture->readback_components[i] = 0;
+        texture->readback_type[i] = 0;
+    }
+    texture->readback_next = 0;
+    texture->readback_pending = 0;
+    if (format!=0) {
+        for (size_t i=0; i<texture_pool.size(); i++) {
+            t_texture_pool_entry *tpe = &texture_pool[i];
+            if ((tpe->width!=width) || (tpe->height!=height) || (tpe->format!=format))
+                continue;
+            texture->hdr.gl_id = tpe->gl_id;
+            texture_pool[i] = texture_pool.back();
+            texture_pool.pop_back();
+            pool_stats.pooled_textures--;
+            pool_stats.pooled_bytes -= texture_gl_bytes(width, height, format);
+            break;
+        }
+    }
+    pool_stats.live_textures++;
+    pool_stats.live_bytes += texture_gl_bytes(width, height, format);
+    return texture;
 }
 
 /*a External functions
@@ -45,12 +187,13 @@ texture_save(t_texture_ptr texture, const char *png_filename, int components, in
     height = texture->hdr.height;
     image_pixels = (unsigned char*)malloc(height*width*4*sizeof(unsigned char));
 
-    glBindTexture(GL_TEXTURE_2D, texture->hdr.gl_id);
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    if (!texture_get_buffer(texture, GL_RGBA)) {
+        free(image_pixels);
+        return 1;
+    }
 
     if (conversion==0) {
         float *raw_img = (float *)texture->raw_buffer;
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, texture->raw_buffer);
         for (int j=0; j<height; j++){
             for (int i=0; i<width; i++){
                 int p_in = (j*width+i)*4;
@@ -63,7 +206,6 @@ texture_save(t_texture_ptr texture, const char *png_filename, int components, in
         }
     } else {
         unsigned int*raw_img = (unsigned int *)texture->raw_buffer;
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, texture->raw_buffer);
         for (int j=0; j<height; j++){
             for (int i=0; i<width; i++){
                 int p_in = (j*width+i)*4+components;
@@ -88,17 +230,23 @@ texture_load(const char *image_filename, GLuint image_type)
 {
     t_texture *texture;
     unsigned char *image_pixels;
+    int width, height;
 
-    texture = (t_texture *)malloc(sizeof(t_texture));
-
-    image_pixels = image_read_rgba(image_filename, &texture->hdr.width, &texture->hdr.height);
+    image_pixels = image_read_rgba(image_filename, &width, &height);
     if (!image_pixels) {
         fprintf(stderr,"Failed to read image file '%s'\n", image_filename);
         return NULL;
     }
 
+    texture = texture_alloc(width, height, GL_RGB);
+    if (texture->hdr.gl_id>0) {
+        glBindTexture(GL_TEXTURE_2D, texture->hdr.gl_id);
+        glTexSubImage2D(GL_TEXTURE_2D,0,0,0,width,height,GL_RGBA,GL_UNSIGNED_BYTE,image_pixels);
+        free(image_pixels);
+        return texture;
+    }
+
     //Generate an OpenGL texture to return
-    texture->hdr.gl_id = 0;
     glGenTextures(1,&texture->hdr.gl_id);
     glBindTexture(GL_TEXTURE_2D, texture->hdr.gl_id);
 
@@ -112,8 +260,6 @@ texture_load(const char *image_filename, GLuint image_type)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
     free(image_pixels);
-
-    texture_buffers(texture);
     return texture;
 }
 
@@ -124,11 +270,10 @@ texture_create(int width, int height)
 {
     t_texture *texture;
 
-    texture = (t_texture *)malloc(sizeof(t_texture));
-    texture->hdr.width = width;
-    texture->hdr.height = height;
+    texture = texture_alloc(width, height, GL_RGBA32F);
+    if (texture->hdr.gl_id>0)
+        return texture;
 
-    texture->hdr.gl_id = 0;
     glGenTextures(1, &texture->hdr.gl_id);
     glBindTexture(GL_TEXTURE_2D, texture->hdr.gl_id);
 
@@ -142,7 +287,51 @@ texture_create(int width, int height)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_BORDER);    
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_BORDER);
-    texture_buffers(texture);
+    return texture;
+}
+
+/*f texture_load_host
+ * As texture_load, but the image is held as RGBA floats in host memory
+ * only; RGB is 0.0 to 1.0, alpha is 1.0 (as GL_RGB textures sample)
+ */
+t_texture_ptr 
+texture_load_host(const char *image_filename)
+{
+    t_texture *texture;
+    unsigned char *image_pixels;
+    float *raw_img;
+    int width, height;
+    int n;
+
+    image_pixels = image_read_rgba(image_filename, &width, &height);
+    if (!image_pixels) {
+        fprintf(stderr,"Failed to read image file '%s'\n", image_filename);
+        return NULL;
+    }
+
+    texture = texture_alloc(width, height, 0);
+    raw_img = (float *)texture_buffers(texture);
+    n = texture->hdr.width * texture->hdr.height;
+    for (int i=0; i<n; i++) {
+        raw_img[i*4+0] = image_pixels[i*4+0]/255.0f;
+        raw_img[i*4+1] = image_pixels[i*4+1]/255.0f;
+        raw_img[i*4+2] = image_pixels[i*4+2]/255.0f;
+        raw_img[i*4+3] = 1.0f;
+    }
+    free(image_pixels);
+    return texture;
+}
+
+/*f texture_create_host
+ * Host-only equivalent of texture_create; contents start as zero
+ */
+t_texture_ptr 
+texture_create_host(int width, int height)
+{
+    t_texture *texture;
+
+    texture = texture_alloc(width, height, 0);
+    memset(texture_buffers(texture), 0, texture_raw_bytes(texture));
     return texture;
 }
 
@@ -302,12 +491,33 @@ void texture_draw_tidy(void)
     glActiveTexture(GL_TEXTURE0);
 }
 
-/*f texture_draw_through_projections*/
-void
-texture_draw_through_projections(c_lens_projection *projections[2], int num_x_divisions, int num_y_divisions)
+/*f texture_mesh_buffer_data
+ * Fill a mesh buffer, reusing its storage if it is large enough
+ */
+static void
+texture_mesh_buffer_data(t_texture_mesh *mesh, int n, GLenum target, size_t bytes, const void *data)
+{
+    glBindBuffer(target, mesh->buffers[n]);
+    if (bytes<=mesh->buffer_bytes[n]) {
+        glBufferSubData(target, 0, bytes, data);
+    } else {
+        glBufferData(target, bytes, data, GL_STATIC_DRAW);
+        mesh->buffer_bytes[n] = bytes;
+    }
+}
+
+/*f texture_mesh_build
+ * Compute the mesh for the projections in to the cache entry
+ */
+static void
+texture_mesh_build(t_texture_mesh *mesh, c_lens_projection *projections[2], int num_x_divisions, int num_y_divisions)
 {
-    float *vertices = (float *)malloc(5*sizeof(float)*(num_x_divisions+1)*(num_y_divisions+1));
     int vn = 0;
+    int in = 0;
+    texture_mesh_vertices.resize(5*(num_x_divisions+1)*(num_y_divisions+1));
+    texture_mesh_indices.resize(6*num_x_divisions*num_y_divisions);
+    float *vertices = &texture_mesh_vertices[0];
+    GLuint *indices = &texture_mesh_indices[0];
     for (int y=0; y<=num_y_divisions; y++) {
         float vy = ((float)y)/num_y_divisions;
         for (int x=0; x<=num_x_divisions; x++) {
@@ -325,59 +535,87 @@ texture_draw_through_projections(c_lens_projection *projections[2], int num_x_di
             vn++;
         }
     }
-    if (0) {
-        for (int i=0; i<40; i++) {
-            fprintf(stderr,"%3d: %lf %lf %lf %lf %lf\n",i,
-                    vertices[5*i+0],
-                    vertices[5*i+1],
-                    vertices[5*i+2],
-                    vertices[5*i+3],
-                    vertices[5*i+4]);
-        }
-    }
-    short *indices = (short *)malloc(sizeof(short)*2*(num_x_divisions+1)*num_y_divisions);
-    int in=0;
+    // The triangles of a strip per row, as a single list
     for (int y=0; y<num_y_divisions; y++) {
-        for (int x=0; x<=num_x_divisions; x++) {
-            indices[in++] = x + y*(num_x_divisions+1);
-            indices[in++] = x + (y+1)*(num_x_divisions+1);
+        for (int x=0; x<num_x_divisions; x++) {
+            GLuint a0 = x + y*(num_x_divisions+1);
+            GLuint b0 = a0 + (num_x_divisions+1);
+            indices[in++] = a0;
+            indices[in++] = b0;
+            indices[in++] = a0+1;
+            indices[in++] = b0;
+            indices[in++] = a0+1;
+            indices[in++] = b0+1;
         }
     }
 
-    GLuint VertexArrayID;
-    GLuint vertex_buffer;
-    GLuint index_buffer;
-    glGenVertexArrays(1,&VertexArrayID);
-    glBindVertexArray(VertexArrayID);
-
-    glGenBuffers(1, &vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, vn*5*sizeof(float), vertices, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &index_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, in*sizeof(unsigned short), indices, GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)(0*sizeof(float)));
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)(3*sizeof(float)));
+    if (mesh->vertex_array==0) {
+        glGenVertexArrays(1, &mesh->vertex_array);
+        glGenBuffers(2, mesh->buffers);
+        mesh->buffer_bytes[0] = 0;
+        mesh->buffer_bytes[1] = 0;
+        glBindVertexArray(mesh->vertex_array);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[0]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->buffers[1]);
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)(0*sizeof(float)));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)(3*sizeof(float)));
+    } else {
+        glBindVertexArray(mesh->vertex_array);
+    }
+    texture_mesh_buffer_data(mesh, 0, GL_ARRAY_BUFFER, vn*5*sizeof(float), vertices);
+    texture_mesh_buffer_data(mesh, 1, GL_ELEMENT_ARRAY_BUFFER, in*sizeof(GLuint), indices);
+    mesh->num_indices = in;
+    mesh->projection_states[0] = projections[0]->get_state_id();
+    mesh->projection_states[1] = projections[1]->get_state_id();
+    mesh->num_x_divisions = num_x_divisions;
+    mesh->num_y_divisions = num_y_divisions;
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
-    for (int y=0; y<num_y_divisions; y++) {
-        // each row is 2*(num_x_divisions+1) indices, and 2*num_x_divisions triangles
-        glDrawElements(GL_TRIANGLE_STRIP, 2*(num_x_divisions+1), GL_UNSIGNED_SHORT, (void*)(y*2*(num_x_divisions+1)*sizeof(short)));
+/*f texture_mesh_find
+ * Return the cached mesh for the projections and divisions, building
+ * it in the least recently used entry if there is none
+ */
+static t_texture_mesh *
+texture_mesh_find(c_lens_projection *projections[2], int num_x_divisions, int num_y_divisions)
+{
+    t_texture_mesh *lru = &texture_mesh_cache[0];
+    uint64_t states[2];
+    states[0] = projections[0]->get_state_id();
+    states[1] = projections[1]->get_state_id();
+    texture_mesh_uses++;
+    for (int i=0; i<TEXTURE_MESH_CACHE_SIZE; i++) {
+        t_texture_mesh *mesh = &texture_mesh_cache[i];
+        if ((mesh->projection_states[0]==states[0]) &&
+            (mesh->projection_states[1]==states[1]) &&
+            (mesh->num_x_divisions==num_x_divisions) &&
+            (mesh->num_y_divisions==num_y_divisions)) {
+            mesh->last_used = texture_mesh_uses;
+            glBindVertexArray(mesh->vertex_array);
+            return mesh;
+        }
+        if (mesh->last_used<lru->last_used) lru = mesh;
     }
+    texture_mesh_build(lru, projections, num_x_divisions, num_y_divisions);
+    lru->last_used = texture_mesh_uses;
+    return lru;
+}
 
-    GL_GET_ERRORS;
+/*f texture_draw_through_projections
+ */
+void
+texture_draw_through_projections(c_lens_projection *projections[2], int num_x_divisions, int num_y_divisions)
+{
+    t_texture_mesh *mesh;
+    if ((num_x_divisions<1) || (num_y_divisions<1))
+        return;
+    mesh = texture_mesh_find(projections, num_x_divisions, num_y_divisions);
+    glDrawElements(GL_TRIANGLES, mesh->num_indices, GL_UNSIGNED_INT, (void*)0);
 
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    GL_GET_ERRORS;
 
-    glDeleteBuffers(1, &vertex_buffer);
-    glDeleteBuffers(1, &index_buffer);
-    glDeleteVertexArrays(1,&VertexArrayID);
+    glBindVertexArray(VertexArrayID);
 }
 
 /*f texture_draw
@@ -395,32 +633,151 @@ texture_draw(void)
 }
 
 
-/*f texture_get_buffer
+/*f texture_read
+ * Read the texture in to its host buffer as components and type; a
+ * pending readback of those is waited for and used, and any other
+ * pending readbacks are waited for first. Return NULL if a wait fails.
  */
-void *
-texture_get_buffer(t_texture_ptr texture, int components)
+static void *
+texture_read(t_texture_ptr texture, int components, GLenum type)
 {
-    int a;
+    int a, b;
+    if (texture_is_host(texture))
+        return texture->raw_buffer;
     a = GL_RGBA;
     if (components>=0) a=components;
+    if (texture->readback_pending>0) {
+        b = (texture->readback_next+2-texture->readback_pending)%2;
+        if ((texture->readback_components[b]==a) && (texture->readback_type[b]==type))
+            return texture_readback_wait(texture);
+        while (texture->readback_pending>0) {
+            if (!texture_readback_wait(texture))
+                return NULL;
+        }
+    }
     glBindTexture(GL_TEXTURE_2D, texture->hdr.gl_id);
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glGetTexImage(GL_TEXTURE_2D, 0, a, GL_FLOAT, texture->raw_buffer);
+    glGetTexImage(GL_TEXTURE_2D, 0, a, type, texture_buffers(texture));
     return texture->raw_buffer;
 }
 
+/*f texture_get_buffer
+ */
+void *
+texture_get_buffer(t_texture_ptr texture, int components)
+{
+    return texture_read(texture, components, GL_FLOAT);
+}
+
 /*f texture_get_buffer_uint
  */
 void *
 texture_get_buffer_uint(t_texture_ptr texture, int components)
 {
-    int a;
+    return texture_read(texture, components, GL_UNSIGNED_INT);
+}
+
+/*f texture_readback_start
+ */
+void
+texture_readback_start(t_texture_ptr texture, int components, GLenum type)
+{
+    int a, b;
+    if (texture_is_host(texture))
+        return;
+    if (texture->readback_pending==2) {
+        texture_readback_wait(texture); // Drop the oldest, so its buffer can be reused
+    }
     a = GL_RGBA;
     if (components>=0) a=components;
+    b = texture->readback_next;
+    if (texture->readback_pbo[b]==0) {
+        glGenBuffers(1, &texture->readback_pbo[b]);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, texture->readback_pbo[b]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, texture_raw_bytes(texture), NULL, GL_STREAM_READ);
+    } else {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, texture->readback_pbo[b]);
+    }
     glBindTexture(GL_TEXTURE_2D, texture->hdr.gl_id);
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glGetTexImage(GL_TEXTURE_2D, 0, a, GL_UNSIGNED_INT, texture->raw_buffer);
-    return texture->raw_buffer;
+    glGetTexImage(GL_TEXTURE_2D, 0, a, type, (void *)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    texture->readback_fence[b] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    texture->readback_components[b] = a;
+    texture->readback_type[b] = type;
+    glFlush();
+    texture->readback_next = 1-b;
+    texture->readback_pending++;
+    GL_GET_ERRORS;
+}
+
+/*f texture_readback_ready
+ */
+int
+texture_readback_ready(t_texture_ptr texture)
+{
+    int b;
+    GLint status;
+    if (texture->readback_pending==0)
+        return 1;
+    b = (texture->readback_next+2-texture->readback_pending)%2;
+    glGetSynciv(texture->readback_fence[b], GL_SYNC_STATUS, sizeof(status), NULL, &status);
+    return (status==GL_SIGNALED);
+}
+
+/*f texture_readback_wait
+ */
+void *
+texture_readback_wait(t_texture_ptr texture)
+{
+    int b;
+    GLenum status;
+    void *pixels;
+    if (texture->readback_pending==0)
+        return texture_buffers(texture);
+    b = (texture->readback_next+2-texture->readback_pending)%2;
+    status = GL_TIMEOUT_EXPIRED;
+    for (int i=0; (i<TEXTURE_READBACK_TIMEOUT) && (status==GL_TIMEOUT_EXPIRED); i++) {
+        status = glClientWaitSync(texture->readback_fence[b], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    }
+    glDeleteSync(texture->readback_fence[b]);
+    texture->readback_fence[b] = 0;
+    texture->readback_pending--;
+    if ((status!=GL_ALREADY_SIGNALED) && (status!=GL_CONDITION_SATISFIED)) {
+        fprintf(stderr,"Readback of texture %d %s\n", texture->hdr.gl_id,
+                (status==GL_WAIT_FAILED) ? "failed" : "timed out");
+        return NULL;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, texture->readback_pbo[b]);
+    pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, texture_raw_bytes(texture), GL_MAP_READ_BIT);
+    if (pixels) {
+        memcpy(texture_buffers(texture), pixels, texture_raw_bytes(texture));
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    GL_GET_ERRORS;
+    return texture_buffers(texture);
+}
+
+/*f texture_host_buffer
+ */
+void *
+texture_host_buffer(t_texture_ptr texture)
+{
+    return texture_buffers(texture);
+}
+
+/*f texture_buffer_updated
+ */
+void
+texture_buffer_updated(t_texture_ptr texture)
+{
+    if (texture_is_host(texture) || !texture->raw_buffer)
+        return;
+    glBindTexture(GL_TEXTURE_2D, texture->hdr.gl_id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture->hdr.width, texture->hdr.height, GL_RGBA, GL_FLOAT, texture->raw_buffer);
 }
 
 /*f texture_destroy
@@ -428,12 +785,66 @@ texture_get_buffer_uint(t_texture_ptr texture, int components)
 void
 texture_destroy(t_texture_ptr texture)
 {
+    size_t gl_bytes;
+    gl_bytes = texture_gl_bytes(texture->hdr.width, texture->hdr.height, texture->hdr.format);
     if (texture->raw_buffer) {
         free(texture->raw_buffer);
         texture->raw_buffer = NULL;
+        pool_stats.live_bytes -= texture_raw_bytes(texture);
+    }
+    pool_stats.live_textures--;
+    pool_stats.live_bytes -= gl_bytes;
+    for (int i=0; i<2; i++) {
+        if (texture->readback_fence[i]) glDeleteSync(texture->readback_fence[i]);
+        if (texture->readback_pbo[i]) glDeleteBuffers(1, &texture->readback_pbo[i]);
     }
     if (texture->hdr.gl_id>0) {
-        glDeleteTextures(1, &texture->hdr.gl_id);
-        texture->hdr.gl_id = 0;
+        t_texture_pool_entry tpe;
+        tpe.width  = texture->hdr.width;
+        tpe.height = texture->hdr.height;
+        tpe.format = texture->hdr.format;
+        tpe.gl_id  = texture->hdr.gl_id;
+        texture_pool.push_back(tpe);
+        pool_stats.pooled_textures++;
+        pool_stats.pooled_bytes += gl_bytes;
+    }
+    free(texture);
+}
+
+/*f texture_pool_stats
+ */
+void
+texture_pool_stats(t_texture_pool_stats *stats)
+{
+    *stats = pool_stats;
+}
+
+/*f texture_pool_flush
+ */
+void
+texture_pool_flush(void)
+{
+    for (size_t i=0; i<texture_pool.size(); i++) {
+        glDeleteTextures(1, &texture_pool[i].gl_id);
+    }
+    texture_pool.clear();
+    pool_stats.pooled_textures = 0;
+    pool_stats.pooled_bytes = 0;
+}
+
+/*f texture_mesh_cache_flush
+ */
+void
+texture_mesh_cache_flush(void)
+{
+    for (int i=0; i<TEXTURE_MESH_CACHE_SIZE; i++) {
+        t_texture_mesh *mesh = &texture_mesh_cache[i];
+        if (mesh->vertex_array!=0) {
+            glDeleteBuffers(2, mesh->buffers);
+            glDeleteVertexArrays(1, &mesh->vertex_array);
+        }
+        memset(mesh, 0, sizeof(*mesh));
     }
+    texture_mesh_vertices.clear();
+    texture_mesh_indices.clear();
 }
@@ -26,6 +26,7 @@
 /*a Includes
  */
 #include <OpenGL/gl3.h>
+#include <stddef.h>
 
 /*a Defines
  */
@@ -57,13 +58,32 @@ typedef struct
     int width;
     int height;
     GLuint gl_id;
-    GLuint format; //NOT USED AT PRESENT
+    GLuint format; // GL internal format; 0 for host textures
 } t_texture_header;
 
+/*t t_texture_pool_stats
+ * Live textures are those created and not yet destroyed; pooled
+ * textures are destroyed GL textures kept for reuse. Bytes are the GL
+ * texture storage plus any host buffers.
+ */
+typedef struct
+{
+    int live_textures;
+    size_t live_bytes;
+    int pooled_textures;
+    size_t pooled_bytes;
+} t_texture_pool_stats;
+
 /*f texture_header
  */
 inline t_texture_header *texture_header(t_texture_ptr texture) { return (t_texture_header *)texture; }
 
+/*f texture_is_host
+ * Host textures have no GL texture (gl_id of 0); their contents are
+ * the RGBA float buffer returned by texture_get_buffer
+ */
+inline int texture_is_host(t_texture_ptr texture) { return texture_header(texture)->gl_id==0; }
+
 /*f texture_target_as_framebuffer
  */
 extern int
@@ -95,6 +115,9 @@ extern void
 texture_draw_tidy(void);
 
 /*f texture_draw_through_projections
+ * Draw a num_x_divisions by num_y_divisions mesh mapping the target
+ * through projections[1] and projections[0] to the source; the mesh is
+ * cached, keyed by the projections' state ids and the divisions
  */
 extern void
 texture_draw_through_projections(class c_lens_projection *projections[2], int num_x_divisions, int num_y_divisions);
@@ -105,6 +128,8 @@ extern void
 texture_draw(void);
 
 /*f texture_get_buffer
+ * The host buffer of the texture read as float, or NULL if a pending
+ * readback could not be waited for
  */
 extern void *
 texture_get_buffer(t_texture_ptr t_texture, int components);
@@ -129,11 +154,77 @@ texture_load(const char *image_filename, GLuint image_type);
 extern t_texture_ptr 
 texture_create(int width, int height);
 
+/*f texture_load_host
+ */
+extern t_texture_ptr 
+texture_load_host(const char *image_filename);
+
+/*f texture_create_host
+ */
+extern t_texture_ptr 
+texture_create_host(int width, int height);
+
+/*f texture_readback_start
+ * Start an asynchronous read of the texture in to host memory, with
+ * components and type as for glGetTexImage; nothing for host textures
+ */
+extern void
+texture_readback_start(t_texture_ptr texture, int components, GLenum type);
+
+/*f texture_readback_ready
+ * Return 1 if texture_readback_wait would not block
+ */
+extern int
+texture_readback_ready(t_texture_ptr texture);
+
+/*f texture_readback_wait
+ * Wait for the oldest readback started, and return the host buffer
+ * holding it, or NULL if the wait failed or timed out;
+ * texture_get_buffer and texture_save do this if a readback of the
+ * components and type they read has been started
+ */
+extern void *
+texture_readback_wait(t_texture_ptr texture);
+
+/*f texture_host_buffer
+ * The RGBA float host buffer of a texture, without fetching it from GL;
+ * for a GL texture this allocates the buffer if it has not been read back
+ */
+extern void *
+texture_host_buffer(t_texture_ptr texture);
+
+/*f texture_buffer_updated
+ * Call after writing the buffer from texture_get_buffer; uploads it if
+ * the texture is a GL texture
+ */
+extern void
+texture_buffer_updated(t_texture_ptr texture);
+
 /*f texture_destroy
+ * Frees the texture; a GL texture is returned to the pool, to be
+ * reused by the next texture_create or texture_load of the same size
+ * and format
  */
 extern void 
 texture_destroy(t_texture_ptr texture);
 
+/*f texture_pool_stats
+ */
+extern void
+texture_pool_stats(t_texture_pool_stats *stats);
+
+/*f texture_pool_flush
+ * Delete the pooled GL textures
+ */
+extern void
+texture_pool_flush(void);
+
+/*f texture_mesh_cache_flush
+ * Delete the cached projection meshes and their GL buffers
+ */
+extern void
+texture_mesh_cache_flush(void);
+
 /*a Wrapper
  */
 #endif
@@ -0,0 +1,135 @@
+/*a Documentation
+ */
+/*a Includes
+ */
+#include "thread_pool.h"
+
+/*a c_thread_pool constructor and destructor
+ */
+/*f c_thread_pool constructor
+ */
+c_thread_pool::c_thread_pool(int num_threads)
+{
+    if (num_threads<=0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    if (num_threads<=0) num_threads=1;
+    this->num_threads = num_threads;
+
+    generation = 0;
+    active_workers = 0;
+    stopping = 0;
+    job_fn = NULL;
+    job_n = 0;
+    job_grain = 1;
+    job_num_chunks = 0;
+    next_chunk = 0;
+    chunks_done = 0;
+
+    // The calling thread is one of the workers
+    for (int i=1; i<num_threads; i++) {
+        threads.push_back(std::thread(&c_thread_pool::worker, this));
+    }
+}
+
+/*f c_thread_pool destructor
+ */
+c_thread_pool::~c_thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = 1;
+    }
+    work_cv.notify_all();
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+/*a c_thread_pool methods
+ */
+/*f c_thread_pool::run_chunks
+ */
+void c_thread_pool::run_chunks(void)
+{
+    while (1) {
+        int chunk = next_chunk.fetch_add(1);
+        if (chunk>=job_num_chunks)
+            break;
+        int start = chunk*job_grain;
+        int end = start+job_grain;
+        if (end>job_n) end=job_n;
+        (*job_fn)(start, end);
+        if (chunks_done.fetch_add(1)+1==job_num_chunks) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done_cv.notify_all();
+        }
+    }
+}
+
+/*f c_thread_pool::worker
+ */
+void c_thread_pool::worker(void)
+{
+    int seen_generation = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (1) {
+        work_cv.wait(lock, [&]{return stopping || (generation!=seen_generation);});
+        if (stopping) return;
+        seen_generation = generation;
+        active_workers++;
+        lock.unlock();
+        run_chunks();
+        lock.lock();
+        active_workers--;
+        if (active_workers==0) done_cv.notify_all();
+    }
+}
+
+/*f c_thread_pool::parallel_for
+ * Workers are all idle again before this returns, so the job fields
+ * can be replaced by the next call
+ */
+void c_thread_pool::parallel_for(int n, int grain, const t_thread_pool_fn &fn)
+{
+    if (n<=0) return;
+    if (grain<1) grain=1;
+    int num_chunks = (n+grain-1)/grain;
+    if ((num_threads<=1) || (num_chunks==1)) {
+        for (int start=0; start<n; start+=grain) {
+            fn(start, (start+grain<n)?(start+grain):n);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> call_lock(call_mutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job_fn = &fn;
+        job_n = n;
+        job_grain = grain;
+        job_num_chunks = num_chunks;
+        next_chunk = 0;
+        chunks_done = 0;
+        generation++;
+    }
+    work_cv.notify_all();
+    run_chunks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&]{return (chunks_done==job_num_chunks) && (active_workers==0);});
+    job_fn = NULL;
+}
+
+/*a External functions
+ */
+/*f thread_pool_default
+ */
+c_thread_pool *
+thread_pool_default(int num_threads)
+{
+    static c_thread_pool *pool=NULL;
+    static std::once_flag once;
+    std::call_once(once, [&]{pool = new c_thread_pool(num_threads);});
+    return pool;
+}
@@ -0,0 +1,96 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          thread_pool.h
+ * @brief         Persistent worker threads for data-parallel loops
+ *
+ */
+
+/*a Wrapper
+ */
+#ifdef __INC_THREAD_POOL
+#else
+#define __INC_THREAD_POOL
+
+/*a Includes
+ */
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*a Types
+ */
+/*t t_thread_pool_fn
+ * Invoked with a half-open range [start, end) of the loop
+ */
+typedef std::function<void(int start, int end)> t_thread_pool_fn;
+
+/*c c_thread_pool
+ * A fixed set of worker threads that split a loop of 'n' iterations
+ * in to chunks of 'grain' iterations; the calling thread works too,
+ * and parallel_for returns only when every chunk has completed.
+ *
+ * parallel_for must not be called from inside a chunk function.
+ */
+class c_thread_pool
+{
+private:
+    void worker(void);
+    void run_chunks(void);
+
+    std::vector<std::thread> threads;
+    std::mutex call_mutex;
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    int generation;
+    int active_workers;
+    int stopping;
+
+    const t_thread_pool_fn *job_fn;
+    int job_n;
+    int job_grain;
+    int job_num_chunks;
+    std::atomic<int> next_chunk;
+    std::atomic<int> chunks_done;
+
+public:
+    c_thread_pool(int num_threads);
+    ~c_thread_pool();
+    void parallel_for(int n, int grain, const t_thread_pool_fn &fn);
+    int num_threads;
+};
+
+/*a External functions
+ */
+/*f thread_pool_default
+ * Process-wide pool; created on first call with 'num_threads' threads
+ * (0 for one per hardware thread), later calls ignore the argument
+ */
+extern c_thread_pool *
+thread_pool_default(int num_threads=0);
+
+/*a Wrapper
+ */
+#endif
+
+/*a Editor preferences and notes
+mode: c ***
+c-basic-offset: 4 ***
+c-default-style: (quote ((c-mode . "k&r") (c++-mode . "k&r"))) ***
+outline-regexp: "/\\\*a\\\|[\t ]*\/\\\*[b-z][\t ]" ***
+*/
@@ -197,42 +197,24 @@ double c_vector::dot_product(const c_vector &other) const
 }
 
 /*f c_vector::cross_product
+  3-vectors only
  */
-c_vector &c_vector::cross_product(const c_vector &other) const
+c_vector c_vector::cross_product(const c_vector &other) const
 {
-    c_vector *r=new c_vector(_length);
-    r->_coords[0] = _coords[1]*other._coords[2] - _coords[2]*other._coords[1];
-    r->_coords[1] = _coords[2]*other._coords[0] - _coords[0]*other._coords[2];
-    r->_coords[2] = _coords[0]*other._coords[1] - _coords[1]*other._coords[0];
-    return *r;
+    return c_vector(value().cross(other.value()));
 }
 
 /*f c_vector::angle_axis_to_v
+  3-vectors only
  */
-c_vector &c_vector::angle_axis_to_v(const c_vector &other, double *cos_angle, double *sin_angle) const
+c_vector c_vector::angle_axis_to_v(const c_vector &other, double *cos_angle, double *sin_angle) const
 {
-    double tl, ol;
-    tl = this->modulus();
-    ol = other.modulus();
-
-    //fprintf(stderr,"tl,ol: %lf, %lf\n",tl, ol);
-    c_vector *axis = new c_vector(cross_product(other)/ (tl*ol));
-    //fprintf(stderr,"axb:%lf,%lf,%lf\n",axis->_coords[0],axis->_coords[1],axis->_coords[2]);
-    *cos_angle = dot_product(other) / (tl*ol);
-    *sin_angle = axis->modulus();
-    //fprintf(stderr,"angles:%lf,%lf\n",*cos_angle,*sin_angle);
-    axis->normalize();
-    //fprintf(stderr,"axis:%lf,%lf,%lf\n",axis->_coords[0],axis->_coords[1],axis->_coords[2]);
-    return *axis;
+    return c_vector(value().angle_axis_to_v(other.value(), cos_angle, sin_angle));
 }
 
 /*f c_vector::angle_axis_to_v (to quaternion)
  */
-c_quaternion &c_vector::angle_axis_to_v(const c_vector &other) const
+c_quaternion c_vector::angle_axis_to_v(const c_vector &other) const
 {
-    c_quaternion *r;
-    double cos_angle, sin_angle;
-    c_vector axis = this->angle_axis_to_v(other, &cos_angle, &sin_angle);
-    r = (new c_quaternion())->from_rotation(cos_angle, sin_angle, axis.coords());
-    return *r;
+    return c_quaternion(t_quatd::angle_axis_between(value(), other.value()));
 }
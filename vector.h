@@ -23,6 +23,10 @@
 #else
 #define __INC_VECTOR
 
+/*a Includes
+ */
+#include "quaternion_value.h"
+
 /*a Defines
  */
 #define VECTOR_MAX_LENGTH 8
@@ -51,6 +55,8 @@ public:
     c_vector(void);
     c_vector(const class c_quaternion &quat);
     c_vector(int length, const double *coords);
+    c_vector(const t_vec3d &v) { _length=3; v.get_coords(_coords); for (int i=3; i<VECTOR_MAX_LENGTH; i++) _coords[i]=0; }
+    inline t_vec3d value(void) const { return t_vec3d::of_coords(_coords); }
     c_vector *copy(void) const;
 
     inline int length(void) {return _length;}
@@ -61,14 +67,14 @@ public:
     c_vector *scale(double scale);
     c_vector *normalize(void);
     double dot_product(const c_vector &other) const;
-    c_vector &cross_product(const c_vector &other) const;
+    c_vector cross_product(const c_vector &other) const;
 
     // axis_angle_to_v works for 3-vectors.
     // It changes 'this' to be the axis of rotation required to
     // get from 'this' to 'other' (i.e. this <= unit(this x other))
     // and sets the angle; it returns 'this'
-    c_vector &angle_axis_to_v(const c_vector &other, double *cos_angle, double *sin_angle) const;
-    class c_quaternion &angle_axis_to_v(const c_vector &other) const;
+    c_vector angle_axis_to_v(const c_vector &other, double *cos_angle, double *sin_angle) const;
+    class c_quaternion angle_axis_to_v(const c_vector &other) const;
     void __str__(char *buffer, int buf_size) const;
 };
 